@@ -1,6 +1,23 @@
 #include <iostream>
+#include <algorithm>
 #include "EventReducer.h"
 
+///Comparison of hit indices by the hit position, used to sort and search the hits of each plane in the sagitta reducer
+struct HitIndexPosLess
+{
+    HitIndexPosLess(const std::vector<Hit>& hits): fHits(hits) {}
+
+    bool operator()(int i, int j) const
+    {
+        if(fHits[i].pos != fHits[j].pos) return fHits[i].pos < fHits[j].pos;
+        return i < j;
+    }
+    bool operator()(int i, double pos) const { return fHits[i].pos < pos; }
+    bool operator()(double pos, int i) const { return pos < fHits[i].pos; }
+
+    const std::vector<Hit>& fHits;
+};
+
 EventReducer::EventReducer(TString options) : afterhit(false), hodomask(false), outoftime(false), decluster(false), mergehodo(false), triggermask(false), sagitta(false), hough(false), externalpar(false), realization(false), difnim(false)
 {
     //parse the reducer setup
@@ -39,6 +56,7 @@ EventReducer::EventReducer(TString options) : afterhit(false), hodomask(false),
         p_triggerAna->buildTriggerTree();
     }
 
+    nHodoWords = 0;
     if(hodomask) initHodoMaskLUT();
 
     //set random seed
@@ -57,75 +75,122 @@ int EventReducer::reduceEvent(SRawEvent* rawEvent)
 {
     int nHits_before = rawEvent->getNChamberHitsAll();
 
-    //dump the vector of hits from SRawEvent to a list first
-    hitlist.clear();
-    hodohitlist.clear();
+    //collect the hodoscope hits first, they are needed for the masking of the chamber hits
+    int nHodoHits = 0;
+    for(unsigned int i = 0; i < nHodoWords; ++i) hodoBits[i] = 0;
     for(std::vector<Hit>::iterator iter = rawEvent->fAllHits.begin(); iter != rawEvent->fAllHits.end(); ++iter)
     {
+        if(iter->detectorID < 25 || iter->detectorID > 40) continue;
         if(outoftime && (!iter->isInTime())) continue;
 
-        if(iter->detectorID <= 24)    //chamber hits
+        // if trigger masking is enabled, all the X hodos are discarded
+        if(triggermask && p_geomSvc->getPlaneType(iter->detectorID) == 1) continue;
+
+        ++nHodoHits;
+        if(hodomask) addHodoHit(*iter);
+    }
+
+    if(mergehodo)
+    {
+        for(std::vector<Hit>::iterator iter = rawEvent->fTriggerHits.begin(); iter != rawEvent->fTriggerHits.end(); ++iter)
+        {
+            if(triggermask && p_geomSvc->getPlaneType(iter->detectorID) == 1) continue;
+
+            ++nHodoHits;
+            if(hodomask) addHodoHit(*iter);
+        }
+    }
+
+    // manully create the X-hodo hits by the trigger roads, done before the hits are touched as it uses the hit index
+    trimhitlist.clear();
+    if(triggermask)
+    {
+        p_triggerAna->trimEvent(rawEvent, trimhitlist, mergehodo ? (USE_HIT | USE_TRIGGER_HIT) : USE_TRIGGER_HIT, nHodoHits);
+        if(hodomask)
+        {
+            for(std::vector<Hit>::iterator iter = trimhitlist.begin(); iter != trimhitlist.end(); ++iter) addHodoHit(*iter);
+        }
+    }
+
+    //take over the vector of hits from SRawEvent and compact it in place while going through the hits
+    hitlist.swap(rawEvent->fAllHits);
+
+    unsigned int nHits = 0;
+    for(unsigned int i = 0; i < hitlist.size(); ++i)
+    {
+        Hit& hit = hitlist[i];
+        if(outoftime && (!hit.isInTime())) continue;
+
+        if(hit.detectorID <= 24)    //chamber hits
         {
             if(realization && rndm.Rndm() > 0.94) continue;
-            //if(hodomask && (!iter->isHodoMask())) continue;
-            //if(triggermask && (!iter->isTriggerMask())) continue;
+            //if(hodomask && (!hit.isHodoMask())) continue;
+            //if(triggermask && (!hit.isTriggerMask())) continue;
         }
-        else if(iter->detectorID > 24 && iter->detectorID <= 40)
+        else if(hit.detectorID > 24 && hit.detectorID <= 40)
         {
             // if trigger masking is enabled, all the X hodos are discarded
-            if(triggermask && p_geomSvc->getPlaneType(iter->detectorID) == 1) continue;
+            if(triggermask && p_geomSvc->getPlaneType(hit.detectorID) == 1) continue;
         }
 
         /*
         //only temporary before the mapping is fixed
-        if((iter->detectorID == 17 || iter->detectorID == 18) && iter->elementID >= 97 && iter->elementID <= 104)
+        if((hit.detectorID == 17 || hit.detectorID == 18) && hit.elementID >= 97 && hit.elementID <= 104)
         {
-            iter->detectorID = iter->detectorID == 17 ? 18 : 17;
-            iter->pos = p_geomSvc->getMeasurement(iter->detectorID, iter->elementID);
-            //iter->driftDistance = p_geomSvc->getDriftDistance(iter->detectorID, iter->tdcTime);
-            //iter->setInTime(p_geomSvc->isInTime(iter->detectorID, iter->tdcTime));
+            hit.detectorID = hit.detectorID == 17 ? 18 : 17;
+            hit.pos = p_geomSvc->getMeasurement(hit.detectorID, hit.elementID);
+            //hit.driftDistance = p_geomSvc->getDriftDistance(hit.detectorID, hit.tdcTime);
+            //hit.setInTime(p_geomSvc->isInTime(hit.detectorID, hit.tdcTime));
         }
         */
 
         if(externalpar)
         {
-            iter->pos = p_geomSvc->getMeasurement(iter->detectorID, iter->elementID);
-            iter->driftDistance = p_geomSvc->getDriftDistance(iter->detectorID, iter->tdcTime);
-            //iter->setInTime(p_geomSvc->isInTime(iter->detectorID, iter->tdcTime));
+            hit.pos = p_geomSvc->getMeasurement(hit.detectorID, hit.elementID);
+            hit.driftDistance = p_geomSvc->getDriftDistance(hit.detectorID, hit.tdcTime);
+            //hit.setInTime(p_geomSvc->isInTime(hit.detectorID, hit.tdcTime));
         }
 
-        if(realization && iter->detectorID <= 24) iter->driftDistance += rndm.Gaus(0., 0.04);
+        if(realization && hit.detectorID <= 24) hit.driftDistance += rndm.Gaus(0., 0.04);
 
-        if(iter->detectorID >= 25 && iter->detectorID <= 40)
-        {
-            hodohitlist.push_back(*iter);
-        }
-        else
-        {
-            hitlist.push_back(*iter);
-        }
+        //apply hodoscope mask
+        if(hodomask && hit.detectorID <= 24 && (!hodoscopeMask(hit))) continue;
+
+        if(nHits != i) hitlist[nHits] = hit;
+        ++nHits;
     }
+    hitlist.resize(nHits);
 
     if(mergehodo)
     {
         for(std::vector<Hit>::iterator iter = rawEvent->fTriggerHits.begin(); iter != rawEvent->fTriggerHits.end(); ++iter)
         {
             if(triggermask && p_geomSvc->getPlaneType(iter->detectorID) == 1) continue;
-            hodohitlist.push_back(*iter);
+            hitlist.push_back(*iter);
         }
     }
+    hitlist.insert(hitlist.end(), trimhitlist.begin(), trimhitlist.end());
 
-    // manully create the X-hodo hits by the trigger roads
-    if(triggermask) p_triggerAna->trimEvent(rawEvent, hodohitlist, mergehodo ? (USE_HIT | USE_TRIGGER_HIT) : USE_TRIGGER_HIT);
-
-    //apply hodoscope mask
-    hodohitlist.sort();
-    if(hodomask) hodoscopeMask(hitlist, hodohitlist);
+    //the hodoscope hits never tie with the others, so a stable sort gives the same order as sorting and merging them separately
+    std::stable_sort(hitlist.begin(), hitlist.end());
+    hitkeep.assign(hitlist.size(), true);
 
-    //Remove after hits
-    hitlist.sort();
-    hitlist.merge(hodohitlist);
-    if(afterhit) hitlist.unique();
+    //Remove after hits, each hit is compared to the last one kept
+    if(afterhit)
+    {
+        int last = -1;
+        for(unsigned int i = 0; i < hitlist.size(); ++i)
+        {
+            if(last >= 0 && hitlist[i] == hitlist[last])
+            {
+                hitkeep[i] = false;
+            }
+            else
+            {
+                last = i;
+            }
+        }
+    }
 
     //Remove hit clusters
     if(decluster) deClusterize();
@@ -133,9 +198,18 @@ int EventReducer::reduceEvent(SRawEvent* rawEvent)
     //Remove the hits by sagitta ratio
     if(sagitta) sagittaReducer();
 
-    //Push everything back to SRawEvent
-    rawEvent->fAllHits.clear();
-    rawEvent->fAllHits.assign(hitlist.begin(), hitlist.end());
+    //Drop the removed hits and push everything back to SRawEvent
+    nHits = 0;
+    for(unsigned int i = 0; i < hitlist.size(); ++i)
+    {
+        if(!hitkeep[i]) continue;
+
+        if(nHits != i) hitlist[nHits] = hitlist[i];
+        ++nHits;
+    }
+    hitlist.resize(nHits);
+    hitlist.swap(rawEvent->fAllHits);
+    hitlist.clear();
 
     rawEvent->reIndex();
     return nHits_before - rawEvent->getNChamberHitsAll();
@@ -143,141 +217,176 @@ int EventReducer::reduceEvent(SRawEvent* rawEvent)
 
 void EventReducer::sagittaReducer()
 {
-    //find index for D1, D2, and D3
-    int nHits_D1 = 0;
-    int nHits_D2 = 0;
-    int nHits_D3 = 0;
-    for(std::list<Hit>::iterator iter = hitlist.begin(); iter != hitlist.end(); ++iter)
+    //collect the chamber hits still kept, they are at the front of the sorted list and grouped by plane
+    sagittaHits.clear();
+    int planeOffset[nChamberPlanes+2];
+    for(int i = 0; i <= nChamberPlanes+1; ++i) planeOffset[i] = 0;
+    int nInvalid = 0;
+    for(unsigned int i = 0; i < hitlist.size(); ++i)
     {
-        if(iter->detectorID > 24) break;
-        if(iter->detectorID <= 6)
-        {
-            ++nHits_D1;
-        }
-        else if(iter->detectorID <= 12)
-        {
-            ++nHits_D2;
-        }
-        else
+        if(!hitkeep[i]) continue;
+        if(hitlist[i].detectorID > 24) break;
+
+        //hits without a valid chamber plane never make a triplet and are dropped, as in the triple loop version
+        if(hitlist[i].detectorID < 1)
         {
-            ++nHits_D3;
+            hitkeep[i] = false;
+            ++nInvalid;
+            continue;
         }
-    }
-    int idx_D1 = nHits_D1;
-    int idx_D2 = nHits_D1 + nHits_D2;
-    int idx_D3 = nHits_D1 + nHits_D2 + nHits_D3;
 
-    //Loop over all hits
-    std::vector<Hit> hitTemp;
-    hitTemp.assign(hitlist.begin(), hitlist.end());
+        sagittaHits.push_back(i);
+        ++planeOffset[hitlist[i].detectorID+1];
+    }
+    if(sagittaHits.empty() && nInvalid > 0) return;
 
-    std::vector<int> flag(hitTemp.size(), -1);
-    for(int i = idx_D2; i < idx_D3; ++i)
+    //as in the triple loop version, the first hit left goes as well when there is no chamber hit at all
+    if(sagittaHits.empty())
     {
-        double z3 = p_geomSvc->getPlanePosition(hitTemp[i].detectorID);
-        double slope_target = hitTemp[i].pos/(z3 - Z_TARGET);
-        double slope_dump = hitTemp[i].pos/(z3 - Z_DUMP);
-        for(int j = idx_D1; j < idx_D2; ++j)
+        for(unsigned int i = 0; i < hitlist.size(); ++i)
         {
-            if(p_geomSvc->getPlaneType(hitTemp[i].detectorID) != p_geomSvc->getPlaneType(hitTemp[j].detectorID)) continue;
-
-            double z2 = p_geomSvc->getPlanePosition(hitTemp[j].detectorID);
-            if(fabs((hitTemp[i].pos - hitTemp[j].pos)/(z2 - z3)) > TX_MAX) continue;
-            double s2_target = hitTemp[j].pos - slope_target*(z2 - Z_TARGET);
-            double s2_dump = hitTemp[j].pos - slope_dump*(z2 - Z_DUMP);
+            if(!hitkeep[i]) continue;
 
-            for(int k = 0; k < idx_D1; ++k)
-            {
-                if(p_geomSvc->getPlaneType(hitTemp[i].detectorID) != p_geomSvc->getPlaneType(hitTemp[k].detectorID)) continue;
-                if(flag[i] > 0 && flag[j] > 0 && flag[k] > 0) continue;
+            hitkeep[i] = false;
+            break;
+        }
+        return;
+    }
 
-                double z1 = p_geomSvc->getPlanePosition(hitTemp[k].detectorID);
-                double pos_exp_target = SAGITTA_TARGET_CENTER*s2_target + slope_target*(z1 - Z_TARGET);
-                double pos_exp_dump = SAGITTA_DUMP_CENTER*s2_dump + slope_dump*(z1 - Z_DUMP);
-                double win_target = fabs(s2_target*SAGITTA_TARGET_WIN);
-                double win_dump = fabs(s2_dump*SAGITTA_DUMP_WIN);
+    //hits of each plane sorted by position, the plane z and type are looked up once per plane
+    HitIndexPosLess comp(hitlist);
+    double z[nChamberPlanes+1];
+    int type[nChamberPlanes+1];
+    for(int i = 1; i <= nChamberPlanes; ++i)
+    {
+        planeOffset[i+1] += planeOffset[i];
+        std::sort(sagittaHits.begin() + planeOffset[i], sagittaHits.begin() + planeOffset[i+1], comp);
 
-                double p_min = std::min(pos_exp_target - win_target, pos_exp_dump - win_dump);
-                double p_max = std::max(pos_exp_target + win_target, pos_exp_dump + win_dump);
+        z[i] = p_geomSvc->getPlanePosition(i);
+        type[i] = p_geomSvc->getPlaneType(i);
+    }
 
-                if(hitTemp[k].pos > p_min && hitTemp[k].pos < p_max)
+    //a D1 hit is kept if it falls in the window of any D2-D3 pair of the same plane type, and the pair if its window
+    //has any D1 hit, the windows are marked at both ends and the D1 hits inside are found in one pass at the end
+    sagittaMarks.assign(sagittaHits.size() + 1, 0);
+    sagittaUsed.assign(sagittaHits.size(), false);
+    for(int d3 = 13; d3 <= 24; ++d3)
+    {
+        for(int i = planeOffset[d3]; i < planeOffset[d3+1]; ++i)
+        {
+            Hit& hit_i = hitlist[sagittaHits[i]];
+            double z3 = z[d3];
+            double slope_target = hit_i.pos/(z3 - Z_TARGET);
+            double slope_dump = hit_i.pos/(z3 - Z_DUMP);
+            for(int d2 = 7; d2 <= 12; ++d2)
+            {
+                if(type[d2] != type[d3]) continue;
+
+                //the slope cut is applied exactly below, the search window is only slightly wider
+                double z2 = z[d2];
+                double win_slope = 1.01*TX_MAX*fabs(z2 - z3);
+                std::vector<int>::iterator jbegin = std::lower_bound(sagittaHits.begin() + planeOffset[d2], sagittaHits.begin() + planeOffset[d2+1], hit_i.pos - win_slope, comp);
+                std::vector<int>::iterator jend = std::upper_bound(jbegin, sagittaHits.begin() + planeOffset[d2+1], hit_i.pos + win_slope, comp);
+                for(std::vector<int>::iterator jter = jbegin; jter != jend; ++jter)
                 {
-                    flag[i] = 1;
-                    flag[j] = 1;
-                    flag[k] = 1;
+                    int j = jter - sagittaHits.begin();
+                    Hit& hit_j = hitlist[*jter];
+                    if(fabs((hit_i.pos - hit_j.pos)/(z2 - z3)) > TX_MAX) continue;
+                    double s2_target = hit_j.pos - slope_target*(z2 - Z_TARGET);
+                    double s2_dump = hit_j.pos - slope_dump*(z2 - Z_DUMP);
+
+                    for(int d1 = 1; d1 <= 6; ++d1)
+                    {
+                        if(type[d1] != type[d3]) continue;
+
+                        double z1 = z[d1];
+                        double pos_exp_target = SAGITTA_TARGET_CENTER*s2_target + slope_target*(z1 - Z_TARGET);
+                        double pos_exp_dump = SAGITTA_DUMP_CENTER*s2_dump + slope_dump*(z1 - Z_DUMP);
+                        double win_target = fabs(s2_target*SAGITTA_TARGET_WIN);
+                        double win_dump = fabs(s2_dump*SAGITTA_DUMP_WIN);
+
+                        double p_min = std::min(pos_exp_target - win_target, pos_exp_dump - win_dump);
+                        double p_max = std::max(pos_exp_target + win_target, pos_exp_dump + win_dump);
+
+                        //both edges of the window are excluded
+                        std::vector<int>::iterator kbegin = std::upper_bound(sagittaHits.begin() + planeOffset[d1], sagittaHits.begin() + planeOffset[d1+1], p_min, comp);
+                        std::vector<int>::iterator kend = std::lower_bound(kbegin, sagittaHits.begin() + planeOffset[d1+1], p_max, comp);
+                        if(kbegin == kend) continue;
+
+                        ++sagittaMarks[kbegin - sagittaHits.begin()];
+                        --sagittaMarks[kend - sagittaHits.begin()];
+                        sagittaUsed[i] = true;
+                        sagittaUsed[j] = true;
+                    }
                 }
             }
         }
     }
 
-    int idx = 0;
-    for(std::list<Hit>::iterator iter = hitlist.begin(); iter != hitlist.end(); )
+    //drop the hits outside of any triplet
+    int nWindows = 0;
+    for(unsigned int i = 0; i < sagittaHits.size(); ++i)
     {
-        if(flag[idx] < 0)
-        {
-            iter = hitlist.erase(iter);
-        }
-        else
-        {
-            ++iter;
-        }
-
-        ++idx;
-        if(idx >= idx_D3) break;
+        nWindows += sagittaMarks[i];
+        if(nWindows == 0 && !sagittaUsed[i]) hitkeep[sagittaHits[i]] = false;
     }
 }
 
 void EventReducer::deClusterize()
 {
-    std::vector<std::list<Hit>::iterator> cluster;
     cluster.clear();
-    for(std::list<Hit>::iterator hit = hitlist.begin(); hit != hitlist.end(); ++hit)
+    for(unsigned int i = 0; i < hitlist.size(); ++i)
     {
+        if(!hitkeep[i]) continue;
+
         //if we already reached the hodo part, stop
-        if(hit->detectorID > 24) break;
+        if(hitlist[i].detectorID > 24) break;
 
         if(cluster.size() == 0)
         {
-            cluster.push_back(hit);
+            cluster.push_back(i);
         }
         else
         {
-            if(hit->detectorID != cluster.back()->detectorID)
+            if(hitlist[i].detectorID != hitlist[cluster.back()].detectorID)
             {
                 processCluster(cluster);
-                cluster.push_back(hit);
+                cluster.push_back(i);
             }
-            else if(hit->elementID - cluster.back()->elementID > 1)
+            else if(hitlist[i].elementID - hitlist[cluster.back()].elementID > 1)
             {
                 processCluster(cluster);
-                cluster.push_back(hit);
+                cluster.push_back(i);
             }
             else
             {
-                cluster.push_back(hit);
+                cluster.push_back(i);
             }
         }
     }
 }
 
-void EventReducer::processCluster(std::vector<std::list<Hit>::iterator>& cluster)
+void EventReducer::processCluster(std::vector<int>& cluster)
 {
     unsigned int clusterSize = cluster.size();
 
     //size-2 clusters, retain the hit with smaller driftDistance
     if(clusterSize == 2)
     {
-        double w_max = 0.9*0.5*(cluster.back()->pos - cluster.front()->pos);
-        double w_min = w_max/9.*4.; //double w_min = 0.6*0.5*(cluster.back()->pos - cluster.front()->pos);
+        Hit& front = hitlist[cluster.front()];
+        Hit& back = hitlist[cluster.back()];
+
+        double w_max = 0.9*0.5*(back.pos - front.pos);
+        double w_min = w_max/9.*4.; //double w_min = 0.6*0.5*(back.pos - front.pos);
 
-        if((cluster.front()->driftDistance > w_max && cluster.back()->driftDistance > w_min) || (cluster.front()->driftDistance > w_min && cluster.back()->driftDistance > w_max))
+        if((front.driftDistance > w_max && back.driftDistance > w_min) || (front.driftDistance > w_min && back.driftDistance > w_max))
         {
-            cluster.front()->driftDistance > cluster.back()->driftDistance ? hitlist.erase(cluster.front()) : hitlist.erase(cluster.back());
+            hitkeep[front.driftDistance > back.driftDistance ? cluster.front() : cluster.back()] = false;
         }
-        else if(fabs(cluster.front()->tdcTime - cluster.back()->tdcTime) < 8. && cluster.front()->detectorID >= 13 && cluster.front()->detectorID <= 18)
+        else if(fabs(front.tdcTime - back.tdcTime) < 8. && front.detectorID >= 13 && front.detectorID <= 18)
         {
-            hitlist.erase(cluster.front());
-            hitlist.erase(cluster.back());
+            hitkeep[cluster.front()] = false;
+            hitkeep[cluster.back()] = false;
         }
     }
 
@@ -287,7 +396,7 @@ void EventReducer::processCluster(std::vector<std::list<Hit>::iterator>& cluster
         double dt_mean = 0.;
         for(unsigned int i = 1; i < clusterSize; ++i)
         {
-            dt_mean += fabs(cluster[i]->tdcTime - cluster[i-1]->tdcTime);
+            dt_mean += fabs(hitlist[cluster[i]].tdcTime - hitlist[cluster[i-1]].tdcTime);
         }
         dt_mean = dt_mean/(clusterSize - 1);
 
@@ -296,7 +405,7 @@ void EventReducer::processCluster(std::vector<std::list<Hit>::iterator>& cluster
             //electric noise, discard them all
             for(unsigned int i = 0; i < clusterSize; ++i)
             {
-                hitlist.erase(cluster[i]);
+                hitkeep[cluster[i]] = false;
             }
         }
         else
@@ -305,7 +414,7 @@ void EventReducer::processCluster(std::vector<std::list<Hit>::iterator>& cluster
             double dt_rms = 0.;
              	  for(unsigned int i = 1; i < clusterSize; ++i)
               {
-                 double dt = fabs(cluster[i]->tdcTime - cluster[i-1]->tdcTime);
+                 double dt = fabs(hitlist[cluster[i]].tdcTime - hitlist[cluster[i-1]].tdcTime);
                  dt_rms += ((dt - dt_mean)*(dt - dt_mean));
               }
             dt_rms = sqrt(dt_rms/(clusterSize - 1));
@@ -315,7 +424,7 @@ void EventReducer::processCluster(std::vector<std::list<Hit>::iterator>& cluster
             {
                 for(unsigned int i = 1; i < clusterSize - 1; ++i)
                 {
-                    hitlist.erase(cluster[i]);
+                    hitkeep[cluster[i]] = false;
                 }
             }
         }
@@ -396,54 +505,67 @@ void EventReducer::initHodoMaskLUT()
         }
     }
 
-    //reverse the LUT
-    c2helementIDs.clear();
+    //number the paddles of the masking hodoscopes and the wires of the chambers
+    for(int i = 0; i <= nChamberPlanes+nHodoPlanes; ++i) hodoBitOffset[i] = -1;
+    int nHodoBits = 0;
+    for(int i = 0; i < 8; ++i)
+    {
+        hodoBitOffset[hodoIDs[i]] = nHodoBits;
+        nHodoBits += p_geomSvc->getPlaneNElements(hodoIDs[i]);
+    }
+    nHodoWords = (nHodoBits + 63)/64;
+
+    int nChamElements = 0;
+    for(int i = 1; i <= nChamberPlanes; ++i)
+    {
+        chamElementOffset[i] = nChamElements;
+        nChamElements += p_geomSvc->getPlaneNElements(i);
+    }
+
+    //reverse the LUT into the flat table
+    c2hMask.assign(nChamElements*nHodoWords, 0);
+    hodoBits.assign(nHodoWords, 0);
     for(LUT::iterator iter = h2celementID_lo.begin(); iter != h2celementID_lo.end(); ++iter)
     {
         int hodoUID = iter->first;
+        int hodoBit = hodoBitOffset[hodoUID/1000] + hodoUID % 1000 - 1;
         for(unsigned int i = 0; i < h2celementID_lo[hodoUID].size(); ++i)
         {
             int chamUID_lo = iter->second[i];
             int chamUID_hi = h2celementID_hi[hodoUID][i];
             for(int j = chamUID_lo; j <= chamUID_hi; ++j)
             {
-                c2helementIDs[j].push_back(hodoUID);
+                ULong64_t* mask = &c2hMask[(chamElementOffset[j/1000] + j % 1000 - 1)*nHodoWords];
+                mask[hodoBit/64] |= ULong64_t(1) << (hodoBit % 64);
             }
         }
     }
 }
 
-void EventReducer::hodoscopeMask(std::list<Hit>& chamberhits, std::list<Hit>& hodohits)
+void EventReducer::addHodoHit(const Hit& hodohit)
 {
-    for(std::list<Hit>::iterator iter = chamberhits.begin(); iter != chamberhits.end(); )
-    {
-        if(iter->detectorID > 40)
-        {
-            ++iter;
-            continue;
-        }
+    //only the masking hodoscopes have bits
+    if(hodohit.detectorID <= nChamberPlanes || hodohit.detectorID > nChamberPlanes+nHodoPlanes) return;
+    if(hodoBitOffset[hodohit.detectorID] < 0) return;
+    if(hodohit.elementID < 1 || hodohit.elementID > p_geomSvc->getPlaneNElements(hodohit.detectorID)) return;
 
-        int uniqueID = iter->uniqueID();
+    int hodoBit = hodoBitOffset[hodohit.detectorID] + hodohit.elementID - 1;
+    hodoBits[hodoBit/64] |= ULong64_t(1) << (hodoBit % 64);
+}
 
-        bool masked = false;
-        for(std::vector<int>::iterator jter = c2helementIDs[uniqueID].begin(); jter != c2helementIDs[uniqueID].end(); ++jter)
-        {
-            if(std::find(hodohits.begin(), hodohits.end(), Hit(*jter)) != hodohits.end())
-            {
-                masked = true;
-                break;
-            }
-        }
+bool EventReducer::hodoscopeMask(const Hit& chamberhit)
+{
+    //a chamber hit is kept if any of the paddles it can be masked by is fired
+    if(chamberhit.detectorID < 1 || chamberhit.detectorID > nChamberPlanes) return false;
+    if(chamberhit.elementID < 1 || chamberhit.elementID > p_geomSvc->getPlaneNElements(chamberhit.detectorID)) return false;
 
-        if(masked)
-        {
-            ++iter;
-        }
-        else
-        {
-            iter = chamberhits.erase(iter);
-        }
+    const ULong64_t* mask = &c2hMask[(chamElementOffset[chamberhit.detectorID] + chamberhit.elementID - 1)*nHodoWords];
+    for(unsigned int i = 0; i < nHodoWords; ++i)
+    {
+        if((mask[i] & hodoBits[i]) != 0) return true;
     }
+
+    return false;
 }
 
 bool EventReducer::lineCrossing(double x1, double y1, double x2, double y2,
@@ -16,6 +16,8 @@ Created: 06-17-2015
 
 #include <list>
 #include <map>
+#include <vector>
+#include <Rtypes.h>
 #include <TString.h>
 #include <TRandom.h>
 
@@ -29,7 +31,7 @@ public:
     EventReducer(TString options);
     ~EventReducer();
 
-    //main external call
+    //main external call, the hits of SRawEvent are reduced in place
     int reduceEvent(SRawEvent* rawEvent);
 
     //sagitta ratio reducer
@@ -40,11 +42,12 @@ public:
 
     //hit cluster remover
     void deClusterize();
-    void processCluster(std::vector<std::list<Hit>::iterator>& cluster);
+    void processCluster(std::vector<int>& cluster);
 
-    //hodosope maksing
+    //hodosope maksing, the hodoscope hits of the event are added as paddle bits first
     void initHodoMaskLUT();
-    void hodoscopeMask(std::list<Hit>& chamberhits, std::list<Hit>& hodohits);
+    void addHodoHit(const Hit& hodohit);
+    bool hodoscopeMask(const Hit& chamberhit);
     bool lineCrossing(double x1, double y1, double x2, double y2,
                       double x3, double y3, double x4, double y4);
 
@@ -58,15 +61,34 @@ private:
     //Random number
     TRandom rndm;
 
-    //temporary container for the hit list
-    std::list<Hit> hitlist;
-    std::list<Hit> hodohitlist;
+    //hit list of the event being reduced, swapped in from SRawEvent and back, and its keep flags,
+    //the reduction passes after the sorting only clear the flags and the list is compacted once at the end
+    std::vector<Hit> hitlist;
+    std::vector<bool> hitkeep;
+
+    //temporary containers of the hodoscope hits made from the trigger roads, the clusters and the sagitta triplets,
+    //sagittaHits holds the chamber hits sorted by plane and position, sagittaMarks the window edges in it
+    std::vector<Hit> trimhitlist;
+    std::vector<int> cluster;
+    std::vector<int> sagittaHits;
+    std::vector<int> sagittaMarks;
+    std::vector<bool> sagittaUsed;
 
     //loop-up table of hodoscope masking
     typedef std::map<int, std::vector<int> > LUT;
     LUT h2celementID_lo;
     LUT h2celementID_hi;
-    LUT c2helementIDs;
+
+    //flat version of the chamber to hodoscope table: the paddles of the masking hodoscopes are numbered bit by bit
+    //from hodoBitOffset[detectorID], and wire elementID of chamber detectorID has the bits of the paddles it is
+    //masked by in the nHodoWords words starting at c2hMask[(chamElementOffset[detectorID] + elementID - 1)*nHodoWords]
+    int hodoBitOffset[nChamberPlanes+nHodoPlanes+1];
+    int chamElementOffset[nChamberPlanes+1];
+    unsigned int nHodoWords;
+    std::vector<ULong64_t> c2hMask;
+
+    //hodoscope hits of the current event as paddle bits
+    std::vector<ULong64_t> hodoBits;
 
     //flags of the hit manipulation method
     bool afterhit;            //after pulse removal
@@ -36,6 +36,55 @@ SignedHit::SignedHit(Hit hit_input, int sign_input) : hit(hit_input), sign(sign_
 {
 }
 
+//Compact hit definition
+Hit CompactHit::getHit() const
+{
+    Hit hit;
+    hit.index = index;
+    hit.detectorID = detectorID;
+    hit.elementID = elementID;
+    hit.tdcTime = tdcTime;
+    hit.driftDistance = driftDistance;
+    hit.pos = pos;
+    hit.flag = flag;
+
+    return hit;
+}
+
+TrackletHitArray::TrackletHitArray(const TrackletHitArray& elem) : nHits(elem.nHits)
+{
+    std::copy(elem.hits, elem.hits + nHits, hits);
+}
+
+TrackletHitArray& TrackletHitArray::operator=(const TrackletHitArray& elem)
+{
+    nHits = elem.nHits;
+    std::copy(elem.hits, elem.hits + nHits, hits);
+
+    return *this;
+}
+
+bool TrackletHitArray::append(const TrackletHitArray& elem)
+{
+    if(nHits + elem.nHits > TRACKLET_MAX_HITS) return false;
+
+    std::copy(elem.hits, elem.hits + elem.nHits, hits + nHits);
+    nHits += elem.nHits;
+    return true;
+}
+
+void TrackletHitArray::sort()
+{
+    for(unsigned int i = 1; i < nHits; ++i)
+    {
+        TrackletHit key = hits[i];
+
+        unsigned int j = i;
+        for(; j > 0 && key < hits[j-1]; --j) hits[j] = hits[j-1];
+        hits[j] = key;
+    }
+}
+
 //Proptube segment definition
 const GeomSvc* PropSegment::p_geomSvc = GeomSvc::instance();
 
@@ -382,7 +431,7 @@ void PropSegment::linearFit_iterative()
 //General tracklet part
 const GeomSvc* Tracklet::p_geomSvc = GeomSvc::instance();
 
-Tracklet::Tracklet() : stationID(-1), nXHits(0), nUHits(0), nVHits(0), chisq(9999.), tx(0.), ty(0.), x0(0.), y0(0.), invP(0.02), err_tx(-1.), err_ty(-1.), err_x0(-1.), err_y0(-1.), err_invP(-1.)
+Tracklet::Tracklet() : stationID(-1), nXHits(0), nUHits(0), nVHits(0), chisq(9999.), hitsUnpacked(false), tx(0.), ty(0.), x0(0.), y0(0.), invP(0.02), err_tx(-1.), err_ty(-1.), err_x0(-1.), err_y0(-1.), err_invP(-1.)
 {
     for(int i = 0; i < 24; i++) residual[i] = 999.;
 }
@@ -410,7 +459,8 @@ bool Tracklet::isValid()
     {
         //Number of hits cuts, second index is X, U, V, second index is station-1, 2, 3
         int nRealHits[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
-        for(std::list<SignedHit>::iterator iter = hits.begin(); iter != hits.end(); ++iter)
+        syncHits();
+        for(TrackletHitArray::iterator iter = hitArray.begin(); iter != hitArray.end(); ++iter)
         {
             if(iter->hit.index < 0) continue;
 
@@ -533,11 +583,14 @@ bool Tracklet::operator<(const Tracklet& elem) const
 
 bool Tracklet::similarity(const Tracklet& elem) const
 {
+    syncHits();
+    elem.syncHits();
+
     int nCommonHits = 0;
-    std::list<SignedHit>::const_iterator first = hits.begin();
-    std::list<SignedHit>::const_iterator second = elem.hits.begin();
+    TrackletHitArray::const_iterator first = hitArray.begin();
+    TrackletHitArray::const_iterator second = elem.hitArray.begin();
 
-    while(first != hits.end() && second != elem.hits.end())
+    while(first != hitArray.end() && second != elem.hitArray.end())
     {
         if((*first) < (*second))
         {
@@ -629,14 +682,16 @@ Tracklet Tracklet::operator+(const Tracklet& elem) const
     tracklet.nUHits = nUHits + elem.nUHits;
     tracklet.nVHits = nVHits + elem.nVHits;
 
-    tracklet.hits.assign(hits.begin(), hits.end());
-    if(elem.stationID > stationID)
-    {
-        tracklet.hits.insert(tracklet.hits.end(), elem.hits.begin(), elem.hits.end());
-    }
-    else
+    syncHits();
+    elem.syncHits();
+
+    const Tracklet& upstream = elem.stationID > stationID ? *this : elem;
+    const Tracklet& downstream = elem.stationID > stationID ? elem : *this;
+    tracklet.hitArray = upstream.hitArray;
+    if(!tracklet.hitArray.append(downstream.hitArray))
     {
-        tracklet.hits.insert(tracklet.hits.begin(), elem.hits.begin(), elem.hits.end());
+        //Not possible with one hit per plane, without the downstream hits the tracklet fails the hit count cuts of isValid()
+        LogInfo("Hit array overflow, " << upstream.hitArray.size() << " + " << downstream.hitArray.size() << " hits > " << TRACKLET_MAX_HITS);
     }
 
     tracklet.err_tx = 1./sqrt(1./err_tx/err_tx + 1./elem.err_tx/elem.err_tx);
@@ -665,14 +720,16 @@ Tracklet Tracklet::operator*(const Tracklet& elem) const
     tracklet.nUHits = nUHits + elem.nUHits;
     tracklet.nVHits = nVHits + elem.nVHits;
 
-    tracklet.hits.assign(hits.begin(), hits.end());
-    if(elem.stationID > stationID)
-    {
-        tracklet.hits.insert(tracklet.hits.end(), elem.hits.begin(), elem.hits.end());
-    }
-    else
+    syncHits();
+    elem.syncHits();
+
+    const Tracklet& upstream = elem.stationID > stationID ? *this : elem;
+    const Tracklet& downstream = elem.stationID > stationID ? elem : *this;
+    tracklet.hitArray = upstream.hitArray;
+    if(!tracklet.hitArray.append(downstream.hitArray))
     {
-        tracklet.hits.insert(tracklet.hits.begin(), elem.hits.begin(), elem.hits.end());
+        //Not possible with one hit per plane, without the downstream hits the tracklet fails the hit count cuts of isValid()
+        LogInfo("Hit array overflow, " << upstream.hitArray.size() << " + " << downstream.hitArray.size() << " hits > " << TRACKLET_MAX_HITS);
     }
 
     if(elem.stationID == 5)
@@ -710,11 +767,13 @@ Tracklet Tracklet::operator*(const Tracklet& elem) const
 
 void Tracklet::addDummyHits()
 {
+    syncHits();
+
     std::vector<int> detectorIDs_all;
     for(int i = stationID*6 - 5; i <= stationID*6; i++) detectorIDs_all.push_back(i);
 
     std::vector<int> detectorIDs_now;
-    for(std::list<SignedHit>::const_iterator iter = hits.begin(); iter != hits.end(); ++iter)
+    for(TrackletHitArray::const_iterator iter = hitArray.begin(); iter != hitArray.end(); ++iter)
     {
         detectorIDs_now.push_back(iter->hit.detectorID);
     }
@@ -725,10 +784,7 @@ void Tracklet::addDummyHits()
 
     for(std::vector<int>::iterator iter = detectorIDs_miss.begin(); iter != detectorIDs_miss.end(); ++iter)
     {
-        SignedHit dummy;
-        dummy.hit.detectorID = *iter;
-
-        hits.push_back(dummy);
+        hitArray.push_back(TrackletHit(*iter));
     }
 
     sortHits();
@@ -736,6 +792,7 @@ void Tracklet::addDummyHits()
 
 double Tracklet::calcChisq()
 {
+    syncHits();
     chisq = 0.;
 
     double tx_st1, x0_st1;
@@ -744,7 +801,7 @@ double Tracklet::calcChisq()
         getXZInfoInSt1(tx_st1, x0_st1);
     }
 
-    for(std::list<SignedHit>::const_iterator iter = hits.begin(); iter != hits.end(); ++iter)
+    for(TrackletHitArray::const_iterator iter = hitArray.begin(); iter != hitArray.end(); ++iter)
     {
         if(iter->hit.index < 0) continue;
 
@@ -780,15 +837,39 @@ double Tracklet::calcChisq()
 
 SignedHit Tracklet::getSignedHit(int index)
 {
-    int id = 0;
+    syncHits();
+    if(index >= 0 && index < int(hitArray.size())) return hitArray.begin()[index].getSignedHit();
+
+    SignedHit dummy;
+    return dummy;
+}
+
+void Tracklet::packHits()
+{
+    hitsUnpacked = true;
+    hits.clear();
+    for(TrackletHitArray::const_iterator iter = hitArray.begin(); iter != hitArray.end(); ++iter)
+    {
+        hits.push_back(iter->getSignedHit());
+    }
+}
+
+void Tracklet::unpackHits() const
+{
+    hitsUnpacked = true;
+    hitArray.clear();
     for(std::list<SignedHit>::const_iterator iter = hits.begin(); iter != hits.end(); ++iter)
     {
-        if(id == index) return *iter;
-        id++;
+        if(!hitArray.push_back(TrackletHit(*iter))) break;
     }
+}
 
-    SignedHit dummy;
-    return dummy;
+void Tracklet::syncHits() const
+{
+    //One-shot: once unpacked the array is the working copy and may be edited (disabled hits, dummy hits),
+    //hitsUnpacked is cleared by the read rule in FastTrackletLinkDef.h when a new entry is streamed in.
+    //On the tracking path the persistent list is only filled by packHits() at the very end
+    if(!hitsUnpacked && !hits.empty()) unpackHits();
 }
 
 double Tracklet::Eval(const double* par)
@@ -803,11 +884,98 @@ double Tracklet::Eval(const double* par)
     return calcChisq();
 }
 
+TrackletChisqKernel::TrackletChisqKernel()
+{
+    nHits = 0;
+    stationID = -1;
+}
+
+void TrackletChisqKernel::pack(const Tracklet& tracklet)
+{
+    const GeomSvc* p_geomSvc = Tracklet::p_geomSvc;
+
+    tracklet.syncHits();
+
+    nHits = 0;
+    stationID = tracklet.stationID;
+    for(TrackletHitArray::const_iterator iter = tracklet.hitArray.begin(); iter != tracklet.hitArray.end(); ++iter)
+    {
+        if(iter->hit.index < 0) continue;
+
+        int i = nHits++;
+        detectorID[i] = iter->hit.detectorID;
+        st1[i] = KMAG_ON == 1 && stationID == 6 && detectorID[i] <= 6 ? 1 : 0;
+        meas[i] = iter->hit.pos + iter->sign*fabs(iter->hit.driftDistance);
+        sigma[i] = iter->sign == 0 ? p_geomSvc->getPlaneSpacing(detectorID[i])/sqrt(12.) : p_geomSvc->getPlaneResolution(detectorID[i]);
+
+        const Plane& plane = p_geomSvc->getPlane(detectorID[i]);
+        nx[i] = plane.nVec[0];
+        ny[i] = plane.nVec[1];
+        nz[i] = plane.nVec[2];
+        vx[i] = plane.vVec[0];
+        vy[i] = plane.vVec[1];
+        vz[i] = plane.vVec[2];
+        xc[i] = plane.xc;
+        yc[i] = plane.yc;
+        zc[i] = plane.zc;
+        wc[i] = plane.wc;
+    }
+}
+
+double TrackletChisqKernel::calcChisq(const double* par, double* residual)
+{
+    double tx = par[0];
+    double ty = par[1];
+    double x0 = par[2];
+    double y0 = par[3];
+
+    //Same kick as Tracklet::getXZInfoInSt1, the charge follows the x0 being evaluated
+    double tx_st1 = tx;
+    double x0_st1 = x0;
+    if(stationID == 6 && KMAG_ON == 1)
+    {
+        int charge = x0*KMAGSTR > 0 ? 1 : -1;
+        tx_st1 = tx + PT_KICK_KMAG*par[4]*charge;
+        x0_st1 = tx*Z_KMAG_BEND + x0 - tx_st1*Z_KMAG_BEND;
+    }
+
+    //Plane::intercept written out per hit, no branch other than the station-1 select
+    for(int i = 0; i < nHits; ++i)
+    {
+        double tx_i = st1[i] == 1 ? tx_st1 : tx;
+        double x0_i = st1[i] == 1 ? x0_st1 : x0;
+
+        double det = -(tx_i*nx[i] + ty*ny[i] + nz[i]);
+        double dpos0 = x0_i - xc[i];
+        double dpos1 = y0 - yc[i];
+        double dpos2 = -zc[i];
+
+        double vcp0 = vy[i] - vz[i]*ty;
+        double vcp1 = vz[i]*tx_i - vx[i];
+        double vcp2 = vx[i]*ty - vy[i]*tx_i;
+
+        res[i] = meas[i] - (-(vcp0*dpos0 + vcp1*dpos1 + vcp2*dpos2)/det + wc[i]);
+        term[i] = res[i]*res[i]/sigma[i]/sigma[i];
+    }
+
+    double chisq = 0.;
+    for(int i = 0; i < nHits; ++i) chisq += term[i];
+
+    if(residual != NULL)
+    {
+        for(int i = 0; i < nHits; ++i) residual[detectorID[i]-1] = res[i];
+    }
+
+    return chisq;
+}
+
 SRecTrack Tracklet::getSRecTrack()
 {
+    syncHits();
+
     SRecTrack strack;
     strack.setChisq(chisq);
-    for(std::list<SignedHit>::iterator iter = hits.begin(); iter != hits.end(); ++iter)
+    for(TrackletHitArray::iterator iter = hitArray.begin(); iter != hitArray.end(); ++iter)
     {
         if(iter->hit.index < 0) continue;
 
@@ -885,7 +1053,7 @@ void Tracklet::print()
     cout << nXHits + nUHits + nVHits << " hits in this station with chisq = " << chisq << endl;
     cout << "Momentum in z: " << 1./invP << " +/- " << err_invP/invP/invP << endl;
     cout << "Charge: " << getCharge() << endl;
-    for(std::list<SignedHit>::iterator iter = hits.begin(); iter != hits.end(); ++iter)
+    for(TrackletHitArray::iterator iter = hitArray.begin(); iter != hitArray.end(); ++iter)
     {
         if(iter->sign > 0) cout << "L: ";
         if(iter->sign < 0) cout << "R: ";
@@ -12,6 +12,7 @@ Created: 06-09-2013
 
 #include "MODE_SWITCH.h"
 
+#include <iostream>
 #include <list>
 #include <vector>
 
@@ -44,6 +45,100 @@ public:
     ClassDef(SignedHit, 1)
 };
 
+///Maximum number of hits in one tracklet, one per chamber plane
+#define TRACKLET_MAX_HITS 18
+
+///Data members of Hit without the TObject overhead, same names so the tracking code reads the same
+struct CompactHit
+{
+    CompactHit() : index(-1), detectorID(-1), elementID(-1), tdcTime(0.), driftDistance(0.), pos(0.), flag(0) {}
+    CompactHit(const Hit& hit_input) : index(hit_input.index), detectorID(hit_input.detectorID), elementID(hit_input.elementID),
+        tdcTime(hit_input.tdcTime), driftDistance(hit_input.driftDistance), pos(hit_input.pos), flag(hit_input.flag) {}
+
+    //Convert back to a full Hit
+    Hit getHit() const;
+
+    //Debugging output
+    void print() const { std::cout << index << " : " << detectorID << " : " << elementID << " : " << pos << " : " << driftDistance << std::endl; }
+
+    Int_t index;
+    Short_t detectorID;
+    Short_t elementID;
+    Float_t tdcTime;
+    Float_t driftDistance;
+    Float_t pos;
+    UShort_t flag;
+};
+
+///Signed hit used by the fast tracking, a plain value type which is cheap to copy
+class TrackletHit
+{
+public:
+    TrackletHit() : sign(0) {}
+    explicit TrackletHit(int detectorID) : sign(0) { hit.detectorID = detectorID; }
+    TrackletHit(const Hit& hit_input, int sign_input) : hit(hit_input), sign(sign_input) {}
+    explicit TrackletHit(const SignedHit& hit_signed) : hit(hit_signed.hit), sign(hit_signed.sign) {}
+
+    //comparision operators for sorting
+    bool operator<(const TrackletHit& elem) const { return hit.detectorID < elem.hit.detectorID; }
+    bool operator==(const TrackletHit& elem) const { return hit.index == elem.hit.index; }
+
+    //Get the real hit position
+    double pos() const { return hit.pos + sign*hit.driftDistance; }
+    double pos(int sign_input) const { return hit.pos + sign_input*hit.driftDistance; }
+
+    //Convert to the persistent form
+    SignedHit getSignedHit() const { return SignedHit(hit.getHit(), sign); }
+
+    //Data members
+    CompactHit hit;
+    int sign;
+};
+
+///Fixed capacity hit list stored inline in the Tracklet, replaces std::list<SignedHit> on the tracking path
+class TrackletHitArray
+{
+public:
+    typedef TrackletHit* iterator;
+    typedef const TrackletHit* const_iterator;
+
+    TrackletHitArray() : nHits(0) {}
+    TrackletHitArray(const TrackletHitArray& elem);
+    TrackletHitArray& operator=(const TrackletHitArray& elem);
+
+    iterator begin() { return hits; }
+    iterator end() { return hits + nHits; }
+    const_iterator begin() const { return hits; }
+    const_iterator end() const { return hits + nHits; }
+
+    unsigned int size() const { return nHits; }
+    bool empty() const { return nHits == 0; }
+    void clear() { nHits = 0; }
+
+    TrackletHit& front() { return hits[0]; }
+    TrackletHit& back() { return hits[nHits-1]; }
+    const TrackletHit& front() const { return hits[0]; }
+    const TrackletHit& back() const { return hits[nHits-1]; }
+
+    //Add one hit at the end, false if the array is full
+    bool push_back(const TrackletHit& hit)
+    {
+        if(nHits == TRACKLET_MAX_HITS) return false;
+        hits[nHits++] = hit;
+        return true;
+    }
+
+    //Add all hits of another array at the end, false if they don't fit
+    bool append(const TrackletHitArray& elem);
+
+    //Stable sort by detectorID, insertion sort is the fastest for this size
+    void sort();
+
+private:
+    unsigned int nHits;
+    TrackletHit hits[TRACKLET_MAX_HITS];
+};
+
 class PropSegment : public TObject
 {
 public:
@@ -110,7 +205,15 @@ public:
     bool isValid();
 
     //Sort hit list
-    void sortHits() { hits.sort(); }
+    void sortHits() { syncHits(); hitArray.sort(); }
+
+    //Fill the persistent hit list from the tracking one, and the other way around after reading
+    void packHits();
+    void unpackHits() const;
+
+    //Unpack the persistent hit list once if the tracklet was read from a file,
+    //called by all the members which use the hits so that they work on tracklets read back
+    void syncHits() const;
 
     //Get number of real hits
     int getNHits() const { return nXHits + nUHits + nVHits; }
@@ -181,9 +284,15 @@ public:
     //Chi square
     double chisq;
 
-    //List of signed hits
+    //Signed hits used by the tracking, not persistent, rebuilt from hits by syncHits() after reading
+    mutable TrackletHitArray hitArray;      //!
+
+    //Persistent form of the signed hits, only filled by packHits() for the output
     std::list<SignedHit> hits;
 
+    //True once hitArray and hits have been made consistent by packHits()/unpackHits(), reset on reading
+    mutable bool hitsUnpacked;      //!
+
     //Corresponding prop. tube segments
     PropSegment seg_x;
     PropSegment seg_y;
@@ -210,5 +319,45 @@ public:
     ClassDef(Tracklet, 3)
 };
 
+///Packed copy of the active hits of one tracklet and their planes, for the chi square in the fit.
+///The per-hit loop has no dependency between hits so that the compiler can vectorize it, the sum
+///is then taken in the hit order so the result is identical to Tracklet::calcChisq
+class TrackletChisqKernel
+{
+public:
+    TrackletChisqKernel();
+
+    //Copy the active hits of the tracklet, once per fit
+    void pack(const Tracklet& tracklet);
+
+    //Kernal function to calculate chi square for minimizer, same parameters as Tracklet::Eval
+    double Eval(const double* par) { return calcChisq(par, NULL); }
+
+    //Chi square at the given parameters, residuals are filled by detectorID - 1 if requested
+    double calcChisq(const double* par, double* residual);
+
+    //Number of packed hits
+    int getNHits() const { return nHits; }
+
+private:
+    int nHits;
+    int stationID;
+
+    //Hits, in the order of the tracklet hit list
+    int detectorID[TRACKLET_MAX_HITS];
+    int st1[TRACKLET_MAX_HITS];
+    double meas[TRACKLET_MAX_HITS];
+    double sigma[TRACKLET_MAX_HITS];
+
+    //Planes of the hits
+    double nx[TRACKLET_MAX_HITS], ny[TRACKLET_MAX_HITS], nz[TRACKLET_MAX_HITS];
+    double vx[TRACKLET_MAX_HITS], vy[TRACKLET_MAX_HITS], vz[TRACKLET_MAX_HITS];
+    double xc[TRACKLET_MAX_HITS], yc[TRACKLET_MAX_HITS], zc[TRACKLET_MAX_HITS], wc[TRACKLET_MAX_HITS];
+
+    //Output of the per-hit loop
+    double res[TRACKLET_MAX_HITS];
+    double term[TRACKLET_MAX_HITS];
+};
+
 
 #endif
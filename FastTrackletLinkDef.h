@@ -8,4 +8,7 @@
 #pragma link C++ class PropSegment+;
 #pragma link C++ class Tracklet;
 
+//The tracking hit array is transient, unpack it again from the persistent list whenever a tracklet is read into a reused object
+#pragma read sourceClass="Tracklet" version="[1-]" targetClass="Tracklet" source="" target="hitsUnpacked" code="{ hitsUnpacked = false; }"
+
 #endif
@@ -10,6 +10,7 @@ Created: 10-19-2011
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <cstdlib>
 #include <cmath>
 #include <algorithm>
 #include <iomanip>
@@ -149,6 +150,29 @@ double Plane::intercept(double tx, double ty, double x0_track, double y0_track)
     return -(vcp[0]*dpos[0] + vcp[1]*dpos[1] + vcp[2]*dpos[2])/det + wc;
 }
 
+double Plane::intercept(double tx, double ty, double x0_track, double y0_track, double* dwdp) const
+{
+    double det = -(tx*nVec[0] + ty*nVec[1] + nVec[2]);
+    double dpos[3] = {x0_track - xc, y0_track - yc, -zc};
+
+    double vcp[3];
+    vcp[0] = vVec[1] - vVec[2]*ty;
+    vcp[1] = vVec[2]*tx - vVec[0];
+    vcp[2] = vVec[0]*ty - vVec[1]*tx;
+
+    double num = vcp[0]*dpos[0] + vcp[1]*dpos[1] + vcp[2]*dpos[2];
+
+    //w = -num/det + wc, derivatives of num and det w.r.t. tx, ty, x0, y0
+    double dnum[4] = {vVec[2]*dpos[1] - vVec[1]*dpos[2], vVec[0]*dpos[2] - vVec[2]*dpos[0], vcp[0], vcp[1]};
+    double ddet[4] = {-nVec[0], -nVec[1], 0., 0.};
+    for(int i = 0; i < 4; ++i)
+    {
+        dwdp[i] = -(dnum[i]*det - num*ddet[i])/det/det;
+    }
+
+    return -num/det + wc;
+}
+
 std::ostream& operator << (std::ostream& os, const Plane& plane)
 {
     os << std::setw(6) << std::setiosflags(std::ios::right) << plane.detectorID
@@ -169,6 +193,7 @@ std::ostream& operator << (std::ostream& os, const Plane& plane)
 }
 
 GeomSvc* GeomSvc::p_geometrySvc = NULL;
+std::string GeomSvc::planesFile;
 
 GeomSvc* GeomSvc::instance()
 {
@@ -261,48 +286,49 @@ void GeomSvc::init(std::string geometrySchema)
         map_detectorName.insert(idToName(iter->second, iter->first));
     }
 
-    ///Initialize the geometrical variables which should be from MySQL database
-    //Connect server
-    char serverName[200];
-    sprintf(serverName, "mysql://%s:%d", MYSQL_SERVER_ADDR, MYSQL_SERVER_PORT);
-    TSQLServer* con = TSQLServer::Connect(serverName, MYSQL_USER, MYSQL_PASS);
-
-    //Make query to Planes table
-    char query[300];
-    const char* buf_planes = "SELECT detectorName,spacing,cellWidth,overlap,numElements,angleFromVert,"
-                             "xPrimeOffset,x0,y0,z0,planeWidth,planeHeight,theta_x,theta_y,theta_z from %s.Planes WHERE"
-                             " detectorName LIKE 'D%%' OR detectorName LIKE 'H__' OR detectorName LIKE 'H____' OR "
-                             "detectorName LIKE 'P____'";
-    sprintf(query, buf_planes, geometrySchema.c_str());
-    TSQLResult* res = con->Query(query);
+    ///Initialize the geometrical variables from MySQL database, or from the ascii dump of the Planes table if requested
+    std::vector<std::vector<std::string> > rows;
+    if(!planesFile.empty())
+    {
+        if(!readPlanesTable(planesFile, rows))
+        {
+            LogInfo("Failed to load the plane geometry from ascii file " << planesFile);
+            exit(EXIT_FAILURE);
+        }
+        cout << "GeomSvc: loaded plane geometry from ascii file: " << planesFile << endl;
+    }
+    else if(!queryPlanesTable(geometrySchema, rows) || rows.empty())
+    {
+        LogInfo("Failed to load the plane geometry of " << geometrySchema << " from MySQL");
+        exit(EXIT_FAILURE);
+    }
 
-    unsigned int nRows = res->GetRowCount();
     int dummy = 0;
-    for(unsigned int i = 0; i < nRows; ++i)
+    for(unsigned int i = 0; i < rows.size(); ++i)
     {
-        TSQLRow* row = res->Next();
-        string detectorName(row->GetField(0));
+        std::vector<std::string>& row = rows[i];
+        string detectorName(row[0]);
         toLocalDetectorName(detectorName, dummy);
 
         int detectorID = map_detectorID[detectorName];
         planes[detectorID].detectorID = detectorID;
         planes[detectorID].detectorName = detectorName;
-        planes[detectorID].spacing = atof(row->GetField(1));
-        planes[detectorID].cellWidth = atof(row->GetField(2));
-        planes[detectorID].overlap = atof(row->GetField(3));
-        planes[detectorID].angleFromVert = atof(row->GetField(5));
-        planes[detectorID].xoffset = atof(row->GetField(6));
-        planes[detectorID].thetaX = atof(row->GetField(12));
-        planes[detectorID].thetaY = atof(row->GetField(13));
-        planes[detectorID].thetaZ = atof(row->GetField(14));
+        planes[detectorID].spacing = atof(row[1].c_str());
+        planes[detectorID].cellWidth = atof(row[2].c_str());
+        planes[detectorID].overlap = atof(row[3].c_str());
+        planes[detectorID].angleFromVert = atof(row[5].c_str());
+        planes[detectorID].xoffset = atof(row[6].c_str());
+        planes[detectorID].thetaX = atof(row[12].c_str());
+        planes[detectorID].thetaY = atof(row[13].c_str());
+        planes[detectorID].thetaZ = atof(row[14].c_str());
 
         //Following items need to be sumed or averaged over all modules
-        planes[detectorID].nElements += atoi(row->GetField(4));
-        double x0_i = atof(row->GetField(7));
-        double y0_i = atof(row->GetField(8));
-        double z0_i = atof(row->GetField(9));
-        double width_i = atof(row->GetField(10));
-        double height_i = atof(row->GetField(11));
+        planes[detectorID].nElements += atoi(row[4].c_str());
+        double x0_i = atof(row[7].c_str());
+        double y0_i = atof(row[8].c_str());
+        double z0_i = atof(row[9].c_str());
+        double width_i = atof(row[10].c_str());
+        double height_i = atof(row[11].c_str());
 
         double x1_i = x0_i - 0.5*width_i;
         double x2_i = x0_i + 0.5*width_i;
@@ -338,10 +364,7 @@ void GeomSvc::init(std::string geometrySchema)
         {
             planes[detectorID].planeType = 4;
         }
-
-        delete row;
     }
-    delete res;
 
     //For prop. tube only, average over 9 modules
     for(int i = 41; i <= nChamberPlanes+nHodoPlanes+nPropPlanes; i++)
@@ -355,12 +378,17 @@ void GeomSvc::init(std::string geometrySchema)
 
 #ifdef LOAD_ONLINE_ALIGNMENT
     //load the initial value in the planeOffsets table
+    char serverName[200];
+    sprintf(serverName, "mysql://%s:%d", MYSQL_SERVER_ADDR, MYSQL_SERVER_PORT);
+    TSQLServer* con = TSQLServer::Connect(serverName, MYSQL_USER, MYSQL_PASS);
+
+    char query[300];
     const char* buf_offsets = "SELECT detectorName,deltaX,deltaY,deltaZ,rotateAboutZ FROM %s.PlaneOffsets WHERE"
                               " detectorName LIKE 'D%%' OR detectorName LIKE 'H__' OR detectorName LIKE 'H____' OR detectorName LIKE 'P____'";
     sprintf(query, buf_offsets, geometrySchema.c_str());
-    res = con->Query(query);
+    TSQLResult* res = con->Query(query);
 
-    nRows = res->GetRowCount();
+    unsigned int nRows = res->GetRowCount();
     if(nRows >= 24) cout << "GeomSvc: loaded chamber alignment parameters from database: " << geometrySchema.c_str() << endl;
     for(unsigned int i = 0; i < nRows; ++i)
     {
@@ -388,8 +416,8 @@ void GeomSvc::init(std::string geometrySchema)
     }
 
     delete res;
-#endif
     delete con;
+#endif
 
     /////Here starts the user-defined part
     //load alignment parameters
@@ -440,14 +468,109 @@ void GeomSvc::init(std::string geometrySchema)
     zmax_kmag = 1064.26 + 120.*2.54;
 }
 
-std::vector<int> GeomSvc::getDetectorIDs(std::string pattern)
+bool GeomSvc::queryPlanesTable(std::string geometrySchema, std::vector<std::vector<std::string> >& rows)
+{
+    char serverName[200];
+    sprintf(serverName, "mysql://%s:%d", MYSQL_SERVER_ADDR, MYSQL_SERVER_PORT);
+    TSQLServer* con = TSQLServer::Connect(serverName, MYSQL_USER, MYSQL_PASS);
+    if(con == NULL)
+    {
+        LogInfo("Failed to connect to MySQL server " << serverName);
+        return false;
+    }
+
+    //Make query to Planes table
+    char query[400];
+    const char* buf_planes = "SELECT detectorName,spacing,cellWidth,overlap,numElements,angleFromVert,"
+                             "xPrimeOffset,x0,y0,z0,planeWidth,planeHeight,theta_x,theta_y,theta_z from %s.Planes WHERE"
+                             " detectorName LIKE 'D%%' OR detectorName LIKE 'H__' OR detectorName LIKE 'H____' OR "
+                             "detectorName LIKE 'P____'";
+    sprintf(query, buf_planes, geometrySchema.c_str());
+    TSQLResult* res = con->Query(query);
+    if(res == NULL)
+    {
+        LogInfo("Failed to read the Planes table of " << geometrySchema);
+        delete con;
+        return false;
+    }
+
+    rows.clear();
+    unsigned int nRows = res->GetRowCount();
+    for(unsigned int i = 0; i < nRows; ++i)
+    {
+        TSQLRow* row = res->Next();
+
+        std::vector<std::string> fields;
+        for(int j = 0; j < PLANES_TABLE_NCOLUMNS; ++j) fields.push_back(row->GetField(j) == NULL ? "0" : row->GetField(j));
+        rows.push_back(fields);
+
+        delete row;
+    }
+    delete res;
+    delete con;
+
+    return true;
+}
+
+bool GeomSvc::readPlanesTable(std::string fileName, std::vector<std::vector<std::string> >& rows)
+{
+    std::ifstream fin(fileName.c_str());
+    if(!fin) return false;
+
+    rows.clear();
+    std::string line;
+    while(std::getline(fin, line))
+    {
+        if(line.empty() || line[0] == '#') continue;
+
+        std::istringstream stringBuf(line);
+        std::vector<std::string> fields;
+        std::string field;
+        while(stringBuf >> field) fields.push_back(field);
+
+        if(int(fields.size()) != PLANES_TABLE_NCOLUMNS)
+        {
+            LogInfo("Wrong number of columns in " << fileName << ": " << line);
+            rows.clear();
+            return false;
+        }
+        rows.push_back(fields);
+    }
+
+    return !rows.empty();
+}
+
+bool GeomSvc::dumpPlanesTable(std::string geometrySchema, std::string fileName)
+{
+    std::vector<std::vector<std::string> > rows;
+    if(!queryPlanesTable(geometrySchema, rows) || rows.empty()) return false;
+
+    std::ofstream fout(fileName.c_str());
+    if(!fout)
+    {
+        LogInfo("Cannot open " << fileName << " for writing");
+        return false;
+    }
+
+    fout << "# Planes table of " << geometrySchema << ": detectorName spacing cellWidth overlap numElements angleFromVert"
+         << " xPrimeOffset x0 y0 z0 planeWidth planeHeight theta_x theta_y theta_z" << std::endl;
+    for(unsigned int i = 0; i < rows.size(); ++i)
+    {
+        for(unsigned int j = 0; j < rows[i].size(); ++j) fout << rows[i][j] << (j + 1 == rows[i].size() ? "" : " ");
+        fout << std::endl;
+    }
+
+    return true;
+}
+
+std::vector<int> GeomSvc::getDetectorIDs(std::string pattern) const
 {
     TPRegexp pattern_re(pattern.c_str());
 
     std::vector<int> detectorIDs;
     detectorIDs.clear();
 
-    for(std::map<std::string, int>::iterator iter = map_detectorID.begin(); iter != map_detectorID.end(); ++iter)
+    for(std::map<std::string, int>::const_iterator iter = map_detectorID.begin(); iter != map_detectorID.end(); ++iter)
     {
         TString detectorName((*iter).first.c_str());
         if(detectorName(pattern_re) != "")
@@ -460,15 +583,27 @@ std::vector<int> GeomSvc::getDetectorIDs(std::string pattern)
     return detectorIDs;
 }
 
-bool GeomSvc::findPatternInDetector(int detectorID, std::string pattern)
+int GeomSvc::getDetectorID(std::string detectorName) const
+{
+    std::map<std::string, int>::const_iterator iter = map_detectorID.find(detectorName);
+    return iter == map_detectorID.end() ? 0 : iter->second;
+}
+
+std::string GeomSvc::getDetectorName(int detectorID) const
+{
+    std::map<int, std::string>::const_iterator iter = map_detectorName.find(detectorID);
+    return iter == map_detectorName.end() ? std::string("") : iter->second;
+}
+
+bool GeomSvc::findPatternInDetector(int detectorID, std::string pattern) const
 {
     TPRegexp pattern_re(pattern.c_str());
-    TString detectorName(map_detectorName[detectorID]);
+    TString detectorName(getDetectorName(detectorID).c_str());
 
     return detectorName(pattern_re) != "";
 }
 
-bool GeomSvc::isInPlane(int detectorID, double x, double y)
+bool GeomSvc::isInPlane(int detectorID, double x, double y) const
 {
     if(x < planes[detectorID].x1 || x > planes[detectorID].x2) return false;
     if(y < planes[detectorID].y1 || y > planes[detectorID].y2) return false;
@@ -476,7 +611,7 @@ bool GeomSvc::isInPlane(int detectorID, double x, double y)
     return true;
 }
 
-bool GeomSvc::isInElement(int detectorID, int elementID, double x, double y, double tolr)
+bool GeomSvc::isInElement(int detectorID, int elementID, double x, double y, double tolr) const
 {
     double x_min, x_max, y_min, y_max;
     get2DBoxSize(detectorID, elementID, x_min, x_max, y_min, y_max);
@@ -489,7 +624,7 @@ bool GeomSvc::isInElement(int detectorID, int elementID, double x, double y, dou
     return x > x_min && x < x_max && y > y_min && y < y_max;
 }
 
-bool GeomSvc::isInKMAG(double x, double y)
+bool GeomSvc::isInKMAG(double x, double y) const
 {
     if(x < xmin_kmag || x > xmax_kmag) return false;
     if(y < ymin_kmag || y > ymax_kmag) return false;
@@ -497,30 +632,36 @@ bool GeomSvc::isInKMAG(double x, double y)
     return true;
 }
 
-void GeomSvc::getMeasurement(int detectorID, int elementID, double& measurement, double& dmeasurement)
+double GeomSvc::getWirePosition(int detectorID, int elementID) const
+{
+    std::map<std::pair<int, int>, double>::const_iterator iter = map_wirePosition.find(std::make_pair(detectorID, elementID));
+    return iter == map_wirePosition.end() ? 0. : iter->second;
+}
+
+void GeomSvc::getMeasurement(int detectorID, int elementID, double& measurement, double& dmeasurement) const
 {
-    measurement = map_wirePosition[std::make_pair(detectorID, elementID)];
+    measurement = getWirePosition(detectorID, elementID);
     dmeasurement = planes[detectorID].resolution;
 }
 
-double GeomSvc::getMeasurement(int detectorID, int elementID)
+double GeomSvc::getMeasurement(int detectorID, int elementID) const
 {
-    return map_wirePosition[std::make_pair(detectorID, elementID)];
+    return getWirePosition(detectorID, elementID);
 }
 
-int GeomSvc::getExpElementID(int detectorID, double pos_exp)
+int GeomSvc::getExpElementID(int detectorID, double pos_exp) const
 {
     if(detectorID <= 40)
     {
         int elementID_lo = int((pos_exp - planes[detectorID].xoffset - planes[detectorID].x0*planes[detectorID].costheta - planes[detectorID].y0*planes[detectorID].sintheta - planes[detectorID].deltaW + 0.5*(planes[detectorID].nElements + 1.)*planes[detectorID].spacing)/planes[detectorID].spacing);
 
-        return fabs(pos_exp - map_wirePosition[std::make_pair(detectorID, elementID_lo)]) < 0.5*planes[detectorID].spacing ? elementID_lo : elementID_lo + 1;
+        return fabs(pos_exp - getWirePosition(detectorID, elementID_lo)) < 0.5*planes[detectorID].spacing ? elementID_lo : elementID_lo + 1;
     }
 
     int elementID = -1;
     for(int i = 1; i < planes[detectorID].nElements; i++)
     {
-        double pos = map_wirePosition[std::make_pair(detectorID, i)];
+        double pos = getWirePosition(detectorID, i);
         if(fabs(pos - pos_exp) < 0.5*planes[detectorID].cellWidth)
         {
             elementID = i;
@@ -531,11 +672,11 @@ int GeomSvc::getExpElementID(int detectorID, double pos_exp)
     return elementID;
 }
 
-void GeomSvc::get2DBoxSize(int detectorID, int elementID, double& x_min, double& x_max, double& y_min, double& y_max)
+void GeomSvc::get2DBoxSize(int detectorID, int elementID, double& x_min, double& x_max, double& y_min, double& y_max) const
 {
     if(planes[detectorID].planeType == 1)
     {
-        double x_center = map_wirePosition[std::make_pair(detectorID, elementID)];
+        double x_center = getWirePosition(detectorID, elementID);
         double x_width = 0.5*planes[detectorID].cellWidth;
         x_min = x_center - x_width;
         x_max = x_center + x_width;
@@ -545,7 +686,7 @@ void GeomSvc::get2DBoxSize(int detectorID, int elementID, double& x_min, double&
     }
     else
     {
-        double y_center = map_wirePosition[std::make_pair(detectorID, elementID)];
+        double y_center = getWirePosition(detectorID, elementID);
         double y_width = 0.5*planes[detectorID].cellWidth;
         y_min = y_center - y_width;
         y_max = y_center + y_width;
@@ -555,7 +696,7 @@ void GeomSvc::get2DBoxSize(int detectorID, int elementID, double& x_min, double&
     }
 }
 
-void GeomSvc::getWireEndPoints(int detectorID, int elementID, double& x_min, double& x_max, double& y_min, double& y_max)
+void GeomSvc::getWireEndPoints(int detectorID, int elementID, double& x_min, double& x_max, double& y_min, double& y_max) const
 {
     y_min = planes[detectorID].y1;
     y_max = planes[detectorID].y2;
@@ -597,7 +738,7 @@ void GeomSvc::toLocalDetectorName(std::string& detectorName, int& eID)
     }
 }
 
-double GeomSvc::getDriftDistance(int detectorID, double tdcTime)
+double GeomSvc::getDriftDistance(int detectorID, double tdcTime) const
 {
     if(!calibration_loaded)
     {
@@ -797,7 +938,7 @@ void GeomSvc::loadCalibration(std::string calibrationFile)
     _cali_file.close();
 }
 
-bool GeomSvc::isInTime(int detectorID, double tdcTime)
+bool GeomSvc::isInTime(int detectorID, double tdcTime) const
 {
     return tdcTime > planes[detectorID].tmin && tdcTime < planes[detectorID].tmax;
 }
@@ -813,9 +954,9 @@ void GeomSvc::printWirePosition()
             std::cout << std::setw(6) << std::setiosflags(std::ios::right) << detectorID;
             std::cout << std::setw(6) << std::setiosflags(std::ios::right) << (*iter).first;
             std::cout << std::setw(6) << std::setiosflags(std::ios::right) << i;
-            std::cout << std::setw(10) << std::setiosflags(std::ios::right) << map_wirePosition[std::make_pair(detectorID, i)];
-            std::cout << std::setw(10) << std::setiosflags(std::ios::right) << map_wirePosition[std::make_pair(detectorID, i)] - 0.5*planes[detectorID].cellWidth;
-            std::cout << std::setw(10) << std::setiosflags(std::ios::right) << map_wirePosition[std::make_pair(detectorID, i)] + 0.5*planes[detectorID].cellWidth;
+            std::cout << std::setw(10) << std::setiosflags(std::ios::right) << getWirePosition(detectorID, i);
+            std::cout << std::setw(10) << std::setiosflags(std::ios::right) << getWirePosition(detectorID, i) - 0.5*planes[detectorID].cellWidth;
+            std::cout << std::setw(10) << std::setiosflags(std::ios::right) << getWirePosition(detectorID, i) + 0.5*planes[detectorID].cellWidth;
             std::cout << std::endl;
         }
     }
@@ -30,6 +30,9 @@ and then prop. tubes
 #include <TVector3.h>
 #include <TSpline.h>
 
+///Columns of the Planes table used by GeomSvc, in the order of the query and of the ascii dump
+#define PLANES_TABLE_NCOLUMNS 15
+
 class Plane
 {
 public:
@@ -39,6 +42,9 @@ public:
     //Get interception with track
     double intercept(double tx, double ty, double x0_track, double y0_track) const;
 
+    //Same as above, also fills the derivatives dw/d(tx, ty, x0, y0) used by the linear track fit
+    double intercept(double tx, double ty, double x0_track, double y0_track, double* dwdp) const;
+
     //X, Y, U, V conversion
     double getX(double w, double y) const { return w/costheta - y*tantheta; }
     double getY(double x, double w) const { return w/sintheta - x/tantheta; }
@@ -119,6 +125,7 @@ public:
     static GeomSvc* instance();
 
     ///Initialization, either from MySQL or from ascii file
+    ///The plane geometry is read from MySQL, or from the ascii dump set by setPlanesFile() before init
     void init(std::string geometrySchema);
     void loadCalibration(std::string calibrateFile);
     void loadAlignment(std::string alignmentFile_chamber, std::string alignmentFile_hodo, std::string alignmentFile_prop);
@@ -131,66 +138,72 @@ public:
     void toLocalDetectorName(std::string& detectorName, int& eID);
 
     ///Get the plane position
-    int getDetectorID(std::string detectorName) { return map_detectorID[detectorName]; }
-    std::string getDetectorName(int detectorID) { return map_detectorName[detectorID]; }
-    std::vector<int> getDetectorIDs(std::string pattern);
-    bool findPatternInDetector(int detectorID, std::string pattern);
+    int getDetectorID(std::string detectorName) const;
+    std::string getDetectorName(int detectorID) const;
+    std::vector<int> getDetectorIDs(std::string pattern) const;
+    bool findPatternInDetector(int detectorID, std::string pattern) const;
 
     double getPlanePosition(int detectorID) const { return planes[detectorID].zc; }
     double getPlaneSpacing(int detectorID) const  { return planes[detectorID].spacing; }
-    double getCellWidth(int detectorID)           { return planes[detectorID].cellWidth; }
+    double getCellWidth(int detectorID) const     { return planes[detectorID].cellWidth; }
     double getCostheta(int detectorID) const  { return planes[detectorID].costheta; }
     double getSintheta(int detectorID) const  { return planes[detectorID].sintheta; }
     double getTantheta(int detectorID) const  { return planes[detectorID].tantheta; }
-    double getPlaneScaleX(int detectorID)   { return planes[detectorID].x2 - planes[detectorID].x1; }
-    double getPlaneScaleY(int detectorID)   { return planes[detectorID].y2 - planes[detectorID].y1; }
-    int getPlaneNElements(int detectorID)   { return planes[detectorID].nElements; }
+    double getPlaneScaleX(int detectorID) const { return planes[detectorID].x2 - planes[detectorID].x1; }
+    double getPlaneScaleY(int detectorID) const { return planes[detectorID].y2 - planes[detectorID].y1; }
+    int getPlaneNElements(int detectorID) const { return planes[detectorID].nElements; }
     double getPlaneResolution(int detectorID) const { return planes[detectorID].resolution; }
 
-    double getPlaneCenterX(int detectorID)  { return planes[detectorID].xc; }
-    double getPlaneCenterY(int detectorID)  { return planes[detectorID].yc; }
-    double getPlaneCenterZ(int detectorID)  { return planes[detectorID].zc; }
-    double getRotationInX(int detectorID)    { return planes[detectorID].rX; }
-    double getRotationInY(int detectorID)    { return planes[detectorID].rY; }
-    double getRotationInZ(int detectorID)    { return planes[detectorID].rZ; }
+    double getPlaneCenterX(int detectorID) const { return planes[detectorID].xc; }
+    double getPlaneCenterY(int detectorID) const { return planes[detectorID].yc; }
+    double getPlaneCenterZ(int detectorID) const { return planes[detectorID].zc; }
+    double getRotationInX(int detectorID) const { return planes[detectorID].rX; }
+    double getRotationInY(int detectorID) const { return planes[detectorID].rY; }
+    double getRotationInZ(int detectorID) const { return planes[detectorID].rZ; }
 
-    double getPlaneZOffset(int detectorID)   { return planes[detectorID].deltaZ; }
-    double getPlanePhiOffset(int detectorID) { return planes[detectorID].rotZ; }
-    double getPlaneWOffset(int detectorID)   { return planes[detectorID].deltaW; }
-    double getPlaneWOffset(int detectorID, int moduleID) { return planes[detectorID].deltaW_module[moduleID]; }
+    double getPlaneZOffset(int detectorID) const { return planes[detectorID].deltaZ; }
+    double getPlanePhiOffset(int detectorID) const { return planes[detectorID].rotZ; }
+    double getPlaneWOffset(int detectorID) const { return planes[detectorID].deltaW; }
+    double getPlaneWOffset(int detectorID, int moduleID) const { return planes[detectorID].deltaW_module[moduleID]; }
 
     int getPlaneType(int detectorID) const { return planes[detectorID].planeType; }
+    const Plane& getPlane(int detectorID) const { return planes[detectorID]; }
 
-    double getKMAGCenter()     { return (zmin_kmag + zmax_kmag)/2.; }
-    double getKMAGUpstream()   { return zmin_kmag; }
-    double getKMAGDownstream() { return zmax_kmag; }
+    double getKMAGCenter() const { return (zmin_kmag + zmax_kmag)/2.; }
+    double getKMAGUpstream() const { return zmin_kmag; }
+    double getKMAGDownstream() const { return zmax_kmag; }
 
     ///Get the interception of a line an a plane
     double getInterception(int detectorID, double tx, double ty, double x0, double y0) const { return planes[detectorID].intercept(tx, ty, x0, y0); }
+    double getInterception(int detectorID, double tx, double ty, double x0, double y0, double* dwdp) const { return planes[detectorID].intercept(tx, ty, x0, y0, dwdp); }
     double getInterceptionFast(int detectorID, double tx, double ty, double x0, double y0) const;
     double getInterceptionFast(int detectorID, double x_exp, double y_exp) const { return planes[detectorID].getW(x_exp, y_exp); }
     ///Convert the detectorID and elementID to the actual hit position
-    void getMeasurement(int detectorID, int elementID, double& measurement, double& dmeasurement);
-    double getMeasurement(int detectorID, int elementID);
-    void get2DBoxSize(int detectorID, int elementID, double& x_min, double& x_max, double& y_min, double& y_max);
-    void getWireEndPoints(int detectorID, int elementID, double& x_min, double& x_max, double& y_min, double& y_max);
-    int getExpElementID(int detectorID, double pos_exp);
+    void getMeasurement(int detectorID, int elementID, double& measurement, double& dmeasurement) const;
+    double getMeasurement(int detectorID, int elementID) const;
+    void get2DBoxSize(int detectorID, int elementID, double& x_min, double& x_max, double& y_min, double& y_max) const;
+    void getWireEndPoints(int detectorID, int elementID, double& x_min, double& x_max, double& y_min, double& y_max) const;
+    int getExpElementID(int detectorID, double pos_exp) const;
 
     ///Calibration related
-    bool isCalibrationLoaded() { return calibration_loaded; }
-    double getDriftDistance(int detectorID, double tdcTime);
-    bool isInTime(int detectorID, double tdcTime);
-    TSpline3* getRTCurve(int detectorID) { return planes[detectorID].rtprofile; }
+    bool isCalibrationLoaded() const { return calibration_loaded; }
+    double getDriftDistance(int detectorID, double tdcTime) const;
+    bool isInTime(int detectorID, double tdcTime) const;
+    TSpline3* getRTCurve(int detectorID) const { return planes[detectorID].rtprofile; }
 
     ///Convert the stereo hits to Y value
-    double getYinStereoPlane(int detectorID, double x, double u) { return planes[detectorID].getY(x, u); }
-    double getUinStereoPlane(int detectorID, double x, double y) { return planes[detectorID].getW(x, y); }
-    double getXinStereoPlane(int detectorID, double u, double y) { return planes[detectorID].getX(u, y); }
+    double getYinStereoPlane(int detectorID, double x, double u) const { return planes[detectorID].getY(x, u); }
+    double getUinStereoPlane(int detectorID, double x, double y) const { return planes[detectorID].getW(x, y); }
+    double getXinStereoPlane(int detectorID, double u, double y) const { return planes[detectorID].getX(u, y); }
 
     ///See if a point is in a plane
-    bool isInPlane(int detectorID, double x, double y);
-    bool isInElement(int detectorID, int elementID, double x, double y, double tolr = 0.);
-    bool isInKMAG(double x, double y);
+    bool isInPlane(int detectorID, double x, double y) const;
+    bool isInElement(int detectorID, int elementID, double x, double y, double tolr = 0.) const;
+    bool isInKMAG(double x, double y) const;
+
+    ///Dump the Planes table of the schema in MySQL to an ascii file, which init() reads instead of MySQL after setPlanesFile()
+    static bool dumpPlanesTable(std::string geometrySchema, std::string fileName);
+    static void setPlanesFile(std::string fileName) { planesFile = fileName; }
 
     ///Debugging print of the content
     void printAlignPar();
@@ -198,6 +211,12 @@ public:
     void printWirePosition();
 
 private:
+    ///Rows of the Planes table, one string per column
+    static bool queryPlanesTable(std::string geometrySchema, std::vector<std::vector<std::string> >& rows);
+    static bool readPlanesTable(std::string fileName, std::vector<std::vector<std::string> >& rows);
+
+    ///Read-only lookup of the wire position, never modifies the map after init
+    double getWirePosition(int detectorID, int elementID) const;
 
     //All the detector planes
     Plane planes[nChamberPlanes+nHodoPlanes+nPropPlanes+1];
@@ -219,6 +238,9 @@ private:
 
     //singleton pointor
     static GeomSvc* p_geometrySvc;
+
+    //Ascii dump of the Planes table to read instead of MySQL, empty by default
+    static std::string planesFile;
 };
 
 #endif
@@ -10,16 +10,44 @@ Created: 05-28-2013
 #include <iostream>
 #include <algorithm>
 #include <cmath>
+#include <sys/time.h>
 
 #include <TCanvas.h>
 #include <TGraphErrors.h>
 #include <TBox.h>
 #include <TMatrixD.h>
+#include <TThread.h>
+#include <TString.h>
 
 #include "KalmanFitter.h"
 #include "KalmanFastTracking.h"
 #include "TriggerRoad.h"
 
+void TrackingStats::clear()
+{
+    for(int i = 0; i < nTrackingStages; ++i)
+    {
+        time[i] = 0.;
+        nCandidates[i] = 0;
+        nFits[i] = 0;
+        nEvals[i] = 0;
+    }
+}
+
+const char* TrackingStats::getStageName(int stage)
+{
+    static const char* names[nTrackingStages] = {"acceptEvent", "propSegments", "station2", "station3", "backPartial", "global", "kalmanFit"};
+    return stage >= 0 && stage < nTrackingStages ? names[stage] : "unknown";
+}
+
+//Wall clock in seconds, gettimeofday is cheap enough to be called a few times per event
+static double getWallTime()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + 1E-6*tv.tv_usec;
+}
+
 KalmanFastTracking::KalmanFastTracking(bool flag) : enable_KF(flag)
 {
     using namespace std;
@@ -35,16 +63,28 @@ KalmanFastTracking::KalmanFastTracking(bool flag) : enable_KF(flag)
         kmfitter->setControlParameter(50, 0.001);
     }
 
+    //Minuit is the default fitter, the analytic one has to be enabled explicitly
+    analyticFit = false;
+
+    //Serial loops by default
+    helpersDone = NULL;
+    minParallelTasks = 0;
+
+    //Counters outside of setRawEvent go to the first stage
+    stats.clear();
+    currentStage = kStageAcceptEvent;
+    stageStart = 0.;
+
     //Initialize minuit minimizer
     minimizer[0] = ROOT::Math::Factory::CreateMinimizer("Minuit2", "Simplex");
     minimizer[1] = ROOT::Math::Factory::CreateMinimizer("Minuit2", "Combined");
     if(KMAG_ON == 1)
     {
-        fcn = ROOT::Math::Functor(&tracklet_curr, &Tracklet::Eval, 5);
+        fcn = ROOT::Math::Functor(&chisqKernel, &TrackletChisqKernel::Eval, 5);
     }
     else
     {
-        fcn = ROOT::Math::Functor(&tracklet_curr, &Tracklet::Eval, 4);
+        fcn = ROOT::Math::Functor(&chisqKernel, &TrackletChisqKernel::Eval, 4);
     }
 
     for(int i = 0; i < 2; ++i)
@@ -274,48 +314,165 @@ KalmanFastTracking::KalmanFastTracking(bool flag) : enable_KF(flag)
 
 KalmanFastTracking::~KalmanFastTracking()
 {
+    for(unsigned int i = 0; i < helpers.size(); ++i)
+    {
+        helpers[i]->commands.close();
+        helpers[i]->thread->Join();
+
+        delete helpers[i]->thread;
+        delete helpers[i]->tracker;
+        delete helpers[i];
+    }
+    if(helpersDone != NULL) delete helpersDone;
+
     if(enable_KF) delete kmfitter;
     delete minimizer[0];
     delete minimizer[1];
 }
 
-void KalmanFastTracking::setRawEventDebug(SRawEvent* event_input)
+void KalmanFastTracking::enableAnalyticFit(bool opt)
 {
-    rawEvent = event_input;
-    hitAll = event_input->getAllHits();
+    analyticFit = opt;
+    for(unsigned int i = 0; i < helpers.size(); ++i) helpers[i]->tracker->enableAnalyticFit(opt);
 }
 
-int KalmanFastTracking::setRawEvent(SRawEvent* event_input)
+void KalmanFastTracking::enableParallel(int nThreads, unsigned int minTasks)
 {
-    rawEvent = event_input;
-    if(!acceptEvent(rawEvent)) return TFEXIT_FAIL_MULTIPLICITY;
-    hitAll = event_input->getAllHits();
-#ifdef _DEBUG_ON
-    for(std::vector<Hit>::iterator iter = hitAll.begin(); iter != hitAll.end(); ++iter) iter->print();
-#endif
+    if(!helpers.empty() || nThreads < 2) return;
 
-    //Initialize hodo and masking IDs
-    for(int i = 0; i < 4; i++)
+    TThread::Initialize();
+    helpersDone = new ThreadQueue<int>(nThreads);
+    minParallelTasks = minTasks;
+
+    //This tracker is used by the calling thread, so only nThreads - 1 helpers are needed
+    for(int i = 0; i < nThreads - 1; ++i)
     {
-        //std::cout << "For station " << i << std::endl;
-        hitIDs_mask[i].clear();
-        hitIDs_mask[i] = rawEvent->getHitsIndexInDetectors(detectorIDs_maskX[i]);
+        TrackingHelper* helper = new TrackingHelper;
+        helper->parent = this;
+        helper->tracker = new KalmanFastTracking(false);
+        helper->tracker->enableAnalyticFit(analyticFit);
+        helper->thread = new TThread(Form("trackingHelper%d", i), runHelper, helper);
+        helper->thread->Run();
+
+        helpers.push_back(helper);
+    }
+}
+
+void KalmanFastTracking::runParallel(int task, std::list<Tracklet>& inputs)
+{
+    currentTask = task;
+    taskInputs.clear();
+    for(std::list<Tracklet>::iterator iter = inputs.begin(); iter != inputs.end(); ++iter) taskInputs.push_back(&(*iter));
+    taskResults.assign(taskInputs.size(), Tracklet());
+    nextTask = 0;
+
+    for(unsigned int i = 0; i < helpers.size(); ++i) helpers[i]->commands.push(task);
+    runTasks(this);
+
+    //The inputs and this tracker are only touched again after all helpers are done
+    int done;
+    for(unsigned int i = 0; i < helpers.size(); ++i) helpersDone->pop(done);
 
-        //for(std::list<int>::iterator iter = hitIDs_mask[i].begin(); iter != hitIDs_mask[i].end(); ++iter) std::cout << *iter << " " << hitAll[*iter].detectorID << " === ";
-        //std::cout << std::endl;
+    //Fit counters of the helpers go to the current stage
+    for(unsigned int i = 0; i < helpers.size(); ++i)
+    {
+        TrackingStats& helperStats = helpers[i]->tracker->stats;
+        stats.nFits[currentStage] += helperStats.nFits[currentStage];
+        stats.nEvals[currentStage] += helperStats.nEvals[currentStage];
+        helperStats.clear();
     }
+}
 
-    //Initialize prop. tube IDs
-    for(int i = 0; i < 2; ++i)
+void KalmanFastTracking::runTasks(KalmanFastTracking* tracker)
+{
+    while(true)
     {
-        for(int j = 0; j < 4; ++j)
+        taskMutex.Lock();
+        unsigned int index = nextTask++;
+        taskMutex.UnLock();
+        if(index >= taskInputs.size()) break;
+
+        if(currentTask == kBackPartialTask)
+        {
+            tracker->buildBackPartialTrack(*taskInputs[index], taskResults[index]);
+        }
+        else
         {
-            hitIDs_muid[i][j].clear();
-            hitIDs_muid[i][j] = rawEvent->getHitsIndexInDetector(detectorIDs_muid[i][j]);
+            tracker->buildGlobalTrack(*taskInputs[index], taskResults[index]);
         }
     }
+}
+
+void KalmanFastTracking::shareEvent(KalmanFastTracking* parent, int task)
+{
+    rawEvent = parent->rawEvent;
+    hitAll = parent->hitAll;
+    currentStage = parent->currentStage;
+    propSegs[0] = parent->propSegs[0];
+    propSegs[1] = parent->propSegs[1];
+
+    if(task == kBackPartialTask)
+    {
+        trackletsInSt[1] = parent->trackletsInSt[1];
+    }
+    else
+    {
+        for(int i = 0; i < 3; ++i) pairsInSt1[i] = parent->pairsInSt1[i];
+        st1Memo.clear();
+        st1Tracklets.clear();
+    }
+}
+
+void* KalmanFastTracking::runHelper(void* arg)
+{
+    TrackingHelper* helper = (TrackingHelper*)arg;
+
+    int task;
+    while(helper->commands.pop(task))
+    {
+        helper->tracker->shareEvent(helper->parent, task);
+        helper->parent->runTasks(helper->tracker);
+        helper->parent->helpersDone->push(task);
+    }
 
+    return NULL;
+}
+
+void KalmanFastTracking::startStage(int stage)
+{
+    currentStage = stage;
+    stageStart = getWallTime();
+}
+
+void KalmanFastTracking::endStage(int nCandidates)
+{
+    stats.time[currentStage] = getWallTime() - stageStart;
+    stats.nCandidates[currentStage] = nCandidates;
+}
+
+void KalmanFastTracking::setRawEventDebug(SRawEvent* event_input)
+{
+    rawEvent = event_input;
+    hitAll = event_input->getAllHits();
+}
+
+int KalmanFastTracking::setRawEvent(SRawEvent* event_input)
+{
+    stats.clear();
+
+    rawEvent = event_input;
+    startStage(kStageAcceptEvent);
+    bool accepted = acceptEvent(rawEvent);
+    endStage(rawEvent->getNHitsAll());
+    if(!accepted) return TFEXIT_FAIL_MULTIPLICITY;
+    hitAll = event_input->getAllHits();
+#ifdef _DEBUG_ON
+    for(std::vector<Hit>::iterator iter = hitAll.begin(); iter != hitAll.end(); ++iter) iter->print();
+#endif
+
+    startStage(kStagePropSegments);
     buildPropSegments();
+    endStage(propSegs[0].size() + propSegs[1].size());
     if(propSegs[0].empty() || propSegs[1].empty())
     {
 #ifdef _DEBUG_ON
@@ -330,7 +487,9 @@ int KalmanFastTracking::setRawEvent(SRawEvent* event_input)
 
     //Build tracklets in station 2, 3+, 3-
     //When i = 3, works for st3+, for i = 4, works for st3-
+    startStage(kStageStation2);
     buildTrackletsInStation(2);
+    endStage(trackletsInSt[1].size());
     if(trackletsInSt[1].empty())
     {
 #ifdef _DEBUG_ON
@@ -339,8 +498,10 @@ int KalmanFastTracking::setRawEvent(SRawEvent* event_input)
         return TFEXIT_FAIL_ST2_TRACKLET;
     }
 
+    startStage(kStageStation3);
     buildTrackletsInStation(3);
     buildTrackletsInStation(4);
+    endStage(trackletsInSt[2].size());
     if(trackletsInSt[2].empty())
     {
 #ifdef _DEBUG_ON
@@ -350,10 +511,14 @@ int KalmanFastTracking::setRawEvent(SRawEvent* event_input)
     }
 
     //Build back partial tracks in station 2, 3+ and 3-
+    startStage(kStageBackPartial);
     buildBackPartialTracks();
+    endStage(trackletsInSt[3].size());
 
     //Connect tracklets in station 2/3 and station 1 to form global tracks
+    startStage(kStageGlobal);
     buildGlobalTracks();
+    endStage(trackletsInSt[4].size());
 
 #ifdef _DEBUG_ON
     for(int i = 0; i < 2; ++i)
@@ -379,6 +544,12 @@ int KalmanFastTracking::setRawEvent(SRawEvent* event_input)
     }
 #endif
 
+    //Only the final tracklets leave the tracker, fill their persistent hit list for the output
+    for(std::list<Tracklet>::iterator tracklet = trackletsInSt[4].begin(); tracklet != trackletsInSt[4].end(); ++tracklet)
+    {
+        tracklet->packHits();
+    }
+
     if(trackletsInSt[4].empty()) return TFEXIT_FAIL_NO_TRACKS;
     if(!enable_KF) return TFEXIT_SUCCESS;
 
@@ -403,10 +574,14 @@ int KalmanFastTracking::setRawEvent(SRawEvent* event_input)
     }
 
     //Build kalman tracks
+    startStage(kStageKalmanFit);
     for(std::list<Tracklet>::iterator tracklet = trackletsInSt[4].begin(); tracklet != trackletsInSt[4].end(); ++tracklet)
     {
         processOneTracklet(*tracklet);
+        ++stats.nFits[kStageKalmanFit];
+        stats.nEvals[kStageKalmanFit] += kmfitter->getNPropagations();
     }
+    endStage(stracks.size());
 
 #ifdef _DEBUG_ON
     LogInfo(stracks.size() << " final tracks:");
@@ -451,214 +626,247 @@ bool KalmanFastTracking::acceptEvent(SRawEvent* rawEvent)
 }
 
 void KalmanFastTracking::buildBackPartialTracks()
+{
+    if(useParallel(trackletsInSt[2].size()))
+    {
+        runParallel(kBackPartialTask, trackletsInSt[2]);
+        for(std::vector<Tracklet>::iterator iter = taskResults.begin(); iter != taskResults.end(); ++iter)
+        {
+            if(iter->isValid()) trackletsInSt[3].push_back(*iter);
+        }
+    }
+    else
+    {
+        for(std::list<Tracklet>::iterator tracklet3 = trackletsInSt[2].begin(); tracklet3 != trackletsInSt[2].end(); ++tracklet3)
+        {
+            Tracklet tracklet_best;
+            buildBackPartialTrack(*tracklet3, tracklet_best);
+            if(tracklet_best.isValid()) trackletsInSt[3].push_back(tracklet_best);
+        }
+    }
+
+    reduceTrackletList(trackletsInSt[3]);
+    trackletsInSt[3].sort();
+}
+
+void KalmanFastTracking::buildBackPartialTrack(Tracklet& tracklet3, Tracklet& tracklet_best)
 {
 #ifndef ALIGNMENT_MODE
     //Temporary container for a simple chisq fit
     int nHitsX2, nHitsX3;
     double z_fit[4], x_fit[4];
     double a, b;
-#endif
 
-    for(std::list<Tracklet>::iterator tracklet3 = trackletsInSt[2].begin(); tracklet3 != trackletsInSt[2].end(); ++tracklet3)
+    //Extract the X hits only from station-3 tracks
+    nHitsX3 = 0;
+    for(TrackletHitArray::iterator ptr_hit = tracklet3.hitArray.begin(); ptr_hit != tracklet3.hitArray.end(); ++ptr_hit)
     {
-#ifndef ALIGNMENT_MODE
-        //Extract the X hits only from station-3 tracks
-        nHitsX3 = 0;
-        for(std::list<SignedHit>::iterator ptr_hit = tracklet3->hits.begin(); ptr_hit != tracklet3->hits.end(); ++ptr_hit)
+        if(ptr_hit->hit.index < 0) continue;
+        if(p_geomSvc->getPlaneType(ptr_hit->hit.detectorID) == 1)
         {
-            if(ptr_hit->hit.index < 0) continue;
-            if(p_geomSvc->getPlaneType(ptr_hit->hit.detectorID) == 1)
-            {
-                z_fit[nHitsX3] = z_plane[ptr_hit->hit.detectorID];
-                x_fit[nHitsX3] = ptr_hit->hit.pos;
-                ++nHitsX3;
-            }
+            z_fit[nHitsX3] = z_plane[ptr_hit->hit.detectorID];
+            x_fit[nHitsX3] = ptr_hit->hit.pos;
+            ++nHitsX3;
         }
+    }
 #endif
-        Tracklet tracklet_best;
-        for(std::list<Tracklet>::iterator tracklet2 = trackletsInSt[1].begin(); tracklet2 != trackletsInSt[1].end(); ++tracklet2)
-        {
+
+    for(std::list<Tracklet>::iterator tracklet2 = trackletsInSt[1].begin(); tracklet2 != trackletsInSt[1].end(); ++tracklet2)
+    {
 #ifdef EVAL_MODE
-            std::cout << "Build_Back_Partial: " << tracklet2->tx << "  " << tracklet3->tx << "  " << tracklet2->x0 << "  " << tracklet3->x0 << "  " << tracklet2->ty << "  " << tracklet3->ty << "  " << tracklet2->y0 << "  " << tracklet3->y0 << std::endl;
+        std::cout << "Build_Back_Partial: " << tracklet2->tx << "  " << tracklet3.tx << "  " << tracklet2->x0 << "  " << tracklet3.x0 << "  " << tracklet2->ty << "  " << tracklet3.ty << "  " << tracklet2->y0 << "  " << tracklet3.y0 << std::endl;
 #endif
-            //a very rough cut
-            if(fabs(tracklet2->tx - tracklet3->tx) > 0.15 || fabs(tracklet2->ty - tracklet3->ty) > 0.1) continue;
+        //a very rough cut
+        if(fabs(tracklet2->tx - tracklet3.tx) > 0.15 || fabs(tracklet2->ty - tracklet3.ty) > 0.1) continue;
 
 #ifndef ALIGNMENT_MODE
-            //Extract the X hits from station-2 track
-            nHitsX2 = nHitsX3;
-            for(std::list<SignedHit>::iterator ptr_hit = tracklet2->hits.begin(); ptr_hit != tracklet2->hits.end(); ++ptr_hit)
+        //Extract the X hits from station-2 track
+        nHitsX2 = nHitsX3;
+        for(TrackletHitArray::iterator ptr_hit = tracklet2->hitArray.begin(); ptr_hit != tracklet2->hitArray.end(); ++ptr_hit)
+        {
+            if(ptr_hit->hit.index < 0) continue;
+            if(p_geomSvc->getPlaneType(ptr_hit->hit.detectorID) == 1)
             {
-                if(ptr_hit->hit.index < 0) continue;
-                if(p_geomSvc->getPlaneType(ptr_hit->hit.detectorID) == 1)
-                {
-                    z_fit[nHitsX2] = z_plane[ptr_hit->hit.detectorID];
-                    x_fit[nHitsX2] = ptr_hit->hit.pos;
-                    ++nHitsX2;
-                }
+                z_fit[nHitsX2] = z_plane[ptr_hit->hit.detectorID];
+                x_fit[nHitsX2] = ptr_hit->hit.pos;
+                ++nHitsX2;
             }
+        }
 
-            //Apply a simple linear fit to get rough estimation of X-Z slope and intersection
-            chi2fit(nHitsX2, z_fit, x_fit, a, b);
-            if(fabs(a) > 2.*TX_MAX || fabs(b) > 2.*X0_MAX) continue;
+        //Apply a simple linear fit to get rough estimation of X-Z slope and intersection
+        chi2fit(nHitsX2, z_fit, x_fit, a, b);
+        if(fabs(a) > 2.*TX_MAX || fabs(b) > 2.*X0_MAX) continue;
 
-            //Project to proportional tubes to see if there is enough
-            int nPropHits = 0;
-            for(int i = 0; i < 4; ++i)
+        //Project to proportional tubes to see if there is enough
+        int nPropHits = 0;
+        for(int i = 0; i < 4; ++i)
+        {
+            double x_exp = a*z_mask[detectorIDs_muid[0][i] - 25] + b;
+            SRawEvent::hit_range hits = rawEvent->getHitsIndexRange(detectorIDs_muid[0][i], x_exp, 5.08);
+            for(SRawEvent::hit_iterator iter = hits.first; iter != hits.second; ++iter)
             {
-                double x_exp = a*z_mask[detectorIDs_muid[0][i] - 25] + b;
-                for(std::list<int>::iterator iter = hitIDs_muid[0][i].begin(); iter != hitIDs_muid[0][i].end(); ++iter)
+                if(fabs(hitAll[*iter].pos - x_exp) < 5.08)
                 {
-                    if(fabs(hitAll[*iter].pos - x_exp) < 5.08)
-                    {
-                        ++nPropHits;
-                        break;
-                    }
+                    ++nPropHits;
+                    break;
                 }
-                if(nPropHits > 0) break;
             }
-            if(nPropHits == 0) continue;
+            if(nPropHits > 0) break;
+        }
+        if(nPropHits == 0) continue;
 #endif
 
-            Tracklet tracklet_23 = (*tracklet2) + (*tracklet3);
+        Tracklet tracklet_23 = (*tracklet2) + tracklet3;
 #ifdef _DEBUG_ON
-            LogInfo("Using following two tracklets:");
-            tracklet2->print();
-            tracklet3->print();
-            LogInfo("Yield this combination:");
-            tracklet_23.print();
-#endif
-            fitTracklet(tracklet_23);
-            if(tracklet_23.chisq > 3000.)
-            {
+        LogInfo("Using following two tracklets:");
+        tracklet2->print();
+        tracklet3.print();
+        LogInfo("Yield this combination:");
+        tracklet_23.print();
+#endif
+        fitTracklet(tracklet_23);
+        if(tracklet_23.chisq > 3000.)
+        {
 #ifdef _DEBUG_ON
-                tracklet_23.print();
-                LogInfo("Impossible combination!");
+            tracklet_23.print();
+            LogInfo("Impossible combination!");
 #endif
-                continue;
-            }
+            continue;
+        }
 
-            if(!hodoMask(tracklet_23))
-            {
+        if(!hodoMask(tracklet_23))
+        {
 #ifdef _DEBUG_ON
-                LogInfo("Hodomasking failed!");
+            LogInfo("Hodomasking failed!");
 #endif
-                continue;
-            }
+            continue;
+        }
 
 #ifndef COARSE_MODE
-            resolveLeftRight(tracklet_23, 25.);
-            resolveLeftRight(tracklet_23, 100.);
+        resolveLeftRight(tracklet_23, 25.);
+        resolveLeftRight(tracklet_23, 100.);
 #endif
-            ///Remove bad hits if needed
-            removeBadHits(tracklet_23);
+        ///Remove bad hits if needed
+        removeBadHits(tracklet_23);
 
 
 #ifdef _DEBUG_ON
-            LogInfo("New tracklet: ");
-            tracklet_23.print();
+        LogInfo("New tracklet: ");
+        tracklet_23.print();
 
-            LogInfo("Current best:");
-            tracklet_best.print();
+        LogInfo("Current best:");
+        tracklet_best.print();
 
-            LogInfo("Comparison: " << (tracklet_23 < tracklet_best));
-            LogInfo("Quality: " << acceptTracklet(tracklet_23));
+        LogInfo("Comparison: " << (tracklet_23 < tracklet_best));
+        LogInfo("Quality: " << acceptTracklet(tracklet_23));
 #endif
 
-            //If current tracklet is better than the best tracklet up-to-now
-            if(acceptTracklet(tracklet_23) && tracklet_23 < tracklet_best)
-            {
-                tracklet_best = tracklet_23;
-            }
+        //If current tracklet is better than the best tracklet up-to-now
+        if(acceptTracklet(tracklet_23) && tracklet_23 < tracklet_best)
+        {
+            tracklet_best = tracklet_23;
+        }
 #ifdef _DEBUG_ON
-            else
-            {
-                LogInfo("Rejected!!");
-            }
-#endif
+        else
+        {
+            LogInfo("Rejected!!");
         }
-
-        if(tracklet_best.isValid()) trackletsInSt[3].push_back(tracklet_best);
+#endif
     }
-
-    reduceTrackletList(trackletsInSt[3]);
-    trackletsInSt[3].sort();
 }
 
 void KalmanFastTracking::buildGlobalTracks()
 {
-    double pos_exp[3], window[3];
-    for(std::list<Tracklet>::iterator tracklet23 = trackletsInSt[3].begin(); tracklet23 != trackletsInSt[3].end(); ++tracklet23)
+    prepareStation1();
+
+    if(useParallel(trackletsInSt[3].size()))
     {
-        //Calculate the window in station 1
-        if(KMAG_ON)
+        runParallel(kGlobalTask, trackletsInSt[3]);
+        for(std::vector<Tracklet>::iterator iter = taskResults.begin(); iter != taskResults.end(); ++iter)
         {
-            getSagittaWindowsInSt1(*tracklet23, pos_exp, window);
+            if(iter->isValid()) trackletsInSt[4].push_back(*iter);
         }
-        else
+    }
+    else
+    {
+        for(std::list<Tracklet>::iterator tracklet23 = trackletsInSt[3].begin(); tracklet23 != trackletsInSt[3].end(); ++tracklet23)
         {
-            getExtrapoWindowsInSt1(*tracklet23, pos_exp, window);
+            Tracklet tracklet_best;
+            buildGlobalTrack(*tracklet23, tracklet_best);
+            if(tracklet_best.isValid()) trackletsInSt[4].push_back(tracklet_best);
         }
+    }
+
+    trackletsInSt[4].sort();
+}
+
+void KalmanFastTracking::buildGlobalTrack(Tracklet& tracklet23, Tracklet& tracklet_best)
+{
+    double pos_exp[3], window[3];
+
+    //Calculate the window in station 1
+    if(KMAG_ON)
+    {
+        getSagittaWindowsInSt1(tracklet23, pos_exp, window);
+    }
+    else
+    {
+        getExtrapoWindowsInSt1(tracklet23, pos_exp, window);
+    }
 
 #ifdef _DEBUG_ON
-        LogInfo("Using this back partial: ");
-        tracklet23->print();
-        for(int i = 0; i < 3; i++) LogInfo("Extrapo: " << pos_exp[i] << "  " << window[i]);
+    LogInfo("Using this back partial: ");
+    tracklet23.print();
+    for(int i = 0; i < 3; i++) LogInfo("Extrapo: " << pos_exp[i] << "  " << window[i]);
 #endif
 
-        trackletsInSt[0].clear();
-        buildTrackletsInStation(1, pos_exp, window);
+    trackletsInSt[0].clear();
+    buildTrackletsInStation(1, pos_exp, window);
 
-        Tracklet tracklet_best;
-        for(std::list<Tracklet>::iterator tracklet1 = trackletsInSt[0].begin(); tracklet1 != trackletsInSt[0].end(); ++tracklet1)
-        {
+    for(std::list<Tracklet>::iterator tracklet1 = trackletsInSt[0].begin(); tracklet1 != trackletsInSt[0].end(); ++tracklet1)
+    {
 #ifdef _DEBUG_ON
-            LogInfo("With this station 1 track:");
-            tracklet1->print();
+        LogInfo("With this station 1 track:");
+        tracklet1->print();
 #endif
 
-            Tracklet tracklet_global = (*tracklet23) * (*tracklet1);
-            fitTracklet(tracklet_global);
-            if(!hodoMask(tracklet_global)) continue;
+        Tracklet tracklet_global = tracklet23 * (*tracklet1);
+        fitTracklet(tracklet_global);
+        if(!hodoMask(tracklet_global)) continue;
 
 #ifndef COARSE_MODE
-            ///Resolve the left-right with a tight pull cut, then a loose one, then resolve by single projections
-            resolveLeftRight(tracklet_global, 50.);
-            resolveLeftRight(tracklet_global, 100.);
-            resolveSingleLeftRight(tracklet_global);
+        ///Resolve the left-right with a tight pull cut, then a loose one, then resolve by single projections
+        resolveLeftRight(tracklet_global, 50.);
+        resolveLeftRight(tracklet_global, 100.);
+        resolveSingleLeftRight(tracklet_global);
 #endif
-            ///Remove bad hits if needed
-            removeBadHits(tracklet_global);
+        ///Remove bad hits if needed
+        removeBadHits(tracklet_global);
 
 #ifdef _DEBUG_ON
-            LogInfo("New tracklet: ");
-            tracklet_global.print();
+        LogInfo("New tracklet: ");
+        tracklet_global.print();
 
-            LogInfo("Current best:");
-            tracklet_best.print();
+        LogInfo("Current best:");
+        tracklet_best.print();
 
-            LogInfo("Comparison: " << (tracklet_global < tracklet_best));
-            LogInfo("Quality   : " << acceptTracklet(tracklet_global));
+        LogInfo("Comparison: " << (tracklet_global < tracklet_best));
+        LogInfo("Quality   : " << acceptTracklet(tracklet_global));
 #endif
-            if(acceptTracklet(tracklet_global) && tracklet_global < tracklet_best)
-            {
+        if(acceptTracklet(tracklet_global) && tracklet_global < tracklet_best)
+        {
 #ifdef _DEBUG_ON
-                LogInfo("Accepted!!!");
+            LogInfo("Accepted!!!");
 #endif
-                tracklet_best = tracklet_global;
-            }
+            tracklet_best = tracklet_global;
+        }
 #ifdef _DEBUG_ON
-            else
-            {
-                LogInfo("Rejected!!!");
-            }
-#endif
+        else
+        {
+            LogInfo("Rejected!!!");
         }
-
-        if(tracklet_best.isValid()) trackletsInSt[4].push_back(tracklet_best);
+#endif
     }
-
-    trackletsInSt[4].sort();
 }
 
 void KalmanFastTracking::resolveLeftRight(Tracklet& tracklet, double threshold)
@@ -675,11 +883,11 @@ void KalmanFastTracking::resolveLeftRight(Tracklet& tracklet, double threshold)
     int possibility[4][2] = {{1, 1}, {1, -1}, {-1, 1}, {-1, -1}};
 
     //Total number of hit pairs in this tracklet
-    int nPairs = tracklet.hits.size()/2;
+    int nPairs = tracklet.hitArray.size()/2;
 
     int nResolved = 0;
-    std::list<SignedHit>::iterator hit1 = tracklet.hits.begin();
-    std::list<SignedHit>::iterator hit2 = tracklet.hits.begin();
+    TrackletHitArray::iterator hit1 = tracklet.hitArray.begin();
+    TrackletHitArray::iterator hit2 = tracklet.hitArray.begin();
     ++hit2;
     while(true)
     {
@@ -774,7 +982,7 @@ void KalmanFastTracking::resolveSingleLeftRight(Tracklet& tracklet)
     //Check if the track has been updated
     bool isUpdated = false;
 
-    for(std::list<SignedHit>::iterator hit_sign = tracklet.hits.begin(); hit_sign != tracklet.hits.end(); ++hit_sign)
+    for(TrackletHitArray::iterator hit_sign = tracklet.hitArray.begin(); hit_sign != tracklet.hitArray.end(); ++hit_sign)
     {
         if(hit_sign->hit.index < 0 || hit_sign->sign != 0) continue;
 
@@ -803,10 +1011,10 @@ void KalmanFastTracking::removeBadHits(Tracklet& tracklet)
         isUpdated = false;
         tracklet.calcChisq();
 
-        SignedHit* hit_remove = NULL;
-        SignedHit* hit_neighbour = NULL;
+        TrackletHit* hit_remove = NULL;
+        TrackletHit* hit_neighbour = NULL;
         double res_remove = -1.;
-        for(std::list<SignedHit>::iterator hit_sign = tracklet.hits.begin(); hit_sign != tracklet.hits.end(); ++hit_sign)
+        for(TrackletHitArray::iterator hit_sign = tracklet.hitArray.begin(); hit_sign != tracklet.hitArray.end(); ++hit_sign)
         {
             if(hit_sign->hit.index < 0) continue;
 
@@ -817,7 +1025,7 @@ void KalmanFastTracking::removeBadHits(Tracklet& tracklet)
                 res_remove = res_curr;
                 hit_remove = &(*hit_sign);
 
-                std::list<SignedHit>::iterator iter = hit_sign;
+                TrackletHitArray::iterator iter = hit_sign;
                 hit_neighbour = detectorID % 2 == 0 ? &(*(--iter)) : &(*(++iter));
             }
         }
@@ -908,6 +1116,82 @@ void KalmanFastTracking::resolveLeftRight(SRawEvent::hit_pair hpair, int& LR1, i
     //LogInfo("Final: " << LR1 << "  " << LR2);
 }
 
+double KalmanFastTracking::getHitPairPos(const SRawEvent::hit_pair& hpair)
+{
+    return hpair.second >= 0 ? 0.5*(hitAll[hpair.first].pos + hitAll[hpair.second].pos) : hitAll[hpair.first].pos;
+}
+
+void KalmanFastTracking::sortHitPairs(const std::list<SRawEvent::hit_pair>& pairs, std::vector<HitPairPos>& sorted)
+{
+    sorted.clear();
+    sorted.reserve(pairs.size());
+    for(std::list<SRawEvent::hit_pair>::const_iterator iter = pairs.begin(); iter != pairs.end(); ++iter)
+    {
+        sorted.push_back(HitPairPos(getHitPairPos(*iter), *iter));
+    }
+    std::stable_sort(sorted.begin(), sorted.end());
+}
+
+void KalmanFastTracking::prepareStation1()
+{
+    for(int i = 0; i < 3; ++i)
+    {
+        sortHitPairs(rawEvent->getPartialHitPairsInSuperDetector(superIDs[0][i]), pairsInSt1[i]);
+    }
+
+    st1Memo.clear();
+    st1Tracklets.clear();
+}
+
+void KalmanFastTracking::selectPairsInSt1(int viewID, double x_exp, double win, std::vector<HitPairPos>& pairs)
+{
+    //Same selection as getPartialHitPairsInSuperDetector(superID, x_exp, win): the hits in the first plane
+    //are within win, the hits in the partner plane within win + 3 cm
+    int detectorID = 2*superIDs[0][viewID];
+    double win2 = win + 3.;
+
+    //The mid-point of any pair with one hit in the windows is within this range
+    std::vector<HitPairPos>& pairs_all = pairsInSt1[viewID];
+    double margin = win2 + spacing_plane[detectorID];
+    std::vector<HitPairPos>::iterator first = std::lower_bound(pairs_all.begin(), pairs_all.end(), HitPairPos(x_exp - margin));
+    std::vector<HitPairPos>::iterator last = std::upper_bound(first, pairs_all.end(), HitPairPos(x_exp + margin));
+
+    pairs.clear();
+    std::vector<int> partners, orphans;
+    for(std::vector<HitPairPos>::iterator iter = first; iter != last; ++iter)
+    {
+        const Hit& hit = hitAll[iter->hpair.first];
+        if(hit.detectorID != detectorID)
+        {
+            //Unpaired hit in the partner plane
+            if(hit.pos >= x_exp - win2 && hit.pos <= x_exp + win2) pairs.push_back(*iter);
+        }
+        else if(hit.pos >= x_exp - win && hit.pos <= x_exp + win)
+        {
+            pairs.push_back(*iter);
+            if(iter->hpair.second >= 0) partners.push_back(iter->hpair.second);
+        }
+        else if(iter->hpair.second >= 0)
+        {
+            //Partner hit in the window whose first plane hit is outside, it's unpaired in the windowed search
+            double pos = hitAll[iter->hpair.second].pos;
+            if(pos >= x_exp - win2 && pos <= x_exp + win2) orphans.push_back(iter->hpair.second);
+        }
+    }
+
+    if(orphans.empty()) return;
+
+    std::sort(partners.begin(), partners.end());
+    std::sort(orphans.begin(), orphans.end());
+    orphans.erase(std::unique(orphans.begin(), orphans.end()), orphans.end());
+    for(std::vector<int>::iterator iter = orphans.begin(); iter != orphans.end(); ++iter)
+    {
+        if(std::binary_search(partners.begin(), partners.end(), *iter)) continue;
+        pairs.push_back(HitPairPos(hitAll[*iter].pos, SRawEvent::hit_pair(*iter, -1)));
+    }
+    std::stable_sort(pairs.begin(), pairs.end());
+}
+
 void KalmanFastTracking::buildTrackletsInStation(int stationID, double* pos_exp, double* window)
 {
 #ifdef _DEBUG_ON
@@ -919,27 +1203,35 @@ void KalmanFastTracking::buildTrackletsInStation(int stationID, double* pos_exp,
     int listID = sID;
     if(listID == 3) listID = 2;
 
-    //Extract the X, U, V hit pairs
-    std::list<SRawEvent::hit_pair> pairs_X, pairs_U, pairs_V;
-    if(pos_exp == NULL)
+    //Extract the X, U, V hit pairs, sorted by their mid-point so only the pairs inside the U/V windows are visited
+    std::vector<HitPairPos> pairs_X, pairs_U, pairs_V;
+    bool useSt1Memo = stationID == 1 && pos_exp != NULL;
+    if(useSt1Memo)
     {
-        pairs_X = rawEvent->getPartialHitPairsInSuperDetector(superIDs[sID][0]);
-        pairs_U = rawEvent->getPartialHitPairsInSuperDetector(superIDs[sID][1]);
-        pairs_V = rawEvent->getPartialHitPairsInSuperDetector(superIDs[sID][2]);
+        //Station-1 pairs are extracted once per event by prepareStation1, only the ones in the windows are taken
+        //Note that in pos_exp[], index 0 stands for U, index 1 stands for X, index 2 stands for V
+        selectPairsInSt1(0, pos_exp[1], window[1], pairs_X);
+        selectPairsInSt1(1, pos_exp[0], window[0], pairs_U);
+        selectPairsInSt1(2, pos_exp[2], window[2], pairs_V);
+    }
+    else if(pos_exp == NULL)
+    {
+        sortHitPairs(rawEvent->getPartialHitPairsInSuperDetector(superIDs[sID][0]), pairs_X);
+        sortHitPairs(rawEvent->getPartialHitPairsInSuperDetector(superIDs[sID][1]), pairs_U);
+        sortHitPairs(rawEvent->getPartialHitPairsInSuperDetector(superIDs[sID][2]), pairs_V);
     }
     else
     {
-        //Note that in pos_exp[], index 0 stands for U, index 1 stands for X, index 2 stands for V
-        pairs_X = rawEvent->getPartialHitPairsInSuperDetector(superIDs[sID][0], pos_exp[1], window[1]);
-        pairs_U = rawEvent->getPartialHitPairsInSuperDetector(superIDs[sID][1], pos_exp[0], window[0]);
-        pairs_V = rawEvent->getPartialHitPairsInSuperDetector(superIDs[sID][2], pos_exp[2], window[2]);
+        sortHitPairs(rawEvent->getPartialHitPairsInSuperDetector(superIDs[sID][0], pos_exp[1], window[1]), pairs_X);
+        sortHitPairs(rawEvent->getPartialHitPairsInSuperDetector(superIDs[sID][1], pos_exp[0], window[0]), pairs_U);
+        sortHitPairs(rawEvent->getPartialHitPairsInSuperDetector(superIDs[sID][2], pos_exp[2], window[2]), pairs_V);
     }
 
 #ifdef _DEBUG_ON
     LogInfo("Hit pairs in this event: ");
-    for(std::list<SRawEvent::hit_pair>::iterator iter = pairs_X.begin(); iter != pairs_X.end(); ++iter) LogInfo("X :" << iter->first << "  " << iter->second << "  " << hitAll[iter->first].index << " " << (iter->second < 0 ? -1 : hitAll[iter->second].index));
-    for(std::list<SRawEvent::hit_pair>::iterator iter = pairs_U.begin(); iter != pairs_U.end(); ++iter) LogInfo("U :" << iter->first << "  " << iter->second << "  " << hitAll[iter->first].index << " " << (iter->second < 0 ? -1 : hitAll[iter->second].index));
-    for(std::list<SRawEvent::hit_pair>::iterator iter = pairs_V.begin(); iter != pairs_V.end(); ++iter) LogInfo("V :" << iter->first << "  " << iter->second << "  " << hitAll[iter->first].index << " " << (iter->second < 0 ? -1 : hitAll[iter->second].index));
+    for(std::vector<HitPairPos>::iterator iter = pairs_X.begin(); iter != pairs_X.end(); ++iter) LogInfo("X :" << iter->hpair.first << "  " << iter->hpair.second << "  " << hitAll[iter->hpair.first].index << " " << (iter->hpair.second < 0 ? -1 : hitAll[iter->hpair.second].index));
+    for(std::vector<HitPairPos>::iterator iter = pairs_U.begin(); iter != pairs_U.end(); ++iter) LogInfo("U :" << iter->hpair.first << "  " << iter->hpair.second << "  " << hitAll[iter->hpair.first].index << " " << (iter->hpair.second < 0 ? -1 : hitAll[iter->hpair.second].index));
+    for(std::vector<HitPairPos>::iterator iter = pairs_V.begin(); iter != pairs_V.end(); ++iter) LogInfo("V :" << iter->hpair.first << "  " << iter->hpair.second << "  " << hitAll[iter->hpair.first].index << " " << (iter->hpair.second < 0 ? -1 : hitAll[iter->hpair.second].index));
 #endif
 
     if(pairs_X.empty() || pairs_U.empty() || pairs_V.empty())
@@ -951,46 +1243,56 @@ void KalmanFastTracking::buildTrackletsInStation(int stationID, double* pos_exp,
     }
 
     //X-U combination first, then add V pairs
-    for(std::list<SRawEvent::hit_pair>::iterator xiter = pairs_X.begin(); xiter != pairs_X.end(); ++xiter)
+    for(std::vector<HitPairPos>::iterator xiter = pairs_X.begin(); xiter != pairs_X.end(); ++xiter)
     {
         //U projections from X plane
-        double x_pos = xiter->second >= 0 ? 0.5*(hitAll[xiter->first].pos + hitAll[xiter->second].pos) : hitAll[xiter->first].pos;
+        double x_pos = xiter->pos;
         double u_min = x_pos*u_costheta[sID] - u_win[sID];
         double u_max = u_min + 2.*u_win[sID];
 
 #ifdef _DEBUG_ON
-        LogInfo("Trying X hits " << xiter->first << "  " << xiter->second << "  " << hitAll[xiter->first].elementID << " at " << x_pos);
+        LogInfo("Trying X hits " << xiter->hpair.first << "  " << xiter->hpair.second << "  " << hitAll[xiter->hpair.first].elementID << " at " << x_pos);
         LogInfo("U plane window:" << u_min << "  " << u_max);
 #endif
-        for(std::list<SRawEvent::hit_pair>::iterator uiter = pairs_U.begin(); uiter != pairs_U.end(); ++uiter)
+        std::vector<HitPairPos>::iterator uend = std::upper_bound(pairs_U.begin(), pairs_U.end(), HitPairPos(u_max));
+        for(std::vector<HitPairPos>::iterator uiter = std::lower_bound(pairs_U.begin(), uend, HitPairPos(u_min)); uiter != uend; ++uiter)
         {
-            double u_pos = uiter->second >= 0 ? 0.5*(hitAll[uiter->first].pos + hitAll[uiter->second].pos) : hitAll[uiter->first].pos;
+            double u_pos = uiter->pos;
 #ifdef _DEBUG_ON
-            LogInfo("Trying U hits " << uiter->first << "  " << uiter->second << "  " << hitAll[uiter->first].elementID << " at " << u_pos);
+            LogInfo("Trying U hits " << uiter->hpair.first << "  " << uiter->hpair.second << "  " << hitAll[uiter->hpair.first].elementID << " at " << u_pos);
 #endif
-            if(u_pos < u_min || u_pos > u_max) continue;
 
             //V projections from X and U plane
-            double z_x = xiter->second >= 0 ? z_plane_x[sID] : z_plane[hitAll[xiter->first].detectorID];
-            double z_u = uiter->second >= 0 ? z_plane_u[sID] : z_plane[hitAll[uiter->first].detectorID];
+            double z_x = xiter->hpair.second >= 0 ? z_plane_x[sID] : z_plane[hitAll[xiter->hpair.first].detectorID];
+            double z_u = uiter->hpair.second >= 0 ? z_plane_u[sID] : z_plane[hitAll[uiter->hpair.first].detectorID];
             double z_v = z_plane_v[sID];
-            double v_win1 = spacing_plane[hitAll[uiter->first].detectorID]*2.*u_costheta[sID];
+            double v_win1 = spacing_plane[hitAll[uiter->hpair.first].detectorID]*2.*u_costheta[sID];
             double v_win2 = fabs((z_u + z_v - 2.*z_x)*u_costheta[sID]*TX_MAX);
             double v_win3 = fabs((z_v - z_u)*u_sintheta[sID]*TY_MAX);
-            double v_win = v_win1 + v_win2 + v_win3 + 2.*spacing_plane[hitAll[uiter->first].detectorID];
+            double v_win = v_win1 + v_win2 + v_win3 + 2.*spacing_plane[hitAll[uiter->hpair.first].detectorID];
             double v_min = 2*x_pos*u_costheta[sID] - u_pos - v_win;
             double v_max = v_min + 2.*v_win;
 
 #ifdef _DEBUG_ON
             LogInfo("V plane window:" << v_min << "  " << v_max);
 #endif
-            for(std::list<SRawEvent::hit_pair>::iterator viter = pairs_V.begin(); viter != pairs_V.end(); ++viter)
+            std::vector<HitPairPos>::iterator vend = std::upper_bound(pairs_V.begin(), pairs_V.end(), HitPairPos(v_max));
+            for(std::vector<HitPairPos>::iterator viter = std::lower_bound(pairs_V.begin(), vend, HitPairPos(v_min)); viter != vend; ++viter)
             {
-                double v_pos = viter->second >= 0 ? 0.5*(hitAll[viter->first].pos + hitAll[viter->second].pos) : hitAll[viter->first].pos;
 #ifdef _DEBUG_ON
-                LogInfo("Trying V hits " << viter->first << "  " << viter->second << "  " << hitAll[viter->first].elementID << " at " << v_pos);
+                LogInfo("Trying V hits " << viter->hpair.first << "  " << viter->hpair.second << "  " << hitAll[viter->hpair.first].elementID << " at " << viter->pos);
 #endif
-                if(v_pos < v_min || v_pos > v_max) continue;
+                //Station-1 combinations are shared by many back partials, each one is only fitted once per event
+                HitCombination combination(xiter->hpair, uiter->hpair, viter->hpair);
+                if(useSt1Memo)
+                {
+                    std::map<HitCombination, int>::iterator memo = st1Memo.find(combination);
+                    if(memo != st1Memo.end())
+                    {
+                        if(memo->second >= 0) trackletsInSt[listID].push_back(st1Tracklets[memo->second]);
+                        continue;
+                    }
+                }
 
                 //Now add the tracklet
                 int LR1 = 0;
@@ -999,38 +1301,38 @@ void KalmanFastTracking::buildTrackletsInStation(int stationID, double* pos_exp,
                 tracklet_new.stationID = stationID;
 
                 //resolveLeftRight(*xiter, LR1, LR2);
-                if(xiter->first >= 0)
+                if(xiter->hpair.first >= 0)
                 {
-                    tracklet_new.hits.push_back(SignedHit(hitAll[xiter->first], LR1));
+                    tracklet_new.hitArray.push_back(TrackletHit(hitAll[xiter->hpair.first], LR1));
                     tracklet_new.nXHits++;
                 }
-                if(xiter->second >= 0)
+                if(xiter->hpair.second >= 0)
                 {
-                    tracklet_new.hits.push_back(SignedHit(hitAll[xiter->second], LR2));
+                    tracklet_new.hitArray.push_back(TrackletHit(hitAll[xiter->hpair.second], LR2));
                     tracklet_new.nXHits++;
                 }
 
                 //resolveLeftRight(*uiter, LR1, LR2);
-                if(uiter->first >= 0)
+                if(uiter->hpair.first >= 0)
                 {
-                    tracklet_new.hits.push_back(SignedHit(hitAll[uiter->first], LR1));
+                    tracklet_new.hitArray.push_back(TrackletHit(hitAll[uiter->hpair.first], LR1));
                     tracklet_new.nUHits++;
                 }
-                if(uiter->second >= 0)
+                if(uiter->hpair.second >= 0)
                 {
-                    tracklet_new.hits.push_back(SignedHit(hitAll[uiter->second], LR2));
+                    tracklet_new.hitArray.push_back(TrackletHit(hitAll[uiter->hpair.second], LR2));
                     tracklet_new.nUHits++;
                 }
 
                 //resolveLeftRight(*viter, LR1, LR2);
-                if(viter->first >= 0)
+                if(viter->hpair.first >= 0)
                 {
-                    tracklet_new.hits.push_back(SignedHit(hitAll[viter->first], LR1));
+                    tracklet_new.hitArray.push_back(TrackletHit(hitAll[viter->hpair.first], LR1));
                     tracklet_new.nVHits++;
                 }
-                if(viter->second >= 0)
+                if(viter->hpair.second >= 0)
                 {
-                    tracklet_new.hits.push_back(SignedHit(hitAll[viter->second], LR2));
+                    tracklet_new.hitArray.push_back(TrackletHit(hitAll[viter->hpair.second], LR2));
                     tracklet_new.nVHits++;
                 }
 
@@ -1048,7 +1350,14 @@ void KalmanFastTracking::buildTrackletsInStation(int stationID, double* pos_exp,
                 tracklet_new.print();
 #endif
 
-                if(acceptTracklet(tracklet_new))
+                bool accepted = acceptTracklet(tracklet_new);
+                if(useSt1Memo)
+                {
+                    st1Memo[combination] = accepted ? int(st1Tracklets.size()) : -1;
+                    if(accepted) st1Tracklets.push_back(tracklet_new);
+                }
+
+                if(accepted)
                 {
                     trackletsInSt[listID].push_back(tracklet_new);
                 }
@@ -1107,38 +1416,42 @@ bool KalmanFastTracking::hodoMask(Tracklet& tracklet)
     for(std::vector<int>::iterator stationID = stationIDs_mask[tracklet.stationID-1].begin(); stationID != stationIDs_mask[tracklet.stationID-1].end(); ++stationID)
     {
         bool masked = false;
-        for(std::list<int>::iterator iter = hitIDs_mask[*stationID-1].begin(); iter != hitIDs_mask[*stationID-1].end(); ++iter)
+        for(std::vector<int>::iterator hodoID = detectorIDs_maskX[*stationID-1].begin(); !masked && hodoID != detectorIDs_maskX[*stationID-1].end(); ++hodoID)
         {
-            int detectorID = hitAll[*iter].detectorID;
-            int elementID = hitAll[*iter].elementID;
+            SRawEvent::hit_range hits = rawEvent->getHitsIndexRange(*hodoID);
+            for(SRawEvent::hit_iterator iter = hits.first; iter != hits.second; ++iter)
+            {
+                int detectorID = hitAll[*iter].detectorID;
+                int elementID = hitAll[*iter].elementID;
 
-            int idx1 = detectorID - 25;
-            int idx2 = elementID - 1;
+                int idx1 = detectorID - 25;
+                int idx2 = elementID - 1;
 
-            double factor = tracklet.stationID == 2 ? 5. : 3.;
-            double xfudge = tracklet.stationID < 4 ? 0.5*(x_mask_max[idx1][idx2] - x_mask_min[idx1][idx2]) : 0.;
-            double z_hodo = z_mask[idx1];
-            double x_hodo = tracklet.getExpPositionX(z_hodo);
-            double y_hodo = tracklet.getExpPositionY(z_hodo);
-            double err_x = factor*tracklet.getExpPosErrorX(z_hodo) + xfudge;
-            double err_y = factor*tracklet.getExpPosErrorY(z_hodo);
+                double factor = tracklet.stationID == 2 ? 5. : 3.;
+                double xfudge = tracklet.stationID < 4 ? 0.5*(x_mask_max[idx1][idx2] - x_mask_min[idx1][idx2]) : 0.;
+                double z_hodo = z_mask[idx1];
+                double x_hodo = tracklet.getExpPositionX(z_hodo);
+                double y_hodo = tracklet.getExpPositionY(z_hodo);
+                double err_x = factor*tracklet.getExpPosErrorX(z_hodo) + xfudge;
+                double err_y = factor*tracklet.getExpPosErrorY(z_hodo);
 
-            double x_min = x_mask_min[idx1][idx2] - err_x;
-            double x_max = x_mask_max[idx1][idx2] + err_x;
-            double y_min = y_mask_min[idx1][idx2] - err_y;
-            double y_max = y_mask_max[idx1][idx2] + err_y;
+                double x_min = x_mask_min[idx1][idx2] - err_x;
+                double x_max = x_mask_max[idx1][idx2] + err_x;
+                double y_min = y_mask_min[idx1][idx2] - err_y;
+                double y_max = y_mask_max[idx1][idx2] + err_y;
 
 #ifdef _DEBUG_ON
-            LogInfo(*iter);
-            hitAll[*iter].print();
-            LogInfo(nHodoHits << "/" << stationIDs_mask[tracklet.stationID-1].size() << ":  " << z_hodo << "  " << x_hodo << " +/- " << err_x << "  " << y_hodo << " +/-" << err_y << " : " << x_min << "  " << x_max << "  " << y_min << "  " << y_max);
+                LogInfo(*iter);
+                hitAll[*iter].print();
+                LogInfo(nHodoHits << "/" << stationIDs_mask[tracklet.stationID-1].size() << ":  " << z_hodo << "  " << x_hodo << " +/- " << err_x << "  " << y_hodo << " +/-" << err_y << " : " << x_min << "  " << x_max << "  " << y_min << "  " << y_max);
 #endif
-            if(x_hodo > x_min && x_hodo < x_max && y_hodo > y_min && y_hodo < y_max)
-            {
-                nHodoHits++;
-                masked = true;
+                if(x_hodo > x_min && x_hodo < x_max && y_hodo > y_min && y_hodo < y_max)
+                {
+                    nHodoHits++;
+                    masked = true;
 
-                break;
+                    break;
+                }
             }
         }
 
@@ -1205,7 +1518,8 @@ bool KalmanFastTracking::muonID_search(Tracklet& tracklet)
             if(!p_geomSvc->isInPlane(detectorIDs_muid[i][j], tracklet.getExpPositionX(z_mask[index]), tracklet.getExpPositionY(z_mask[index]))) continue;
 
             double dist_min = 1E6;
-            for(std::list<int>::iterator iter = hitIDs_muid[i][j].begin(); iter != hitIDs_muid[i][j].end(); ++iter)
+            SRawEvent::hit_range hits = rawEvent->getHitsIndexRange(detectorIDs_muid[i][j], pos_exp, win_loose);
+            for(SRawEvent::hit_iterator iter = hits.first; iter != hits.second; ++iter)
             {
 #ifdef _DEBUG_ON
                 LogInfo(" ... trying this hit: ");
@@ -1213,14 +1527,9 @@ bool KalmanFastTracking::muonID_search(Tracklet& tracklet)
 #endif
 
                 double pos = hitAll[*iter].pos;
-                double dist = pos - pos_exp;
-
-                if(dist < -win_loose) continue;
-                if(dist > win_loose) break;
-
                 double dist_l = fabs(pos - hitAll[*iter].driftDistance - pos_exp);
                 double dist_r = fabs(pos + hitAll[*iter].driftDistance - pos_exp);
-                dist = dist_l < dist_r ? dist_l : dist_r;
+                double dist = dist_l < dist_r ? dist_l : dist_r;
 
                 if(dist < dist_min)
                 {
@@ -1365,7 +1674,12 @@ void KalmanFastTracking::buildPropSegments()
 
 int KalmanFastTracking::fitTracklet(Tracklet& tracklet)
 {
-    tracklet_curr = tracklet;
+    ++stats.nFits[currentStage];
+
+    //Fall back to Minuit when the analytic fit fails, i.e. fewer real hits than parameters or a singular normal matrix
+    if(analyticFit && fitTrackletAnalytic(tracklet) == 0) return 0;
+
+    chisqKernel.pack(tracklet);
 
     //idx = 0, using simplex; idx = 1 using migrad
     int idx = 1;
@@ -1382,6 +1696,7 @@ int KalmanFastTracking::fitTracklet(Tracklet& tracklet)
         minimizer[idx]->SetLimitedVariable(4, "invP", tracklet.invP, 0.001*tracklet.invP, INVP_MIN, INVP_MAX);
     }
     minimizer[idx]->Minimize();
+    stats.nEvals[currentStage] += minimizer[idx]->NCalls();
 
     tracklet.tx = minimizer[idx]->X()[0];
     tracklet.ty = minimizer[idx]->X()[1];
@@ -1405,41 +1720,240 @@ int KalmanFastTracking::fitTracklet(Tracklet& tracklet)
     return status;
 }
 
-int KalmanFastTracking::reduceTrackletList(std::list<Tracklet>& tracklets)
+//In-place Gauss-Jordan inversion of the n x n normal matrix, returns false if it is singular
+static bool invertNormalMatrix(double m[5][5], int n)
 {
-    std::list<Tracklet> targetList;
+    for(int i = 0; i < n; ++i)
+    {
+        //diagonal pivoting is enough for a positive definite matrix
+        double pivot = m[i][i];
+        if(fabs(pivot) < 1E-30) return false;
 
+        m[i][i] = 1.;
+        for(int j = 0; j < n; ++j) m[i][j] /= pivot;
+        for(int k = 0; k < n; ++k)
+        {
+            if(k == i) continue;
+            double factor = m[k][i];
+            m[k][i] = 0.;
+            for(int j = 0; j < n; ++j) m[k][j] -= factor*m[i][j];
+        }
+    }
+
+    return true;
+}
+
+int KalmanFastTracking::fitTrackletAnalytic(Tracklet& tracklet)
+{
+    //For fixed left/right signs and fixed kick the residuals are (almost) linear in tx, ty, x0, y0,
+    //the small non-linearity of tilted planes and the charge flip are absorbed by a few Gauss-Newton steps.
+    //invP only affects the station-1 hits of global tracks, and enters the same normal equations there.
+    //Once invP runs into its limit it is fixed there and the remaining 4 parameters are solved alone
+    bool fitInvP = KMAG_ON == 1 && tracklet.stationID == 6;
+    int nPar = fitInvP ? 5 : 4;
+    double err_invP = tracklet.err_invP;
+
+    double par[5] = {tracklet.tx, tracklet.ty, tracklet.x0, tracklet.y0, tracklet.invP};
+    double par_min[5] = {-TX_MAX, -TY_MAX, -X0_MAX, -Y0_MAX, INVP_MIN};
+    double par_max[5] = {TX_MAX, TY_MAX, X0_MAX, Y0_MAX, INVP_MAX};
+    double A[5][5], b[5];
+
+    bool converged = false;
+    const int nIterMax = 10;
+    for(int iIter = 0; iIter < nIterMax; ++iIter)
+    {
+        ++stats.nEvals[currentStage];
+        for(int i = 0; i < nPar; ++i)
+        {
+            b[i] = 0.;
+            for(int j = 0; j < nPar; ++j) A[i][j] = 0.;
+        }
+
+        double kick = fitInvP ? PT_KICK_KMAG*(par[2]*KMAGSTR > 0 ? 1. : -1.) : 0.;
+        int nHits = 0;
+        for(TrackletHitArray::iterator iter = tracklet.hitArray.begin(); iter != tracklet.hitArray.end(); ++iter)
+        {
+            if(iter->hit.index < 0) continue;
+
+            int detectorID = iter->hit.detectorID;
+            double sigma = iter->sign == 0 ? p_geomSvc->getPlaneSpacing(detectorID)/sqrt(12.) : p_geomSvc->getPlaneResolution(detectorID);
+            double p = iter->hit.pos + iter->sign*fabs(iter->hit.driftDistance);
+
+            //Same parameterization as Tracklet::getXZInfoInSt1
+            double J[5];
+            double w;
+            if(fitInvP && detectorID <= 6)
+            {
+                double tx_st1 = par[0] + kick*par[4];
+                double x0_st1 = par[2] - kick*par[4]*Z_KMAG_BEND;
+                w = p_geomSvc->getInterception(detectorID, tx_st1, par[1], x0_st1, par[3], J);
+                J[4] = kick*(J[0] - J[2]*Z_KMAG_BEND);
+            }
+            else
+            {
+                w = p_geomSvc->getInterception(detectorID, par[0], par[1], par[2], par[3], J);
+                J[4] = 0.;
+            }
+
+            double weight = 1./sigma/sigma;
+            double res = p - w;
+            for(int i = 0; i < nPar; ++i)
+            {
+                b[i] += J[i]*res*weight;
+                for(int j = 0; j <= i; ++j) A[i][j] += J[i]*J[j]*weight;
+            }
+            ++nHits;
+        }
+        if(nHits < nPar) return -1;
+
+        for(int i = 0; i < nPar; ++i)
+        {
+            for(int j = i + 1; j < nPar; ++j) A[i][j] = A[j][i];
+        }
+        if(!invertNormalMatrix(A, nPar)) return -1;
+        if(nPar == 5) err_invP = sqrt(fabs(A[4][4]));
+
+        double delta[5];
+        for(int i = 0; i < nPar; ++i)
+        {
+            delta[i] = 0.;
+            for(int j = 0; j < nPar; ++j) delta[i] += A[i][j]*b[j];
+        }
+
+        //A solution outside the Minuit limits of the line parameters is left to Minuit,
+        //an invP beyond its limit is fixed there and the 4-parameter system is solved again in the next step
+        for(int i = 0; i < 4; ++i)
+        {
+            if(par[i] + delta[i] < par_min[i] || par[i] + delta[i] > par_max[i]) return -1;
+        }
+        if(nPar == 5 && (par[4] + delta[4] < par_min[4] || par[4] + delta[4] > par_max[4]))
+        {
+            par[4] = par[4] + delta[4] < par_min[4] ? par_min[4] : par_max[4];
+            nPar = 4;
+            continue;
+        }
+
+        converged = true;
+        for(int i = 0; i < nPar; ++i)
+        {
+            par[i] += delta[i];
+            if(fabs(delta[i]) > 1E-6*(par_max[i] - par_min[i])) converged = false;
+        }
+        if(converged) break;
+    }
+    if(!converged) return -1;
+
+    //A now holds the inverse of the normal matrix from the last step, i.e. the covariance of the free parameters,
+    //a fixed invP keeps the error of the last 5-parameter step
+    tracklet.tx = par[0];
+    tracklet.ty = par[1];
+    tracklet.x0 = par[2];
+    tracklet.y0 = par[3];
+
+    tracklet.err_tx = sqrt(fabs(A[0][0]));
+    tracklet.err_ty = sqrt(fabs(A[1][1]));
+    tracklet.err_x0 = sqrt(fabs(A[2][2]));
+    tracklet.err_y0 = sqrt(fabs(A[3][3]));
+
+    if(fitInvP)
+    {
+        tracklet.invP = par[4];
+        tracklet.err_invP = err_invP;
+    }
+
+    tracklet.calcChisq();
+    return 0;
+}
+
+int KalmanFastTracking::reduceTrackletList(std::list<Tracklet>& tracklets)
+{
+    //Sorting the list only relinks the nodes, the tracklets are not copied
     tracklets.sort();
-    while(!tracklets.empty())
+
+    int nTracklets = tracklets.size();
+    if(nTracklets < 2) return 0;
+
+    //Signatures and the hash buckets of all keys
+    reduceOrder.clear();
+    reduceSignatures.resize(nTracklets);
+    reduceEntries.clear();
+
+    int nKeys = 0;
+    for(std::list<Tracklet>::iterator iter = tracklets.begin(); iter != tracklets.end(); ++iter)
     {
-        targetList.push_back(tracklets.front());
-        tracklets.pop_front();
+        reduceSignatures[reduceOrder.size()].fill(*iter);
+        nKeys += reduceSignatures[reduceOrder.size()].nKeys;
+        reduceOrder.push_back(iter);
+    }
+
+    unsigned int nBuckets = 64;
+    while(nBuckets < 2*(unsigned int)nKeys) nBuckets *= 2;
+    reduceBuckets.assign(nBuckets, -1);
+
+    for(int i = 0; i < nTracklets; ++i)
+    {
+        for(int j = 0; j < reduceSignatures[i].nKeys; ++j)
+        {
+            SignatureEntry entry;
+            entry.key = reduceSignatures[i].keys[j];
+            entry.tracklet = i;
+
+            unsigned int bucket = ((unsigned int)entry.key*2654435761u) & (nBuckets - 1);
+            entry.next = reduceBuckets[bucket];
+            reduceBuckets[bucket] = reduceEntries.size();
+            reduceEntries.push_back(entry);
+        }
+    }
+
+    //Same greedy reduction as before: the best remaining tracklet removes all the lower ranked ones similar to it,
+    //only the tracklets sharing at least one key with it are looked at
+    reduceCommon.assign(nTracklets, 0);
+    reduceRemoved.assign(nTracklets, false);
+    int nRemoved = 0;
+    for(int i = 0; i < nTracklets; ++i)
+    {
+        if(reduceRemoved[i]) continue;
 
 #ifdef _DEBUG_ON_LEVEL_2
         LogInfo("Current best tracklet in reduce");
-        targetList.back().print();
+        reduceOrder[i]->print();
 #endif
 
-        for(std::list<Tracklet>::iterator iter = tracklets.begin(); iter != tracklets.end(); )
+        const TrackletSignature& signature = reduceSignatures[i];
+        reduceTouched.clear();
+        for(int j = 0; j < signature.nKeys; ++j)
+        {
+            unsigned int bucket = ((unsigned int)signature.keys[j]*2654435761u) & (nBuckets - 1);
+            for(int k = reduceBuckets[bucket]; k >= 0; k = reduceEntries[k].next)
+            {
+                const SignatureEntry& entry = reduceEntries[k];
+                if(entry.key != signature.keys[j] || entry.tracklet <= i || reduceRemoved[entry.tracklet]) continue;
+                if(reduceCommon[entry.tracklet]++ == 0) reduceTouched.push_back(entry.tracklet);
+            }
+        }
+
+        for(std::vector<int>::iterator iter = reduceTouched.begin(); iter != reduceTouched.end(); ++iter)
         {
-            if(iter->similarity(targetList.back()))
+            //Same criterion as Tracklet::similarity
+            if(reduceCommon[*iter]/double(signature.nHits) > 0.33333)
             {
 #ifdef _DEBUG_ON_LEVEL_2
                 LogInfo("Removing this tracklet: ");
-                iter->print();
+                reduceOrder[*iter]->print();
 #endif
-                iter = tracklets.erase(iter);
-                continue;
-            }
-            else
-            {
-                ++iter;
+                reduceRemoved[*iter] = true;
+                ++nRemoved;
             }
+            reduceCommon[*iter] = 0;
         }
     }
 
-    tracklets.assign(targetList.begin(), targetList.end());
-    return 0;
+    for(int i = 0; i < nTracklets; ++i)
+    {
+        if(reduceRemoved[i]) tracklets.erase(reduceOrder[i]);
+    }
+
+    return nRemoved;
 }
 
 void KalmanFastTracking::getExtrapoWindowsInSt1(Tracklet& tracklet, double* pos_exp, double* window)
@@ -1482,7 +1996,7 @@ void KalmanFastTracking::getSagittaWindowsInSt1(Tracklet& tracklet, double* pos_
         return;
     }
 
-    double z_st3 = z_plane[tracklet.hits.back().hit.detectorID];
+    double z_st3 = z_plane[tracklet.hitArray.back().hit.detectorID];
     double x_st3 = tracklet.getExpPositionX(z_st3);
     double y_st3 = tracklet.getExpPositionY(z_st3);
 
@@ -1563,7 +2077,7 @@ void KalmanFastTracking::processOneTracklet(Tracklet& tracklet)
     KalmanTrack kmtrk;
 
     //Set the whole hit and node list
-    for(std::list<SignedHit>::iterator iter = tracklet.hits.begin(); iter != tracklet.hits.end(); ++iter)
+    for(TrackletHitArray::iterator iter = tracklet.hitArray.begin(); iter != tracklet.hitArray.end(); ++iter)
     {
         if(iter->hit.index < 0) continue;
 
@@ -1581,12 +2095,22 @@ void KalmanFastTracking::processOneTracklet(Tracklet& tracklet)
     trkpar_curr._state_kf[3][0] = tracklet.getExpPositionX(trkpar_curr._z);
     trkpar_curr._state_kf[4][0] = tracklet.getExpPositionY(trkpar_curr._z);
 
+    //Start from the fast fit errors, inflated since the same hits are fitted again, the
+    //fixed values are only the fall back when the fast fit did not provide the errors
+    double err_state[5];
+    err_state[0] = tracklet.err_invP/sqrt(1. + tracklet.tx*tracklet.tx + tracklet.ty*tracklet.ty);
+    err_state[1] = tracklet.err_tx;
+    err_state[2] = tracklet.err_ty;
+    err_state[3] = tracklet.getExpPosErrorX(trkpar_curr._z);
+    err_state[4] = tracklet.getExpPosErrorY(trkpar_curr._z);
+
+    const double cov_default[5] = {0.001, 0.01, 0.01, 100., 100.};
     trkpar_curr._covar_kf.Zero();
-    trkpar_curr._covar_kf[0][0] = 0.001;//1E6*tracklet.err_invP*tracklet.err_invP;
-    trkpar_curr._covar_kf[1][1] = 0.01;//1E6*tracklet.err_tx*tracklet.err_tx;
-    trkpar_curr._covar_kf[2][2] = 0.01;//1E6*tracklet.err_ty*tracklet.err_ty;
-    trkpar_curr._covar_kf[3][3] = 100;//1E6*tracklet.getExpPosErrorX(trkpar_curr._z)*tracklet.getExpPosErrorX(trkpar_curr._z);
-    trkpar_curr._covar_kf[4][4] = 100;//1E6*tracklet.getExpPosErrorY(trkpar_curr._z)*tracklet.getExpPosErrorY(trkpar_curr._z);
+    for(int i = 0; i < 5; ++i)
+    {
+        double cov = KF_INIT_COV_SCALE*err_state[i]*err_state[i];
+        trkpar_curr._covar_kf[i][i] = cov > 0. && cov < cov_default[i] ? cov : cov_default[i];
+    }
 
     kmtrk.setCurrTrkpar(trkpar_curr);
     kmtrk.getNodeList().back().getPredicted() = trkpar_curr;
@@ -1665,7 +2189,7 @@ void KalmanFastTracking::resolveLeftRight(KalmanTrack& kmtrk)
             }
 
             //update the node list
-            TMatrixD m(1, 1), dm(1, 1);
+            KMatrix<1, 1> m, dm;
             m[0][0] = node->getHit().pos + sign*node->getHit().driftDistance;
             dm[0][0] = p_geomSvc->getPlaneResolution(node->getHit().detectorID)*p_geomSvc->getPlaneResolution(node->getHit().detectorID);
             node->setMeasurement(m, dm);
@@ -14,6 +14,8 @@ Created: 05-24-2013
 
 #include <list>
 #include <vector>
+#include <map>
+#include <algorithm>
 
 #include <Math/Factory.h>
 #include <Math/Minimizer.h>
@@ -24,6 +26,90 @@ Created: 05-24-2013
 #include "KalmanTrack.h"
 #include "KalmanFitter.h"
 #include "FastTracklet.h"
+#include "ThreadQueue.h"
+
+class TThread;
+class KalmanFastTracking;
+
+///Stages of the fast tracking timed in setRawEvent
+enum TrackingStage {kStageAcceptEvent, kStagePropSegments, kStageStation2, kStageStation3, kStageBackPartial, kStageGlobal, kStageKalmanFit, nTrackingStages};
+
+///Per-event wall time and counters of each stage, the stages not reached in the event stay at 0
+struct TrackingStats
+{
+    void clear();
+    static const char* getStageName(int stage);
+
+    double time[nTrackingStages];       //wall time in seconds
+    int nCandidates[nTrackingStages];   //hits, prop. tube segments, tracklets or tracks coming out of the stage
+    int nFits[nTrackingStages];         //fitTracklet calls, Kalman fits in the Kalman fitting stage
+    int nEvals[nTrackingStages];        //minimizer function calls, Gauss-Newton steps of the analytic fit, or Kalman propagations
+};
+
+///Helper of the intra-event parallel loops, a tracker with its own minimizers and chi square kernel running in its own thread
+struct TrackingHelper
+{
+    KalmanFastTracking* parent;
+    KalmanFastTracking* tracker;
+    TThread* thread;
+
+    ThreadQueue<int> commands;
+};
+
+///Hit pair with its mid-point position, sorted by position for the window search of X-U-V combinations
+struct HitPairPos
+{
+    HitPairPos() : pos(0.) {}
+    explicit HitPairPos(double pos_input) : pos(pos_input), hpair(-1, -1) {}
+    HitPairPos(double pos_input, const SRawEvent::hit_pair& hpair_input) : pos(pos_input), hpair(hpair_input) {}
+
+    bool operator<(const HitPairPos& elem) const { return pos < elem.pos; }
+
+    double pos;
+    SRawEvent::hit_pair hpair;
+};
+
+///Hits of a X-U-V combination of hit pairs, key of the per-event memo of station-1 tracklets
+struct HitCombination
+{
+    HitCombination(const SRawEvent::hit_pair& x, const SRawEvent::hit_pair& u, const SRawEvent::hit_pair& v)
+    {
+        index[0] = x.first; index[1] = x.second;
+        index[2] = u.first; index[3] = u.second;
+        index[4] = v.first; index[5] = v.second;
+    }
+
+    bool operator<(const HitCombination& elem) const { return std::lexicographical_compare(index, index + 6, elem.index, elem.index + 6); }
+
+    int index[6];
+};
+
+///Hit signature of a tracklet for the duplicate removal, one key per hit: the hit index, or -detectorID for
+///dummy hits. Two hits give the same key exactly when Tracklet::similarity counts them as common
+struct TrackletSignature
+{
+    void fill(const Tracklet& tracklet)
+    {
+        nKeys = 0;
+        nHits = tracklet.getNHits();
+        for(TrackletHitArray::const_iterator iter = tracklet.hitArray.begin(); iter != tracklet.hitArray.end(); ++iter)
+        {
+            keys[nKeys++] = iter->hit.index >= 0 ? iter->hit.index : -iter->hit.detectorID;
+        }
+    }
+
+    int nKeys;
+    int nHits;
+    int keys[TRACKLET_MAX_HITS];
+};
+
+///Entry of the hash buckets of signature keys, chained by the index of the next entry in the same bucket
+struct SignatureEntry
+{
+    int key;
+    int tracklet;
+    int next;
+};
 
 class KalmanFastTracking
 {
@@ -42,14 +128,39 @@ public:
     //Build tracklets in a station
     void buildTrackletsInStation(int stationID, double* pos_exp = NULL, double* window = NULL);
 
+    //Mid-point position of a hit pair, and a list of hit pairs sorted by it
+    double getHitPairPos(const SRawEvent::hit_pair& hpair);
+    void sortHitPairs(const std::list<SRawEvent::hit_pair>& pairs, std::vector<HitPairPos>& sorted);
+
     //Build back partial tracks using tracklets in station 2 & 3
     void buildBackPartialTracks();
+    void buildBackPartialTrack(Tracklet& tracklet3, Tracklet& tracklet_best);
 
     //Build global tracks by connecting station 23 tracklets and station 1 tracklets
     void buildGlobalTracks();
+    void buildGlobalTrack(Tracklet& tracklet23, Tracklet& tracklet_best);
+
+    //Extract the station-1 hit pairs once per event, and select the ones inside the windows of a back partial
+    void prepareStation1();
+    void selectPairsInSt1(int viewID, double x_exp, double win, std::vector<HitPairPos>& pairs);
 
-    //Fit tracklets
+    //Fit tracklets, either by Minuit or by the linearized least square fit
     int fitTracklet(Tracklet& tracklet);
+    int fitTrackletAnalytic(Tracklet& tracklet);
+    void enableAnalyticFit(bool opt = true);
+
+    //Use the Runge-Kutta-Nystrom propagator instead of Geant4e in the Kalman filter
+    void enableRKPropagation(bool opt = true) { if(enable_KF) kmfitter->getKalmanFilter()->enableRKPropagation(opt); }
+
+    //Run the loops over station-3 tracklets and back partials with nThreads threads in events with at least
+    //minTasks of them, the results are merged in the serial order so the output is the same as the serial one
+    void enableParallel(int nThreads, unsigned int minTasks = 8);
+
+    //Use the propagator table in the Kalman filter, it has to stay alive while this tracker is used
+    void setPropagatorLUT(const PropagatorLUT* propLUT) { if(enable_KF) kmfitter->getKalmanFilter()->setPropagatorLUT(propLUT); }
+
+    //Reuse the propagator of the previous Kalman iteration for the nodes whose reference trajectory barely moved
+    void enableLinearizationReuse(bool opt = true) { if(enable_KF) kmfitter->getKalmanFilter()->enableLinearizationReuse(opt); }
 
     //Check the quality of tracklet, number of hits
     bool acceptTracklet(Tracklet& tracklet);
@@ -67,6 +178,10 @@ public:
     //Remove bad hit if needed
     void removeBadHits(Tracklet& tracklet);
 
+    //Time the stage from now on, and record the time and the number of candidates at its end
+    void startStage(int stage);
+    void endStage(int nCandidates);
+
     //Reduce the list of tracklets, returns the number of elements reduced
     int reduceTrackletList(std::list<Tracklet>& tracklets);
 
@@ -93,6 +208,9 @@ public:
     std::list<SRecTrack>& getSRecTracks() { return stracks; }
     std::list<PropSegment>& getPropSegments(int i) { return propSegs[i]; }
 
+    ///Timing and counters of the last event
+    const TrackingStats& getStats() const { return stats; }
+
     ///Tool, a simple-minded chi square fit
     void chi2fit(int n, double x[], double y[], double& a, double& b);
 
@@ -117,13 +235,11 @@ private:
     std::vector<int> detectorIDs_mask[4];
     std::vector<int> detectorIDs_maskX[4];
     std::vector<int> detectorIDs_maskY[4];
-    std::list<int> hitIDs_mask[4]; //hits in T/B, L/R are combined
     std::vector<int> stationIDs_mask[6];
 
     //prop. tube IDs for MUID -- 0 for x-z, 1 for y-z
     int detectorIDs_muid[2][4];
     double z_ref_muid[2][4];
-    std::list<int> hitIDs_muid[2][4];
 
     //Masking window sizes, index is the uniqueID defined by nElement*detectorID + elementID
     double z_mask[24];
@@ -164,8 +280,54 @@ private:
     //Sagitta ratio in station 1 U/X/V
     int s_detectorID[3];
 
-    //Current tracklets being processed
-    Tracklet tracklet_curr;
+    //Station-1 hit pairs of the current event sorted by mid-point, 0, 1, 2 for X, U, V
+    std::vector<HitPairPos> pairsInSt1[3];
+
+    //Station-1 combinations tried in the current event, index in st1Tracklets or -1 if rejected
+    std::map<HitCombination, int> st1Memo;
+    std::vector<Tracklet> st1Tracklets;
+
+    //Work space of reduceTrackletList, the tracklets are referred to by their position in the sorted list
+    std::vector<std::list<Tracklet>::iterator> reduceOrder;
+    std::vector<TrackletSignature> reduceSignatures;
+    std::vector<int> reduceBuckets;
+    std::vector<SignatureEntry> reduceEntries;
+    std::vector<int> reduceCommon;
+    std::vector<int> reduceTouched;
+    std::vector<bool> reduceRemoved;
+
+    //Stage timing and counters, the helpers count into their own and are summed after each parallel loop
+    TrackingStats stats;
+    int currentStage;
+    double stageStart;
+
+    ///Intra-event parallel loops
+    enum ParallelTask {kBackPartialTask, kGlobalTask};
+    bool useParallel(unsigned int nTasks) { return !helpers.empty() && nTasks >= minParallelTasks; }
+
+    //Farm out one tracklet per task to this tracker and the helpers, result i is in taskResults[i]
+    void runParallel(int task, std::list<Tracklet>& inputs);
+
+    //Take tasks until none is left, called by every thread with its own tracker
+    void runTasks(KalmanFastTracking* tracker);
+
+    //Copy the parts of the current event needed by the task from the parent tracker
+    void shareEvent(KalmanFastTracking* parent, int task);
+
+    static void* runHelper(void* arg);
+
+    std::vector<TrackingHelper*> helpers;
+    ThreadQueue<int>* helpersDone;
+    unsigned int minParallelTasks;
+
+    int currentTask;
+    std::vector<Tracklet*> taskInputs;
+    std::vector<Tracklet> taskResults;
+    unsigned int nextTask;
+    TMutex taskMutex;
+
+    //Packed hits of the tracklet being fitted
+    TrackletChisqKernel chisqKernel;
 
     //Least chi square fitter and functor
     ROOT::Math::Minimizer* minimizer[2];
@@ -179,6 +341,9 @@ private:
 
     //Flag for enable Kalman fitting
     const bool enable_KF;
+
+    //Flag for using the linearized fit instead of Minuit in fitTracklet
+    bool analyticFit;
 };
 
 #endif
@@ -14,29 +14,13 @@ Created: 11-21-2011
 
 #include "KalmanFilter.h"
 
-KalmanFilter* KalmanFilter::p_kmfit = NULL;
-
-KalmanFilter* KalmanFilter::instance()
-{
-    if(p_kmfit == NULL)
-    {
-        p_kmfit = new KalmanFilter();
-    }
-
-    return p_kmfit;
-}
-
-void KalmanFilter::close()
-{
-    if(p_kmfit != NULL)
-    {
-        delete p_kmfit;
-    }
-}
-
 KalmanFilter::KalmanFilter(bool limitedStep)
 {
     _extrapolator.init(GEOMETRY_VERSION);
+    _propLUT = NULL;
+
+    _reuseLinearization = false;
+    resetCounters();
 }
 
 bool KalmanFilter::fit_node(Node& _node)
@@ -68,9 +52,32 @@ bool KalmanFilter::predict(Node& _node)
     }
 
     double z_pred = _node.getZ();
+
+    ///Downstream of FMAG there is no process noise, so the prediction is fully determined by the propagator
+    ///and the reference of the previous iteration can be reused if the track barely moved
+    if(_reuseLinearization && z_pred > FMAG_LENGTH && _node.hasReference() && predictFromReference(_node))
+    {
+        ++_nReused;
+        return true;
+    }
+
+    ///The table only covers the chamber planes, which are all downstream of FMAG so there is no process noise
+    if(_propLUT != NULL && _propLUT->propagate(_trkpar_curr._z, _trkpar_curr._state_kf, z_pred, _node.getPredicted()._state_kf, _node.getPropagator()))
+    {
+        _node.getPredicted()._z = z_pred;
+        _node.getPredicted()._covar_kf = SMatrix::getSimilarity(_node.getPropagator(), _trkpar_curr._covar_kf);
+        _node.setPredictionDone();
+        _node.setReference(_trkpar_curr._z, _trkpar_curr._state_kf, z_pred, _node.getPredicted()._state_kf);
+        ++_nPropagations;
+
+        return true;
+    }
+
     _extrapolator.setInitialStateWithCov(_trkpar_curr._z, _trkpar_curr._state_kf, _trkpar_curr._covar_kf);
+    ++_nPropagations;
     if(!_extrapolator.extrapolateTo(z_pred))
     {
+        _node.clearReference();
         return false;
     }
 
@@ -81,7 +88,8 @@ bool KalmanFilter::predict(Node& _node)
 
     if(z_pred > FMAG_LENGTH)
     {
-        _node.getPredicted()._covar_kf = SMatrix::getABCt(_node.getPropagator(), _trkpar_curr._covar_kf, _node.getPropagator());
+        _node.getPredicted()._covar_kf = SMatrix::getSimilarity(_node.getPropagator(), _trkpar_curr._covar_kf);
+        _node.setReference(_trkpar_curr._z, _trkpar_curr._state_kf, z_pred, _node.getPredicted()._state_kf);
     }
     /*
     else
@@ -101,6 +109,34 @@ bool KalmanFilter::predict(Node& _node)
     return true;
 }
 
+bool KalmanFilter::predictFromReference(Node& _node)
+{
+    ///Move the incoming state and the target along straight lines to the z of the reference, the
+    ///shifts in z come only from the alignment update and are far from any field
+    double dz_in = _node.getReferenceZIn() - _trkpar_curr._z;
+    double dz_out = _node.getZ() - _node.getReferenceZOut();
+    if(fabs(dz_in) > KF_REUSE_DZ || fabs(dz_out) > KF_REUSE_DZ) return false;
+
+    KMatrix<5, 1> dstate = _trkpar_curr._state_kf - _node.getReferenceStateIn();
+    dstate[3][0] += _trkpar_curr._state_kf[1][0]*dz_in;
+    dstate[4][0] += _trkpar_curr._state_kf[2][0]*dz_in;
+
+    if(fabs(dstate[0][0]) > KF_REUSE_DINVP) return false;
+    if(fabs(dstate[1][0]) > KF_REUSE_DSLOPE || fabs(dstate[2][0]) > KF_REUSE_DSLOPE) return false;
+    if(fabs(dstate[3][0]) > KF_REUSE_DPOS || fabs(dstate[4][0]) > KF_REUSE_DPOS) return false;
+
+    ///p_pred = p_ref_out + prop.(p_in - p_ref_in), then drift to the current node z
+    TrkPar& _predicted = _node.getPredicted();
+    _predicted._state_kf = _node.getReferenceStateOut() + _node.getPropagator()*dstate;
+    _predicted._state_kf[3][0] += _predicted._state_kf[1][0]*dz_out;
+    _predicted._state_kf[4][0] += _predicted._state_kf[2][0]*dz_out;
+    _predicted._covar_kf = SMatrix::getSimilarity(_node.getPropagator(), _trkpar_curr._covar_kf);
+    _predicted._z = _node.getZ();
+    _node.setPredictionDone();
+
+    return true;
+}
+
 bool KalmanFilter::filter(Node& _node)
 {
     if(_node.isFilterDone())
@@ -115,63 +151,52 @@ bool KalmanFilter::filter(Node& _node)
         return false;
     }
 
+    if(_node.getMeasurementDim() == 1) return filterMeasurement<1>(_node);
+    return filterMeasurement<2>(_node);
+}
+
+template<unsigned int M>
+bool KalmanFilter::filterMeasurement(Node& _node)
+{
     ///Get all the predicted state vector and covariance
-    const TMatrixD& p_pred = _node.getPredicted()._state_kf;
-    const TMatrixD& cov_pred = _node.getPredicted()._covar_kf;
-    const TMatrixD& m = _node.getMeasurement();
-    const TMatrixD& cov_m = _node.getMeasurementCov();
-    const TMatrixD& proj = _node.getProjector();
-
-    ///Calculate the filtered covariance matrix
-    ///cov_filter = ( c_pred^{-1} + proj^t*G*proj)^{-1}
-    TMatrixD g = SMatrix::invertMatrix(cov_m);
-    TMatrixD cov_pred_inv = SMatrix::invertMatrix(cov_pred);
-    TMatrixD cov_filter = SMatrix::invertMatrix(cov_pred_inv + SMatrix::getAtBC(proj, g, proj));
-
-    ///Calculate the filtered state vector
-    ///p_filter = c_filter.(c_pred^{-1}.p_pred + h^t.g.measure)
-    ///Three equations below are mathematically equal, but EQ.2 appears to be faster
-    //EQ. 1:
-    //TMatrixD htgm = SMatrix::getAtBC(proj, g, m);
-    //TMatrixD p_filter = cov_filter*(cov_pred_inv*p_pred + htgm);
-    //EQ. 2:
-    TMatrixD k = SMatrix::getABtC(cov_pred, proj, SMatrix::invertMatrix(cov_m + SMatrix::getABCt(proj, cov_pred, proj)));
-    TMatrixD p_filter = p_pred + k*(m - proj*p_pred);
-    //EQ. 3:
-    //TMatrixD p_filter = p_pred + SMatrix::getABtC(cov_filter, proj, g)*(m - proj*p_pred);
-
-    ///Calculate the filtered residule and associated covariance
-    /// r_filter = m - h.p_filter
-    /// r_cov_filter = m_cov - h.c_filter.h^t
-    TMatrixD r_filter = m - proj*p_filter;
-    TMatrixD r_cov_filter = cov_m - SMatrix::getABCt(proj, cov_filter, proj);
+    const KMatrix<5, 1>& p_pred = _node.getPredicted()._state_kf;
+    const KMatrix<5, 5>& cov_pred = _node.getPredicted()._covar_kf;
+    const KMatrix<M, 1> m = _node.getMeasurement().getSub<M, 1>();
+    const KMatrix<M, M> cov_m = _node.getMeasurementCov().getSub<M, M>();
+    const KMatrix<M, 5> proj = _node.getProjector().getSub<M, 5>();
+
+    ///Calculate the kalman gain, only the MxM residual covariance needs to be inverted
+    /// r = m - proj.p_pred
+    /// s = cov_m + proj.c_pred.proj^t
+    /// k = c_pred.proj^t.s^{-1}
+    KMatrix<5, M> cht = cov_pred*proj.transpose();
+    KMatrix<M, M> s = cov_m + proj*cht;
+    KMatrix<M, M> s_inv;
+    if(!SMatrix::invertMatrix(s, s_inv)) return false;
+
+    KMatrix<M, 1> r = m - proj*p_pred;
+    KMatrix<5, M> k = cht*s_inv;
+
+    ///Calculate the filtered state vector and covariance, updated in place in the node
+    /// p_filter = p_pred + k.r
+    /// c_filter = c_pred - k.proj.c_pred = c_pred - k.cht^t, which equals ( c_pred^{-1} + proj^t*G*proj)^{-1}
+    TrkPar& _filtered = _node.getFiltered();
+    _filtered._state_kf = p_pred + k*r;
+    _filtered._covar_kf = cov_pred;
+    SMatrix::subtractSymProduct(_filtered._covar_kf, k, cht);
 
     ///Calculate the filtered parameter's contribution to chi square
-    /// chi2 += chi2m + chi2p
+    /// chi2 = chi2m + chi2p
     /// chi2m = r_filter^t.g.r_filter (contribution from measurement)
     /// chi2p = (p_filter-p_pred)^t.c_pred^{-1}.(p_filter - p_pred) (contribution from extrapolator)
-    double chi2m = SMatrix::getAtBC(r_filter, g, r_filter)[0][0];
-    TMatrixD dp = p_filter - p_pred;
-    double chi2p = SMatrix::getAtBC(dp, cov_pred_inv, dp)[0][0];
+    /// with r_filter = cov_m.s^{-1}.r and p_filter - p_pred = k.r, the sum reduces to r^t.s^{-1}.r
+    double chi2 = SMatrix::getAtBC(r, s_inv, r)[0][0];
 
     ///Store the filtered state vector
-    _node.getFiltered()._state_kf = p_filter;
-    _node.getFiltered()._covar_kf = cov_filter;
-    _node.getFiltered()._z = _node.getPredicted()._z;
-    _node.setChisq(chi2m + chi2p);
+    _filtered._z = _node.getPredicted()._z;
+    _node.setChisq(chi2);
     _node.setFilterDone();
 
-    /*
-    if(_node.getFiltered().get_charge()*_node.getPredicted().get_charge() < 1)
-      {
-        LogInfo("ERROR!! Filter Wrong!");
-        SMatrix::printMatrix(p_pred, "p_pred");
-        SMatrix::printMatrix(p_filter, "p_filter");
-        SMatrix::printMatrix(k, "k matrix");
-        SMatrix::printMatrix(m - proj*p_pred, "m - proj*p_pred");
-      }
-    */
-
     return true;
 }
 
@@ -195,23 +220,26 @@ bool KalmanFilter::smooth(Node& _node, Node& _node_prev)
     }
 
     ///Retrieve related info
-    const TMatrixD& p_filter = _node.getFiltered()._state_kf;
-    const TMatrixD& cov_filter = _node.getFiltered()._covar_kf;
-    const TMatrixD& p_pred_prev = _node_prev.getPredicted()._state_kf;
-    const TMatrixD& cov_pred_prev = _node_prev.getPredicted()._covar_kf;
-    const TMatrixD& p_smooth_prev = _node_prev.getSmoothed()._state_kf;
-    const TMatrixD& cov_smooth_prev = _node_prev.getSmoothed()._covar_kf;
-    const TMatrixD& prop_prev = _node_prev.getPropagator();
+    const KMatrix<5, 1>& p_filter = _node.getFiltered()._state_kf;
+    const KMatrix<5, 5>& cov_filter = _node.getFiltered()._covar_kf;
+    const KMatrix<5, 1>& p_pred_prev = _node_prev.getPredicted()._state_kf;
+    const KMatrix<5, 5>& cov_pred_prev = _node_prev.getPredicted()._covar_kf;
+    const KMatrix<5, 1>& p_smooth_prev = _node_prev.getSmoothed()._state_kf;
+    const KMatrix<5, 5>& cov_smooth_prev = _node_prev.getSmoothed()._covar_kf;
+    const KMatrix<5, 5>& prop_prev = _node_prev.getPropagator();
 
     ///Calculate smoothed state vector
     /// p_smooth = p_filter + a.(p_prev_smooth - p_prev_pred)
     /// a = c_filter.prop_prev^t.c_prev_pred^{-1}
-    TMatrixD a = SMatrix::getABtCinv(cov_filter, prop_prev, cov_pred_prev);
-    TMatrixD p_smooth = p_filter + a*(p_smooth_prev - p_pred_prev);
+    KMatrix<5, 5> cov_pred_prev_inv;
+    if(!SMatrix::invertSymMatrix(cov_pred_prev, cov_pred_prev_inv) && !SMatrix::invertMatrix(cov_pred_prev, cov_pred_prev_inv)) return false;
+
+    KMatrix<5, 5> a = cov_filter*prop_prev.transpose()*cov_pred_prev_inv;
+    KMatrix<5, 1> p_smooth = p_filter + a*(p_smooth_prev - p_pred_prev);
 
     ///Calculate the covariance of the smoothed state vector
     ///c_smooth = c_filter + a.(c_smooth_prev - c_pred_prev).a^t
-    TMatrixD cov_smooth = cov_filter + SMatrix::getABCt(a, cov_smooth_prev - cov_pred_prev, a);
+    KMatrix<5, 5> cov_smooth = cov_filter + SMatrix::getSimilarity(a, cov_smooth_prev - cov_pred_prev);
 
     ///Fill the smoothed track parameter
     _node.getSmoothed()._state_kf = p_smooth;
@@ -21,16 +21,13 @@ Created: 10-14-2011
 
 #include "GeomSvc.h"
 #include "KalmanUtil.h"
+#include "PropagatorLUT.h"
 #include "TrackExtrapolator/TrackExtrapolator.hh"
 
 class KalmanFilter
 {
 public:
-    ///singlton instance
-    static KalmanFilter* instance();
-    void close();
-
-    ///Real constructor
+    ///Each user (fitter, vertex finder, worker thread) owns its own filter and extrapolator
     KalmanFilter(bool limitedStep = true);
 
     ///Kalman filter steps
@@ -48,15 +45,43 @@ public:
     ///Enable the dump mode: stop calc prop matrix, start calc travel length
     void enableDumpCorrection() { _extrapolator.setPropCalc(true); _extrapolator.setLengthCalc(true); }
 
+    ///Use the Runge-Kutta-Nystrom propagator instead of Geant4e in the prediction
+    void enableRKPropagation(bool option = true) { _extrapolator.setRKPropagation(option); }
+
+    ///Use the pre-computed propagator table between chamber planes if it is loaded, the extrapolator is the fall back.
+    ///The table is only read and is owned by the caller, NULL switches it off
+    void setPropagatorLUT(const PropagatorLUT* propLUT) { _propLUT = propLUT != NULL && propLUT->isLoaded() ? propLUT : NULL; }
+
+    ///Reuse the propagator of the node's last full propagation while the incoming state stays within
+    ///KF_REUSE_* of its linearization point. Off by default as it changes the fit result slightly,
+    ///kFastTracking opts in
+    void enableLinearizationReuse(bool option = true) { _reuseLinearization = option; }
+
+    ///Number of full propagations (extrapolator or table) and of linearized re-predictions since the last reset
+    int getNPropagations() { return _nPropagations; }
+    int getNReused() { return _nReused; }
+    void resetCounters() { _nPropagations = 0; _nReused = 0; }
+
 private:
-    ///Pointer to singlton instance
-    static KalmanFilter *p_kmfit;
+    ///Update with a M-D measurement, the dimension is only known at run time so filter() dispatches
+    template<unsigned int M> bool filterMeasurement(Node& _node);
+
+    ///Predict by linearizing around the node's reference, returns false if the reference cannot be used
+    bool predictFromReference(Node& _node);
 
     ///Stores the current track parameter
     TrkPar _trkpar_curr;
 
     ///Track extrapolator
     TrackExtrapolator _extrapolator;
+
+    ///Propagator table, NULL if not used
+    const PropagatorLUT* _propLUT;
+
+    ///Linearization reuse flag and counters
+    bool _reuseLinearization;
+    int _nPropagations;
+    int _nReused;
 };
 
 #endif
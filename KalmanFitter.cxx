@@ -15,12 +15,15 @@ Created: 10-18-2012
 #include "GeomSvc.h"
 #include "KalmanFitter.h"
 
-KalmanFitter::KalmanFitter()
+KalmanFitter::KalmanFitter(KalmanFilter* kmfit)
 {
-    _kmfit = KalmanFilter::instance();
+    _own_kmfit = kmfit == NULL;
+    _kmfit = _own_kmfit ? new KalmanFilter() : kmfit;
 
     _max_iteration = 100;
     _tolerance = 1E-3;
+    _nPropagations = 0;
+    _nReused = 0;
 
     GeomSvc* p_geomSvc = GeomSvc::instance();
     for(int i = 1; i <= nChamberPlanes; ++i)
@@ -36,6 +39,11 @@ KalmanFitter::KalmanFitter()
     }
 }
 
+KalmanFitter::~KalmanFitter()
+{
+    if(_own_kmfit) delete _kmfit;
+}
+
 void KalmanFitter::init()
 {
     _chisq = 0.;
@@ -46,6 +54,23 @@ void KalmanFitter::init()
 }
 
 int KalmanFitter::processOneTrack(KalmanTrack& _track)
+{
+    ///The filter may be shared, so the usage of this track is taken as the difference of its counters
+    int nPropagations_start = _kmfit->getNPropagations();
+    int nReused_start = _kmfit->getNReused();
+
+    int status = iterate(_track);
+
+    _nPropagations = _kmfit->getNPropagations() - nPropagations_start;
+    _nReused = _kmfit->getNReused() - nReused_start;
+#ifdef _DEBUG_ON
+    LogInfo("Fit status " << status << ", " << _nPropagations << " propagations, " << _nReused << " reused");
+#endif
+
+    return status;
+}
+
+int KalmanFitter::iterate(KalmanTrack& _track)
 {
     //LogInfo("Start processing this track..");
     int iIter = 0;
@@ -22,12 +22,16 @@ Created: 10-18-2012
 class KalmanFitter
 {
 public:
-    KalmanFitter();
-    //~KalmanFitter();
+    ///The fitter uses the external Kalman filter if provided, otherwise it owns a private one
+    KalmanFitter(KalmanFilter* kmfit = NULL);
+    ~KalmanFitter();
 
     ///Set the convergence control parameters
     void setControlParameter(int nMaxIteration, double tolerance) { _max_iteration = nMaxIteration; _tolerance = tolerance; }
 
+    ///The underlying Kalman filter
+    KalmanFilter* getKalmanFilter() { return _kmfit; }
+
     ///external call to process one single tracks
     ///the prediction-filter-smooth cycle is iteratively done
     ///until the chi square converges
@@ -65,12 +69,19 @@ public:
 
     double getChisq() { return _chisq; }
 
+    ///Full propagations and linearized re-predictions used by the last processOneTrack
+    int getNPropagations() { return _nPropagations; }
+    int getNReused() { return _nReused; }
+
     const TrkPar& getTrkParInitial() { return _nodes.front().getSmoothed(); }
     const TrkPar& getTrkParFinal() { return _nodes.back().getSmoothed(); }
 
     //TrkPar getTrkPar(double z) { std::cout << "Will be implemented later" << std::endl; }
 
 private:
+    ///The prediction-filter-smooth iterations of processOneTrack
+    int iterate(KalmanTrack& _track);
+
     ///list of all nodes associated with this track
     std::list<Node> _nodes;
 
@@ -79,6 +90,7 @@ private:
 
     ///Pointer to an instance of Kalman filter
     KalmanFilter *_kmfit;
+    bool _own_kmfit;
 
     ///cache of the rotation matrix of all detector planes
     double rM_20[nChamberPlanes];
@@ -86,6 +98,10 @@ private:
     double rM_22[nChamberPlanes];
     double z_planes[nChamberPlanes];
 
+    ///Propagator usage of the last track
+    int _nPropagations;
+    int _nReused;
+
     ///Control variables
     int _max_iteration;
     double _tolerance;
@@ -0,0 +1,148 @@
+/*
+KalmanMatrix.h
+
+Definition of KMatrix, a fixed-size dense matrix with the dimensions known at compile time.
+It is used by the Kalman filter for the state vector (5x1), covariance and propagator (5x5),
+projector and measurement, in place of TMatrixD which allocates every temporary on the heap.
+
+All storage is on the stack. Elements are accessed with the same m[i][j] syntax as TMatrixD,
+conversion from/to TMatrixD is only meant for the SRecTrack persistence.
+
+Author: Kun Liu, liuk@fnal.gov
+Created: 10-17-2014
+*/
+
+#ifndef _KALMANMATRIX_H
+#define _KALMANMATRIX_H
+
+#include <TMatrixD.h>
+
+template<unsigned int R, unsigned int C>
+class KMatrix
+{
+public:
+    KMatrix() { Zero(); }
+    explicit KMatrix(const TMatrixD& m) { *this = m; }
+
+    ///Conversion from/to TMatrixD, elements outside the TMatrixD are set to 0
+    KMatrix& operator=(const TMatrixD& m)
+    {
+        for(unsigned int i = 0; i < R; ++i)
+        {
+            for(unsigned int j = 0; j < C; ++j)
+            {
+                fArray[i*C + j] = (int(i) < m.GetNrows() && int(j) < m.GetNcols()) ? m[i][j] : 0.;
+            }
+        }
+        return *this;
+    }
+
+    TMatrixD toTMatrixD() const
+    {
+        TMatrixD m(R, C);
+        for(unsigned int i = 0; i < R; ++i)
+        {
+            for(unsigned int j = 0; j < C; ++j) m[i][j] = fArray[i*C + j];
+        }
+        return m;
+    }
+
+    ///Element access
+    double* operator[](unsigned int i) { return fArray + i*C; }
+    const double* operator[](unsigned int i) const { return fArray + i*C; }
+    double& operator()(unsigned int i, unsigned int j) { return fArray[i*C + j]; }
+    double operator()(unsigned int i, unsigned int j) const { return fArray[i*C + j]; }
+
+    int GetNrows() const { return R; }
+    int GetNcols() const { return C; }
+    double* GetMatrixArray() { return fArray; }
+    const double* GetMatrixArray() const { return fArray; }
+
+    KMatrix& Zero()
+    {
+        for(unsigned int i = 0; i < R*C; ++i) fArray[i] = 0.;
+        return *this;
+    }
+
+    KMatrix& UnitMatrix()
+    {
+        Zero();
+        for(unsigned int i = 0; i < R && i < C; ++i) fArray[i*C + i] = 1.;
+        return *this;
+    }
+
+    ///Sub-block of size R2xC2 starting from (row0, col0)
+    template<unsigned int R2, unsigned int C2>
+    KMatrix<R2, C2> getSub(unsigned int row0 = 0, unsigned int col0 = 0) const
+    {
+        KMatrix<R2, C2> mout;
+        for(unsigned int i = 0; i < R2; ++i)
+        {
+            for(unsigned int j = 0; j < C2; ++j) mout[i][j] = fArray[(i + row0)*C + j + col0];
+        }
+        return mout;
+    }
+
+    template<unsigned int R2, unsigned int C2>
+    void setSub(const KMatrix<R2, C2>& m, unsigned int row0 = 0, unsigned int col0 = 0)
+    {
+        for(unsigned int i = 0; i < R2; ++i)
+        {
+            for(unsigned int j = 0; j < C2; ++j) fArray[(i + row0)*C + j + col0] = m[i][j];
+        }
+    }
+
+    KMatrix<C, R> transpose() const
+    {
+        KMatrix<C, R> mout;
+        for(unsigned int i = 0; i < R; ++i)
+        {
+            for(unsigned int j = 0; j < C; ++j) mout[j][i] = fArray[i*C + j];
+        }
+        return mout;
+    }
+
+    ///Arithmetics
+    KMatrix& operator+=(const KMatrix& m)
+    {
+        for(unsigned int i = 0; i < R*C; ++i) fArray[i] += m.fArray[i];
+        return *this;
+    }
+
+    KMatrix& operator-=(const KMatrix& m)
+    {
+        for(unsigned int i = 0; i < R*C; ++i) fArray[i] -= m.fArray[i];
+        return *this;
+    }
+
+    KMatrix& operator*=(double val)
+    {
+        for(unsigned int i = 0; i < R*C; ++i) fArray[i] *= val;
+        return *this;
+    }
+
+    KMatrix operator+(const KMatrix& m) const { KMatrix mout(*this); mout += m; return mout; }
+    KMatrix operator-(const KMatrix& m) const { KMatrix mout(*this); mout -= m; return mout; }
+    KMatrix operator*(double val) const { KMatrix mout(*this); mout *= val; return mout; }
+
+private:
+    double fArray[R*C];
+};
+
+template<unsigned int R, unsigned int K, unsigned int C>
+inline KMatrix<R, C> operator*(const KMatrix<R, K>& a, const KMatrix<K, C>& b)
+{
+    KMatrix<R, C> mout;
+    for(unsigned int i = 0; i < R; ++i)
+    {
+        for(unsigned int j = 0; j < C; ++j)
+        {
+            double sum = 0.;
+            for(unsigned int k = 0; k < K; ++k) sum += a[i][k]*b[k][j];
+            mout[i][j] = sum;
+        }
+    }
+    return mout;
+}
+
+#endif
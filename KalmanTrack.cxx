@@ -322,14 +322,13 @@ void KalmanTrack::flipCharge()
     _nodes.back().getPredicted() = _trkpar;
 }
 
-bool KalmanTrack::propagateTo(int detectorID)
+bool KalmanTrack::propagateTo(int detectorID, KalmanFilter* kmfit)
 {
     Hit hit_dummy;
     hit_dummy.detectorID = detectorID;
 
     _node_next = Node(hit_dummy);
 
-    KalmanFilter *kmfit = KalmanFilter::instance();
     kmfit->setCurrTrkpar(_trkpar_curr);
     if(kmfit->predict(_node_next))
     {
@@ -341,32 +340,24 @@ bool KalmanTrack::propagateTo(int detectorID)
     }
 }
 
-double KalmanTrack::getMomentumVertex(double z, double& px, double& py, double& pz)
+double KalmanTrack::getMomentumVertex(double z, double& px, double& py, double& pz, KalmanFilter* kmfit)
 {
     Node _node_vertex;
     _node_vertex.setZ(z);
 
-    TMatrixD m(2, 1), cov(2, 2),  proj(2, 5);
-    m[0][0] = 0.;
-    m[1][0] = 0.;
+    KMatrix<2, 1> m;
+    KMatrix<2, 2> cov;
+    KMatrix<2, 5> proj;
 
-    cov.Zero();
     cov[0][0] = 1.;
     cov[1][1] = 1.;
 
-    proj.Zero();
     proj[0][3] = 1.;
     proj[1][4] = 1.;
 
-    _node_vertex.getMeasurement().ResizeTo(2, 1);
-    _node_vertex.getMeasurementCov().ResizeTo(2, 2);
-    _node_vertex.getProjector().ResizeTo(2, 5);
+    _node_vertex.setMeasurement(m, cov);
+    _node_vertex.setProjector(proj);
 
-    _node_vertex.getMeasurement() = m;
-    _node_vertex.getMeasurementCov() = cov;
-    _node_vertex.getProjector() = proj;
-
-    KalmanFilter *kmfit = KalmanFilter::instance();
     kmfit->setCurrTrkpar(_nodes.front().getSmoothed());
     kmfit->fit_node(_node_vertex);
 
@@ -378,8 +369,8 @@ double KalmanTrack::getMomentumVertex(double z, double& px, double& py, double&
 
 double KalmanTrack::getExpPosition()
 {
-    const TMatrixD& proj = _node_next.getProjector();
-    const TMatrixD& state = _node_next.getPredicted()._state_kf;
+    const KMatrix<2, 5>& proj = _node_next.getProjector();
+    const KMatrix<5, 1>& state = _node_next.getPredicted()._state_kf;
 
 #ifdef _DEBUG_ON
     LogInfo("Expected X: " << _node_next.getPredicted()._state_kf[3][0]);
@@ -391,15 +382,15 @@ double KalmanTrack::getExpPosition()
 
 double KalmanTrack::getExpPosError()
 {
-    const TMatrixD& proj = _node_next.getProjector();
-    const TMatrixD& covar = _node_next.getPredicted()._covar_kf;
-    //const TMatrixD& cov_m = _node_next.getMeasurementCov();
+    const KMatrix<2, 5>& proj = _node_next.getProjector();
+    const KMatrix<5, 5>& covar = _node_next.getPredicted()._covar_kf;
+    //const KMatrix<2, 2>& cov_m = _node_next.getMeasurementCov();
 
     //double err_x = sqrt(covar[3][3]);
     //double err_y = sqrt(covar[4][4]);
     //double track_err = fabs(proj[0][3]*err_x) + fabs(proj[0][4]*err_y);
 
-    double track_err_sq = SMatrix::getABCt(proj, covar, proj)[0][0];
+    double track_err_sq = SMatrix::getSimilarity(proj, covar)[0][0];
     double wire_spacing = GeomSvc::instance()->getPlaneSpacing(_node_next.getHit().detectorID);
 
     //LogInfo("measurement error: " << sqrt(cov_m[0][0]) << ", tracking error: " << track_err);
@@ -490,8 +481,8 @@ void KalmanTrack::getExpPosErrorFast(double z, double& dx, double& dy, Node* _no
 
 double KalmanTrack::getExpLocalSlop()
 {
-    const TMatrixD& proj = _node_next.getProjector();
-    const TMatrixD& state = _node_next.getPredicted()._state_kf;
+    const KMatrix<2, 5>& proj = _node_next.getProjector();
+    const KMatrix<5, 1>& state = _node_next.getPredicted()._state_kf;
 
 
     return proj[0][3]*state[1][0] + proj[0][4]*state[2][0];
@@ -499,8 +490,8 @@ double KalmanTrack::getExpLocalSlop()
 
 double KalmanTrack::getExpLcSlopErr()
 {
-    const TMatrixD& proj = _node_next.getProjector();
-    const TMatrixD& covar = _node_next.getPredicted()._covar_kf;
+    const KMatrix<2, 5>& proj = _node_next.getProjector();
+    const KMatrix<5, 5>& covar = _node_next.getPredicted()._covar_kf;
 
     double err_x = sqrt(covar[1][1]);
     double err_y = sqrt(covar[2][2]);
@@ -713,16 +704,14 @@ bool KalmanTrack::similarity(const KalmanTrack& elem) const
 }
 
 
-bool KalmanTrack::addHit(Hit _hit)
+bool KalmanTrack::addHit(Hit _hit, KalmanFilter* kmfit)
 {
     _hit_index.push_front(_hit.index);
 
     Node _node(_hit);
-    KalmanFilter *_kmfit = KalmanFilter::instance();
-
     _node.getPredicted() = _node_next.getPredicted();
     _node.setPredictionDone();
-    if(_kmfit->filter(_node))
+    if(kmfit->filter(_node))
     {
         _nodes.push_front(_node);
         update();
@@ -960,8 +949,8 @@ SRecTrack KalmanTrack::getSRecTrack()
     for(std::list<Node>::iterator iter = _nodes.begin(); iter != _nodes.end(); ++iter)
     {
         _strack.insertHitIndex(iter->getHit().index);
-        _strack.insertStateVector(iter->getSmoothed()._state_kf);
-        _strack.insertCovariance(iter->getSmoothed()._covar_kf);
+        _strack.insertStateVector(iter->getSmoothed()._state_kf.toTMatrixD());
+        _strack.insertCovariance(iter->getSmoothed()._covar_kf.toTMatrixD());
         _strack.insertZ(iter->getZ());
         _strack.insertChisq(iter->getChisq());
     }
@@ -70,7 +70,7 @@ public:
     int isInStation3();
 
     ///Propagate the track to a designated position
-    bool propagateTo(int detectorID);
+    bool propagateTo(int detectorID, KalmanFilter* kmfit);
     int getCurrentDetectorID() { return _node_next.getHit().detectorID; }
 
     ///Get the expected position
@@ -93,7 +93,7 @@ public:
 
     ///Add a new hit to the hit list
     ///both in index list and node list
-    bool addHit(Hit _hit);
+    bool addHit(Hit _hit, KalmanFilter* kmfit);
 
     ///Update the track status
     void update();
@@ -105,7 +105,7 @@ public:
     void setCurrTrkpar(TrkPar& _trkpar) { _trkpar_curr = _trkpar; }
 
     ///Get the rough vertex momentum
-    double getMomentumVertex(double z, double& px, double& py, double& pz);
+    double getMomentumVertex(double z, double& px, double& py, double& pz, KalmanFilter* kmfit);
 
     ///Get the list of hits associated
     std::list<int>& getHitIndexList() { return _hit_index; }
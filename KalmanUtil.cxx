@@ -14,147 +14,6 @@ Created: 11-20-2011
 #include "SRawEvent.h"
 #include "KalmanUtil.h"
 
-void SMatrix::printMatrix(const TMatrixD& m)
-{
-    int nRow = m.GetNrows();
-    int nCol = m.GetNcols();
-
-    std::cout << "The matrix has " << nRow << " rows and " << nCol << " columns." << std::endl;
-    for(int i = 0; i < nRow; i++)
-    {
-        std::cout << "Line " << i << ":  ";
-        for(int j = 0; j < nCol; j++)
-        {
-            std::cout << m[i][j] << "  ";
-        }
-        std::cout << std::endl;
-    }
-}
-
-void SMatrix::printMatrix(const TMatrixD& m, std::string str)
-{
-    int nRow = m.GetNrows();
-    int nCol = m.GetNcols();
-
-    std::cout << "Printing the content of matrix: " << str << std::endl;
-    std::cout << "The matrix has " << nRow << " rows and " << nCol << " columns." << std::endl;
-    for(int i = 0; i < nRow; i++)
-    {
-        std::cout << "Line " << i << ":  ";
-        for(int j = 0; j < nCol; j++)
-        {
-            std::cout << m[i][j] << "  ";
-        }
-        std::cout << std::endl;
-    }
-}
-
-TMatrixD SMatrix::invertMatrix(const TMatrixD& m)
-{
-    TMatrixD mout = m;
-    if(m.GetNrows() > 1 && m.GetNrows() <= 5)
-    {
-        mout.InvertFast();
-    }
-    else if(m.GetNrows() == 1)
-    {
-        mout[0][0] = 1./m[0][0];
-    }
-    else
-    {
-        mout.Invert();
-    }
-
-    return mout;
-}
-
-TMatrixD SMatrix::invertMatrixFast(const TMatrixD& m)
-{
-    TMatrixD mout = m;
-    mout.InvertFast();
-
-    return mout;
-}
-
-TMatrixD SMatrix::transposeMatrix(const TMatrixD& m)
-{
-    TMatrixD mout = m;
-    mout.T();
-
-    return mout;
-}
-
-void SMatrix::unitMatrix(TMatrixD& m)
-{
-    int nRows = m.GetNrows();
-    int nCols = m.GetNcols();
-    for(int i = 0; i < nRows; i++)
-    {
-        for(int j = 0; j < nCols; j++)
-        {
-            if(i == j)
-            {
-                m[i][j] = 1.;
-            }
-            else
-            {
-                m[i][j] = 0.;
-            }
-        }
-    }
-}
-
-void SMatrix::zeroMatrix(TMatrixD& m)
-{
-    int nRows = m.GetNrows();
-    int nCols = m.GetNcols();
-    for(int i = 0; i < nRows; i++)
-    {
-        for(int j = 0; j < nCols; j++)
-        {
-            m[i][j] = 0.;
-        }
-    }
-}
-
-TMatrixD SMatrix::getABC(const TMatrixD& A, const TMatrixD& B, const TMatrixD& C)
-{
-    return A*B*C;
-}
-
-TMatrixD SMatrix::getABCt(const TMatrixD& A, const TMatrixD& B, const TMatrixD& C)
-{
-    TMatrixD Ct = C;
-    Ct.T();
-
-    return A*B*Ct;
-}
-
-TMatrixD SMatrix::getAtBC(const TMatrixD& A, const TMatrixD& B, const TMatrixD& C)
-{
-    TMatrixD At = A;
-    At.T();
-
-    return At*B*C;
-}
-
-TMatrixD SMatrix::getABtC(const TMatrixD& A, const TMatrixD& B, const TMatrixD& C)
-{
-    TMatrixD Bt = B;
-    Bt.T();
-
-    return A*Bt*C;
-}
-
-TMatrixD SMatrix::getABtCinv(const TMatrixD& A, const TMatrixD& B, const TMatrixD& C)
-{
-    TMatrixD Bt = B;
-    Bt.T();
-    TMatrixD Cinv = invertMatrix(C);
-
-    return A*Bt*Cinv;
-}
-
 void TrkPar::flip_charge()
 {
     _state_kf[0][0] = -1.*_state_kf[0][0];
@@ -233,15 +92,12 @@ void Node::print(bool verbose)
 
 Node::Node()
 {
-    _measurement.ResizeTo(1, 1);
-    _measurement_cov.ResizeTo(1, 1);
-
-    _projector.ResizeTo(1, 5);
-    _propagator.ResizeTo(5, 5);
+    _dim = 1;
 
     _prediction_done = false;
     _filter_done = false;
     _smooth_done = false;
+    _ref_valid = false;
 
     _chisq = 0.;
 }
@@ -249,16 +105,12 @@ Node::Node()
 Node::Node(const Hit& hit_input)
 {
     _hit = hit_input;
-
-    _measurement.ResizeTo(1, 1);
-    _measurement_cov.ResizeTo(1, 1);
-
-    _projector.ResizeTo(1, 5);
-    _propagator.ResizeTo(5, 5);
+    _dim = 1;
 
     _prediction_done = false;
     _filter_done = false;
     _smooth_done = false;
+    _ref_valid = false;
 
     _chisq = 0.;
 
@@ -280,25 +132,31 @@ Node::Node(const Hit& hit_input)
 
 Node::Node(const SignedHit& hit_input)
 {
-    _hit = hit_input.hit;
-    _hit.index = _hit.index*hit_input.sign;
+    initSigned(hit_input.hit, hit_input.sign);
+}
 
-    _measurement.ResizeTo(1, 1);
-    _measurement_cov.ResizeTo(1, 1);
+Node::Node(const TrackletHit& hit_input)
+{
+    initSigned(hit_input.hit.getHit(), hit_input.sign);
+}
 
-    _projector.ResizeTo(1, 5);
-    _propagator.ResizeTo(5, 5);
+void Node::initSigned(const Hit& hit_input, int sign)
+{
+    _hit = hit_input;
+    _hit.index = _hit.index*sign;
+    _dim = 1;
 
     _prediction_done = false;
     _filter_done = false;
     _smooth_done = false;
+    _ref_valid = false;
 
     _chisq = 0.;
 
     GeomSvc* geometrySvc = GeomSvc::instance();
 
     double sigma;
-    if(hit_input.sign != 0)
+    if(sign != 0)
     {
         sigma = geometrySvc->getPlaneResolution(_hit.detectorID);
     }
@@ -306,7 +164,7 @@ Node::Node(const SignedHit& hit_input)
     {
         sigma = _hit.driftDistance;//geometrySvc->getPlaneSpacing(_hit.detectorID)/sqrt(12.);
     }
-    _measurement[0][0] = _hit.pos + hit_input.sign*_hit.driftDistance;
+    _measurement[0][0] = _hit.pos + sign*_hit.driftDistance;
     _measurement_cov[0][0] = sigma*sigma;
 
     _projector[0][3] = geometrySvc->getCostheta(_hit.detectorID);
@@ -318,63 +176,57 @@ Node::Node(const SignedHit& hit_input)
     _smoothed._z = _z;
 }
 
-void Node::setMeasurement(TMatrixD& m, TMatrixD& cov)
+KMatrix<2, 1> Node::getPredictedResidual()
 {
-    _measurement = m;
-    _measurement_cov = cov;
+    return _measurement - _projector*_predicted._state_kf;
 }
 
-TMatrixD Node::getPredictedResidual()
+KMatrix<2, 2> Node::getPredictedResidualCov()
 {
-    TMatrixD mout = _measurement;
-    mout -= (_projector*_predicted._state_kf);
-
-    return mout;
+    return _measurement_cov + SMatrix::getSimilarity(_projector, _predicted._covar_kf);
 }
 
-TMatrixD Node::getPredictedResidualCov()
+KMatrix<2, 1> Node::getFilteredResidual()
 {
-    TMatrixD mout = _measurement_cov;
-    mout += SMatrix::getABCt(_projector, _predicted._covar_kf, _projector);
-
-    return mout;
+    return _measurement - _projector*_filtered._state_kf;
 }
 
-TMatrixD Node::getFilteredResidual()
+KMatrix<2, 2> Node::getFilteredResidualCov()
 {
-    TMatrixD mout = _measurement;
-    mout -= (_projector*_filtered._state_kf);
-
-    return mout;
+    return _measurement_cov + SMatrix::getSimilarity(_projector, _filtered._covar_kf);
 }
 
-TMatrixD Node::getFilteredResidualCov()
+KMatrix<2, 1> Node::getSmoothedResidual()
 {
-    TMatrixD mout = _measurement_cov;
-    mout += SMatrix::getABCt(_projector, _filtered._covar_kf, _projector);
-
-    return mout;
+    return _measurement - _projector*_smoothed._state_kf;
 }
 
-TMatrixD Node::getSmoothedResidual()
+KMatrix<2, 2> Node::getSmoothedResidualCov()
 {
-    TMatrixD mout = _measurement;
-    mout -= (_projector*_smoothed._state_kf);
-
-    return mout;
+    return _measurement_cov + SMatrix::getSimilarity(_projector, _smoothed._covar_kf);
 }
 
-TMatrixD Node::getSmoothedResidualCov()
+template<unsigned int M>
+KMatrix<5, M> Node::calcKalmanGain()
 {
-    TMatrixD mout = _measurement_cov;
-    mout += SMatrix::getABCt(_projector, _smoothed._covar_kf, _projector);
+    KMatrix<M, 5> proj = _projector.getSub<M, 5>();
+    KMatrix<M, M> cov_m = _measurement_cov.getSub<M, M>();
 
-    return mout;
+    return SMatrix::getABtC(_predicted._covar_kf, proj, SMatrix::invertMatrix(cov_m + SMatrix::getSimilarity(proj, _predicted._covar_kf)));
 }
 
-TMatrixD Node::getKalmanGain()
+KMatrix<5, 2> Node::getKalmanGain()
 {
-    TMatrixD K = SMatrix::getABtC(_predicted._covar_kf, _projector, SMatrix::invertMatrix(_measurement_cov + SMatrix::getABCt(_projector, _predicted._covar_kf, _projector)));
+    KMatrix<5, 2> K;
+    if(_dim == 1)
+    {
+        K.setSub(calcKalmanGain<1>());
+    }
+    else
+    {
+        K.setSub(calcKalmanGain<2>());
+    }
+
     return K;
 }
 
@@ -387,3 +239,12 @@ void Node::resetFlags()
     _chisq = 0.;
 }
 
+void Node::setReference(double z_in, const KMatrix<5, 1>& state_in, double z_out, const KMatrix<5, 1>& state_out)
+{
+    _ref_valid = true;
+    _ref_z_in = z_in;
+    _ref_z_out = z_out;
+    _ref_state_in = state_in;
+    _ref_state_out = state_out;
+}
+
@@ -6,6 +6,9 @@ Utilities for kalman filter, including:
 2. Node: node defination for kalman filter
 3. SMatrix: some frequently used matrix manipulations
 
+All the matrices are fixed-size KMatrix (see KalmanMatrix.h), so no heap allocation happens in
+the filter steps.
+
 Author: Kun Liu, liuk@fnal.gov
 Created: 11-20-2011
 */
@@ -18,43 +21,235 @@ Created: 11-20-2011
 #include <iostream>
 #include <cmath>
 #include <string>
+#include <algorithm>
 
-#include <TMatrixD.h>
 #include <TVector3.h>
 
+#include "KalmanMatrix.h"
 #include "SRawEvent.h"
 #include "FastTracklet.h"
 
+///Frequently used matrix manipulations on the fixed-size KMatrix, the Sym versions assume
+///symmetric input and fill only one triangle before mirroring it
 class SMatrix
 {
 public:
-    static void printMatrix(const TMatrixD& m);
-    static void printMatrix(const TMatrixD& m, std::string str);
-    static TMatrixD invertMatrix(const TMatrixD& m);
-    static TMatrixD invertMatrixFast(const TMatrixD& m);
-    static TMatrixD transposeMatrix(const TMatrixD& m);
-    static void unitMatrix(TMatrixD& m);
-    static void zeroMatrix(TMatrixD& m);
-    static TMatrixD getABC(const TMatrixD& A, const TMatrixD& B, const TMatrixD& C);
-    static TMatrixD getABCt(const TMatrixD& A, const TMatrixD& B, const TMatrixD& C);
-    static TMatrixD getAtBC(const TMatrixD& A, const TMatrixD& B, const TMatrixD& C);
-    static TMatrixD getABtC(const TMatrixD& A, const TMatrixD& B, const TMatrixD& C);
-    static TMatrixD getABtCinv(const TMatrixD& A, const TMatrixD& B, const TMatrixD& C);
+    template<unsigned int R, unsigned int C> static void printMatrix(const KMatrix<R, C>& m);
+    template<unsigned int R, unsigned int C> static void printMatrix(const KMatrix<R, C>& m, std::string str);
+
+    ///Gauss-Jordan with partial pivoting, returns false if the matrix is singular
+    template<unsigned int N> static bool invertMatrix(const KMatrix<N, N>& m, KMatrix<N, N>& mout);
+    static bool invertMatrix(const KMatrix<1, 1>& m, KMatrix<1, 1>& mout);
+    static bool invertMatrix(const KMatrix<2, 2>& m, KMatrix<2, 2>& mout);
+    template<unsigned int N> static KMatrix<N, N> invertMatrix(const KMatrix<N, N>& m) { KMatrix<N, N> mout; invertMatrix(m, mout); return mout; }
+
+    ///Cholesky inversion of a symmetric positive definite matrix, returns false if it is not
+    template<unsigned int N> static bool invertSymMatrix(const KMatrix<N, N>& m, KMatrix<N, N>& mout);
+
+    template<unsigned int R, unsigned int C> static KMatrix<C, R> transposeMatrix(const KMatrix<R, C>& m) { return m.transpose(); }
+    template<unsigned int R, unsigned int C> static void unitMatrix(KMatrix<R, C>& m) { m.UnitMatrix(); }
+    template<unsigned int R, unsigned int C> static void zeroMatrix(KMatrix<R, C>& m) { m.Zero(); }
+
+    template<unsigned int R, unsigned int K, unsigned int L, unsigned int C>
+    static KMatrix<R, C> getABC(const KMatrix<R, K>& A, const KMatrix<K, L>& B, const KMatrix<L, C>& C_) { return A*B*C_; }
+    template<unsigned int R, unsigned int K, unsigned int L, unsigned int C>
+    static KMatrix<R, C> getABCt(const KMatrix<R, K>& A, const KMatrix<K, L>& B, const KMatrix<C, L>& C_) { return A*B*C_.transpose(); }
+    template<unsigned int R, unsigned int K, unsigned int L, unsigned int C>
+    static KMatrix<R, C> getAtBC(const KMatrix<K, R>& A, const KMatrix<K, L>& B, const KMatrix<L, C>& C_) { return A.transpose()*B*C_; }
+    template<unsigned int R, unsigned int K, unsigned int L, unsigned int C>
+    static KMatrix<R, C> getABtC(const KMatrix<R, K>& A, const KMatrix<L, K>& B, const KMatrix<L, C>& C_) { return A*B.transpose()*C_; }
+    template<unsigned int R, unsigned int K, unsigned int L>
+    static KMatrix<R, L> getABtCinv(const KMatrix<R, K>& A, const KMatrix<L, K>& B, const KMatrix<L, L>& C_) { return A*B.transpose()*invertMatrix(C_); }
+
+    ///A.B.A^t with symmetric B, the result is symmetric
+    template<unsigned int R, unsigned int N> static KMatrix<R, R> getSimilarity(const KMatrix<R, N>& A, const KMatrix<N, N>& B);
+
+    ///In-place m -= A.B^t for a symmetric result, e.g. the filtered covariance C - K.(C.H^t)^t
+    template<unsigned int N, unsigned int M> static void subtractSymProduct(KMatrix<N, N>& m, const KMatrix<N, M>& A, const KMatrix<N, M>& B);
 };
 
+template<unsigned int R, unsigned int C>
+void SMatrix::printMatrix(const KMatrix<R, C>& m)
+{
+    std::cout << "The matrix has " << R << " rows and " << C << " columns." << std::endl;
+    for(unsigned int i = 0; i < R; i++)
+    {
+        std::cout << "Line " << i << ":  ";
+        for(unsigned int j = 0; j < C; j++)
+        {
+            std::cout << m[i][j] << "  ";
+        }
+        std::cout << std::endl;
+    }
+}
+
+template<unsigned int R, unsigned int C>
+void SMatrix::printMatrix(const KMatrix<R, C>& m, std::string str)
+{
+    std::cout << "Printing the content of matrix: " << str << std::endl;
+    printMatrix(m);
+}
+
+template<unsigned int N>
+bool SMatrix::invertMatrix(const KMatrix<N, N>& m, KMatrix<N, N>& mout)
+{
+    KMatrix<N, N> a = m;
+    mout.UnitMatrix();
+    for(unsigned int i = 0; i < N; ++i)
+    {
+        unsigned int pivot = i;
+        for(unsigned int j = i + 1; j < N; ++j)
+        {
+            if(fabs(a[j][i]) > fabs(a[pivot][i])) pivot = j;
+        }
+        if(a[pivot][i] == 0.) return false;
+
+        if(pivot != i)
+        {
+            for(unsigned int k = 0; k < N; ++k)
+            {
+                std::swap(a[i][k], a[pivot][k]);
+                std::swap(mout[i][k], mout[pivot][k]);
+            }
+        }
+
+        double norm = 1./a[i][i];
+        for(unsigned int k = 0; k < N; ++k)
+        {
+            a[i][k] *= norm;
+            mout[i][k] *= norm;
+        }
+
+        for(unsigned int j = 0; j < N; ++j)
+        {
+            if(j == i || a[j][i] == 0.) continue;
+
+            double factor = a[j][i];
+            for(unsigned int k = 0; k < N; ++k)
+            {
+                a[j][k] -= factor*a[i][k];
+                mout[j][k] -= factor*mout[i][k];
+            }
+        }
+    }
+
+    return true;
+}
+
+inline bool SMatrix::invertMatrix(const KMatrix<1, 1>& m, KMatrix<1, 1>& mout)
+{
+    if(m[0][0] == 0.) return false;
+
+    mout[0][0] = 1./m[0][0];
+    return true;
+}
+
+inline bool SMatrix::invertMatrix(const KMatrix<2, 2>& m, KMatrix<2, 2>& mout)
+{
+    double det = m[0][0]*m[1][1] - m[0][1]*m[1][0];
+    if(det == 0.) return false;
+
+    mout[0][0] = m[1][1]/det;
+    mout[0][1] = -m[0][1]/det;
+    mout[1][0] = -m[1][0]/det;
+    mout[1][1] = m[0][0]/det;
+    return true;
+}
+
+template<unsigned int N>
+bool SMatrix::invertSymMatrix(const KMatrix<N, N>& m, KMatrix<N, N>& mout)
+{
+    ///m = L.L^t
+    KMatrix<N, N> l;
+    for(unsigned int j = 0; j < N; ++j)
+    {
+        double diag = m[j][j];
+        for(unsigned int k = 0; k < j; ++k) diag -= l[j][k]*l[j][k];
+        if(!(diag > 0.)) return false;
+        l[j][j] = sqrt(diag);
+
+        for(unsigned int i = j + 1; i < N; ++i)
+        {
+            double sum = m[i][j];
+            for(unsigned int k = 0; k < j; ++k) sum -= l[i][k]*l[j][k];
+            l[i][j] = sum/l[j][j];
+        }
+    }
+
+    ///L^{-1}, still lower triangular
+    KMatrix<N, N> linv;
+    for(unsigned int i = 0; i < N; ++i)
+    {
+        linv[i][i] = 1./l[i][i];
+        for(unsigned int j = 0; j < i; ++j)
+        {
+            double sum = 0.;
+            for(unsigned int k = j; k < i; ++k) sum += l[i][k]*linv[k][j];
+            linv[i][j] = -sum/l[i][i];
+        }
+    }
+
+    ///m^{-1} = L^{-t}.L^{-1}
+    for(unsigned int i = 0; i < N; ++i)
+    {
+        for(unsigned int j = i; j < N; ++j)
+        {
+            double sum = 0.;
+            for(unsigned int k = j; k < N; ++k) sum += linv[k][i]*linv[k][j];
+            mout[i][j] = sum;
+            mout[j][i] = sum;
+        }
+    }
+
+    return true;
+}
+
+template<unsigned int R, unsigned int N>
+KMatrix<R, R> SMatrix::getSimilarity(const KMatrix<R, N>& A, const KMatrix<N, N>& B)
+{
+    KMatrix<R, N> AB = A*B;
+
+    KMatrix<R, R> mout;
+    for(unsigned int i = 0; i < R; ++i)
+    {
+        for(unsigned int j = i; j < R; ++j)
+        {
+            double sum = 0.;
+            for(unsigned int k = 0; k < N; ++k) sum += AB[i][k]*A[j][k];
+            mout[i][j] = sum;
+            mout[j][i] = sum;
+        }
+    }
+
+    return mout;
+}
+
+template<unsigned int N, unsigned int M>
+void SMatrix::subtractSymProduct(KMatrix<N, N>& m, const KMatrix<N, M>& A, const KMatrix<N, M>& B)
+{
+    for(unsigned int i = 0; i < N; ++i)
+    {
+        for(unsigned int j = i; j < N; ++j)
+        {
+            double sum = 0.;
+            for(unsigned int k = 0; k < M; ++k) sum += A[i][k]*B[j][k];
+            m[i][j] -= sum;
+            m[j][i] = m[i][j];
+        }
+    }
+}
+
 class TrkPar
 {
 public:
     TrkPar()
     {
-        _state_kf.ResizeTo(5, 1);
-        _covar_kf.ResizeTo(5, 5);
         _z = 0;
     }
 
     ///Gets
-    const TMatrixD& get_state_vector() { return _state_kf; }
-    const TMatrixD& get_covariance() {return _covar_kf; }
+    const KMatrix<5, 1>& get_state_vector() { return _state_kf; }
+    const KMatrix<5, 5>& get_covariance() {return _covar_kf; }
     double get_x() { return _state_kf(3, 0); }
     double get_y() { return _state_kf(4, 0); }
     double get_z() { return _z; }
@@ -67,8 +262,8 @@ public:
     int get_charge() { return _state_kf[0][0] > 0 ? 1 : -1; }
 
     ///Sets
-    void set_state_vector(TMatrixD& state) { _state_kf = state; }
-    void set_covariance(TMatrixD& cov) { _covar_kf = cov; }
+    void set_state_vector(const KMatrix<5, 1>& state) { _state_kf = state; }
+    void set_covariance(const KMatrix<5, 5>& cov) { _covar_kf = cov; }
     void set_x(double val) { _state_kf[3][0] = val; }
     void set_y(double val) { _state_kf[4][0] = val; }
     void set_z(double val) { _z = val; }
@@ -82,8 +277,8 @@ public:
     void print();
 
     ///State vectors and its covariance
-    TMatrixD _state_kf;
-    TMatrixD _covar_kf;
+    KMatrix<5, 1> _state_kf;
+    KMatrix<5, 5> _covar_kf;
     double _z;
 };
 
@@ -98,6 +293,7 @@ public:
 
     ///Constructor from a signed hit to a Node
     Node(const SignedHit& _hit_signed);
+    Node(const TrackletHit& _hit_signed);
 
     ///print for debugging purposes
     void print(bool verbose = true);
@@ -107,21 +303,23 @@ public:
     TrkPar& getFiltered() { return _filtered; }
     TrkPar& getSmoothed() { return _smoothed; }
 
-    TMatrixD& getMeasurement() { return _measurement; }
-    TMatrixD& getMeasurementCov() { return _measurement_cov; }
+    ///The measurement is at most 2-D (x and y of the vertex), only the first getMeasurementDim() rows are used
+    unsigned int getMeasurementDim() { return _dim; }
+    KMatrix<2, 1>& getMeasurement() { return _measurement; }
+    KMatrix<2, 2>& getMeasurementCov() { return _measurement_cov; }
 
     ///Matrix calculations, should be called as less as possible
-    TMatrixD getPredictedResidual();
-    TMatrixD getPredictedResidualCov();
-    TMatrixD getFilteredResidual();
-    TMatrixD getFilteredResidualCov();
-    TMatrixD getSmoothedResidual();
-    TMatrixD getSmoothedResidualCov();
+    KMatrix<2, 1> getPredictedResidual();
+    KMatrix<2, 2> getPredictedResidualCov();
+    KMatrix<2, 1> getFilteredResidual();
+    KMatrix<2, 2> getFilteredResidualCov();
+    KMatrix<2, 1> getSmoothedResidual();
+    KMatrix<2, 2> getSmoothedResidualCov();
 
-    TMatrixD& getPropagator() { return _propagator; }
-    TMatrixD& getProjector() { return _projector; }
+    KMatrix<5, 5>& getPropagator() { return _propagator; }
+    KMatrix<2, 5>& getProjector() { return _projector; }
 
-    TMatrixD getKalmanGain();
+    KMatrix<5, 2> getKalmanGain();
 
     double getZ() { return _z; }
     double getChisq() { return _chisq; }
@@ -132,11 +330,11 @@ public:
     bool isFilterDone() { return _filter_done; }
     bool isSmoothDone() { return _smooth_done; }
 
-    ///Sets
-    void setMeasurement(TMatrixD& m, TMatrixD& cov);
+    ///Sets, the dimension of the measurement is taken from the input
+    template<unsigned int M> void setMeasurement(const KMatrix<M, 1>& m, const KMatrix<M, M>& cov);
+    template<unsigned int M> void setProjector(const KMatrix<M, 5>& p) { _projector.Zero(); _projector.setSub(p); }
     void setZ(double z) { _z = z; }
-    void setProjector(TMatrixD& p) { _projector = p; }
-    void setPropagator(TMatrixD& p) { _propagator = p; };
+    void setPropagator(const KMatrix<5, 5>& p) { _propagator = p; };
 
     void setPredictionDone(bool flag = true) { _prediction_done = flag; }
     void setFilterDone(bool flag = true) { _filter_done = flag; }
@@ -147,14 +345,31 @@ public:
 
     void resetFlags();
 
+    ///Linearization point of the last full propagation onto this node: the incoming state at z_in
+    ///and the predicted state at z_out, the propagator in between is the one stored in the node
+    bool hasReference() { return _ref_valid; }
+    double getReferenceZIn() { return _ref_z_in; }
+    double getReferenceZOut() { return _ref_z_out; }
+    const KMatrix<5, 1>& getReferenceStateIn() { return _ref_state_in; }
+    const KMatrix<5, 1>& getReferenceStateOut() { return _ref_state_out; }
+    void setReference(double z_in, const KMatrix<5, 1>& state_in, double z_out, const KMatrix<5, 1>& state_out);
+    void clearReference() { _ref_valid = false; }
+
     ///Overriden operators
     bool operator<(const Node& elem) const { return _z < elem._z; };
 
 private:
-    TMatrixD _measurement;
-    TMatrixD _measurement_cov;
-    TMatrixD _projector;
-    TMatrixD _propagator;
+    ///Common part of the signed hit constructors
+    void initSigned(const Hit& hit_input, int sign);
+
+    ///Kalman gain for a M-D measurement
+    template<unsigned int M> KMatrix<5, M> calcKalmanGain();
+
+    unsigned int _dim;
+    KMatrix<2, 1> _measurement;
+    KMatrix<2, 2> _measurement_cov;
+    KMatrix<2, 5> _projector;
+    KMatrix<5, 5> _propagator;
 
     double _z;
 
@@ -167,7 +382,24 @@ private:
     TrkPar _smoothed;
     double _chisq;
 
+    bool _ref_valid;
+    double _ref_z_in;
+    double _ref_z_out;
+    KMatrix<5, 1> _ref_state_in;
+    KMatrix<5, 1> _ref_state_out;
+
     Hit _hit;
 };
 
+template<unsigned int M>
+void Node::setMeasurement(const KMatrix<M, 1>& m, const KMatrix<M, M>& cov)
+{
+    _dim = M;
+
+    _measurement.Zero();
+    _measurement.setSub(m);
+    _measurement_cov.Zero();
+    _measurement_cov.setSub(cov);
+}
+
 #endif
@@ -118,12 +118,28 @@
 #define BEAM_SPOT_X 0.5
 #define BEAM_SPOT_Y 0.5
 
+//-------------- Kalman filter setup -------------
+//=== Initial covariance of the Kalman fit = KF_INIT_COV_SCALE x tracklet covariance
+#define KF_INIT_COV_SCALE 100.
+//=== Maximum state/z shift w.r.t. the last full propagation for which the propagator is reused
+#define KF_REUSE_DINVP 1E-4
+#define KF_REUSE_DSLOPE 1E-3
+#define KF_REUSE_DPOS 0.5
+#define KF_REUSE_DZ 1.
+
+//-------------- Dimuon vertex fit setup --------
+//=== Pre-screening of the pairs, a pair is only fitted if the swum trajectories come closer than VTX_PRESCREEN_DCA
+//=== and the sum of the single muon vertex chi squares is below VTX_PRESCREEN_CHISQ
+#define VTX_PRESCREEN_DCA 20.
+#define VTX_PRESCREEN_CHISQ 40.
+
 //-------------- Coarse swim setup --------------
 #define FMAG_HOLE_LENGTH 27.94
 #define FMAG_HOLE_RADIUS 1.27
 #define FMAG_LENGTH 502.92
 #define NSLICES_FMAG 100
 #define NSTEPS_TARGET 200
+#define SWIM_BLOCK_SIZE 16
 #define ELOSS_FMAG_P0 7.18274
 #define ELOSS_FMAG_P1 0.0361447
 #define ELOSS_FMAG_P2 -0.000718127
@@ -7,15 +7,59 @@ Author: Kun Liu, liuk@fnal.gov
 Created: 9-29-2013
 */
 
+#include <sstream>
+#include <map>
+#include <set>
+
 #include <boost/lexical_cast.hpp>
 #include <boost/math/special_functions/fpclassify.hpp>
 #include <TLorentzVector.h>
+#include <TThread.h>
 
 #include "FastTracklet.h"
 #include "MySQLSvc.h"
 
 MySQLSvc* MySQLSvc::p_mysqlSvc = NULL;
 
+//Head of the INSERT statement of each output table, followed by one or more value tuples
+static const char* insertHeads[3] = {
+    "INSERT INTO kTrack(trackID,runID,spillID,eventID,charge,roadID,numHits,numHitsSt1,numHitsSt2,numHitsSt3,"
+    "numHitsSt4H,numHitsSt4V,chisq,x0,y0,z0,px0,py0,pz0,x_target,y_target,z_target,x_dump,y_dump,z_dump,"
+    "x1,y1,z1,px1,py1,pz1,x3,y3,z3,px3,py3,pz3,tx_PT,ty_PT,chisq_target,chisq_dump,chisq_upstream) VALUES",
+    "INSERT INTO kTrackHit(runID,eventID,trackID,hitID,driftSign,residual) VALUES",
+    "INSERT INTO kDimuon(dimuonID,runID,spillID,eventID,posTrackID,negTrackID,dx,dy,dz,dpx,"
+    "dpy,dpz,mass,xF,xB,xT,trackSeparation,chisq_dimuon,px1,py1,pz1,px2,py2,pz2,isValid,isTarget,isDump) VALUES"};
+
+//Columns of the event header, QIE, trigger hit and hit queries, shared by the per-event and the prefetching reader
+static const char* headerColumns = "runID,spillID,MATRIX1,MATRIX2,MATRIX3,MATRIX4,MATRIX5,NIM1,NIM2,NIM3,NIM4,NIM5";
+static const char* qieColumns = "turnOnset,rfOnSet,`RF-16`,`RF-15`,`RF-14`,`RF-13`,`RF-12`,`RF-11`,`RF-10`,`RF-09`,"
+    "`RF-08`,`RF-07`,`RF-06`,`RF-05`,`RF-04`,`RF-03`,`RF-02`,`RF-01`,`RF+00`,`RF+01`,`RF+02`,"
+    "`RF+03`,`RF+04`,`RF+05`,`RF+06`,`RF+07`,`RF+08`,`RF+09`,`RF+10`,`RF+11`,`RF+12`,`RF+13`,"
+    "`RF+14`,`RF+15`,`RF+16`";
+static const char* triggerHitColumns = "hitID,detectorName,elementID,tdcTime,inTime";
+static const char* hitColumns = "hitID,elementID,tdcTime,driftDistance,detectorName,inTime,masked";
+#ifdef USE_M_TABLES
+static const char* hitTable = "mHit";
+#else
+static const char* hitTable = "Hit";
+#endif
+
+//Field conversion on any row, so that the prefetching thread does not touch the shared row
+static int fieldInt(TSQLRow* r, int id, int default_val = 0)
+{
+    if(r->GetField(id) == NULL) return default_val;
+    return boost::lexical_cast<int>(r->GetField(id));
+}
+
+static float fieldFloat(TSQLRow* r, int id, float default_val = 0.)
+{
+    if(r->GetField(id) == NULL) return default_val;
+    return boost::lexical_cast<float>(r->GetField(id));
+}
+
+//Multi-row statements are sent before they grow beyond this size, well below the default max_allowed_packet
+static const size_t MAX_BATCH_SIZE = 500000;
+
 MySQLSvc::MySQLSvc()
 {
     runID = -1;
@@ -43,11 +87,28 @@ MySQLSvc::MySQLSvc()
     readTargetPos = true;
     readTrackPos = true;
 
+    batchWriter = false;
+    batchEvents = 1;
+    batchSeconds = 0.;
+    nEventsBuffered = 0;
+    lastFlush = 0;
+    writerServer = NULL;
+    writerThread = NULL;
+    writerQueue = NULL;
+
+    prefetchSize = 0;
+    readerServer = NULL;
+    readerThread = NULL;
+    prefetchQueue = NULL;
+
     rndm.SetSeed(0);
 }
 
 MySQLSvc::~MySQLSvc()
 {
+    closeWriter();
+    closePrefetch();
+
     if(server != NULL) delete server;
     if(res != NULL) delete res;
     if(row != NULL) delete row;
@@ -228,6 +289,8 @@ bool MySQLSvc::getRandomEvt(SRawEvent* rawEvent)
 
 bool MySQLSvc::getNextEvent(SRawEvent* rawEvent)
 {
+    if(prefetchQueue != NULL) return getPrefetchedEvent(rawEvent);
+
     int eventID = eventIDs[index_eventID++];
 
     rawEvent->clear();
@@ -285,46 +348,100 @@ bool MySQLSvc::getEvent(SRawEvent* rawEvent, int eventID)
       eventID, eventID, eventID, eventID, eventID);
     #endif
     */
-#ifdef USE_M_TABLES
-    sprintf(query, "SELECT hitID,elementID,tdcTime,driftDistance,detectorName,inTime,masked FROM mHit WHERE (detectorName LIKE 'D%%' "
-            "OR detectorName LIKE 'H%%' OR detectorName LIKE 'P%%') AND eventID=%d", eventID);
-#else
-    sprintf(query, "SELECT hitID,elementID,tdcTime,driftDistance,detectorName,inTime,masked FROM Hit WHERE (detectorName LIKE 'D%%' "
-            "OR detectorName LIKE 'H%%' OR detectorName LIKE 'P%%') AND eventID=%d", eventID);
-#endif
+    sprintf(query, "SELECT %s FROM %s WHERE (detectorName LIKE 'D%%' OR detectorName LIKE 'H%%' OR detectorName LIKE 'P%%') AND eventID=%d",
+            hitColumns, hitTable, eventID);
     int nHits = makeQuery();
     if(nHits < 1) return false;
 
     for(int i = 0; i < nHits; ++i)
     {
         nextEntry();
+        rawEvent->insertHit(makeHit(row));
+    }
+    rawEvent->reIndex(true);
+
+    emulateTrigger(rawEvent);
+    return true;
+}
 
-        std::string detectorName(row->GetField(4));
-        int elementID = getInt(1);
-        p_geomSvc->toLocalDetectorName(detectorName, elementID);
-
-        Hit h;
-        h.index = getInt(0);
-        h.detectorID = p_geomSvc->getDetectorID(detectorName);
-        h.elementID = elementID;
-        h.tdcTime = getFloat(2);
-        h.driftDistance = getFloat(3);
-        h.pos = p_geomSvc->getMeasurement(h.detectorID, h.elementID);
-        if(getInt(5, 0) > 0) h.setInTime();
-        if(getInt(6, 0) > 0) h.setHodoMask();
-
-        if(p_geomSvc->isCalibrationLoaded())
+Hit MySQLSvc::makeHit(TSQLRow* r, int col)
+{
+    std::string detectorName(r->GetField(col+4));
+    int elementID = fieldInt(r, col+1);
+    p_geomSvc->toLocalDetectorName(detectorName, elementID);
+
+    Hit h;
+    h.index = fieldInt(r, col);
+    h.detectorID = p_geomSvc->getDetectorID(detectorName);
+    h.elementID = elementID;
+    h.tdcTime = fieldFloat(r, col+2);
+    h.driftDistance = fieldFloat(r, col+3);
+    h.pos = p_geomSvc->getMeasurement(h.detectorID, h.elementID);
+    if(fieldInt(r, col+5, 0) > 0) h.setInTime();
+    if(fieldInt(r, col+6, 0) > 0) h.setHodoMask();
+
+    if(p_geomSvc->isCalibrationLoaded())
+    {
+        if((h.detectorID >= 1 && h.detectorID <= 24) || (h.detectorID >= 41))
         {
-            if((h.detectorID >= 1 && h.detectorID <= 24) || (h.detectorID >= 41))
-            {
-                h.setInTime(p_geomSvc->isInTime(h.detectorID, h.tdcTime));
-                if(h.isInTime()) h.driftDistance = p_geomSvc->getDriftDistance(h.detectorID, h.tdcTime);
-            }
+            h.setInTime(p_geomSvc->isInTime(h.detectorID, h.tdcTime));
+            if(h.isInTime()) h.driftDistance = p_geomSvc->getDriftDistance(h.detectorID, h.tdcTime);
         }
-        rawEvent->insertHit(h);
     }
-    rawEvent->reIndex(true);
 
+    return h;
+}
+
+Hit MySQLSvc::makeTriggerHit(TSQLRow* r, int col)
+{
+    Hit h;
+    h.index = fieldInt(r, col);
+    h.elementID = fieldInt(r, col+2);
+    h.tdcTime = fieldFloat(r, col+3);
+    h.driftDistance = 0.;
+    if(fieldInt(r, col+4, 0) > 0) h.setInTime();
+
+    std::string detectorName(r->GetField(col+1));
+    if(detectorName.find("H4T") != std::string::npos || detectorName.find("H4B") != std::string::npos)
+    {
+        detectorName.replace(3, detectorName.length(), "");
+    }
+    h.detectorID = p_geomSvc->getDetectorID(detectorName);
+    h.pos = p_geomSvc->getMeasurement(h.detectorID, h.elementID);
+
+    return h;
+}
+
+void MySQLSvc::setEventHeader(SRawEvent* rawEvent, TSQLRow* r, int col, int eventID)
+{
+    rawEvent->setEventInfo(fieldInt(r, col), fieldInt(r, col+1), eventID);
+
+    int triggers[10];
+    for(int i = 0; i < 10; ++i)
+    {
+        triggers[i] = fieldInt(r, i+col+2);
+    }
+    rawEvent->setTriggerBits(triggers);
+}
+
+void MySQLSvc::setBeamInfo(SRawEvent* rawEvent, TSQLRow* r, int col)
+{
+    if(r != NULL)
+    {
+        rawEvent->setTurnID(fieldInt(r, col, -1));
+        rawEvent->setRFID(fieldInt(r, col+1, -1));
+        for(int i = 0; i < 33; ++i) rawEvent->setIntensity(i, fieldInt(r, i+col+2));
+    }
+    else
+    {
+        rawEvent->setTurnID(-2);
+        rawEvent->setRFID(-2);
+        for(int i = 0; i < 33; ++i) rawEvent->setIntensity(i, -1);
+    }
+}
+
+void MySQLSvc::emulateTrigger(SRawEvent* rawEvent)
+{
     //Set the trigger emulation info
     if(setTriggerEmu)
     {
@@ -347,10 +464,251 @@ bool MySQLSvc::getEvent(SRawEvent* rawEvent, int eventID)
         int nRoads[4] = {0, 0, 0, 0};
         rawEvent->setNRoads(nRoads);
     }
+}
+
+bool MySQLSvc::enablePrefetch(int blockSize, int nBlocks)
+{
+    if(server == NULL || readerThread != NULL || blockSize < 1) return false;
+
+    //The prefetching thread has its own connection, the main one is still used for the rest
+    char address[300];
+    sprintf(address, "mysql://%s:%d", server->GetHost(), server->GetPort());
+    readerServer = TSQLServer::Connect(address, user.c_str(), passwd.c_str());
+    if(readerServer == NULL)
+    {
+        LogInfo("Connection for the prefetching reader failed, events will be read one by one.");
+        return false;
+    }
+
+    sprintf(query, "USE %s", dataSchema.c_str());
+    readerServer->Exec(query);
+
+    prefetchSize = blockSize;
+    TThread::Initialize();
+    prefetchQueue = new ThreadQueue<SRawEvent*>(blockSize*(nBlocks > 1 ? nBlocks : 1));
+    readerThread = new TThread("sqlReader", runPrefetch, (void*)this);
+    readerThread->Run();
 
     return true;
 }
 
+void MySQLSvc::closePrefetch()
+{
+    if(readerThread == NULL) return;
+
+    //Stop the reader thread and drop what is not consumed yet
+    prefetchQueue->close();
+    SRawEvent* event;
+    while(prefetchQueue->pop(event)) delete event;
+    readerThread->Join();
+
+    delete readerThread;
+    delete prefetchQueue;
+    readerThread = NULL;
+    prefetchQueue = NULL;
+
+    readerServer->Close();
+    delete readerServer;
+    readerServer = NULL;
+}
+
+bool MySQLSvc::getPrefetchedEvent(SRawEvent* rawEvent)
+{
+    SRawEvent* event;
+    if(index_eventID >= int(eventIDs.size()) || !prefetchQueue->pop(event)) return false;
+
+    int eventID = eventIDs[index_eventID++];
+    eventIDs_loaded.push_back(eventID);
+
+    rawEvent->clear();
+    if(event == NULL) return false;
+
+    *rawEvent = *event;
+    delete event;
+
+    runID = rawEvent->getRunID();
+    spillID = rawEvent->getSpillID();
+
+    //Trigger emulation is not thread-safe, so it is done here rather than in the reader thread
+    emulateTrigger(rawEvent);
+    return true;
+}
+
+void* MySQLSvc::runPrefetch(void* arg)
+{
+    MySQLSvc* p_mysqlSvc = (MySQLSvc*)arg;
+
+    int nTotal = p_mysqlSvc->eventIDs.size();
+    for(int first = p_mysqlSvc->index_eventID; first < nTotal; first += p_mysqlSvc->prefetchSize)
+    {
+        int last = std::min(first + p_mysqlSvc->prefetchSize, nTotal);
+
+        std::vector<SRawEvent*> events;
+        p_mysqlSvc->prefetchEvents(first, last, events);
+
+        //One entry per eventID in the original order, NULL for the events that failed to load
+        for(unsigned int i = 0; i < events.size(); ++i)
+        {
+            if(p_mysqlSvc->prefetchQueue->push(events[i])) continue;
+
+            //Queue closed by the consumer
+            for(; i < events.size(); ++i) delete events[i];
+            return NULL;
+        }
+    }
+    p_mysqlSvc->prefetchQueue->close();
+
+    return NULL;
+}
+
+void MySQLSvc::prefetchEvents(int first, int last, std::vector<SRawEvent*>& events)
+{
+    //Events of this block by eventID, all the queries below cover the whole block
+    std::map<int, SRawEvent*> block;
+    std::ostringstream idList;
+    for(int i = first; i < last; ++i) idList << (i == first ? "" : ",") << eventIDs[i];
+
+    std::set<int> spills;
+    std::ostringstream sql;
+    sql << "SELECT eventID," << headerColumns << " FROM Event WHERE eventID IN (" << idList.str() << ")";
+
+    //As in getEventHeader an event needs exactly one header row, the others are dropped from the block
+    std::map<int, int> nRows;
+    TSQLResult* result = readerServer->Query(sql.str().c_str());
+    TSQLRow* r;
+    while(result != NULL && (r = result->Next()) != NULL)
+    {
+        int eventID = fieldInt(r, 0);
+        int nEventRows = ++nRows[eventID];
+        if(nEventRows == 1)
+        {
+            SRawEvent* event = new SRawEvent();
+            setEventHeader(event, r, 1, eventID);
+            if(readQIE) setBeamInfo(event, NULL);
+
+            block[eventID] = event;
+            spills.insert(event->getSpillID());
+        }
+        else if(nEventRows == 2)
+        {
+            delete block[eventID];
+            block.erase(eventID);
+        }
+        delete r;
+    }
+    delete result;
+
+    //Target positions are cached per spill, a spill without exactly one entry gets 99 as in getEventHeader
+    if(readTargetPos)
+    {
+        std::ostringstream spillList;
+        for(std::set<int>::iterator iter = spills.begin(); iter != spills.end(); ++iter)
+        {
+            if(targetPosCache.find(*iter) != targetPosCache.end()) continue;
+
+            spillList << (spillList.str().empty() ? "" : ",") << *iter;
+            targetPosCache[*iter] = 99;
+        }
+
+        if(!spillList.str().empty())
+        {
+            std::map<int, int> nEntries;
+            sql.str("");
+            sql << "SELECT spillID,targetPos FROM Spill WHERE spillID IN (" << spillList.str() << ")";
+            result = readerServer->Query(sql.str().c_str());
+            while(result != NULL && (r = result->Next()) != NULL)
+            {
+                int spill = fieldInt(r, 0);
+                targetPosCache[spill] = ++nEntries[spill] == 1 ? fieldInt(r, 1) : 99;
+                delete r;
+            }
+            delete result;
+        }
+
+        for(std::map<int, SRawEvent*>::iterator iter = block.begin(); iter != block.end(); ++iter)
+        {
+            iter->second->setTargetPos(targetPosCache[iter->second->getSpillID()]);
+        }
+    }
+
+    //Beam information, only set if there is exactly one QIE row of the event as in getEventHeader
+    if(readQIE)
+    {
+        nRows.clear();
+        sql.str("");
+        sql << "SELECT eventID," << qieColumns << " FROM QIE WHERE eventID IN (" << idList.str() << ")";
+        result = readerServer->Query(sql.str().c_str());
+        while(result != NULL && (r = result->Next()) != NULL)
+        {
+            std::map<int, SRawEvent*>::iterator iter = block.find(fieldInt(r, 0));
+            if(iter != block.end())
+            {
+                int nEventRows = ++nRows[iter->first];
+                if(nEventRows == 1) setBeamInfo(iter->second, r, 1);
+                if(nEventRows == 2) setBeamInfo(iter->second, NULL);
+            }
+            delete r;
+        }
+        delete result;
+    }
+
+    //Trigger hits
+    if(readTriggerHits)
+    {
+        sql.str("");
+        sql << "SELECT eventID," << triggerHitColumns << " FROM TriggerHit WHERE detectorName LIKE 'H%' AND eventID IN (" << idList.str() << ")";
+        result = readerServer->Query(sql.str().c_str());
+        while(result != NULL && (r = result->Next()) != NULL)
+        {
+            std::map<int, SRawEvent*>::iterator iter = block.find(fieldInt(r, 0));
+            if(iter != block.end()) iter->second->insertTriggerHit(makeTriggerHit(r, 1));
+            delete r;
+        }
+        delete result;
+    }
+
+    //All the hits of the block in one query
+    sql.str("");
+    sql << "SELECT eventID," << hitColumns << " FROM " << hitTable << " WHERE (detectorName LIKE 'D%' OR detectorName LIKE 'H%' "
+        << "OR detectorName LIKE 'P%') AND eventID IN (" << idList.str() << ")";
+    result = readerServer->Query(sql.str().c_str());
+    while(result != NULL && (r = result->Next()) != NULL)
+    {
+        std::map<int, SRawEvent*>::iterator iter = block.find(fieldInt(r, 0));
+        if(iter != block.end()) iter->second->insertHit(makeHit(r, 1));
+        delete r;
+    }
+    delete result;
+
+    //Hand them out in the order of the event list, events without header or hits are not valid
+    events.resize(last - first);
+    for(int i = first; i < last; ++i)
+    {
+        std::map<int, SRawEvent*>::iterator iter = block.find(eventIDs[i]);
+        if(iter == block.end() || iter->second == NULL)
+        {
+            events[i-first] = NULL;
+            continue;
+        }
+
+        SRawEvent* event = iter->second;
+        iter->second = NULL;
+        if(event->getNHitsAll() < 1)
+        {
+            delete event;
+            event = NULL;
+        }
+        else
+        {
+            event->reIndex(true);
+        }
+        events[i-first] = event;
+    }
+
+    //Duplicated eventIDs in the list are left over
+    for(std::map<int, SRawEvent*>::iterator iter = block.begin(); iter != block.end(); ++iter) delete iter->second;
+}
+
 int MySQLSvc::getNEvents()
 {
 #ifndef MC_MODE
@@ -380,21 +738,13 @@ bool MySQLSvc::getEventHeader(SRawEvent* rawEvent, int eventID)
     eventIDs_loaded.push_back(eventID);
 
     //Get the event header
-    sprintf(query, "SELECT runID,spillID,MATRIX1,MATRIX2,MATRIX3,MATRIX4,MATRIX5,NIM1,NIM2,NIM3,NIM4,NIM5 FROM Event WHERE eventID=%d", eventID);
+    sprintf(query, "SELECT %s FROM Event WHERE eventID=%d", headerColumns, eventID);
     if(makeQuery() != 1) return false;
 
     nextEntry();
-    runID = getInt(0);
-    spillID = getInt(1);
-    rawEvent->setEventInfo(runID, spillID, eventID);
-
-    //Get the trigger bits
-    int triggers[10];
-    for(int i = 0; i < 10; ++i)
-    {
-        triggers[i] = getInt(i+2);
-    }
-    rawEvent->setTriggerBits(triggers);
+    setEventHeader(rawEvent, row, 0, eventID);
+    runID = rawEvent->getRunID();
+    spillID = rawEvent->getSpillID();
 
     //Get target position
     if(readTargetPos)
@@ -414,52 +764,28 @@ bool MySQLSvc::getEventHeader(SRawEvent* rawEvent, int eventID)
     //Get beam information
     if(readQIE)
     {
-        sprintf(query, "SELECT turnOnset,rfOnSet,`RF-16`,`RF-15`,`RF-14`,`RF-13`,`RF-12`,`RF-11`,`RF-10`,`RF-09`,"
-                "`RF-08`,`RF-07`,`RF-06`,`RF-05`,`RF-04`,`RF-03`,`RF-02`,`RF-01`,`RF+00`,`RF+01`,`RF+02`,"
-                "`RF+03`,`RF+04`,`RF+05`,`RF+06`,`RF+07`,`RF+08`,`RF+09`,`RF+10`,`RF+11`,`RF+12`,`RF+13`,"
-                "`RF+14`,`RF+15`,`RF+16` FROM QIE WHERE eventID=%d", eventID);
+        sprintf(query, "SELECT %s FROM QIE WHERE eventID=%d", qieColumns, eventID);
         if(makeQuery() == 1)
         {
             nextEntry();
-
-            rawEvent->setTurnID(getInt(0, -1));
-            rawEvent->setRFID(getInt(1, -1));
-            for(int i = 0; i < 33; ++i) rawEvent->setIntensity(i, getInt(i+2));
+            setBeamInfo(rawEvent, row);
         }
         else
         {
-            rawEvent->setTurnID(-2);
-            rawEvent->setRFID(-2);
-            for(int i = 0; i < 33; ++i) rawEvent->setIntensity(i, -1);
+            setBeamInfo(rawEvent, NULL);
         }
     }
 
     //Get trigger hits
     if(readTriggerHits)
     {
-        sprintf(query, "SELECT hitID,detectorName,elementID,tdcTime,inTime FROM TriggerHit WHERE detectorName LIKE 'H%%' AND eventID=%d", eventID);
+        sprintf(query, "SELECT %s FROM TriggerHit WHERE detectorName LIKE 'H%%' AND eventID=%d", triggerHitColumns, eventID);
         int nTriggerHits = makeQuery();
 
         for(int i = 0; i < nTriggerHits; ++i)
         {
             nextEntry();
-
-            Hit h;
-            h.index = getInt(0);
-            h.elementID = getInt(2);
-            h.tdcTime = getFloat(3);
-            h.driftDistance = 0.;
-            if(getInt(4, 0) > 0) h.setInTime();
-
-            std::string detectorName(row->GetField(1));
-            if(detectorName.find("H4T") != std::string::npos || detectorName.find("H4B") != std::string::npos)
-            {
-                detectorName.replace(3, detectorName.length(), "");
-            }
-            h.detectorID = p_geomSvc->getDetectorID(detectorName);
-            h.pos = p_geomSvc->getMeasurement(h.detectorID, h.elementID);
-
-            rawEvent->insertTriggerHit(h);
+            rawEvent->insertTriggerHit(makeTriggerHit(row));
         }
     }
 
@@ -742,6 +1068,16 @@ void MySQLSvc::writeTrackingRes(SRecEvent* recEvent, TClonesArray* tracklets)
 
     nTracks += nTracks_local;
     nDimuons += nDimuons_local;
+
+    if(!batchWriter) return;
+    if(++nEventsBuffered >= batchEvents)
+    {
+        flushWriter();
+    }
+    else
+    {
+        pollWriter();
+    }
 }
 
 void MySQLSvc::writeTrackTable(int trackID, SRecTrack* recTrack)
@@ -795,19 +1131,12 @@ void MySQLSvc::writeTrackTable(int trackID, SRecTrack* recTrack)
     if(boost::math::isnan(px3) || boost::math::isnan(py3) || boost::math::isnan(pz3)) return;
 
     //Database output
-    sprintf(query, "INSERT INTO kTrack(trackID,runID,spillID,eventID,charge,roadID,numHits,numHitsSt1,numHitsSt2,numHitsSt3,"
-            "numHitsSt4H,numHitsSt4V,chisq,x0,y0,z0,px0,py0,pz0,x_target,y_target,z_target,x_dump,y_dump,z_dump,"
-            "x1,y1,z1,px1,py1,pz1,x3,y3,z3,px3,py3,pz3,tx_PT,ty_PT,chisq_target,chisq_dump,chisq_upstream) VALUES(%d,%d,%d,%d,"
-            "%d,%d,%d,%d,%d,%d,%d,%d,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f)",
+    sprintf(query, "(%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f)",
             trackID, runID, spillID, eventIDs_loaded.back(),charge, roadID, numHits, numHitsSt1, numHitsSt2, numHitsSt3, numHitsSt4H,
             numHitsSt4V, chisq, x0, y0, z0, px0, py0, pz0, proj_target.X(), proj_target.Y(), proj_target.Z(), proj_dump.X(),
             proj_dump.Y(), proj_dump.Z(), x1, y1, z1, px1, py1, pz1, x3, y3, z3, px3, py3, pz3, tx_prop, ty_prop, chisq_target,
             chisq_dump, chisq_upstream);
-#ifndef OUT_TO_SCREEN
-    server->Exec(query);
-#else
-    std::cout << __FUNCTION__ << ": " << query << std::endl;
-#endif
+    insertRow(kTrackTable, query);
 }
 
 void MySQLSvc::writeTrackHitTable(int trackID, Tracklet* tracklet)
@@ -816,13 +1145,9 @@ void MySQLSvc::writeTrackHitTable(int trackID, Tracklet* tracklet)
     {
         if(iter->hit.index < 0) continue;
 
-        sprintf(query, "INSERT INTO kTrackHit(runID,eventID,trackID,hitID,driftSign,residual) VALUES(%d,%d,%d,%d,%d,%f)",
-                runID, eventIDs_loaded.back(), trackID, iter->hit.index, iter->sign, tracklet->residual[iter->hit.detectorID-1]);
-#ifndef OUT_TO_SCREEN
-        server->Exec(query);
-#else
-        std::cout << __FUNCTION__ << ": " << query << std::endl;
-#endif
+        sprintf(query, "(%d,%d,%d,%d,%d,%f)", runID, eventIDs_loaded.back(), trackID, iter->hit.index, iter->sign,
+                tracklet->residual[iter->hit.detectorID-1]);
+        insertRow(kTrackHitTable, query);
     }
 }
 
@@ -842,20 +1167,144 @@ void MySQLSvc::writeDimuonTable(int dimuonID, SRecDimuon dimuon)
 
     double dz = dimuon.vtx_pos.Z() - dimuon.vtx_neg.Z();
 
-    sprintf(query, "INSERT INTO kDimuon(dimuonID,runID,spillID,eventID,posTrackID,negTrackID,dx,dy,dz,dpx,"
-            "dpy,dpz,mass,xF,xB,xT,trackSeparation,chisq_dimuon,px1,py1,pz1,px2,py2,pz2,isValid,isTarget,isDump) VALUES(%d,%d,%d,%d,"
-            "%d,%d,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%i,%i,%i)",
+    sprintf(query, "(%d,%d,%d,%d,%d,%d,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%i,%i,%i)",
             dimuonID, runID, spillID, eventIDs_loaded.back(), dimuon.trackID_pos+nTracks, dimuon.trackID_neg+nTracks,
             x0, y0, z0, px0, py0, pz0, dimuon.mass, dimuon.xF, dimuon.x1, dimuon.x2, dz, dimuon.chisq_kf,
             dimuon.p_pos.Px(), dimuon.p_pos.Py(), dimuon.p_pos.Pz(), dimuon.p_neg.Px(), dimuon.p_neg.Py(), dimuon.p_neg.Pz(),
             dimuon.isValid(), dimuon.isTarget(), dimuon.isDump());
+    insertRow(kDimuonTable, query);
+}
+
+void MySQLSvc::insertRow(OutputTable table, const char* values)
+{
+    if(!batchWriter)
+    {
+        std::string statement = std::string(insertHeads[table]) + values;
+        execute(statement.c_str());
+        return;
+    }
+
+    if(!rowBuffer[table].empty()) rowBuffer[table] += ",";
+    rowBuffer[table] += values;
+    if(rowBuffer[table].size() > MAX_BATCH_SIZE) flushTable(table);
+}
+
+void MySQLSvc::execute(const char* statement)
+{
 #ifndef OUT_TO_SCREEN
-    server->Exec(query);
+    server->Exec(statement);
 #else
-    std::cout << __FUNCTION__ << ": " << query << std::endl;
+    std::cout << __FUNCTION__ << ": " << statement << std::endl;
 #endif
 }
 
+bool MySQLSvc::enableBatchWriter(int nEvents, double nSeconds)
+{
+    if(server == NULL) return false;
+
+    batchWriter = true;
+    batchEvents = nEvents;
+    batchSeconds = nSeconds;
+    nEventsBuffered = 0;
+    lastFlush = time(NULL);
+    if(writerThread != NULL) return true;
+
+    //The writer thread has its own connection, the main one is still used by the reader
+    char address[300];
+    sprintf(address, "mysql://%s:%d", server->GetHost(), server->GetPort());
+    writerServer = TSQLServer::Connect(address, user.c_str(), passwd.c_str());
+    if(writerServer == NULL)
+    {
+        LogInfo("Connection for the batch writer failed, batches will be uploaded from the main thread.");
+        return false;
+    }
+
+    sprintf(query, "USE %s", dataSchema.c_str());
+    writerServer->Exec(query);
+
+    TThread::Initialize();
+    writerQueue = new ThreadQueue<std::string*>(50);
+    writerThread = new TThread("sqlWriter", runWriter, (void*)this);
+    writerThread->Run();
+
+    return true;
+}
+
+void MySQLSvc::flushTable(OutputTable table)
+{
+    if(rowBuffer[table].empty()) return;
+
+    std::string* statement = new std::string(insertHeads[table]);
+    statement->append(rowBuffer[table]);
+    rowBuffer[table].clear();
+
+    //Only blocks if the writer thread is more than the queue capacity behind
+    if(writerQueue != NULL)
+    {
+        writerQueue->push(statement);
+    }
+    else
+    {
+        execute(statement->c_str());
+        delete statement;
+    }
+}
+
+void MySQLSvc::flushWriter()
+{
+    if(!batchWriter) return;
+
+    for(int i = 0; i < nOutputTables; ++i) flushTable(OutputTable(i));
+    nEventsBuffered = 0;
+    lastFlush = time(NULL);
+}
+
+void MySQLSvc::pollWriter()
+{
+    if(batchWriter && difftime(time(NULL), lastFlush) >= batchSeconds) flushWriter();
+}
+
+void MySQLSvc::closeWriter()
+{
+    if(!batchWriter) return;
+
+    flushWriter();
+    if(writerThread != NULL)
+    {
+        writerQueue->close();
+        writerThread->Join();
+
+        delete writerThread;
+        delete writerQueue;
+        writerThread = NULL;
+        writerQueue = NULL;
+
+        writerServer->Close();
+        delete writerServer;
+        writerServer = NULL;
+    }
+
+    batchWriter = false;
+}
+
+void* MySQLSvc::runWriter(void* arg)
+{
+    MySQLSvc* p_mysqlSvc = (MySQLSvc*)arg;
+
+    std::string* statement;
+    while(p_mysqlSvc->writerQueue->pop(statement))
+    {
+#ifndef OUT_TO_SCREEN
+        if(!p_mysqlSvc->writerServer->Exec(statement->c_str())) LogInfo("Batch upload failed: " << p_mysqlSvc->writerServer->GetErrorMsg());
+#else
+        std::cout << __FUNCTION__ << ": " << *statement << std::endl;
+#endif
+        delete statement;
+    }
+
+    return NULL;
+}
+
 int MySQLSvc::getNEventsFast()
 {
     if(nEvents < 1) nEvents = getNEvents();
@@ -887,22 +1336,12 @@ bool MySQLSvc::nextEntry()
 
 int MySQLSvc::getInt(int id, int default_val)
 {
-    if(row->GetField(id) == NULL)
-    {
-        return default_val;
-    }
-
-    return boost::lexical_cast<int>(row->GetField(id));
+    return fieldInt(row, id, default_val);
 }
 
 float MySQLSvc::getFloat(int id, float default_val)
 {
-    if(row->GetField(id) == NULL)
-    {
-        return default_val;
-    }
-
-    return boost::lexical_cast<float>(row->GetField(id));
+    return fieldFloat(row, id, default_val);
 }
 
 
@@ -12,7 +12,9 @@ Created: 2013.9.29
 #include <vector>
 #include <string>
 #include <list>
+#include <map>
 #include <algorithm>
+#include <ctime>
 
 #include <TSQLServer.h>
 #include <TSQLResult.h>
@@ -26,6 +28,9 @@ Created: 2013.9.29
 #include "SRawEvent.h"
 #include "FastTracklet.h"
 #include "TriggerAnalyzer.h"
+#include "ThreadQueue.h"
+
+class TThread;
 
 //#define OUT_TO_SCREEN
 //#define USE_M_TABLES
@@ -60,6 +65,12 @@ public:
     bool getNextEvent(SRawEvent* rawEvent);
     bool getNextEvent(SRawMCEvent* rawEvent);
 
+    //Prefetching reader: a background thread with its own connection loads blocks of blockSize events
+    //from the event list with one query per table and keeps up to nBlocks blocks ready, used by
+    //getNextEvent(SRawEvent*) once enabled. Call after getNEvents(), not for the MC events
+    bool enablePrefetch(int blockSize = 1000, int nBlocks = 4);
+    void closePrefetch();
+
     //Check if the event has been loaded
     bool isEventLoaded(int eventID) { return std::find(eventIDs_loaded.begin(), eventIDs_loaded.end(), eventID) != eventIDs_loaded.end(); }
 
@@ -77,6 +88,16 @@ public:
     void writeTrackHitTable(int trackID, Tracklet* tracklet);
     void writeDimuonTable(int dimuonID, SRecDimuon dimuon);
 
+    //Buffered output: the rows are collected in memory and uploaded as multi-row INSERTs every
+    //nEvents events or every nSeconds seconds, by a background thread with its own connection.
+    //The time limit is checked by writeTrackingRes and pollWriter, so the event loop has to call
+    //pollWriter on the iterations which write nothing. While the loop waits for the next event
+    //nothing is checked, the rows are uploaded once it arrives or by closeWriter
+    bool enableBatchWriter(int nEvents = 200, double nSeconds = 5.);
+    void flushWriter();
+    void pollWriter();
+    void closeWriter();
+
     //Set the data schema
     void setWorkingSchema(std::string schema);
     void setLoggingSchema(std::string schema) { logSchema = schema; }
@@ -132,6 +153,23 @@ private:
     std::vector<int> eventIDs_loaded;
     int index_eventID;
 
+    //Conversion of one row to hits/event info, col is the column of the first field
+    Hit makeHit(TSQLRow* r, int col = 0);
+    Hit makeTriggerHit(TSQLRow* r, int col = 0);
+    void setEventHeader(SRawEvent* rawEvent, TSQLRow* r, int col, int eventID);
+    void setBeamInfo(SRawEvent* rawEvent, TSQLRow* r, int col = 0);
+    void emulateTrigger(SRawEvent* rawEvent);
+
+    //Prefetching reader
+    int prefetchSize;
+    TSQLServer* readerServer;
+    TThread* readerThread;
+    ThreadQueue<SRawEvent*>* prefetchQueue;
+    std::map<int, int> targetPosCache;
+    bool getPrefetchedEvent(SRawEvent* rawEvent);
+    void prefetchEvents(int first, int last, std::vector<SRawEvent*>& events);
+    static void* runPrefetch(void* arg);
+
     //Query string used in all clause
     char query[2000];
 
@@ -142,6 +180,25 @@ private:
     //Internal counter of tracks and dimuons
     int nTracks;
     int nDimuons;
+
+    //Either execute the single row INSERT right away or append the row to the batch buffer
+    enum OutputTable {kTrackTable, kTrackHitTable, kDimuonTable, nOutputTables};
+    void insertRow(OutputTable table, const char* values);
+    void flushTable(OutputTable table);
+    void execute(const char* statement);
+
+    //Batch writer buffers and the background thread
+    bool batchWriter;
+    int batchEvents;
+    double batchSeconds;
+    int nEventsBuffered;
+    time_t lastFlush;
+    std::string rowBuffer[nOutputTables];
+
+    TSQLServer* writerServer;
+    TThread* writerThread;
+    ThreadQueue<std::string*>* writerQueue;
+    static void* runWriter(void* arg);
 };
 
 #endif
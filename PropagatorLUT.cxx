@@ -0,0 +1,294 @@
+/*
+PropagatorLUT.cxx
+
+Implementation of the class PropagatorLUT
+
+Author: Kun Liu, liuk@fnal.gov
+Created: 10-22-2014
+*/
+
+#include <iostream>
+#include <cmath>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "PropagatorLUT.h"
+
+///Maximum distance between the node z and the tabulated plane z, covers the plane tilts
+static const double Z_TOLERANCE = 2.;
+
+PropagatorLUT::PropagatorLUT()
+{
+    buffer = NULL;
+    bufferSize = 0;
+
+    header = NULL;
+    links = NULL;
+    data = NULL;
+
+    nPlanes = 0;
+    nNodes = 0;
+}
+
+PropagatorLUT::~PropagatorLUT()
+{
+    release();
+}
+
+void PropagatorLUT::release()
+{
+    if(buffer != NULL) munmap(buffer, bufferSize);
+    buffer = NULL;
+    bufferSize = 0;
+
+    header = NULL;
+    links = NULL;
+    data = NULL;
+
+    nPlanes = 0;
+    nNodes = 0;
+}
+
+bool PropagatorLUT::init(std::string filename)
+{
+    release();
+
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        LogInfo("Failed to open the propagator table " << filename);
+        return false;
+    }
+
+    struct stat fileStat;
+    if(fstat(fd, &fileStat) != 0 || size_t(fileStat.st_size) < sizeof(PropLUTHeader))
+    {
+        LogInfo("Propagator table " << filename << " is not valid");
+        ::close(fd);
+        return false;
+    }
+
+    bufferSize = fileStat.st_size;
+    buffer = mmap(NULL, bufferSize, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(buffer == MAP_FAILED)
+    {
+        LogInfo("Failed to map the propagator table " << filename);
+        buffer = NULL;
+        release();
+        return false;
+    }
+
+    ///Check the header and the size before using anything
+    const PropLUTHeader* h = (const PropLUTHeader*)buffer;
+    size_t expected = sizeof(PropLUTHeader);
+    if(strncmp(h->magic, "KPROPLUT", 8) == 0 && h->version == PROPLUT_VERSION && h->nLinks > 0 && h->nLinks <= 2*nChamberPlanes)
+    {
+        expected += h->nLinks*(sizeof(PropLUTLink) + sizeof(float)*PROPLUT_NODE_SIZE*getNNodes(*h));
+    }
+    if(expected != bufferSize || getNNodes(*h) <= 0)
+    {
+        LogInfo("Propagator table " << filename << " is corrupted or of a different version");
+        release();
+        return false;
+    }
+
+    header = h;
+    links = (const PropLUTLink*)((const char*)buffer + sizeof(PropLUTHeader));
+    data = (const float*)((const char*)links + header->nLinks*sizeof(PropLUTLink));
+
+    nNodes = getNNodes(*header);
+    for(int i = 0; i < 5; ++i) step[i] = (header->max[i] - header->min[i])/(header->nBins[i] - 1);
+
+    ///Rebuild the sorted plane list from the links, which always connect adjacent planes
+    nPlanes = 0;
+    for(int i = 0; i < header->nLinks; ++i)
+    {
+        double z[2] = {links[i].z_from, links[i].z_to};
+        for(int j = 0; j < 2; ++j)
+        {
+            if(findPlane(z[j]) >= 0 && fabs(z_planes[findPlane(z[j])] - z[j]) < 1E-6) continue;
+            if(nPlanes == nChamberPlanes)
+            {
+                LogInfo("Propagator table " << filename << " has too many planes");
+                release();
+                return false;
+            }
+
+            int k = nPlanes++;
+            for(; k > 0 && z_planes[k-1] > z[j]; --k) z_planes[k] = z_planes[k-1];
+            z_planes[k] = z[j];
+        }
+    }
+
+    for(int i = 0; i < nPlanes; ++i) link_down[i] = link_up[i] = -1;
+    for(int i = 0; i < header->nLinks; ++i)
+    {
+        int from = findPlane(links[i].z_from);
+        int to = findPlane(links[i].z_to);
+        if(to == from + 1) link_down[from] = i;
+        if(to == from - 1) link_up[from] = i;
+    }
+
+    return true;
+}
+
+int PropagatorLUT::getNNodes(const PropLUTHeader& h)
+{
+    int n = 1;
+    for(int i = 0; i < 5; ++i)
+    {
+        if(h.nBins[i] < 2) return 0;
+        n *= h.nBins[i];
+    }
+
+    return n;
+}
+
+void PropagatorLUT::getNodeState(const PropLUTHeader& h, int index, double state[5])
+{
+    for(int i = 4; i >= 0; --i)
+    {
+        int bin = index % h.nBins[i];
+        index /= h.nBins[i];
+
+        state[i] = h.min[i] + bin*(h.max[i] - h.min[i])/(h.nBins[i] - 1);
+    }
+}
+
+int PropagatorLUT::findPlane(double z) const
+{
+    int index = -1;
+    double dz_min = Z_TOLERANCE;
+    for(int i = 0; i < nPlanes; ++i)
+    {
+        if(fabs(z - z_planes[i]) < dz_min)
+        {
+            dz_min = fabs(z - z_planes[i]);
+            index = i;
+        }
+    }
+
+    return index;
+}
+
+bool PropagatorLUT::propagate(double z_in, const KMatrix<5, 1>& state_in, double z_out, KMatrix<5, 1>& state_out, KMatrix<5, 5>& prop) const
+{
+    if(header == NULL) return false;
+
+    int from = findPlane(z_in);
+    int to = findPlane(z_out);
+    if(from < 0 || to < 0 || from == to) return false;
+
+    ///Straight line to the first tabulated plane
+    double state[5];
+    for(int i = 0; i < 5; ++i) state[i] = state_in[i][0];
+
+    double dz = z_planes[from] - z_in;
+    state[3] += dz*state[1];
+    state[4] += dz*state[2];
+
+    prop.UnitMatrix();
+    prop[3][1] = dz;
+    prop[4][2] = dz;
+
+    ///Chain of links
+    KMatrix<5, 5> prop_link;
+    double state_link[5];
+    int direction = to > from ? 1 : -1;
+    for(int i = from; i != to; i += direction)
+    {
+        int iLink = direction > 0 ? link_down[i] : link_up[i];
+        if(iLink < 0 || !propagateLink(iLink, state, state_link, prop_link)) return false;
+
+        for(int j = 0; j < 5; ++j) state[j] = state_link[j];
+        prop = prop_link*prop;
+    }
+
+    ///Straight line from the last tabulated plane
+    dz = z_out - z_planes[to];
+    state[3] += dz*state[1];
+    state[4] += dz*state[2];
+
+    KMatrix<5, 5> drift;
+    drift.UnitMatrix();
+    drift[3][1] = dz;
+    drift[4][2] = dz;
+    prop = drift*prop;
+
+    for(int i = 0; i < 5; ++i) state_out[i][0] = state[i];
+    return true;
+}
+
+bool PropagatorLUT::propagateLink(int iLink, const double state_in[5], double state_out[5], KMatrix<5, 5>& prop) const
+{
+    ///Lower grid node and the fractions in each dimension, outside the grid is not covered
+    int bin[5];
+    double frac[5];
+    for(int i = 0; i < 5; ++i)
+    {
+        double u = (state_in[i] - header->min[i])/step[i];
+        if(u < 0. || u > header->nBins[i] - 1) return false;
+
+        bin[i] = int(u);
+        if(bin[i] > header->nBins[i] - 2) bin[i] = header->nBins[i] - 2;
+        frac[i] = u - bin[i];
+    }
+
+    for(int i = 0; i < 5; ++i) state_out[i] = 0.;
+    prop.Zero();
+
+    ///Weighted sum of the first order expansions around the 32 surrounding nodes
+    const float* table = data + size_t(iLink)*nNodes*PROPLUT_NODE_SIZE;
+    for(int corner = 0; corner < 32; ++corner)
+    {
+        int index = 0;
+        double weight = 1.;
+        double delta[5];
+        for(int i = 0; i < 5; ++i)
+        {
+            int upper = (corner >> (4 - i)) & 1;
+            index = index*header->nBins[i] + bin[i] + upper;
+            weight *= upper == 1 ? frac[i] : 1. - frac[i];
+            delta[i] = state_in[i] - (header->min[i] + (bin[i] + upper)*step[i]);
+        }
+
+        const float* node = table + size_t(index)*PROPLUT_NODE_SIZE;
+        if(node[0] != node[0]) return false;       //failed extrapolation when building
+        if(weight == 0.) continue;
+
+        for(int i = 0; i < 5; ++i)
+        {
+            const float* row = node + 5 + 5*i;
+            double val = node[i];
+            for(int j = 0; j < 5; ++j)
+            {
+                val += row[j]*delta[j];
+                prop[i][j] += weight*row[j];
+            }
+            state_out[i] += weight*val;
+        }
+    }
+
+    return true;
+}
+
+void PropagatorLUT::print()
+{
+    if(header == NULL)
+    {
+        std::cout << "Propagator table is not loaded." << std::endl;
+        return;
+    }
+
+    const char* names[5] = {"q/p", "tx", "ty", "x", "y"};
+    std::cout << "Propagator table with " << header->nLinks << " links between " << nPlanes << " planes, " << nNodes << " nodes per link: " << std::endl;
+    for(int i = 0; i < 5; ++i)
+    {
+        std::cout << "  " << names[i] << ": " << header->nBins[i] << " nodes from " << header->min[i] << " to " << header->max[i] << std::endl;
+    }
+}
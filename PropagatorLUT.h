@@ -0,0 +1,114 @@
+/*
+PropagatorLUT.h
+
+Definition of the class PropagatorLUT, a pre-computed table of the track transport
+between the adjacent drift chamber planes, used by KalmanFilter::predict in place of
+the full TrackExtrapolator between stations 1 - 3.
+
+For each link between two adjacent chamber planes (in both directions), the final state
+and the propagator are tabulated on a regular grid in (q/p, tx, ty, x, y). The transport
+of an arbitrary state is the multi-linear interpolation of the first order expansions
+around the 32 surrounding grid nodes, and the transport between any two planes is the
+chain of the links in between. States that are off the plane z (tilted planes) are moved
+to the plane with a straight line. Anything outside of the table is left to the caller,
+which should fall back to the full extrapolation.
+
+The table is written once by analysis_tools/propLUT.cxx and memory mapped read-only at
+run time, so one copy is shared by all threads and all processes on the same node. The
+caller creates and initializes the table before starting the threads, and hands it to
+each KalmanFilter, which only reads it.
+
+Author: Kun Liu, liuk@fnal.gov
+Created: 10-22-2014
+*/
+
+#ifndef _PROPAGATORLUT_H
+#define _PROPAGATORLUT_H
+
+#include "MODE_SWITCH.h"
+
+#include <string>
+
+#include "KalmanMatrix.h"
+
+///Number of floats stored per grid node: final state (5) and propagator (5x5)
+#define PROPLUT_NODE_SIZE 30
+#define PROPLUT_VERSION 1
+
+///File layout: header, then nLinks PropLUTLink, then nLinks*nNodes*PROPLUT_NODE_SIZE floats
+struct PropLUTHeader
+{
+    char magic[8];
+    int version;
+    int nLinks;
+    int nBins[5];
+    int reserved;
+    double min[5];
+    double max[5];
+};
+
+struct PropLUTLink
+{
+    double z_from;
+    double z_to;
+};
+
+class PropagatorLUT
+{
+public:
+    PropagatorLUT();
+    ~PropagatorLUT();
+
+    ///Memory map the table file, a table already loaded is unmapped first
+    bool init(std::string filename);
+    bool isLoaded() const { return header != NULL; }
+
+    ///Transport the state vector from z_in to z_out, false if it's not covered by the table
+    bool propagate(double z_in, const KMatrix<5, 1>& state_in, double z_out, KMatrix<5, 1>& state_out, KMatrix<5, 5>& prop) const;
+
+    ///Tabulated planes, sorted in z
+    int getNPlanes() const { return nPlanes; }
+    double getPlaneZ(int index) const { return z_planes[index]; }
+    const PropLUTHeader* getHeader() const { return header; }
+
+    ///Grid definition, shared with the table builder
+    static int getNNodes(const PropLUTHeader& h);
+    static void getNodeState(const PropLUTHeader& h, int index, double state[5]);
+
+    ///Debug print
+    void print();
+
+private:
+    ///The mapping is owned by one object
+    PropagatorLUT(const PropagatorLUT&);
+    PropagatorLUT& operator=(const PropagatorLUT&);
+
+    ///Unmap the table and reset to the unloaded state
+    void release();
+
+    ///Index of the chamber plane z within tolerance, -1 if none
+    int findPlane(double z) const;
+
+    ///Transport through one link with the interpolation, the link goes from plane z_from to z_to
+    bool propagateLink(int iLink, const double state_in[5], double state_out[5], KMatrix<5, 5>& prop) const;
+
+    ///Memory mapped table
+    void* buffer;
+    size_t bufferSize;
+
+    const PropLUTHeader* header;
+    const PropLUTLink* links;
+    const float* data;
+
+    ///Sorted plane z and the link index between plane i and i+1 (downstream) or i-1 (upstream)
+    int nPlanes;
+    double z_planes[nChamberPlanes+1];
+    int link_down[nChamberPlanes+1];
+    int link_up[nChamberPlanes+1];
+
+    ///Grid steps and total number of nodes
+    double step[5];
+    int nNodes;
+};
+
+#endif
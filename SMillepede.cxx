@@ -122,9 +122,12 @@ void SMillepede::setEvent(TClonesArray* trks)
 
 void SMillepede::addTrack(Tracklet& trk)
 {
+    //Tracklets read from file only have the persistent hit list, the tracker works on the inline one
+    trk.unpackHits();
+
     //Push meanningful nodes
     nodes.clear();
-    for(std::list<SignedHit>::iterator iter = trk.hits.begin(); iter != trk.hits.end(); ++iter)
+    for(TrackletHitArray::iterator iter = trk.hitArray.begin(); iter != trk.hitArray.end(); ++iter)
     {
         if(iter->hit.index < 0)
         {
@@ -139,7 +142,8 @@ void SMillepede::addTrack(Tracklet& trk)
             iter->hit.index = -iter->hit.index;
             trk.calcChisq();
 
-            MPNode node_real(*iter, trk);
+            SignedHit hit_signed = iter->getSignedHit();
+            MPNode node_real(hit_signed, trk);
             nodes.push_back(node_real);
 
             ++nHits[iter->hit.detectorID - 1];
@@ -147,7 +151,7 @@ void SMillepede::addTrack(Tracklet& trk)
     }
 
     //Push dummy nodes
-    int detectorID_s3 = trk.hits.back().hit.detectorID > 18 ? 13 : 19;
+    int detectorID_s3 = trk.hitArray.back().hit.detectorID > 18 ? 13 : 19;
     for(int i = 0; i < 6; i++)
     {
         MPNode node_dummy(detectorID_s3 + i);
@@ -15,7 +15,14 @@ Created: Apr. 29, 2013
 #include <TObject.h>
 #include <TROOT.h>
 
+//the fixed-size Kalman matrices are not for CINT, MPNode only needs to know the names
+#ifndef __CINT__
 #include "KalmanUtil.h"
+#else
+class Node;
+class SignedHit;
+class Tracklet;
+#endif
 
 class MPNode: public TObject
 {
@@ -9,6 +9,7 @@ Created: 10-24-2011
 
 #include <iostream>
 #include <cmath>
+#include <algorithm>
 
 #include <TRandom.h>
 #include <TMath.h>
@@ -22,6 +23,22 @@ ClassImp(Hit)
 ClassImp(SRawEvent)
 ClassImp(SRawMCEvent)
 
+///Comparison of hit indices by the hit position, used to build and search the position-sorted index
+struct HitPosLess
+{
+    HitPosLess(const std::vector<Hit>& hits): fHits(hits) {}
+
+    bool operator()(Int_t i, Int_t j) const
+    {
+        if(fHits[i].pos != fHits[j].pos) return fHits[i].pos < fHits[j].pos;
+        return i < j;
+    }
+    bool operator()(Int_t i, Double_t pos) const { return fHits[i].pos < pos; }
+    bool operator()(Double_t pos, Int_t i) const { return pos < fHits[i].pos; }
+
+    const std::vector<Hit>& fHits;
+};
+
 Hit::Hit() : index(-1), detectorID(-1), flag(0)
 {
 }
@@ -81,7 +98,7 @@ bool Hit::operator==(const Hit& elem) const
     return false;
 }
 
-SRawEvent::SRawEvent() : fRunID(-1), fEventID(-1), fSpillID(-1), fTriggerBits(-1), fTriggerEmu(-1)
+SRawEvent::SRawEvent() : fRunID(-1), fEventID(-1), fSpillID(-1), fTriggerBits(-1), fTriggerEmu(-1), fIndexed(false)
 {
     fAllHits.clear();
     fTriggerHits.clear();
@@ -89,6 +106,10 @@ SRawEvent::SRawEvent() : fRunID(-1), fEventID(-1), fSpillID(-1), fTriggerBits(-1
     {
         fNHits[i] = 0;
     }
+    for(Int_t i = 0; i < nChamberPlanes+nHodoPlanes+nPropPlanes+2; i++)
+    {
+        fHitOffset[i] = 0;
+    }
 }
 
 SRawEvent::~SRawEvent()
@@ -109,6 +130,7 @@ void SRawEvent::insertHit(Hit h)
 
     fNHits[0]++;
     fNHits[h.detectorID]++;
+    fIndexed = false;
 }
 
 Int_t SRawEvent::findHit(Short_t detectorID, Short_t elementID)
@@ -225,97 +247,75 @@ std::list<Int_t> SRawEvent::getHitsIndexInDetectors(std::vector<Int_t>& detector
     return hit_list;
 }
 
-std::list<SRawEvent::hit_pair> SRawEvent::getPartialHitPairsInSuperDetector(Short_t detectorID)
+SRawEvent::hit_range SRawEvent::getHitsIndexRange(Short_t detectorID)
 {
-    std::list<SRawEvent::hit_pair> _hitpairs;
-    std::list<int> _hitlist1 = getHitsIndexInDetector(2*detectorID);
-    std::list<int> _hitlist2 = getHitsIndexInDetector(2*detectorID - 1);
+    if(!fIndexed) reIndex();
+    if(detectorID < 1 || detectorID > nChamberPlanes+nHodoPlanes+nPropPlanes) return hit_range(fHitIndex.end(), fHitIndex.end());
 
-    std::vector<int> _hitflag1(_hitlist1.size(), -1);
-    std::vector<int> _hitflag2(_hitlist2.size(), -1);
-
-    //Temp solutions here
-    double spacing[25] = {0., 0.40, 0.40, 0.40, 1.3, 1.3, 1.3, 1.2, 1.2, 1.2, 1.2, 1.2, 1.2,  //DCs
-                          4.0, 4.0, 7.0, 7.0, 8.0, 12.0, 12.0, 10.0,                          //hodos
-                          3.0, 3.0, 3.0, 3.0};                                                //prop tubes
-
-    int index1 = -1;
-    int index2 = -1;
-    for(std::list<int>::iterator iter = _hitlist1.begin(); iter != _hitlist1.end(); ++iter)
-    {
-        index1++;
-        index2 = -1;
-        for(std::list<int>::iterator jter = _hitlist2.begin(); jter != _hitlist2.end(); ++jter)
-        {
-            index2++;
-            if(fabs(fAllHits[*iter].pos - fAllHits[*jter].pos) > spacing[detectorID]) continue;
-            _hitpairs.push_back(std::make_pair(*iter, *jter));
+    return hit_range(fHitIndex.begin() + fHitOffset[detectorID], fHitIndex.begin() + fHitOffset[detectorID+1]);
+}
 
-            _hitflag1[index1] = 1;
-            _hitflag2[index2] = 1;
-        }
-    }
+SRawEvent::hit_range SRawEvent::getHitsIndexRange(Short_t detectorID, Double_t x_exp, Double_t win)
+{
+    hit_range range = getHitsIndexRange(detectorID);
 
-    index1 = 0;
-    for(std::list<int>::iterator iter = _hitlist1.begin(); iter != _hitlist1.end(); ++iter)
-    {
-        if(_hitflag1[index1] < 0) _hitpairs.push_back(std::make_pair(*iter, -1));
-        ++index1;
-    }
+    //same as the fabs(pos - x_exp) > win cut in getHitsIndexInDetector, both edges are included
+    HitPosLess comp(fAllHits);
+    hit_iterator first = std::lower_bound(range.first, range.second, x_exp - win, comp);
+    hit_iterator last = std::upper_bound(first, range.second, x_exp + win, comp);
 
-    index2 = 0;
-    for(std::list<int>::iterator iter = _hitlist2.begin(); iter != _hitlist2.end(); ++iter)
-    {
-        if(_hitflag2[index2] < 0) _hitpairs.push_back(std::make_pair(*iter, -1));
-        ++index2;
-    }
+    return hit_range(first, last);
+}
 
-    return _hitpairs;
+std::list<SRawEvent::hit_pair> SRawEvent::getPartialHitPairsInSuperDetector(Short_t detectorID)
+{
+    return getPartialHitPairs(detectorID, getHitsIndexRange(2*detectorID), getHitsIndexRange(2*detectorID - 1));
 }
 
 std::list<SRawEvent::hit_pair> SRawEvent::getPartialHitPairsInSuperDetector(Short_t detectorID, Double_t x_exp, Double_t win)
 {
-    std::list<SRawEvent::hit_pair> _hitpairs;
-    std::list<int> _hitlist1 = getHitsIndexInDetector(2*detectorID, x_exp, win);
-    std::list<int> _hitlist2 = getHitsIndexInDetector(2*detectorID - 1, x_exp, win+3);
+    return getPartialHitPairs(detectorID, getHitsIndexRange(2*detectorID, x_exp, win), getHitsIndexRange(2*detectorID - 1, x_exp, win+3));
+}
 
-    std::vector<int> _hitflag1(_hitlist1.size(), -1);
-    std::vector<int> _hitflag2(_hitlist2.size(), -1);
+std::list<SRawEvent::hit_pair> SRawEvent::getPartialHitPairs(Short_t detectorID, hit_range range1, hit_range range2)
+{
+    std::list<SRawEvent::hit_pair> _hitpairs;
+    std::vector<int> _hitflag2(range2.second - range2.first, -1);
 
     //Temp solutions here
     double spacing[25] = {0., 0.40, 0.40, 0.40, 1.3, 1.3, 1.3, 1.2, 1.2, 1.2, 1.2, 1.2, 1.2,  //DCs
                           4.0, 4.0, 7.0, 7.0, 8.0, 12.0, 12.0, 10.0,                          //hodos
                           3.0, 3.0, 3.0, 3.0};                                                //prop tubes
 
-    int index1 = -1;
-    int index2 = -1;
-    for(std::list<int>::iterator iter = _hitlist1.begin(); iter != _hitlist1.end(); ++iter)
+    //both ranges are sorted by position, so the partners of each hit are found by binary search
+    HitPosLess comp(fAllHits);
+    std::list<int> _unpaired1;
+    for(hit_iterator iter = range1.first; iter != range1.second; ++iter)
     {
-        index1++;
-        index2 = -1;
-        for(std::list<int>::iterator jter = _hitlist2.begin(); jter != _hitlist2.end(); ++jter)
+        double pos = fAllHits[*iter].pos;
+        hit_iterator jter = std::lower_bound(range2.first, range2.second, pos - spacing[detectorID], comp);
+        hit_iterator jend = std::upper_bound(jter, range2.second, pos + spacing[detectorID], comp);
+        if(jter == jend)
         {
-            index2++;
-            if(fabs(fAllHits[*iter].pos - fAllHits[*jter].pos) > spacing[detectorID]) continue;
-            _hitpairs.push_back(std::make_pair(*iter, *jter));
+            _unpaired1.push_back(*iter);
+            continue;
+        }
 
-            _hitflag1[index1] = 1;
-            _hitflag2[index2] = 1;
+        for(; jter != jend; ++jter)
+        {
+            _hitpairs.push_back(std::make_pair(*iter, *jter));
+            _hitflag2[jter - range2.first] = 1;
         }
     }
 
-    index1 = 0;
-    for(std::list<int>::iterator iter = _hitlist1.begin(); iter != _hitlist1.end(); ++iter)
+    for(std::list<int>::iterator iter = _unpaired1.begin(); iter != _unpaired1.end(); ++iter)
     {
-        if(_hitflag1[index1] < 0) _hitpairs.push_back(std::make_pair(*iter, -1));
-        ++index1;
+        _hitpairs.push_back(std::make_pair(*iter, -1));
     }
 
-    index2 = 0;
-    for(std::list<int>::iterator iter = _hitlist2.begin(); iter != _hitlist2.end(); ++iter)
+    for(hit_iterator jter = range2.first; jter != range2.second; ++jter)
     {
-        if(_hitflag2[index2] < 0) _hitpairs.push_back(std::make_pair(*iter, -1));
-        ++index2;
+        if(_hitflag2[jter - range2.first] < 0) _hitpairs.push_back(std::make_pair(*jter, -1));
     }
 
     return _hitpairs;
@@ -455,6 +455,32 @@ void SRawEvent::reIndex(bool doSort)
     for(UInt_t i = 0; i < fAllHits.size(); i++) ++fNHits[fAllHits[i].detectorID];
 
     fNHits[0] = fAllHits.size();
+
+    ///Rebuild the position-sorted index, bucket the hits by detectorID first and sort each plane by pos
+    fHitOffset[0] = 0;
+    fHitOffset[1] = 0;
+    for(Int_t i = 1; i <= nChamberPlanes+nHodoPlanes+nPropPlanes; i++) fHitOffset[i+1] = fHitOffset[i] + fNHits[i];
+
+    Int_t fill[nChamberPlanes+nHodoPlanes+nPropPlanes+1];
+    for(Int_t i = 1; i <= nChamberPlanes+nHodoPlanes+nPropPlanes; i++) fill[i] = fHitOffset[i];
+
+    ///Hits with an invalid detectorID (e.g. 0 for an unmapped channel) are left out of the index
+    fHitIndex.resize(fHitOffset[nChamberPlanes+nHodoPlanes+nPropPlanes+1]);
+    for(UInt_t i = 0; i < fAllHits.size(); i++)
+    {
+        Short_t detectorID = fAllHits[i].detectorID;
+        if(detectorID < 1 || detectorID > nChamberPlanes+nHodoPlanes+nPropPlanes) continue;
+
+        fHitIndex[fill[detectorID]++] = i;
+    }
+
+    HitPosLess comp(fAllHits);
+    for(Int_t i = 1; i <= nChamberPlanes+nHodoPlanes+nPropPlanes; i++)
+    {
+        if(fNHits[i] > 1) std::sort(fHitIndex.begin() + fHitOffset[i], fHitIndex.begin() + fHitOffset[i+1], comp);
+    }
+
+    fIndexed = true;
 }
 
 void SRawEvent::mergeEvent(const SRawEvent& event)
@@ -496,6 +522,7 @@ void SRawEvent::clear()
     //set everything to empty or impossible numbers
     fAllHits.clear();
     for(Int_t i = 0; i < nChamberPlanes+nHodoPlanes+nPropPlanes+1; i++) fNHits[i] = 0;
+    fIndexed = false;
 
     fRunID = -1;
     fSpillID = -1;
@@ -38,9 +38,9 @@ public:
     Hit(int detectorID, int elementID);
 
     //Decompose the data quality flag
-    bool isInTime() { return (flag & Hit::inTime) != 0; }
-    bool isHodoMask() { return (flag & Hit::hodoMask) != 0; }
-    bool isTriggerMask() { return (flag & Hit::triggerMask) != 0; }
+    bool isInTime() const { return (flag & Hit::inTime) != 0; }
+    bool isHodoMask() const { return (flag & Hit::hodoMask) != 0; }
+    bool isTriggerMask() const { return (flag & Hit::triggerMask) != 0; }
 
     //Set the flag
     void setFlag(UShort_t flag_input) { flag |= flag_input; }
@@ -98,6 +98,13 @@ public:
     std::list<Int_t> getHitsIndexInDetectors(std::vector<Int_t>& detectorIDs);
     std::list<Int_t> getAdjacentHitsIndex(Hit& _hit);
 
+    ///Position-sorted hit index built by reIndex(), the iterators point to the hit indices in fAllHits
+    ///Hits on one plane are sorted by pos, window queries are binary searches and allocate nothing
+    typedef std::vector<Int_t>::const_iterator hit_iterator;
+    typedef std::pair<hit_iterator, hit_iterator> hit_range;
+    hit_range getHitsIndexRange(Short_t detectorID);
+    hit_range getHitsIndexRange(Short_t detectorID, Double_t x_exp, Double_t win);
+
     Int_t getNHitsAll() { return fNHits[0]; }
     Int_t getNTriggerHits() { return fTriggerHits.size(); }
     Int_t getNChamberHitsAll();
@@ -112,7 +119,8 @@ public:
     Int_t getNHitsInSuperDetector(Short_t detectorID) { return fNHits[2*detectorID-1] + fNHits[2*detectorID]; }
     Int_t getNHitsInDetectors(std::vector<Int_t>& detectorIDs);
 
-    std::vector<Hit>& getAllHits() { return fAllHits; }
+    ///Read-only, the hits are changed through setHit/insertHit (or by EventReducer) to keep the index valid
+    const std::vector<Hit>& getAllHits() { return fAllHits; }
     std::vector<Hit>& getTriggerHits() { return fTriggerHits; }
     Hit getTriggerHit(Int_t index) { return fTriggerHits[index]; }
     Hit getHit(Int_t index) { return fAllHits[index]; }
@@ -126,7 +134,7 @@ public:
 
     ///Sets
     void setEventInfo(Int_t runID, Int_t spillID, Int_t eventID);
-    void setHit(Int_t index, Hit h) { fAllHits[index] = h; }
+    void setHit(Int_t index, Hit h) { fAllHits[index] = h; fIndexed = false; }
     void setTriggerHit(Int_t index, Hit h) { fTriggerHits[index] = h; }
 
     ///Insert a new hit
@@ -136,7 +144,7 @@ public:
     ///Find a hit -- binary search since hit list is sorted
     Int_t findHit(Short_t detectorID, Short_t elementID);
 
-    ///Reset the number hits on each plane
+    ///Reset the number hits on each plane and rebuild the position-sorted hit index
     void reIndex(bool doSort = false);
 
     ///Type of pair with two adjacent wires
@@ -194,7 +202,7 @@ public:
     void clear();
 
     ///only empty the hit list, leave other information untouched
-    void empty() { fAllHits.clear(); fTriggerHits.clear(); }
+    void empty() { fAllHits.clear(); fTriggerHits.clear(); fIndexed = false; }
 
     ///Print for debugging purposes
     void print();
@@ -219,6 +227,9 @@ public:
     };
 
 private:
+    ///Pair up the hits of two neighbouring planes, used by getPartialHitPairsInSuperDetector
+    std::list<SRawEvent::hit_pair> getPartialHitPairs(Short_t detectorID, hit_range range1, hit_range range2);
+
     //RunID, spillID, eventID
     Int_t fRunID;
     Int_t fEventID;
@@ -244,6 +255,13 @@ private:
     std::vector<Hit> fAllHits;
     std::vector<Hit> fTriggerHits;
 
+    ///Transient position-sorted index, hits of plane i are fHitIndex[fHitOffset[i]] ... fHitIndex[fHitOffset[i+1]-1]
+    ///It is not saved: fIndexed is reset by the read rule in SRawEventLinkDef.h when an event is streamed in,
+    ///and the queries rebuild the index if the hit list changed since the last reIndex()
+    bool fIndexed;                                                     //!
+    Int_t fHitOffset[nChamberPlanes+nHodoPlanes+nPropPlanes+2];        //!
+    std::vector<Int_t> fHitIndex;                                      //!
+
     ClassDef(SRawEvent, 8)
 };
 
@@ -8,4 +8,7 @@
 #pragma link C++ class SRawEvent+;
 #pragma link C++ class SRawMCEvent+;
 
+//The position-sorted hit index is transient, mark it stale whenever an event is read into a reused object
+#pragma read sourceClass="SRawEvent" version="[1-]" targetClass="SRawEvent" source="" target="fIndexed" code="{ fIndexed = false; }"
+
 #endif
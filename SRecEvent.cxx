@@ -59,49 +59,61 @@ Int_t SRecTrack::getNHitsInStation(Int_t stationID)
     return nHits;
 }
 
-void SRecTrack::setZVertex(Double_t z, bool update)
+void SRecTrack::setZVertex(Double_t z, KalmanFilter* kmfit, bool update)
 {
     Node _node_vertex;
+    fChisqVertex = fitVertexNode(z, kmfit, _node_vertex);
+    if(!update) return;
+
+    fVertexPos.SetXYZ(_node_vertex.getFiltered().get_x(), _node_vertex.getFiltered().get_y(), z);
+    fVertexMom = _node_vertex.getFiltered().get_mom_vec();
+
+    fStateVertex = _node_vertex.getFiltered()._state_kf.toTMatrixD();
+    fCovarVertex = _node_vertex.getFiltered()._covar_kf.toTMatrixD();
+}
+
+Double_t SRecTrack::getVertexAtZ(Double_t z, KalmanFilter* kmfit, TLorentzVector& mom)
+{
+    Node _node_vertex;
+    Double_t chisq = fitVertexNode(z, kmfit, _node_vertex);
+
+    //Same momentum as getMomentumVertex() after setZVertex(z, kmfit)
+    Double_t mmu = 0.10566;
+    Double_t px, py, pz;
+    TMatrixD state = _node_vertex.getFiltered()._state_kf.toTMatrixD();
+    getMomentum(state, px, py, pz);
+    mom.SetPxPyPzE(px, py, pz, sqrt(px*px + py*py + pz*pz + mmu*mmu));
+
+    return chisq;
+}
+
+Double_t SRecTrack::fitVertexNode(Double_t z, KalmanFilter* kmfit, Node& _node_vertex)
+{
     _node_vertex.setZ(z);
 
-    TMatrixD m(2, 1), cov(2, 2),  proj(2, 5);
-    m[0][0] = 0.;
-    m[1][0] = 0.;
+    KMatrix<2, 1> m;
+    KMatrix<2, 2> cov;
+    KMatrix<2, 5> proj;
 
-    cov.Zero();
     cov[0][0] = BEAM_SPOT_X*BEAM_SPOT_X;
     cov[1][1] = BEAM_SPOT_Y*BEAM_SPOT_Y;
 
-    proj.Zero();
     proj[0][3] = 1.;
     proj[1][4] = 1.;
 
-    _node_vertex.getMeasurement().ResizeTo(2, 1);
-    _node_vertex.getMeasurementCov().ResizeTo(2, 2);
-    _node_vertex.getProjector().ResizeTo(2, 5);
-
-    _node_vertex.getMeasurement() = m;
-    _node_vertex.getMeasurementCov() = cov;
-    _node_vertex.getProjector() = proj;
+    _node_vertex.setMeasurement(m, cov);
+    _node_vertex.setProjector(proj);
 
     TrkPar _trkpar_curr;
     _trkpar_curr._state_kf = fState[0];
     _trkpar_curr._covar_kf = fCovar[0];
     _trkpar_curr._z = fZ[0];
 
-    KalmanFilter* kmfit = KalmanFilter::instance();
     kmfit->enableDumpCorrection();
     kmfit->setCurrTrkpar(_trkpar_curr);
     kmfit->fit_node(_node_vertex);
 
-    fChisqVertex = _node_vertex.getChisq();
-    if(!update) return;
-
-    fVertexPos.SetXYZ(_node_vertex.getFiltered().get_x(), _node_vertex.getFiltered().get_y(), z);
-    fVertexMom = _node_vertex.getFiltered().get_mom_vec();
-
-    fStateVertex = _node_vertex.getFiltered()._state_kf;
-    fCovarVertex = _node_vertex.getFiltered()._covar_kf;
+    return _node_vertex.getChisq();
 }
 
 void SRecTrack::setVertexFast(TVector3 mom, TVector3 pos)
@@ -253,20 +265,96 @@ bool SRecTrack::isValid()
 
 void SRecTrack::swimToVertex(TVector3* pos, TVector3* mom)
 {
-    //Store the steps on each point (center of the interval)
-    bool cleanupPos = false;
-    bool cleanupMom = false;
-    if(pos == NULL)
+    //The trajectory is only swum again if the upstream state changed
+    updateTrajectory();
+
+    int nSteps = NSLICES_FMAG + NSTEPS_TARGET + 1;
+    if(pos != NULL)
     {
-        pos = new TVector3[NSLICES_FMAG + NSTEPS_TARGET + 1];
-        cleanupPos = true;
+        for(int i = 0; i < nSteps; ++i) pos[i].SetXYZ(fSwimTraj[6*i], fSwimTraj[6*i+1], fSwimTraj[6*i+2]);
     }
-    if(mom == NULL)
+    if(mom != NULL)
     {
-        mom = new TVector3[NSLICES_FMAG + NSTEPS_TARGET + 1];
-        cleanupMom = true;
+        for(int i = 0; i < nSteps; ++i) mom[i].SetXYZ(fSwimTraj[6*i+3], fSwimTraj[6*i+4], fSwimTraj[6*i+5]);
     }
 
+    //Save the dump position, it is taken from the middle of the FMAG step that crosses Z_DUMP
+    double step_fmag = FMAG_LENGTH/NSLICES_FMAG/2.;
+    double ptkick_unit = PT_KICK_FMAG/FMAG_LENGTH;
+    double ty = fState.front()[2][0];
+    double charge = getCharge();
+    for(int iStep = 1; iStep <= NSLICES_FMAG; ++iStep)
+    {
+        const double* step_i = &fSwimTraj[6*(iStep-1)];
+        double tx_i = step_i[3]/step_i[5];
+        double tx_f = tx_i + 2.*charge*ptkick_unit*step_fmag/sqrt(step_i[3]*step_i[3] + step_i[5]*step_i[5]);
+
+        TVector3 pos_b(step_i[0] - tx_i*step_fmag, step_i[1] - ty*step_fmag, step_i[2] - step_fmag);
+        if(fabs(pos_b.Z() - Z_DUMP) < step_fmag)
+        {
+            double dz = Z_DUMP - pos_b.Z();
+            if(dz < 0)
+            {
+                setDumpPos(pos_b + TVector3(tx_f*dz, ty*dz, dz));
+                setDumpMom(getSwimMom(iStep));
+            }
+            else
+            {
+                setDumpPos(pos_b + TVector3(tx_i*dz, ty*dz, dz));
+                setDumpMom(getSwimMom(iStep-1));
+            }
+        }
+    }
+
+    //Find the point with closest distance of approach
+    int iStep_min = nSteps - 1;
+    double dca_min = 1E9;
+    for(int i = 0; i < nSteps; ++i)
+    {
+        const double* step = &fSwimTraj[6*i];
+        double dca = sqrt(step[0]*step[0] + step[1]*step[1]);
+        if(dca < dca_min && charge*step[3] > 0.)
+        {
+            dca_min = dca;
+            iStep_min = i;
+        }
+    }
+
+    setVertexFast(getSwimMom(iStep_min), getSwimPos(iStep_min));
+    setDumpFacePos(getSwimPos(NSLICES_FMAG));
+    setDumpFaceMom(getSwimMom(NSLICES_FMAG));
+    setTargetPos(fDumpFacePos + TVector3(fDumpFaceMom.Px()/fDumpFaceMom.Pz()*Z_TARGET, fDumpFaceMom.Py()/fDumpFaceMom.Pz()*Z_TARGET, Z_TARGET));
+    setTargetMom(getSwimMom(NSLICES_FMAG));
+
+#ifdef _DEBUG_ON_LEVEL_2
+    std::cout << "The one with minimum DCA is: " << iStep_min << ": " << std::endl;
+    std::cout << fVertexMom[0]/fVertexMom[2] << "     " << fVertexMom[1]/fVertexMom[2] << "     " << fVertexMom[2] << "     ";
+    std::cout << fVertexPos[0] << "  " << fVertexPos[1] << "   " << fVertexPos[2] << std::endl << std::endl;
+#endif
+}
+
+bool SRecTrack::isTrajectoryValid()
+{
+    if(fState.empty() || fSwimTraj.size() != 6*(NSLICES_FMAG + NSTEPS_TARGET + 1)) return false;
+
+    const TMatrixD& state = fState.front();
+    return fSwimState[0] == state[1][0] && fSwimState[1] == state[2][0] && fSwimState[2] == state[3][0] &&
+           fSwimState[3] == state[4][0] && fSwimState[4] == state[0][0] && fSwimState[5] == fZ.front();
+}
+
+void SRecTrack::updateTrajectory()
+{
+    if(isTrajectoryValid()) return;
+
+    SRecTrack* track = this;
+    swimTrajectories(&track, 1);
+}
+
+///One FMAG step of a block of tracks in structure-of-arrays form, from z_b + step to z through the slice center z_b.
+///Only the steps near the hole need the per-track hole check, the version without it has no branch in the loop
+template<bool checkHole>
+inline void swimFMAGStep(int nBlock, double z_b, double z, double* x, double* y, double* px, double* py, double* pz, const double* ty, const double* charge)
+{
     //E-loss and pT-kick per length, note the eloss is done in half-slices
     double eloss_unit_0 = ELOSS_FMAG_P0/FMAG_LENGTH;
     double eloss_unit_1 = ELOSS_FMAG_P1/FMAG_LENGTH;
@@ -274,135 +362,194 @@ void SRecTrack::swimToVertex(TVector3* pos, TVector3* mom)
     double eloss_unit_3 = ELOSS_FMAG_P3/FMAG_LENGTH;
     double eloss_unit_4 = ELOSS_FMAG_P4/FMAG_LENGTH;
     double ptkick_unit = PT_KICK_FMAG/FMAG_LENGTH;
+    double step_fmag = FMAG_LENGTH/NSLICES_FMAG/2.;
 
-    //Step size in FMAG/target area
-    double step_fmag = FMAG_LENGTH/NSLICES_FMAG/2.;   //note that in FMag, each step is devided into two slices
-    double step_target = fabs(Z_UPSTREAM)/NSTEPS_TARGET;
-
-    //track slope/location in upstream
-    double tx = fState.front()[1][0];
-    double ty = fState.front()[2][0];
-    double x0 = fState.front()[3][0];
-    double y0 = fState.front()[4][0];
-    double z0 = fZ.front();
-
-    //Initial position should be on the downstream face of beam dump
-    pos[0].SetXYZ(x0 + tx*(FMAG_LENGTH - z0), y0 + ty*(FMAG_LENGTH - z0), FMAG_LENGTH);
-    mom[0] = getMomentumVecSt1();
-
-    //Charge of the track
-    double charge = getCharge();
-
-    //Now make the swim
-    int iStep = 1;
-    for(; iStep <= NSLICES_FMAG; ++iStep)
+    for(int j = 0; j < nBlock; ++j)
     {
         //Make pT kick at the center of slice, add energy loss at both first and last half-slice
-        //Note that ty is the global class data member, which does not change during the entire swimming
-        double tx_i = mom[iStep-1].Px()/mom[iStep-1].Pz();
-        double tx_f = tx_i + 2.*charge*ptkick_unit*step_fmag/sqrt(mom[iStep-1].Px()*mom[iStep-1].Px() + mom[iStep-1].Pz()*mom[iStep-1].Pz());
-
-        TVector3 trajVec1(tx_i*step_fmag, ty*step_fmag, step_fmag);
-        TVector3 pos_b = pos[iStep-1] - trajVec1;
-
-        double p_tot_i = mom[iStep-1].Mag();
-        double p_tot_b;
-        if(pos_b[2] > FMAG_HOLE_LENGTH || pos_b.Perp() > FMAG_HOLE_RADIUS)
+        //Note that ty does not change during the entire swimming
+        double tx_i = px[j]/pz[j];
+        double tx_f = tx_i + 2.*charge[j]*ptkick_unit*step_fmag/sqrt(px[j]*px[j] + pz[j]*pz[j]);
+
+        double traj1_x = tx_i*step_fmag;
+        double traj1_y = ty[j]*step_fmag;
+        double len1 = sqrt(traj1_x*traj1_x + traj1_y*traj1_y + step_fmag*step_fmag);
+        double x_b = x[j] - traj1_x;
+        double y_b = y[j] - traj1_y;
+
+        double p_tot_i = sqrt(px[j]*px[j] + py[j]*py[j] + pz[j]*pz[j]);
+        double p_tot_b = p_tot_i;
+        if(!checkHole || z_b > FMAG_HOLE_LENGTH || sqrt(x_b*x_b + y_b*y_b) > FMAG_HOLE_RADIUS)
         {
-            p_tot_b = p_tot_i + (eloss_unit_0 + p_tot_i*eloss_unit_1 + p_tot_i*p_tot_i*eloss_unit_2 + p_tot_i*p_tot_i*p_tot_i*eloss_unit_3 + p_tot_i*p_tot_i*p_tot_i*p_tot_i*eloss_unit_4)*trajVec1.Mag();
-        }
-        else
-        {
-            p_tot_b = p_tot_i;
+            p_tot_b = p_tot_i + (eloss_unit_0 + p_tot_i*eloss_unit_1 + p_tot_i*p_tot_i*eloss_unit_2 + p_tot_i*p_tot_i*p_tot_i*eloss_unit_3 + p_tot_i*p_tot_i*p_tot_i*p_tot_i*eloss_unit_4)*len1;
         }
 
-        TVector3 trajVec2(tx_f*step_fmag, ty*step_fmag, step_fmag);
-        pos[iStep] = pos_b - trajVec2;
+        double traj2_x = tx_f*step_fmag;
+        double traj2_y = ty[j]*step_fmag;
+        double len2 = sqrt(traj2_x*traj2_x + traj2_y*traj2_y + step_fmag*step_fmag);
+        x[j] = x_b - traj2_x;
+        y[j] = y_b - traj2_y;
 
-        double p_tot_f;
-        if(pos[iStep][2] > FMAG_HOLE_LENGTH || pos[iStep].Perp() > FMAG_HOLE_RADIUS)
+        double p_tot_f = p_tot_b;
+        if(!checkHole || z > FMAG_HOLE_LENGTH || sqrt(x[j]*x[j] + y[j]*y[j]) > FMAG_HOLE_RADIUS)
         {
-            p_tot_f = p_tot_b + (eloss_unit_0 + p_tot_b*eloss_unit_1 + p_tot_b*p_tot_b*eloss_unit_2 + p_tot_b*p_tot_b*p_tot_b*eloss_unit_3 + p_tot_b*p_tot_b*p_tot_b*p_tot_b*eloss_unit_4)*trajVec2.Mag();
+            p_tot_f = p_tot_b + (eloss_unit_0 + p_tot_b*eloss_unit_1 + p_tot_b*p_tot_b*eloss_unit_2 + p_tot_b*p_tot_b*p_tot_b*eloss_unit_3 + p_tot_b*p_tot_b*p_tot_b*p_tot_b*eloss_unit_4)*len2;
         }
-        else
+
+        //Now the final momentum in this step
+        pz[j] = p_tot_f/sqrt(1. + tx_f*tx_f + ty[j]*ty[j]);
+        px[j] = pz[j]*tx_f;
+        py[j] = pz[j]*ty[j];
+    }
+}
+
+void SRecTrack::swimTrajectories(SRecTrack** tracks, Int_t nTracks)
+{
+    //Tracks are swum in blocks of SWIM_BLOCK_SIZE, the state of the block is kept in structure-of-arrays form so
+    //that the per-step update below is a plain loop over the tracks, the arithmetic of each track is the same
+    //as in the original one-track swim so the results do not depend on the batch
+    const int blockSize = SWIM_BLOCK_SIZE;
+    int nSteps = NSLICES_FMAG + NSTEPS_TARGET + 1;
+
+    //Step size in FMAG/target area
+    double step_fmag = FMAG_LENGTH/NSLICES_FMAG/2.;   //note that in FMag, each step is devided into two slices
+    double step_target = fabs(Z_UPSTREAM)/NSTEPS_TARGET;
+
+    SRecTrack* block[blockSize];
+    double x[blockSize], y[blockSize], px[blockSize], py[blockSize], pz[blockSize];
+    double ty[blockSize], charge[blockSize];
+
+    int iTrack = 0;
+    while(iTrack < nTracks)
+    {
+        //Collect the next block of tracks that need to be swum
+        int nBlock = 0;
+        for(; iTrack < nTracks && nBlock < blockSize; ++iTrack)
         {
-            p_tot_f = p_tot_b;
+            SRecTrack* track = tracks[iTrack];
+            if(track->fState.empty() || track->isTrajectoryValid()) continue;
+
+            //track slope/location in upstream
+            double tx = track->fState.front()[1][0];
+            double z0 = track->fZ.front();
+            track->fSwimState[0] = tx;
+            track->fSwimState[1] = track->fState.front()[2][0];
+            track->fSwimState[2] = track->fState.front()[3][0];
+            track->fSwimState[3] = track->fState.front()[4][0];
+            track->fSwimState[4] = track->fState.front()[0][0];
+            track->fSwimState[5] = z0;
+
+            //Initial position should be on the downstream face of beam dump
+            ty[nBlock] = track->fSwimState[1];
+            x[nBlock] = track->fSwimState[2] + tx*(FMAG_LENGTH - z0);
+            y[nBlock] = track->fSwimState[3] + ty[nBlock]*(FMAG_LENGTH - z0);
+            track->getMomentumSt1(px[nBlock], py[nBlock], pz[nBlock]);
+            charge[nBlock] = track->getCharge();
+
+            track->fSwimTraj.resize(6*nSteps);
+            block[nBlock] = track;
+            ++nBlock;
         }
 
-        //Now the final position and momentum in this step
-        double pz_f = p_tot_f/sqrt(1. + tx_f*tx_f + ty*ty);
-        mom[iStep].SetXYZ(pz_f*tx_f, pz_f*ty, pz_f);
-        pos[iStep] = pos[iStep-1] - trajVec1 - trajVec2;
+        if(nBlock == 0) break;
 
-        //Save the dump position when applicable
-        if(fabs(pos_b.Z() - Z_DUMP) < step_fmag)
+        //All tracks share the same z on each step
+        double z = FMAG_LENGTH;
+        storeSwimStep(block, nBlock, 0, x, y, z, px, py, pz);
+
+        int iStep = 1;
+        for(; iStep <= NSLICES_FMAG; ++iStep)
         {
-            double dz = Z_DUMP - pos_b.Z();
-            if(dz < 0)
+            double z_b = z - step_fmag;
+            z = z_b - step_fmag;
+            if(z_b > FMAG_HOLE_LENGTH && z > FMAG_HOLE_LENGTH)
             {
-                setDumpPos(pos_b + TVector3(tx_f*dz, ty*dz, dz));
-                setDumpMom(mom[iStep]);
+                swimFMAGStep<false>(nBlock, z_b, z, x, y, px, py, pz, ty, charge);
             }
             else
             {
-                setDumpPos(pos_b + TVector3(tx_i*dz, ty*dz, dz));
-                setDumpMom(mom[iStep-1]);
+                swimFMAGStep<true>(nBlock, z_b, z, x, y, px, py, pz, ty, charge);
             }
+            storeSwimStep(block, nBlock, iStep, x, y, z, px, py, pz);
         }
 
-#ifdef _DEBUG_ON_LEVEL_2
-        std::cout << "FMAG: " << iStep << ": " << pos[iStep-1][2] << " ==================>>> " << pos[iStep][2] << std::endl;
-        std::cout << mom[iStep-1][0]/mom[iStep-1][2] << "     " << mom[iStep-1][1]/mom[iStep-1][2] << "     " << mom[iStep-1][2] << "     ";
-        std::cout << pos[iStep-1][0] << "  " << pos[iStep-1][1] << "   " << pos[iStep-1][2] << std::endl << std::endl;
-        std::cout << mom[iStep][0]/mom[iStep][2] << "     " << mom[iStep][1]/mom[iStep][2] << "     " << mom[iStep][2] << "     ";
-        std::cout << pos[iStep][0] << "  " << pos[iStep][1] << "   " << pos[iStep][2] << std::endl << std::endl;
-#endif
+        for(; iStep < nSteps; ++iStep)
+        {
+            //Simple straight line flight
+            z = z - step_target;
+            for(int j = 0; j < nBlock; ++j)
+            {
+                x[j] = x[j] - px[j]/pz[j]*step_target;
+                y[j] = y[j] - ty[j]*step_target;
+            }
+            storeSwimStep(block, nBlock, iStep, x, y, z, px, py, pz);
+        }
     }
+}
 
-    for(; iStep < NSLICES_FMAG+NSTEPS_TARGET+1; ++iStep)
+void SRecTrack::storeSwimStep(SRecTrack** block, Int_t nBlock, Int_t iStep, const Double_t* x, const Double_t* y, Double_t z, const Double_t* px, const Double_t* py, const Double_t* pz)
+{
+    for(int j = 0; j < nBlock; ++j)
     {
-        //Simple straight line flight
-        double tx_i = mom[iStep-1].Px()/mom[iStep-1].Pz();
-        TVector3 trajVec(tx_i*step_target, ty*step_target, step_target);
-
-        mom[iStep] = mom[iStep-1];
-        pos[iStep] = pos[iStep-1] - trajVec;
-
-#ifdef _DEBUG_ON_LEVEL_2
-        std::cout << "TARGET: " << iStep << ": " << pos[iStep-1][2] << " ==================>>> " << pos[iStep][2] << std::endl;
-        std::cout << mom[iStep-1][0]/mom[iStep-1][2] << "     " << mom[iStep-1][1]/mom[iStep-1][2] << "     " << mom[iStep-1][2] << "     ";
-        std::cout << pos[iStep-1][0] << "  " << pos[iStep-1][1] << "   " << pos[iStep-1][2] << std::endl << std::endl;
-        std::cout << mom[iStep][0]/mom[iStep][2] << "     " << mom[iStep][1]/mom[iStep][2] << "     " << mom[iStep][2] << "     ";
-        std::cout << pos[iStep][0] << "  " << pos[iStep][1] << "   " << pos[iStep][2] << std::endl << std::endl;
-#endif
+        double* step = &block[j]->fSwimTraj[6*iStep];
+        step[0] = x[j];
+        step[1] = y[j];
+        step[2] = z;
+        step[3] = px[j];
+        step[4] = py[j];
+        step[5] = pz[j];
     }
+}
 
-    //Now the swimming is done, find the point with closest distance of approach, let iStep store the index of that step
-    double dca_min = 1E9;
-    for(int i = 0; i < NSLICES_FMAG+NSTEPS_TARGET+1; ++i)
+int SRecTrack::findSwimStep(Double_t z)
+{
+    //The steps are ordered in decreasing z, start from the nominal step size and correct for the rounding
+    int nSteps = NSLICES_FMAG + NSTEPS_TARGET + 1;
+    int iStep;
+    if(z > 0.)
     {
-        double dca = pos[i].Perp();
-        if(dca < dca_min && charge*mom[i].Px() > 0.)
-        {
-            dca_min = dca;
-            iStep = i;
-        }
+        iStep = int((FMAG_LENGTH - z)/(FMAG_LENGTH/NSLICES_FMAG));
+    }
+    else
+    {
+        iStep = NSLICES_FMAG + int(-z/(fabs(Z_UPSTREAM)/NSTEPS_TARGET));
     }
 
-    setVertexFast(mom[iStep], pos[iStep]);
-    setDumpFacePos(pos[NSLICES_FMAG]);
-    setDumpFaceMom(mom[NSLICES_FMAG]);
-    setTargetPos(fDumpFacePos + TVector3(fDumpFaceMom.Px()/fDumpFaceMom.Pz()*Z_TARGET, fDumpFaceMom.Py()/fDumpFaceMom.Pz()*Z_TARGET, Z_TARGET));
-    setTargetMom(mom[NSLICES_FMAG]);
+    if(iStep < 0) iStep = 0;
+    if(iStep > nSteps - 2) iStep = nSteps - 2;
+    while(iStep > 0 && fSwimTraj[6*iStep+2] < z) --iStep;
+    while(iStep < nSteps - 2 && fSwimTraj[6*(iStep+1)+2] >= z) ++iStep;
 
-#ifdef _DEBUG_ON_LEVEL_2
-    std::cout << "The one with minimum DCA is: " << iStep << ": " << std::endl;
-    std::cout << mom[iStep][0]/mom[iStep][2] << "     " << mom[iStep][1]/mom[iStep][2] << "     " << mom[iStep][2] << "     ";
-    std::cout << pos[iStep][0] << "  " << pos[iStep][1] << "   " << pos[iStep][2] << std::endl << std::endl;
-#endif
+    return iStep;
+}
+
+void SRecTrack::getSwimPosition(Double_t z, Double_t& x, Double_t& y)
+{
+    updateTrajectory();
+
+    int iStep = findSwimStep(z);
+    const double* step_i = &fSwimTraj[6*iStep];
+    const double* step_f = &fSwimTraj[6*(iStep+1)];
+
+    double frac = (z - step_i[2])/(step_f[2] - step_i[2]);
+    x = step_i[0] + frac*(step_f[0] - step_i[0]);
+    y = step_i[1] + frac*(step_f[1] - step_i[1]);
+}
+
+Double_t SRecTrack::getSwimMomentum(Double_t z, Double_t& px, Double_t& py, Double_t& pz)
+{
+    updateTrajectory();
 
-    if(cleanupPos) delete[] pos;
-    if(cleanupMom) delete[] mom;
+    int iStep = findSwimStep(z);
+    const double* step_i = &fSwimTraj[6*iStep];
+    const double* step_f = &fSwimTraj[6*(iStep+1)];
+
+    double frac = (z - step_i[2])/(step_f[2] - step_i[2]);
+    px = step_i[3] + frac*(step_f[3] - step_i[3]);
+    py = step_i[4] + frac*(step_f[4] - step_i[4]);
+    pz = step_i[5] + frac*(step_f[5] - step_i[5]);
+
+    return sqrt(px*px + py*py + pz*pz);
 }
 
 void SRecTrack::print()
@@ -547,6 +694,18 @@ std::vector<Int_t> SRecEvent::getChargedTrackIDs(Int_t charge)
     return trkIDs;
 }
 
+void SRecEvent::swimTracks()
+{
+    std::vector<SRecTrack*> tracks;
+    tracks.reserve(fAllTracks.size());
+    for(std::vector<SRecTrack>::iterator iter = fAllTracks.begin(); iter != fAllTracks.end(); ++iter)
+    {
+        tracks.push_back(&(*iter));
+    }
+
+    if(!tracks.empty()) SRecTrack::swimTrajectories(&tracks[0], tracks.size());
+}
+
 void SRecEvent::clear()
 {
     fAllTracks.clear();
@@ -32,6 +32,9 @@ Created: 01-21-2013
 
 #include "SRawEvent.h"
 
+class KalmanFilter;
+class Node;
+
 class SRecTrack: public TObject
 {
 public:
@@ -94,9 +97,12 @@ public:
     ///Fast-adjust of kmag
     void adjustKMag(double kmagStr);
 
-    ///Vertex stuff
+    ///Vertex stuff, the Kalman filter is provided by the caller
     bool isVertexValid();
-    void setZVertex(Double_t z, bool update = true);
+    void setZVertex(Double_t z, KalmanFilter* kmfit, bool update = true);
+
+    ///Vertex chi square and momentum at z without touching the stored vertex, so that many fits can share the track
+    Double_t getVertexAtZ(Double_t z, KalmanFilter* kmfit, TLorentzVector& mom);
 
     ///Plain setting, no KF-related stuff
     void setVertexFast(TVector3 mom, TVector3 pos);
@@ -104,6 +110,25 @@ public:
     ///Simple swim to vertex
     void swimToVertex(TVector3* pos = NULL, TVector3* mom = NULL);
 
+    ///Trajectory of the swim through FMAG and the target area, swum once and reused until the upstream state changes
+    ///Step i holds (x, y, z, px, py, pz), the z of each step is the same for all tracks
+    void updateTrajectory();
+    bool isTrajectoryValid();
+
+    ///Swim the trajectories of many tracks at once, e.g. all tracks of an event or of a block of events, the
+    ///tracks are updated in structure-of-arrays blocks and the result is the same as swimming them one by one,
+    ///tracks with a valid trajectory are skipped
+    static void swimTrajectories(SRecTrack** tracks, Int_t nTracks);
+    Int_t getNSwimSteps() { return NSLICES_FMAG + NSTEPS_TARGET + 1; }
+    const Double_t* getSwimStep(Int_t iStep) { updateTrajectory(); return &fSwimTraj[6*iStep]; }
+    TVector3 getSwimPos(Int_t iStep) { const Double_t* step = getSwimStep(iStep); return TVector3(step[0], step[1], step[2]); }
+    TVector3 getSwimMom(Int_t iStep) { const Double_t* step = getSwimStep(iStep); return TVector3(step[3], step[4], step[5]); }
+
+    ///Position/momentum along the swum trajectory at any z between Z_UPSTREAM and FMAG_LENGTH, linearly interpolated
+    void getSwimPosition(Double_t z, Double_t& x, Double_t& y);
+    Double_t getSwimMomentum(Double_t z, Double_t& px, Double_t& py, Double_t& pz);
+    Double_t getSwimDCA(Double_t z) { Double_t x, y; getSwimPosition(z, x, y); return sqrt(x*x + y*y); }
+
     ///Get the vertex info
     TLorentzVector getMomentumVertex();
     Double_t getMomentumVertex(Double_t& px, Double_t& py, Double_t& pz) { return getMomentum(fStateVertex, px, py, pz); }
@@ -158,6 +183,15 @@ public:
     void print();
 
 private:
+    ///Copy step iStep of a block of tracks from the structure-of-arrays state into their trajectories
+    static void storeSwimStep(SRecTrack** block, Int_t nBlock, Int_t iStep, const Double_t* x, const Double_t* y, Double_t z, const Double_t* px, const Double_t* py, const Double_t* pz);
+
+    ///Index of the last step upstream of z, i.e. the step right before z is crossed
+    Int_t findSwimStep(Double_t z);
+
+    ///Kalman fit of the first node to the beam spot at z, returns the chi square
+    Double_t fitVertexNode(Double_t z, KalmanFilter* kmfit, Node& _node_vertex);
+
     ///Total Chisq
     Double_t fChisq;
 
@@ -201,6 +235,10 @@ private:
     Double_t fChisqDump;
     Double_t fChisqUpstream;
 
+    ///Transient swim trajectory and the upstream state (tx, ty, x0, y0, q/p, z0) it was swum from
+    std::vector<Double_t> fSwimTraj;    //!
+    Double_t fSwimState[6];             //!
+
     ClassDef(SRecTrack, 9)
 };
 
@@ -311,6 +349,9 @@ public:
     ///Insert dimuon
     void insertDimuon(SRecDimuon dimuon) { fDimuons.push_back(dimuon); }
 
+    ///Swim all tracks whose trajectory is not up to date in one batch
+    void swimTracks();
+
     ///Clear everything
     void clear();
 
@@ -0,0 +1,123 @@
+/*
+ThreadQueue.h
+
+Light-weighted thread-safe containers used to pass events between the reader, worker and
+writer stages of the multi-threaded executables. ThreadQueue is a bounded FIFO, OrderedQueue
+hands the items back in the order of their sequence index regardless of the order they arrive.
+
+Based on ROOT TMutex/TCondition, so no extra dependency on top of libThread
+
+Author: Kun Liu, liuk@fnal.gov
+Created: 10-16-2014
+*/
+
+#ifndef _THREADQUEUE_H
+#define _THREADQUEUE_H
+
+#include <list>
+#include <map>
+
+#include <TMutex.h>
+#include <TCondition.h>
+
+template<class T>
+class ThreadQueue
+{
+public:
+    ThreadQueue(unsigned int capacity = 100): fCapacity(capacity), fClosed(false), fNotEmpty(&fMutex), fNotFull(&fMutex) {}
+
+    ///Blocks while the queue is full, returns false if the queue is already closed
+    bool push(const T& item)
+    {
+        fMutex.Lock();
+        while(fQueue.size() >= fCapacity && !fClosed) fNotFull.Wait();
+        if(fClosed)
+        {
+            fMutex.UnLock();
+            return false;
+        }
+
+        fQueue.push_back(item);
+        fNotEmpty.Signal();
+        fMutex.UnLock();
+
+        return true;
+    }
+
+    ///Blocks while the queue is empty, returns false once it is closed and drained
+    bool pop(T& item)
+    {
+        fMutex.Lock();
+        while(fQueue.empty() && !fClosed) fNotEmpty.Wait();
+        if(fQueue.empty())
+        {
+            fMutex.UnLock();
+            return false;
+        }
+
+        item = fQueue.front();
+        fQueue.pop_front();
+        fNotFull.Signal();
+        fMutex.UnLock();
+
+        return true;
+    }
+
+    ///No more input, wake up everybody waiting
+    void close()
+    {
+        fMutex.Lock();
+        fClosed = true;
+        fNotEmpty.Broadcast();
+        fNotFull.Broadcast();
+        fMutex.UnLock();
+    }
+
+private:
+    unsigned int fCapacity;
+    bool fClosed;
+    std::list<T> fQueue;
+
+    TMutex fMutex;
+    TCondition fNotEmpty;
+    TCondition fNotFull;
+};
+
+template<class T>
+class OrderedQueue
+{
+public:
+    OrderedQueue(long firstIndex = 0): fNext(firstIndex), fReady(&fMutex) {}
+
+    ///Items can be pushed in any order
+    void push(long index, const T& item)
+    {
+        fMutex.Lock();
+        fPending.insert(std::make_pair(index, item));
+        if(index == fNext) fReady.Broadcast();
+        fMutex.UnLock();
+    }
+
+    ///Blocks until the item with the next sequence index is available
+    T pop()
+    {
+        fMutex.Lock();
+        while(fPending.empty() || fPending.begin()->first != fNext) fReady.Wait();
+
+        T item = fPending.begin()->second;
+        fPending.erase(fPending.begin());
+        ++fNext;
+        fMutex.UnLock();
+
+        return item;
+    }
+
+private:
+    long fNext;
+    std::map<long, T> fPending;
+
+    TMutex fMutex;
+    TCondition fReady;
+};
+
+#endif
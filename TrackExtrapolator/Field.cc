@@ -31,14 +31,16 @@ Field::Field(Settings* settings)
       if(!chdir(filepath))
       {
         filecheck = fopen(mySettings->fMagName,"r");
+        if(filecheck == NULL && mySettings->useFieldMapCache)
+          filecheck = fopen(TabulatedField3D::binaryMapName(mySettings->fMagName),"r");
         if(filecheck != NULL)
         {
           errorFlag = false;
 	  fclose(filecheck);
 	  cout << "Reading field maps..." << endl;
 	  //                             zOffset, nx, ny, nz, fmag, settings
-	  Mag1Field= new TabulatedField3D(0.0, 131, 121, 73, true, settings);
-	  Mag2Field= new TabulatedField3D(-1064.26*cm, 49, 37, 81, false, settings);
+	  Mag1Field= new TabulatedField3D(fieldMapZOffset[0], fieldMapGrid[0][0], fieldMapGrid[0][1], fieldMapGrid[0][2], true, settings);
+	  Mag2Field= new TabulatedField3D(fieldMapZOffset[1], fieldMapGrid[1][0], fieldMapGrid[1][1], fieldMapGrid[1][2], false, settings);
         }
 	else
 	  cout << "File not found!" << endl;
@@ -59,17 +61,18 @@ Field::Field(Settings* settings)
   {
     G4cout << "Preparing to read magnetic field map files...\n"; 
     G4cout << "Reading field maps...\n";
-    Mag1Field= new TabulatedField3D(0.0, 131, 121, 73, true, settings);
-    Mag2Field= new TabulatedField3D(-1064.26*cm, 49, 37, 81, false, settings);
+    Mag1Field= new TabulatedField3D(fieldMapZOffset[0], fieldMapGrid[0][0], fieldMapGrid[0][1], fieldMapGrid[0][2], true, settings);
+    Mag2Field= new TabulatedField3D(fieldMapZOffset[1], fieldMapGrid[1][0], fieldMapGrid[1][1], fieldMapGrid[1][2], false, settings);
   }
   G4cout << "Finished loading magnetic field map files!\n";
 
   // These should probably be softcoded at some point, but doesn't matter as long as field maps don't get resized.
+  // The bounds are shared with RKPropagator through Field.hh
 
-  zValues[0] = -204.0*cm;  // front of fmag field map
-  zValues[1] = 403.74*cm;  // front of kmag field map
-  zValues[2] = 712.0*cm;   // end of fmag field map
-  zValues[3] = 1572.26*cm; // end of kmag field map
+  zValues[0] = fieldMapZBounds[0]*cm;  // front of fmag field map
+  zValues[1] = fieldMapZBounds[1]*cm;  // front of kmag field map
+  zValues[2] = fieldMapZBounds[2]*cm;  // end of fmag field map
+  zValues[3] = fieldMapZBounds[3]*cm;  // end of kmag field map
 }
 
 Field::~Field()
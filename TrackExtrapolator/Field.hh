@@ -8,6 +8,9 @@
 #include <cstdlib>
 #include <unistd.h>
 
+// Extent of the field maps in z in cm: front of fmag, front of kmag, end of fmag, end of kmag
+const double fieldMapZBounds[4] = {-204.0, 403.74, 712.0, 1572.26};
+
 class Field : public G4MagneticField
 {
   public:
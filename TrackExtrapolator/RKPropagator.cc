@@ -0,0 +1,282 @@
+/*
+RKPropagator.cc
+
+Implementation of class RKPropagator
+
+Author: Kun Liu, liuk@fnal.gov
+Created: 10-20-2014
+*/
+
+#include <iostream>
+#include <cmath>
+
+#include "globals.hh"
+#include "RKPropagator.hh"
+#include "Field.hh"
+
+///Extent of the field maps in z, outside the track is a straight line
+static const double Z_FIELD_MIN = fieldMapZBounds[0];
+static const double Z_FIELD_MAX = fieldMapZBounds[3];
+
+///Radiation length of iron in cm
+static const double X0_IRON = 1.757;
+
+///Speed of light in GeV/(T*cm)
+static const double C_LIGHT = 0.0029979246;
+
+RKPropagator::RKPropagator()
+{
+    fField = NULL;
+    fMaxStep = 10.;
+    fMaterial = true;
+    fTravelLength = 0.;
+}
+
+bool RKPropagator::propagate(double z_in, const KMatrix<5, 1>& state_in, double z_out, KMatrix<5, 1>& state_out, KMatrix<5, 5>& prop, KMatrix<5, 5>& noise)
+{
+    double state[5];
+    for(int i = 0; i < 5; ++i) state[i] = state_in[i][0];
+
+    prop.UnitMatrix();
+    noise.Zero();
+    fTravelLength = 0.;
+
+    ///The steps always stop at the field and material boundaries
+    const int nBoundaries = 6;
+    const double boundaries[nBoundaries] = {Z_FIELD_MIN, 0., FMAG_HOLE_LENGTH, FMAG_LENGTH, Z_FIELD_MAX, Z_ABSORBER};
+
+    double dir = z_out > z_in ? 1. : -1.;
+    double z = z_in;
+    bool hasNoise = false;
+    KMatrix<5, 5> jac;
+    while(z != z_out)
+    {
+        double z_next = z_out;
+        for(int i = 0; i < nBoundaries; ++i)
+        {
+            if((boundaries[i] - z)*dir > 1E-6 && (z_next - boundaries[i])*dir > 0.) z_next = boundaries[i];
+        }
+
+        double z_mid = 0.5*(z + z_next);
+        bool inField = z_mid > Z_FIELD_MIN && z_mid < Z_FIELD_MAX;
+        if(inField && fabs(z_next - z) > fMaxStep) z_next = z + dir*fMaxStep;
+
+        double h = z_next - z;
+        if(fMaterial && !applyMaterial(z, z_next, false, state, prop, noise)) return false;
+
+        if(inField)
+        {
+            stepRKN(z, h, state, jac);
+        }
+        else
+        {
+            state[3] += h*state[1];
+            state[4] += h*state[2];
+
+            jac.UnitMatrix();
+            jac[3][1] = h;
+            jac[4][2] = h;
+        }
+
+        prop = jac*prop;
+        if(hasNoise) noise = jac*noise*jac.transpose();
+
+        z_mid = 0.5*(z + z_next);
+        if(z_mid > 0. && z_mid < FMAG_LENGTH) fTravelLength += fabs(h)*sqrt(1. + state[1]*state[1] + state[2]*state[2]);
+
+        if(fMaterial)
+        {
+            if(!applyMaterial(z, z_next, true, state, prop, noise)) return false;
+            hasNoise = hasNoise || (z_mid > 0. && z_mid < FMAG_LENGTH);
+        }
+
+        z = z_next;
+    }
+
+    for(int i = 0; i < 5; ++i) state_out[i][0] = state[i];
+    return state[0] == state[0];
+}
+
+void RKPropagator::stepRKN(double z, double h, double state[5], KMatrix<5, 5>& jac)
+{
+    const double qp = state[0];
+    const double t0[2] = {state[1], state[2]};
+    const double r0[2] = {state[3], state[4]};
+
+    double B[3], t[2];
+    double k1[2], k2[2], k3[2], k4[2];
+    double A1[2][2], A2[2][2], A3[2][2], A4[2][2];
+    double a1[2], a2[2], a3[2], a4[2];
+
+    ///Stage 1 at the beginning of the step
+    getField(r0[0], r0[1], z, B);
+    evalDerivative(t0, qp, B, k1, A1, a1);
+
+    ///Stage 2 and 3 share the field at the middle of the step
+    getField(r0[0] + 0.5*h*t0[0] + 0.125*h*h*k1[0], r0[1] + 0.5*h*t0[1] + 0.125*h*h*k1[1], z + 0.5*h, B);
+    for(int i = 0; i < 2; ++i) t[i] = t0[i] + 0.5*h*k1[i];
+    evalDerivative(t, qp, B, k2, A2, a2);
+    for(int i = 0; i < 2; ++i) t[i] = t0[i] + 0.5*h*k2[i];
+    evalDerivative(t, qp, B, k3, A3, a3);
+
+    ///Stage 4 at the end of the step
+    getField(r0[0] + h*t0[0] + 0.5*h*h*k3[0], r0[1] + h*t0[1] + 0.5*h*h*k3[1], z + h, B);
+    for(int i = 0; i < 2; ++i) t[i] = t0[i] + h*k3[i];
+    evalDerivative(t, qp, B, k4, A4, a4);
+
+    for(int i = 0; i < 2; ++i)
+    {
+        state[1+i] = t0[i] + h/6.*(k1[i] + 2.*k2[i] + 2.*k3[i] + k4[i]);
+        state[3+i] = r0[i] + h*t0[i] + h*h/6.*(k1[i] + k2[i] + k3[i]);
+    }
+
+    ///Transport matrix, the derivatives w.r.t. q/p, tx and ty go through the same stages,
+    ///x and y only enter via the field which is taken as uniform within the step
+    jac.UnitMatrix();
+    for(int j = 0; j < 3; ++j)
+    {
+        double dqp = j == 0 ? 1. : 0.;
+        double dt0[2] = {j == 1 ? 1. : 0., j == 2 ? 1. : 0.};
+        double dt[2], dk1[2], dk2[2], dk3[2], dk4[2];
+
+        for(int i = 0; i < 2; ++i) dk1[i] = A1[i][0]*dt0[0] + A1[i][1]*dt0[1] + a1[i]*dqp;
+        for(int i = 0; i < 2; ++i) dt[i] = dt0[i] + 0.5*h*dk1[i];
+        for(int i = 0; i < 2; ++i) dk2[i] = A2[i][0]*dt[0] + A2[i][1]*dt[1] + a2[i]*dqp;
+        for(int i = 0; i < 2; ++i) dt[i] = dt0[i] + 0.5*h*dk2[i];
+        for(int i = 0; i < 2; ++i) dk3[i] = A3[i][0]*dt[0] + A3[i][1]*dt[1] + a3[i]*dqp;
+        for(int i = 0; i < 2; ++i) dt[i] = dt0[i] + h*dk3[i];
+        for(int i = 0; i < 2; ++i) dk4[i] = A4[i][0]*dt[0] + A4[i][1]*dt[1] + a4[i]*dqp;
+
+        for(int i = 0; i < 2; ++i)
+        {
+            jac[1+i][j] = dt0[i] + h/6.*(dk1[i] + 2.*dk2[i] + 2.*dk3[i] + dk4[i]);
+            jac[3+i][j] = h*dt0[i] + h*h/6.*(dk1[i] + dk2[i] + dk3[i]);
+        }
+    }
+}
+
+bool RKPropagator::applyMaterial(double z_prev, double z, bool secondHalf, double state[5], KMatrix<5, 5>& prop, KMatrix<5, 5>& noise)
+{
+    double h = z - z_prev;
+    double dir = h > 0. ? 1. : -1.;
+    double charge = state[0] > 0. ? 1. : -1.;
+    double p = fabs(1./state[0]);
+
+    ///d(q/p)_after/d(q/p)_before
+    double scale = 1.;
+
+    ///Lumped energy loss in the hadron absorber, a state at Z_ABSORBER is downstream of it
+    if(secondHalf && ((z_prev < Z_ABSORBER && z >= Z_ABSORBER) || (z < Z_ABSORBER && z_prev >= Z_ABSORBER)))
+    {
+        double p_new = p - dir*ELOSS_ABSORBER;
+        if(p_new < 0.1) return false;
+
+        scale *= (p/p_new)*(p/p_new);
+        p = p_new;
+    }
+
+    ///FMAG iron, except for the beam hole. The state is at one end of the step so the
+    ///middle of the step is estimated with the straight line
+    double tx = state[1];
+    double ty = state[2];
+    double dz_mid = secondHalf ? -0.5*h : 0.5*h;
+    double z_mid = 0.5*(z_prev + z);
+    double x_mid = state[3] + tx*dz_mid;
+    double y_mid = state[4] + ty*dz_mid;
+    if(z_mid > 0. && z_mid < FMAG_LENGTH && !(z_mid < FMAG_HOLE_LENGTH && x_mid*x_mid + y_mid*y_mid < FMAG_HOLE_RADIUS*FMAG_HOLE_RADIUS))
+    {
+        double t2 = 1. + tx*tx + ty*ty;
+        double length = fabs(h)*sqrt(t2);
+
+        ///Multiple scattering of the whole step, the noise on the slopes is spread over the step for the positions
+        if(secondHalf)
+        {
+            double theta0 = 0.0136/p*sqrt(length/X0_IRON)*(1. + 0.038*log(length/X0_IRON));
+            double sigma2 = theta0*theta0*t2;
+
+            double q11 = (1. + tx*tx)*sigma2;
+            double q22 = (1. + ty*ty)*sigma2;
+            double q12 = tx*ty*sigma2;
+
+            noise[1][1] += q11;
+            noise[2][2] += q22;
+            noise[1][2] += q12;
+            noise[2][1] += q12;
+
+            noise[3][3] += q11*h*h/3.;
+            noise[4][4] += q22*h*h/3.;
+            noise[3][4] += q12*h*h/3.;
+            noise[4][3] += q12*h*h/3.;
+
+            noise[1][3] += q11*h/2.;
+            noise[3][1] += q11*h/2.;
+            noise[2][4] += q22*h/2.;
+            noise[4][2] += q22*h/2.;
+            noise[1][4] += q12*h/2.;
+            noise[4][1] += q12*h/2.;
+            noise[2][3] += q12*h/2.;
+            noise[3][2] += q12*h/2.;
+        }
+
+        ///Half of the energy loss on each side of the Runge-Kutta step, the track loses
+        ///energy going downstream and gains going upstream
+        double deriv;
+        double eloss = 0.5*getFMAGdEdx(p, deriv)*length;
+        double p_new = p - dir*eloss;
+        if(p_new < 0.1) return false;
+
+        scale *= (p/p_new)*(p/p_new)*(1. - 0.5*dir*deriv*length);
+        p = p_new;
+    }
+
+    if(scale != 1.)
+    {
+        state[0] = charge/p;
+        for(int i = 0; i < 5; ++i)
+        {
+            prop[0][i] *= scale;
+            noise[0][i] *= scale;
+            noise[i][0] *= scale;
+        }
+    }
+
+    return true;
+}
+
+void RKPropagator::evalDerivative(const double t[2], double qp, const double B[3], double k[2], double dkdt[2][2], double dkdqp[2])
+{
+    double t2 = 1. + t[0]*t[0] + t[1]*t[1];
+    double A = sqrt(t2);
+
+    ///Lorentz force in z-parameterization
+    double gx = t[0]*t[1]*B[0] - (1. + t[0]*t[0])*B[1] + t[1]*B[2];
+    double gy = (1. + t[1]*t[1])*B[0] - t[0]*t[1]*B[1] - t[0]*B[2];
+
+    double cA = C_LIGHT*A;
+    k[0] = cA*qp*gx;
+    k[1] = cA*qp*gy;
+
+    dkdqp[0] = cA*gx;
+    dkdqp[1] = cA*gy;
+
+    double cqp = C_LIGHT*qp;
+    dkdt[0][0] = cqp*(t[0]/A*gx + A*(t[1]*B[0] - 2.*t[0]*B[1]));
+    dkdt[0][1] = cqp*(t[1]/A*gx + A*(t[0]*B[0] + B[2]));
+    dkdt[1][0] = cqp*(t[0]/A*gy + A*(-t[1]*B[1] - B[2]));
+    dkdt[1][1] = cqp*(t[1]/A*gy + A*(2.*t[1]*B[0] - t[0]*B[1]));
+}
+
+void RKPropagator::getField(double x, double y, double z, double B[3])
+{
+    double point[4] = {x*cm, y*cm, z*cm, 0.};
+    double field[3] = {0., 0., 0.};
+    if(fField != NULL) fField->GetFieldValue(point, field);
+
+    for(int i = 0; i < 3; ++i) B[i] = field[i]/tesla;
+}
+
+double RKPropagator::getFMAGdEdx(double p, double& deriv)
+{
+    deriv = (ELOSS_FMAG_P1 + p*(2.*ELOSS_FMAG_P2 + p*(3.*ELOSS_FMAG_P3 + p*4.*ELOSS_FMAG_P4)))/FMAG_LENGTH;
+    return (ELOSS_FMAG_P0 + p*(ELOSS_FMAG_P1 + p*(ELOSS_FMAG_P2 + p*(ELOSS_FMAG_P3 + p*ELOSS_FMAG_P4))))/FMAG_LENGTH;
+}
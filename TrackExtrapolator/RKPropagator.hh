@@ -0,0 +1,77 @@
+/*
+RKPropagator.hh
+
+Class definition of RKPropagator, a Geant4-free alternative to the Geant4e stepping
+in TrackExtrapolator. The track state (q/p, tx, ty, x, y) is integrated in z with a
+4th order Runge-Kutta-Nystrom scheme directly on the tabulated field map, and the
+transport matrix is obtained analytically by propagating the derivatives through the
+same Runge-Kutta stages (the field gradient is neglected within one step).
+
+Material effects are limited to a simple model of the dominant absorbers:
+1. FMAG iron: energy loss with the same parameterization as SRecTrack::swimToVertex,
+   and multiple scattering with the Highland formula, except in the beam hole;
+2. hadron absorber: a lumped energy loss of ELOSS_ABSORBER at Z_ABSORBER.
+
+All the units are kTracker units: cm, GeV and Tesla.
+
+Author: Kun Liu, liuk@fnal.gov
+Created: 10-20-2014
+*/
+
+#ifndef _RKPROPAGATOR_H
+#define _RKPROPAGATOR_H
+
+#include "G4Field.hh"
+
+#include "../MODE_SWITCH.h"
+#include "../KalmanMatrix.h"
+
+class RKPropagator
+{
+public:
+    RKPropagator();
+
+    ///Set the magnetic field, which is only read and can be shared by all the propagators
+    void setField(const G4Field* field) { fField = field; }
+
+    ///Control of the maximum step size inside the field and of the material effects
+    void setMaxStep(double step) { fMaxStep = step; }
+    void setMaterialEffects(bool option) { fMaterial = option; }
+
+    ///Propagate the state vector from z_in to z_out, the transport matrix and the process
+    ///noise are also calculated, so that cov_out = prop*cov_in*prop^T + noise
+    bool propagate(double z_in, const KMatrix<5, 1>& state_in, double z_out, KMatrix<5, 1>& state_out, KMatrix<5, 5>& prop, KMatrix<5, 5>& noise);
+
+    ///Path length inside FMAG in the last propagation
+    double getTravelLength() { return fTravelLength; }
+
+private:
+    ///One Runge-Kutta-Nystrom step of size h from z, the state is updated in place and
+    ///the transport matrix of this step is returned in jac
+    void stepRKN(double z, double h, double state[5], KMatrix<5, 5>& jac);
+
+    ///Material effects of the step from z_prev to z, applied in two halves before and after
+    ///the Runge-Kutta step, the state is at z_prev for the first half and at z for the second
+    bool applyMaterial(double z_prev, double z, bool secondHalf, double state[5], KMatrix<5, 5>& prop, KMatrix<5, 5>& noise);
+
+    ///Second derivative (d2x/dz2, d2y/dz2) and its derivatives w.r.t tx, ty and q/p
+    void evalDerivative(const double t[2], double qp, const double B[3], double k[2], double dkdt[2][2], double dkdqp[2]);
+
+    ///Field in Tesla at (x, y, z) in cm
+    void getField(double x, double y, double z, double B[3]);
+
+    ///Energy loss per unit length in FMAG as a function of momentum, and its derivative
+    double getFMAGdEdx(double p, double& deriv);
+
+    ///Magnetic field
+    const G4Field* fField;
+
+    ///Step control
+    double fMaxStep;
+    bool fMaterial;
+
+    ///Path length in FMAG
+    double fTravelLength;
+};
+
+#endif
@@ -9,6 +9,7 @@ Settings::Settings()
   beamMomentum = 120*GeV;
   beamCurrent = 2e12;
   asciiFieldMap = true;
+  useFieldMapCache = true;
   generator = "gun";
   energyCut = 1.0*GeV;
   recordMethod = "hits";
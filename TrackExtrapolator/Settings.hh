@@ -23,6 +23,7 @@ public:
   double beamMomentum;		// The momentum of the beam
   double beamCurrent;		// protons/sec of the beam
   bool asciiFieldMap;		// True if the magnetic field is loaded from the ascii files, false if from SQL
+  bool useFieldMapCache;	// True if the binary cache (ascii name + ".bin") is memory mapped instead of parsing the ascii files
   G4String generator;		// The type of event generator running, i.e. gun or dimuon
   int target;			// The material the target is made of
   double energyCut;		// How much energy a particle must have to be recorded.  All particles that cause hits are recorded anyway.
@@ -37,9 +37,23 @@
 #include "TabulatedField3D.hh"
 #include "../MODE_SWITCH.h"
 
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 TabulatedField3D::TabulatedField3D(double zOffset, int nX, int nY, int nZ, bool fMagnet, Settings* settings) 
 {
   mySettings = settings;
+  field = NULL;
+  mappedBuffer = NULL;
+  mappedSize = 0;
+  con = NULL;
+  sourceSize = -1;
+  sourceMTime = -1;
+
   if (mySettings->asciiFieldMap)
   {
 
@@ -56,75 +70,75 @@ TabulatedField3D::TabulatedField3D(double zOffset, int nX, int nY, int nZ, bool
     else
       filename = settings->kMagName;
 
-    double fieldUnit= tesla; 
     G4cout << "\n-----------------------------------------------------------"
 	   << "\n      Magnetic field"
-	   << "\n-----------------------------------------------------------"
-	   << "\n ---> " "Reading the field grid from " << filename << " ... " << endl; 
-    ifstream file( filename );
-    if (!file.good())
-      cout << "Field map input file error." << endl;
-
-    char buffer[256];
-    file.getline(buffer,256);
+	   << "\n-----------------------------------------------------------" << endl;
 
     G4cout << "  [ Number of values x,y,z: " 
 	   << nx << " " << ny << " " << nz << " ] "
 	   << endl;
 
-    // Set up storage space for table
-    xField.resize( nx );
-    yField.resize( nx );
-    zField.resize( nx );
-    int ix, iy, iz;
-    for (ix=0; ix<nx; ix++)
+    // The ascii map may be missing when only the binary cache is installed
+    struct stat sourceStat;
+    if (stat(filename, &sourceStat) == 0)
     {
-      xField[ix].resize(ny);
-      yField[ix].resize(ny);
-      zField[ix].resize(ny);
-      for (iy=0; iy<ny; iy++)
-      {
-        xField[ix][iy].resize(nz);
-        yField[ix][iy].resize(nz);
-        zField[ix][iy].resize(nz);
-      }
+      sourceSize = sourceStat.st_size;
+      sourceMTime = sourceStat.st_mtime;
+    }
+
+    if (mySettings->useFieldMapCache && readBinaryMap(binaryMapName(filename)))
+    {
+      G4cout << "\n ---> Mapped the binary field map " << binaryMapName(filename) << endl;
     }
+    else
+    {
+      G4cout << "\n ---> " "Reading the field grid from " << filename << " ... " << endl; 
+      ifstream file( filename );
+      if (!file.good())
+        cout << "Field map input file error." << endl;
 
-    // Read in the data
-    double xval,yval,zval,bx,by,bz;
-    double temp;
+      char buffer[256];
+      file.getline(buffer,256);
 
-    minx = miny = minz = maxx = maxy = maxz = 0;
+      // Set up storage space for table
+      fieldTable.assign(3*nx*ny*nz, 0.);
 
-    for (ix=0; ix<nx; ix++)
-    {
-      for (iy=0; iy<ny; iy++)
+      // Read in the data
+      double xval,yval,zval,bx,by,bz;
+
+      minx = miny = minz = maxx = maxy = maxz = 0;
+
+      float* entry = &fieldTable[0];
+      for (int i=0; i<nx*ny*nz; i++, entry += 3)
       {
-        for (iz=0; iz<nz; iz++)
-        {
-	  //  The field map has 1 column we don't use
-          file >> xval >> yval >> zval >> bx >> by >> bz;
-          if (xval*cm < minx)
-            minx = xval * cm;
-          if (yval*cm < miny)
-            miny = yval * cm;
-          if (zval*cm < minz)
-            minz = zval * cm;
-          if (xval*cm > maxx)
-            maxx = xval * cm;
-          if (yval*cm > maxy)
-            maxy = yval * cm;
-          if (zval*cm > maxz)
-            maxz = zval * cm;
-          xField[ix][iy][iz] = bx * fieldUnit;
-          yField[ix][iy][iz] = by * fieldUnit;
-          zField[ix][iy][iz] = bz * fieldUnit;
-        }
+        //  The field map has 1 column we don't use
+        file >> xval >> yval >> zval >> bx >> by >> bz;
+        if (xval*cm < minx)
+          minx = xval * cm;
+        if (yval*cm < miny)
+          miny = yval * cm;
+        if (zval*cm < minz)
+          minz = zval * cm;
+        if (xval*cm > maxx)
+          maxx = xval * cm;
+        if (yval*cm > maxy)
+          maxy = yval * cm;
+        if (zval*cm > maxz)
+          maxz = zval * cm;
+        entry[0] = bx;
+        entry[1] = by;
+        entry[2] = bz;
       }
-    }
-    file.close();
+      bool readOK = !file.fail();
+      file.close();
 
-    G4cout << "\n ---> ... done reading " << endl;
+      G4cout << "\n ---> ... done reading " << endl;
+
+      // Rebuild the missing or stale cache for the next jobs
+      field = &fieldTable[0];
+      if (mySettings->useFieldMapCache && readOK && sourceSize >= 0)
+        writeBinaryMap(binaryMapName(filename));
+    }
   }
   else // if loading field map from MySQL
   {
@@ -146,8 +160,6 @@ TabulatedField3D::TabulatedField3D(double zOffset, int nX, int nY, int nZ, bool
   
     fmag = fMagnet;
 
-    double fieldUnit= tesla; 
-
     G4cout << "\n-----------------------------------------------------------"
 	   << "\n      Magnetic field"
 	   << "\n-----------------------------------------------------------\n";
@@ -157,22 +169,7 @@ TabulatedField3D::TabulatedField3D(double zOffset, int nX, int nY, int nZ, bool
 	   << endl;
 
     // Set up storage space for table
-    xField.resize( nx );
-    yField.resize( nx );
-    zField.resize( nx );
-    int ix, iy;
-    for (ix=0; ix<nx; ix++)
-    {
-      xField[ix].resize(ny);
-      yField[ix].resize(ny);
-      zField[ix].resize(ny);
-      for (iy=0; iy<ny; iy++)
-      {
-        xField[ix][iy].resize(nz);
-        yField[ix][iy].resize(nz);
-        zField[ix][iy].resize(nz);
-      }
-    }
+    fieldTable.assign(3*nx*ny*nz, 0.);
 
     float xval,yval,zval,bx,by,bz;
 
@@ -228,9 +225,10 @@ TabulatedField3D::TabulatedField3D(double zOffset, int nX, int nY, int nZ, bool
       yc = floor((yval*cm-miny)*(ny-1)/(maxy-miny)+0.5);
       zc = floor((zval*cm-minz)*(nz-1)/(maxz-minz)+0.5);
 
-      xField[xc][yc][zc] = bx*fieldUnit;
-      yField[xc][yc][zc] = by*fieldUnit;
-      zField[xc][yc][zc] = bz*fieldUnit;
+      float* entry = &fieldTable[3*((xc*ny + yc)*nz + zc)];
+      entry[0] = bx;
+      entry[1] = by;
+      entry[2] = bz;
     }
 
     mysql_free_result(resField);
@@ -238,7 +236,9 @@ TabulatedField3D::TabulatedField3D(double zOffset, int nX, int nY, int nZ, bool
     G4cout << "\n ---> ... done reading " << endl;
   }
 
-  // This code is run whether it is loaded from ascii or MySQL
+  // This code is run whether it is loaded from ascii, MySQL or the binary cache
+  if (field == NULL)
+    field = &fieldTable[0];
 
   G4cout << "\n ---> Min values x,y,z: " 
 	 << minx/cm << " " << miny/cm << " " << minz/cm << " cm "
@@ -250,11 +250,117 @@ TabulatedField3D::TabulatedField3D(double zOffset, int nX, int nY, int nZ, bool
   dy = maxy - miny;
   dz = maxz - minz;
 
+  invdx = (nx-1)/dx;
+  invdy = (ny-1)/dy;
+  invdz = (nz-1)/dz;
+
   G4cout << "\n ---> Dif values x,y,z (range): " 
 	 << dx/cm << " " << dy/cm << " " << dz/cm << " cm in z "
 	 << "\n-----------------------------------------------------------" << endl;
 }
 
+TabulatedField3D::~TabulatedField3D()
+{
+  if (mappedBuffer != NULL)
+    munmap(mappedBuffer, mappedSize);
+  if (con != NULL)
+    mysql_close(con);
+}
+
+bool TabulatedField3D::readBinaryMap(const G4String& filename)
+{
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0 || size_t(fileStat.st_size) < sizeof(FieldMapHeader))
+  {
+    ::close(fd);
+    return false;
+  }
+
+  // Shared read-only mapping, all the processes on the node use the same pages
+  size_t size = fileStat.st_size;
+  void* buffer = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (buffer == MAP_FAILED)
+    return false;
+
+  const FieldMapHeader* header = (const FieldMapHeader*)buffer;
+  if (strncmp(header->magic, "KFLDMAP", 8) != 0 || header->version != FIELDMAP_VERSION ||
+      header->nx != nx || header->ny != ny || header->nz != nz ||
+      size != sizeof(FieldMapHeader) + 3*sizeof(float)*nx*ny*nz)
+  {
+    cout << "Binary field map " << filename << " does not match the expected grid, ignored." << endl;
+    munmap(buffer, size);
+    return false;
+  }
+
+  // Without the ascii map there is nothing to compare with, the cache is used as it is
+  if (sourceSize >= 0 && (header->sourceSize != sourceSize || header->sourceMTime != sourceMTime))
+  {
+    cout << "Binary field map " << filename << " is out of date w.r.t. the ascii map, rebuilding it." << endl;
+    munmap(buffer, size);
+    return false;
+  }
+
+  minx = header->min[0]*cm;
+  miny = header->min[1]*cm;
+  minz = header->min[2]*cm;
+  maxx = header->max[0]*cm;
+  maxy = header->max[1]*cm;
+  maxz = header->max[2]*cm;
+
+  mappedBuffer = buffer;
+  mappedSize = size;
+  field = (const float*)((const char*)buffer + sizeof(FieldMapHeader));
+
+  return true;
+}
+
+bool TabulatedField3D::writeBinaryMap(const G4String& filename) const
+{
+  FieldMapHeader header;
+  memset(&header, 0, sizeof(FieldMapHeader));
+  strncpy(header.magic, "KFLDMAP", 8);
+  header.version = FIELDMAP_VERSION;
+  header.nx = nx;
+  header.ny = ny;
+  header.nz = nz;
+  header.min[0] = minx/cm;
+  header.min[1] = miny/cm;
+  header.min[2] = minz/cm;
+  header.max[0] = maxx/cm;
+  header.max[1] = maxy/cm;
+  header.max[2] = maxz/cm;
+  header.sourceSize = sourceSize;
+  header.sourceMTime = sourceMTime;
+
+  // One temporary file per process, several jobs may rebuild the cache at the same time
+  char suffix[32];
+  sprintf(suffix, ".tmp.%d", int(getpid()));
+  G4String tempName = filename + suffix;
+  FILE* fp = fopen(tempName, "wb");
+  if (fp == NULL)
+  {
+    cout << "Cannot open " << tempName << " for writing." << endl;
+    return false;
+  }
+
+  size_t nValues = 3*nx*ny*nz;
+  bool ok = fwrite(&header, sizeof(FieldMapHeader), 1, fp) == 1 && fwrite(field, sizeof(float), nValues, fp) == nValues;
+  ok = (fclose(fp) == 0) && ok;
+  if (!ok || rename(tempName, filename) != 0)
+  {
+    cout << "Failed to write the binary field map " << filename << endl;
+    remove(tempName);
+    return false;
+  }
+
+  return true;
+}
+
 void TabulatedField3D::GetFieldValue(const double point[3], double *Bfield ) const
 {
   Bfield[0] = 0.0;
@@ -272,68 +378,56 @@ void TabulatedField3D::GetFieldValue(const double point[3], double *Bfield ) con
        y>=miny && y<=maxy && 
        z>=minz && z<=maxz )
   {    
-    // Position of given point within region, normalized to the range
-    // [0,1]
-    double xfraction = (x - minx) / dx;
-    double yfraction = (y - miny) / dy; 
-    double zfraction = (z - minz) / dz;
-
-    // Need addresses of these to pass to modf below.
-    // modf uses its second argument as an OUTPUT argument.
-    double xdIndex, ydIndex, zdIndex;
-    
+    // Position of given point in units of the grid spacing
+    double xu = (x - minx)*invdx;
+    double yu = (y - miny)*invdy;
+    double zu = (z - minz)*invdz;
+
+    // The indices of the nearest tabulated point whose coordinates
+    // are all less than those of the given point, the upper edge
+    // belongs to the last cell
+    int xindex = static_cast<int>(xu);
+    int yindex = static_cast<int>(yu);
+    int zindex = static_cast<int>(zu);
+    if (xindex > nx-2) xindex = nx-2;
+    if (yindex > ny-2) yindex = ny-2;
+    if (zindex > nz-2) zindex = nz-2;
+
     // Position of the point within the cuboid defined by the
     // nearest surrounding tabulated points
-    double xlocal = ( std::modf(xfraction*(nx-1), &xdIndex));
-    double ylocal = ( std::modf(yfraction*(ny-1), &ydIndex));
-    double zlocal = ( std::modf(zfraction*(nz-1), &zdIndex));
-    
-    // The indices of the nearest tabulated point whose coordinates
-    // are all less than those of the given point
-    int xindex = static_cast<int>(xdIndex);
-    int yindex = static_cast<int>(ydIndex);
-    int zindex = static_cast<int>(zdIndex);
-    
+    double xlocal = xu - xindex;
+    double ylocal = yu - yindex;
+    double zlocal = zu - zindex;
+
+    // Strides of the interleaved table
+    const int sz = 3;
+    const int sy = 3*nz;
+    const int sx = 3*ny*nz;
+    const float* c = field + xindex*sx + yindex*sy + zindex*sz;
+
+    double w000 = (1-xlocal) * (1-ylocal) * (1-zlocal);
+    double w001 = (1-xlocal) * (1-ylocal) *    zlocal ;
+    double w010 = (1-xlocal) *    ylocal  * (1-zlocal);
+    double w011 = (1-xlocal) *    ylocal  *    zlocal ;
+    double w100 =    xlocal  * (1-ylocal) * (1-zlocal);
+    double w101 =    xlocal  * (1-ylocal) *    zlocal ;
+    double w110 =    xlocal  *    ylocal  * (1-zlocal);
+    double w111 =    xlocal  *    ylocal  *    zlocal ;
+
     // Full 3-dimensional version
-    Bfield[0] =
-      xField[xindex  ][yindex  ][zindex  ] * (1-xlocal) * (1-ylocal) * (1-zlocal) +
-      xField[xindex  ][yindex  ][zindex+1] * (1-xlocal) * (1-ylocal) *    zlocal  +
-      xField[xindex  ][yindex+1][zindex  ] * (1-xlocal) *    ylocal  * (1-zlocal) +
-      xField[xindex  ][yindex+1][zindex+1] * (1-xlocal) *    ylocal  *    zlocal  +
-      xField[xindex+1][yindex  ][zindex  ] *    xlocal  * (1-ylocal) * (1-zlocal) +
-      xField[xindex+1][yindex  ][zindex+1] *    xlocal  * (1-ylocal) *    zlocal  +
-      xField[xindex+1][yindex+1][zindex  ] *    xlocal  *    ylocal  * (1-zlocal) +
-      xField[xindex+1][yindex+1][zindex+1] *    xlocal  *    ylocal  *    zlocal ;
-    Bfield[1] =
-      yField[xindex  ][yindex  ][zindex  ] * (1-xlocal) * (1-ylocal) * (1-zlocal) +
-      yField[xindex  ][yindex  ][zindex+1] * (1-xlocal) * (1-ylocal) *    zlocal  +
-      yField[xindex  ][yindex+1][zindex  ] * (1-xlocal) *    ylocal  * (1-zlocal) +
-      yField[xindex  ][yindex+1][zindex+1] * (1-xlocal) *    ylocal  *    zlocal  +
-      yField[xindex+1][yindex  ][zindex  ] *    xlocal  * (1-ylocal) * (1-zlocal) +
-      yField[xindex+1][yindex  ][zindex+1] *    xlocal  * (1-ylocal) *    zlocal  +
-      yField[xindex+1][yindex+1][zindex  ] *    xlocal  *    ylocal  * (1-zlocal) +
-      yField[xindex+1][yindex+1][zindex+1] *    xlocal  *    ylocal  *    zlocal ;
-    Bfield[2] =
-      zField[xindex  ][yindex  ][zindex  ] * (1-xlocal) * (1-ylocal) * (1-zlocal) +
-      zField[xindex  ][yindex  ][zindex+1] * (1-xlocal) * (1-ylocal) *    zlocal  +
-      zField[xindex  ][yindex+1][zindex  ] * (1-xlocal) *    ylocal  * (1-zlocal) +
-      zField[xindex  ][yindex+1][zindex+1] * (1-xlocal) *    ylocal  *    zlocal  +
-      zField[xindex+1][yindex  ][zindex  ] *    xlocal  * (1-ylocal) * (1-zlocal) +
-      zField[xindex+1][yindex  ][zindex+1] *    xlocal  * (1-ylocal) *    zlocal  +
-      zField[xindex+1][yindex+1][zindex  ] *    xlocal  *    ylocal  * (1-zlocal) +
-      zField[xindex+1][yindex+1][zindex+1] *    xlocal  *    ylocal  *    zlocal ;
+    for (int i = 0; i < 3; i++)
+    {
+      Bfield[i] =
+        c[i          ] * w000 + c[i      + sz] * w001 +
+        c[i + sy     ] * w010 + c[i + sy + sz] * w011 +
+        c[i + sx     ] * w100 + c[i + sx + sz] * w101 +
+        c[i + sx + sy] * w110 + c[i + sx + sy + sz] * w111;
+    }
   }
 
-  if (fmag)
-  {
-    Bfield[0] = Bfield[0]*mySettings->fMagMultiplier;
-    Bfield[1] = Bfield[1]*mySettings->fMagMultiplier;
-    Bfield[2] = Bfield[2]*mySettings->fMagMultiplier;
-  }
-  else
-  {
-    Bfield[0] = Bfield[0]*mySettings->kMagMultiplier;
-    Bfield[1] = Bfield[1]*mySettings->kMagMultiplier;
-    Bfield[2] = Bfield[2]*mySettings->kMagMultiplier;
-  }
+  // The table is in Tesla, convert to the Geant4 unit together with the scale
+  double scale = tesla*(fmag ? mySettings->fMagMultiplier : mySettings->kMagMultiplier);
+  Bfield[0] = Bfield[0]*scale;
+  Bfield[1] = Bfield[1]*scale;
+  Bfield[2] = Bfield[2]*scale;
 }
@@ -41,17 +41,41 @@
 #include <fstream>
 #include <vector>
 #include <cmath>
+#include <stdint.h>
 #include <mysql.h>
 
 using namespace std;
 
+// Layout of the binary field map cache, written by writeBinaryMap() and memory
+// mapped at start-up: header followed by nx*ny*nz*3 floats (Bx, By, Bz) in Tesla,
+// x being the slowest and z the fastest running index. The size and modification
+// time of the ascii map it was made from are kept to detect a stale cache
+#define FIELDMAP_VERSION 2
+
+struct FieldMapHeader
+{
+  char magic[8];
+  int version;
+  int nx, ny, nz;
+  double min[3];
+  double max[3];
+  int64_t sourceSize;
+  int64_t sourceMTime;
+};
+
+// Grid dimensions and z offsets of the FMAG (index 0) and KMAG (index 1) maps
+const int fieldMapGrid[2][3] = {{131, 121, 73}, {49, 37, 81}};
+const double fieldMapZOffset[2] = {0.0, -1064.26*cm};
+
 class TabulatedField3D: public G4MagneticField
 
 {
-  // Storage space for the table
-  vector< vector< vector< double > > > xField;
-  vector< vector< vector< double > > > yField;
-  vector< vector< vector< double > > > zField;
+  // Storage space for the table, interleaved (Bx, By, Bz) in Tesla, either owned
+  // or pointing into the memory mapped binary cache
+  vector< float > fieldTable;
+  const float* field;
+  void* mappedBuffer;
+  size_t mappedSize;
 
   // The dimensions of the table
   int nx,ny,nz; 
@@ -59,15 +83,34 @@ class TabulatedField3D: public G4MagneticField
   // The physical limits of the defined region
   float minx, maxx, miny, maxy, minz, maxz;
 
-  // The physical extent of the defined region
+  // The physical extent of the defined region and the inverse grid spacing
   double dx, dy, dz;
+  double invdx, invdy, invdz;
   double fZoffset;
   bool fmag;
 
   MYSQL* con;
 
+  // Size and modification time of the ascii map, -1 if it was not read from a file
+  int64_t sourceSize;
+  int64_t sourceMTime;
+
+  // Load the binary cache, false if it does not exist, does not match the grid
+  // or was made from a different version of the ascii map
+  bool readBinaryMap(const G4String& filename);
+
 public:
   TabulatedField3D(double, int, int, int, bool, Settings*);
+  ~TabulatedField3D();
   void  GetFieldValue(const double Point[3], double *Bfield) const;
+
+  // Save the current table as the binary cache, it is written to a temporary
+  // file first and renamed so that concurrent jobs never read a partial file.
+  // The constructor calls it when the cache is missing or stale
+  bool writeBinaryMap(const G4String& filename) const;
+
+  // Name of the binary cache next to the ascii map
+  static G4String binaryMapName(const G4String& asciiName) { return asciiName + ".bin"; }
+
   Settings* mySettings;
 };
@@ -11,30 +11,27 @@ Created: 10-13-2011
 #include <cmath>
 #include <TMath.h>
 #include <TVector3.h>
-#include <TMatrixD.h>
-#include <TMatrixDSym.h>
+#include <TMutex.h>
+#include <TVirtualMutex.h>
 
 #include "../MODE_SWITCH.h"
 #include "Settings.hh"
 #include "TrackExtrapolator.hh"
 #include "TPhysicsList.hh"
 
-bool TrackExtrapolator::fullInit = false;
+///Geant4e keeps one propagator manager per process, all the actual propagation has to be serialized
+static TMutex g4eMutex;
 
 TrackExtrapolator::TrackExtrapolator()
 {
     cov_i = G4ErrorTrajErr(5, 0);
     cov_f = G4ErrorTrajErr(5, 0);
     g4eProp = G4ErrorMatrix(5, 5);
-
-    jac_sd2sc.ResizeTo(5, 5);
-    jac_sc2sd.ResizeTo(5, 5);
 }
 
 TrackExtrapolator::~TrackExtrapolator()
 {
-    //delete everything ...
-    g4eMgr->CloseGeometry();
+    //The Geant4e geometry is shared by all extrapolators in the process and is left to Geant4 to clean up
 }
 
 bool TrackExtrapolator::init(std::string geometrySchema, double fMagStr, double kMagStr)
@@ -46,7 +43,11 @@ bool TrackExtrapolator::init(std::string geometrySchema, double fMagStr, double
 
     calcProp = true;
     calcLength = false;
-    if(!fullInit)
+    useRK = false;
+
+    //Only the first extrapolator in the process actually builds the geometry, the rest reuse it
+    TLockGuard lock(&g4eMutex);
+    if(g4eData->GetState() == G4ErrorState_PreInit)
     {
         //Specify the geometry schema for the MySQL
         Settings *mySettings = new Settings();
@@ -57,13 +58,14 @@ bool TrackExtrapolator::init(std::string geometrySchema, double fMagStr, double
 
         g4eMgr->SetUserInitialization(new DetectorConstruction(mySettings));
         g4eMgr->InitGeant4e();
-
-        fullInit = true;
     }
 
     G4UImanager::GetUIpointer()->ApplyCommand("/control/verbose 0");
     G4UImanager::GetUIpointer()->ApplyCommand("/tracking/verbose 0");
 
+    //The RKN propagator reads the same field map as Geant4e
+    rkProp.setField(G4TransportationManager::GetTransportationManager()->GetFieldManager()->GetDetectorField());
+
     return true;
 }
 
@@ -86,7 +88,7 @@ void TrackExtrapolator::setParticleType(int type)
     }
 }
 
-void TrackExtrapolator::convertSVtoMP(double z, TMatrixD& state, G4ThreeVector& mom, G4ThreeVector& pos)
+void TrackExtrapolator::convertSVtoMP(double z, const KMatrix<5, 1>& state, G4ThreeVector& mom, G4ThreeVector& pos)
 {
     double p = fabs(1./state[0][0]);
     double pz = p/sqrt(1. + state[1][0]*state[1][0] + state[2][0]*state[2][0]);
@@ -100,7 +102,7 @@ void TrackExtrapolator::convertSVtoMP(double z, TMatrixD& state, G4ThreeVector&
     mom.set(px*GeV, py*GeV, pz*GeV);
 }
 
-void TrackExtrapolator::convertMPtoSV(G4ThreeVector& mom, G4ThreeVector& pos, TMatrixD& state)
+void TrackExtrapolator::convertMPtoSV(G4ThreeVector& mom, G4ThreeVector& pos, KMatrix<5, 1>& state)
 {
     G4ThreeVector mom_gev = mom*MeV/GeV;
     G4ThreeVector pos_cm = pos*mm/cm;
@@ -113,7 +115,7 @@ void TrackExtrapolator::convertMPtoSV(G4ThreeVector& mom, G4ThreeVector& pos, TM
     state[4][0] = pos_cm.y();
 }
 
-void TrackExtrapolator::setInitialStateWithCov(double z_in, TMatrixD& state_in, TMatrixD& cov_in)
+void TrackExtrapolator::setInitialStateWithCov(double z_in, const KMatrix<5, 1>& state_in, const KMatrix<5, 5>& cov_in)
 {
     //Convert (1/p, x', y', x, y) to 3-vectors of momentum and position
     convertSVtoMP(z_in, state_in, mom_i, pos_i);
@@ -127,7 +129,14 @@ void TrackExtrapolator::setInitialStateWithCov(double z_in, TMatrixD& state_in,
         setParticleType(-1);
     }
 
-    TMatrixD cov_sd(5, 5);
+    //The RKN propagator works on the SD parameters, no conversion needed
+    if(useRK)
+    {
+        cov_sd_i = cov_in;
+        return;
+    }
+
+    KMatrix<5, 5> cov_sd;
     for(int i = 0; i < 5; i++)
     {
         for(int j = 0; j < 5; j++)
@@ -141,10 +150,7 @@ void TrackExtrapolator::setInitialStateWithCov(double z_in, TMatrixD& state_in,
 
     ///convert the error matrix from SD to SC
     TRSDSC(iParType, mom_i, pos_i);
-    TMatrixD jac_sd2sc_T = jac_sd2sc;
-    jac_sd2sc_T.T();
-
-    TMatrixD cov_sc = jac_sd2sc*cov_sd*jac_sd2sc_T;
+    KMatrix<5, 5> cov_sc = jac_sd2sc*cov_sd*jac_sd2sc.transpose();
     for(int i = 0; i < 5; i++)
     {
         for(int j = 0; j < 5; j++)
@@ -173,10 +179,14 @@ bool TrackExtrapolator::extrapolateTo(double z_out)
         mom_f = mom_i;
         pos_f = pos_i;
         cov_f = cov_i;
+        cov_sd_f = cov_sd_i;
+        prop_sd.UnitMatrix();
 
         return true;
     }
 
+    if(useRK) return extrapolateRK(z_out);
+
     ///Set step size
     int step = 1;
     if(z_out < 5000.)
@@ -192,6 +202,9 @@ bool TrackExtrapolator::extrapolateTo(double z_out)
         step = 4;
     }
 
+    ///From here on the shared Geant4e manager is used
+    TLockGuard lock(&g4eMutex);
+
     char buffer[100];
     sprintf(buffer, "/geant4e/limits/stepLength %d mm", step);
     G4UImanager::GetUIpointer()->ApplyCommand(buffer);
@@ -261,6 +274,24 @@ bool TrackExtrapolator::extrapolateTo(double z_out)
     return true;
 }
 
+bool TrackExtrapolator::extrapolateRK(double z_out)
+{
+    KMatrix<5, 1> state_i, state_f;
+    convertMPtoSV(mom_i, pos_i, state_i);
+
+    KMatrix<5, 5> noise;
+    if(!rkProp.propagate(pos_i[2]*mm/cm, state_i, z_out*mm/cm, state_f, prop_sd, noise))
+    {
+        return false;
+    }
+
+    convertSVtoMP(z_out*mm/cm, state_f, mom_f, pos_f);
+    cov_sd_f = prop_sd*cov_sd_i*prop_sd.transpose() + noise;
+    travelLength = rkProp.getTravelLength()*cm;
+
+    return true;
+}
+
 int TrackExtrapolator::propagate()
 {
     travelLength = 0.;
@@ -336,11 +367,16 @@ int TrackExtrapolator::propagate()
     return 0;
 }
 
-void TrackExtrapolator::getFinalStateWithCov(TMatrixD& state_out, TMatrixD& cov_out)
+void TrackExtrapolator::getFinalStateWithCov(KMatrix<5, 1>& state_out, KMatrix<5, 5>& cov_out)
 {
     convertMPtoSV(mom_f, pos_f, state_out);
+    if(useRK)
+    {
+        cov_out = cov_sd_f;
+        return;
+    }
 
-    TMatrixD cov_sc(5, 5);
+    KMatrix<5, 5> cov_sc;
     for(int i = 0; i < 5; i++)
     {
         for(int j = 0; j < 5; j++)
@@ -359,10 +395,7 @@ void TrackExtrapolator::getFinalStateWithCov(TMatrixD& state_out, TMatrixD& cov_
 
     //convert from SC to SD error matrix
     TRSCSD(iParType, mom_f, pos_f);
-    TMatrixD jac_sc2sd_T = jac_sc2sd;
-    jac_sc2sd_T.T();
-
-    cov_out = jac_sc2sd*cov_sc*jac_sc2sd_T;
+    cov_out = jac_sc2sd*cov_sc*jac_sc2sd.transpose();
 
     for(int i = 0; i < 5; i++)
     {
@@ -374,7 +407,7 @@ void TrackExtrapolator::getFinalStateWithCov(TMatrixD& state_out, TMatrixD& cov_
     }
 }
 
-void TrackExtrapolator::getPropagator(TMatrixD& prop)
+void TrackExtrapolator::getPropagator(KMatrix<5, 5>& prop)
 {
     if(fabs(pos_i[2] - pos_f[2]) < 1E-3)
     {
@@ -382,6 +415,12 @@ void TrackExtrapolator::getPropagator(TMatrixD& prop)
         return;
     }
 
+    if(useRK)
+    {
+        prop = prop_sd;
+        return;
+    }
+
     for(int i = 0; i < 5; i++)
     {
         for(int j = 0; j < 5; j++)
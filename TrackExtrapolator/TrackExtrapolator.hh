@@ -7,7 +7,9 @@ The magnetic field integration and energy loss effect are included.
 
 This class will be used in the prediction step of Kalman filter.
 
-The whole algorithm is based on the Geant4e.
+The whole algorithm is based on the Geant4e. Alternatively the Geant4e stepping can be
+replaced by the Runge-Kutta-Nystrom propagator (RKPropagator) on the same field map,
+which does not need the global Geant4e lock.
 The detector construction is taken from GMC by Bryan Kerns.
 
 Author: Kun Liu, liuk@fnal.gov
@@ -29,11 +31,12 @@ Created: 10-13-2011
 #include "G4VSteppingVerbose.hh"
 
 #include <string>
-#include <TMatrixD.h>
 #include <TVector3.h>
 
 #include "DetectorConstruction.hh"
+#include "RKPropagator.hh"
 #include "../MODE_SWITCH.h"
+#include "../KalmanMatrix.h"
 
 #define LogDebug(message) std::cout << "DEBUG: " << __FILE__ << "  " << __LINE__ << "  " << __FUNCTION__ << " :::  " << message << std::endl
 
@@ -47,19 +50,19 @@ public:
     bool init(std::string geometrySchema, double fMagStr = FMAGSTR, double kMagStr = KMAGSTR);
 
     ///Set input initial state parameters
-    void setInitialStateWithCov(double z_in, TMatrixD& state_in, TMatrixD& cov_in);
+    void setInitialStateWithCov(double z_in, const KMatrix<5, 1>& state_in, const KMatrix<5, 5>& cov_in);
 
     ///Set particle type
     void setParticleType(int type);
 
     ///Get the final state parameters and covariance
-    void getFinalStateWithCov(TMatrixD& state_out, TMatrixD& cov_out);
+    void getFinalStateWithCov(KMatrix<5, 1>& state_out, KMatrix<5, 5>& cov_out);
     double getTravelLength() { return travelLength;}
 
     ///Get the propagator
     //void buildNumericalPropagator();
-    //void getNumericalPropagator(TMatrixD& prop);
-    void getPropagator(TMatrixD& prop);
+    //void getNumericalPropagator(KMatrix<5, 5>& prop);
+    void getPropagator(KMatrix<5, 5>& prop);
 
     ///Extrapolate to a new surface z_out
     bool extrapolateTo(double z_out);
@@ -69,28 +72,29 @@ public:
     double extrapolateToIP();
 
     ///Transformation between the state vector and the mom/pos
-    void convertSVtoMP(double z, TMatrixD& state, G4ThreeVector& mom, G4ThreeVector& pos);
-    void convertMPtoSV(G4ThreeVector& mom, G4ThreeVector& pos, TMatrixD& state);
+    void convertSVtoMP(double z, const KMatrix<5, 1>& state, G4ThreeVector& mom, G4ThreeVector& pos);
+    void convertMPtoSV(G4ThreeVector& mom, G4ThreeVector& pos, KMatrix<5, 1>& state);
 
     ///Transformation between the SC and SD parameters and error matrix
     ///Transplanted from GEANT3 fortran code
     void TRSDSC(int charge, G4ThreeVector mom_input, G4ThreeVector pos_input);
     void TRSCSD(int charge, G4ThreeVector mom_input, G4ThreeVector pos_input);
-    TMatrixD& getJacSD2SC() { return jac_sd2sc; }
-    TMatrixD& getJacSC2SD() { return jac_sc2sd; }
+    KMatrix<5, 5>& getJacSD2SC() { return jac_sd2sc; }
+    KMatrix<5, 5>& getJacSC2SD() { return jac_sc2sd; }
 
     ///External control of modes
     void setPropCalc(bool option) { calcProp = option; }
     void setLengthCalc(bool option) { calcLength = option; }
 
+    ///Use the Runge-Kutta-Nystrom propagator instead of Geant4e
+    void setRKPropagation(bool option) { useRK = option; }
+    bool isRKPropagation() { return useRK; }
+
     ///Debug print
     void print();
 
 private:
 
-    ///Internal static flag, check if the tracking manager has been inited of not
-    static bool fullInit;
-
     ///Particle type, for now only mu+/- is implemented
     int iParType;
     G4String parType;
@@ -114,8 +118,8 @@ private:
     G4ErrorTrajErr cov_f;
 
     ///Jacobians
-    TMatrixD jac_sd2sc;
-    TMatrixD jac_sc2sd;
+    KMatrix<5, 5> jac_sd2sc;
+    KMatrix<5, 5> jac_sc2sd;
 
     ///Control on calculation of propagation matrix
     bool calcProp;
@@ -123,6 +127,15 @@ private:
     ///Control on calculation of travel length
     bool calcLength;
     double travelLength;
+
+    ///Runge-Kutta-Nystrom propagation, which works directly on the SD parameters
+    bool extrapolateRK(double z_out);
+
+    bool useRK;
+    RKPropagator rkProp;
+    KMatrix<5, 5> cov_sd_i;
+    KMatrix<5, 5> cov_sd_f;
+    KMatrix<5, 5> prop_sd;
 };
 
 #endif
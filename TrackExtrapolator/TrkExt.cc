@@ -4,7 +4,8 @@
 
 using namespace std;
 
-void printMatrix(const TMatrixD& m, std::string str)
+template<unsigned int R, unsigned int C>
+void printMatrix(const KMatrix<R, C>& m, std::string str)
 {  
   int nRow = m.GetNrows();
   int nCol = m.GetNcols();
@@ -28,7 +29,7 @@ int main(int argc, char *argv[])
 
   j.init("geometry_R997");
 
-  TMatrixD state_i(5, 1), state_f(5, 1);
+  KMatrix<5, 1> state_i, state_f;
   //state_i[0][0] = 0.0197863;
   //state_i[1][0] = 3.14749/sqrt(1./0.0197863/0.0197863-3.14749*3.14749-0.563128*0.563128);
   //state_i[2][0] = 0.563128/sqrt(1./0.0197863/0.0197863-3.14749*3.14749-0.563128*0.563128);
@@ -41,7 +42,7 @@ int main(int argc, char *argv[])
   state_i[3][0] = 55.2596;
   state_i[4][0] = 15.3771;
 
-  TMatrixD cov_i(5, 5), cov_f(5, 5);
+  KMatrix<5, 5> cov_i, cov_f;
   for(Int_t i = 0; i < 5; i++)
     {
       state_f[i][0] = 0.;
@@ -66,10 +67,10 @@ int main(int argc, char *argv[])
   j.getFinalStateWithCov(state_f, cov_f);
   }
   
-  TMatrixD prop(5, 5);
+  KMatrix<5, 5> prop;
   j.getPropagator(prop);
     
-  TMatrixD state_calc = prop*state_i;
+  KMatrix<5, 1> state_calc = prop*state_i;
   
   printMatrix(prop, "propagator");
   printMatrix(state_f, "final state vector");
@@ -77,7 +78,7 @@ int main(int argc, char *argv[])
   printMatrix(cov_f, "error matrix");
   printMatrix(cov_i, "original error matrix");
 
-  TMatrixD prop_T = prop; prop_T.T();
+  KMatrix<5, 5> prop_T = prop.transpose();
   printMatrix(prop*cov_i*prop_T, "propagated error matrix");
 
   printMatrix(cov_f - prop*cov_i*prop_T, "extra added on err matrix");
@@ -325,15 +325,19 @@ bool TriggerAnalyzer::acceptEvent(SRawEvent* rawEvent, int mode)
 
     if((mode & USE_HIT) != 0)
     {
-        for(std::vector<Hit>::iterator iter = rawEvent->getAllHits().begin(); iter != rawEvent->getAllHits().end(); ++iter)
+        const std::vector<Hit>& hits = rawEvent->getAllHits();
+        for(int detectorID = 25; detectorID <= 40; ++detectorID)
         {
-            if(iter->detectorID < 25 || iter->detectorID > 40) continue;
-            if(!iter->isInTime()) continue;
+            SRawEvent::hit_range range = rawEvent->getHitsIndexRange(detectorID);
+            for(SRawEvent::hit_iterator iter = range.first; iter != range.second; ++iter)
+            {
+                if(!hits[*iter].isInTime()) continue;
 
-            detectorIDs[nHits] = iter->detectorID;
-            elementIDs[nHits] = iter->elementID;
+                detectorIDs[nHits] = hits[*iter].detectorID;
+                elementIDs[nHits] = hits[*iter].elementID;
 
-            ++nHits;
+                ++nHits;
+            }
         }
     }
 
@@ -574,7 +578,7 @@ void TriggerAnalyzer::outputEnabled()
     fout_pair.close();
 }
 
-void TriggerAnalyzer::trimEvent(SRawEvent* rawEvent, std::list<Hit>& hitlist, int mode)
+void TriggerAnalyzer::trimEvent(SRawEvent* rawEvent, std::vector<Hit>& hitlist, int mode, int nHitsBefore)
 {
     rawEvent->setTriggerEmu(acceptEvent(rawEvent, mode));
 
@@ -588,7 +592,7 @@ void TriggerAnalyzer::trimEvent(SRawEvent* rawEvent, std::list<Hit>& hitlist, in
             for(int j = 0; j < 4; ++j)
             {
                 Hit h;
-                h.index = 10000 + hitlist.size();  // give it a huge offset
+                h.index = 10000 + nHitsBefore + hitlist.size();  // give it a huge offset
                 h.detectorID = iter->detectorIDs[j];
                 h.elementID = iter->elementIDs[j];
                 h.tdcTime = 9999.;
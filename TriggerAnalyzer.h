@@ -50,8 +50,9 @@ public:
     bool acceptEvent(int nHits, int detectorIDs[], int elementIDs[]);
     bool acceptEvent(SRawEvent* rawEvent, int mode = USE_TRIGGER_HIT);
 
-    //Trim a event's hodoscope hits
-    void trimEvent(SRawEvent* rawEvent, std::list<Hit>& hitlist, int mode = USE_TRIGGER_HIT);
+    //Trim a event's hodoscope hits, the hits made from the roads found are appended to hitlist and
+    //numbered after the nHitsBefore hodoscope hits the caller already has elsewhere
+    void trimEvent(SRawEvent* rawEvent, std::vector<Hit>& hitlist, int mode = USE_TRIGGER_HIT, int nHitsBefore = 0);
 
     //Get the road list of +/-
     std::list<TriggerRoad>& getRoadsAll(int charge) { return roads[(-charge+1)/2]; }
@@ -10,33 +10,31 @@ Created: 2-8-2012
 
 #include <iostream>
 #include <cmath>
-#include <TMatrixD.h>
+
+#include <TThread.h>
+#include <TString.h>
 
 #include "VertexFit.h"
 
-VertexFit::VertexFit()
+VertexFit::VertexFit(KalmanFilter* kmfit)
 {
     ///In construction, initialize the projector for the vertex node
-    TMatrixD proj(2, 5);
-    proj.Zero();
-
+    KMatrix<2, 5> proj;
     proj[0][3] = 1.;
     proj[1][4] = 1.;
 
-    _node_vertex.getMeasurement().ResizeTo(2, 1);
-    _node_vertex.getMeasurementCov().ResizeTo(2, 2);
-    _node_vertex.getProjector().ResizeTo(2, 5);
-
-    _node_vertex.getProjector() = proj;
+    KMatrix<2, 2> cov;
+    cov[0][0] = 1.;
+    cov[1][1] = 1.;
 
-    _node_vertex.getMeasurementCov().Zero();
-    _node_vertex.getMeasurementCov()[0][0] = 1.;
-    _node_vertex.getMeasurementCov()[1][1] = 1.;
+    _node_vertex.setMeasurement(KMatrix<2, 1>(), cov);
+    _node_vertex.setProjector(proj);
 
     _max_iteration = 200;
     _tolerance = .05;
 
-    _kmfit = KalmanFilter::instance();
+    _own_kmfit = kmfit == NULL;
+    _kmfit = _own_kmfit ? new KalmanFilter() : kmfit;
     _kmfit->enableDumpCorrection();
     _extrapolator.init(GEOMETRY_VERSION);
 
@@ -47,6 +45,15 @@ VertexFit::VertexFit()
     ///disable target optimization by default
     optimize = false;
 
+    ///fit all pairs in the calling thread by default
+    preScreen = false;
+    nPairsAll = 0;
+    nPairsScreened = 0;
+    pairEvent = NULL;
+    pairLikeSign = false;
+    helpersDone = NULL;
+    nextTask = 0;
+
     ///disable evaluation by default
     evalFile = NULL;
     evalTree = NULL;
@@ -58,32 +65,48 @@ VertexFit::VertexFit()
 
 VertexFit::~VertexFit()
 {
+    for(unsigned int i = 0; i < helpers.size(); ++i)
+    {
+        helpers[i]->commands.close();
+        helpers[i]->thread->Join();
+
+        delete helpers[i]->thread;
+        delete helpers[i]->fitter;
+        delete helpers[i];
+    }
+    if(helpersDone != NULL) delete helpersDone;
+
     if(evalFile != NULL)
     {
         evalFile->cd();
         evalTree->Write();
         evalFile->Close();
     }
+
+    if(_own_kmfit) delete _kmfit;
 }
 
 int VertexFit::setRecEvent(SRecEvent* recEvent, int sign1, int sign2)
 {
+    //Swim all tracks together once here, the pairs below only read the trajectories
+    recEvent->swimTracks();
+
     //if the single vertex is not set, set it first
     int nTracks = recEvent->getNTracks();
     for(int i = 0; i < nTracks; ++i)
     {
         SRecTrack& recTrack = recEvent->getTrack(i);
 
-        recTrack.setZVertex(Z_TARGET, false);
+        recTrack.setZVertex(Z_TARGET, _kmfit, false);
         recTrack.setChisqTarget(recTrack.getChisqVertex());
 
-        recTrack.setZVertex(Z_DUMP, false);
+        recTrack.setZVertex(Z_DUMP, _kmfit, false);
         recTrack.setChisqDump(recTrack.getChisqVertex());
 
-        recTrack.setZVertex(Z_UPSTREAM+10., false);
+        recTrack.setZVertex(Z_UPSTREAM+10., _kmfit, false);
         recTrack.setChisqUpstream(recTrack.getChisqVertex());
 
-        recTrack.setZVertex(recTrack.getZVertex(), true);
+        recTrack.setZVertex(recTrack.getZVertex(), _kmfit, true);
     }
 
     std::vector<int> idx_pos = recEvent->getChargedTrackIDs(sign1);
@@ -101,127 +124,224 @@ int VertexFit::setRecEvent(SRecEvent* recEvent, int sign1, int sign2)
         targetPos = recEvent->getTargetPos();
     }
 
-    //Loop over all possible combinations
+    //Collect the combinations passing the pre-screening, the tracks stay in the event and are referred to by index
+    pairs.clear();
     for(int i = 0; i < nPos; ++i)
     {
-        if(!recEvent->getTrack(idx_pos[i]).isValid()) continue;
+        SRecTrack& track_pos = recEvent->getTrack(idx_pos[i]);
+        if(!track_pos.isValid()) continue;
         for(int j = 0; j < nNeg; ++j)
         {
             //Only needed for like-sign muons
             if(idx_pos[i] == idx_neg[j]) continue;
 
-            SRecTrack track_neg = recEvent->getTrack(idx_neg[j]);
+            SRecTrack& track_neg = recEvent->getTrack(idx_neg[j]);
             if(!track_neg.isValid()) continue;
-            SRecTrack track_pos = recEvent->getTrack(idx_pos[i]);
-
-            SRecDimuon dimuon;
-            dimuon.trackID_pos = idx_pos[i];
-            dimuon.trackID_neg = idx_neg[j];
-
-            dimuon.p_pos_single = track_pos.getMomentumVertex();
-            dimuon.p_neg_single = track_neg.getMomentumVertex();
-            dimuon.vtx_pos = track_pos.getVertex();
-            dimuon.vtx_neg = track_neg.getVertex();
-            dimuon.chisq_single = track_pos.getChisqVertex() + track_neg.getChisqVertex();
-
-            //Start prepare the vertex fit
-            init();
-            addTrack(0, track_pos);
-            addTrack(1, track_neg);
-            addHypothesis(0.5*(dimuon.vtx_pos[2] + dimuon.vtx_neg[2]), 50.);
-            addHypothesis(findDimuonVertexFast(track_pos, track_neg), 50.);
-            choice_eval = processOnePair();
-
-            //Fill the dimuon info which are not related to track refitting first
-            dimuon.chisq_vx = getVXChisq();
-            dimuon.vtx.SetXYZ(_vtxpar_curr._r[0][0], _vtxpar_curr._r[1][0], _vtxpar_curr._r[2][0]);
-
-            dimuon.proj_target_pos = track_pos.getTargetPos();
-            dimuon.proj_dump_pos = track_pos.getDumpPos();
-            dimuon.proj_target_neg = track_neg.getTargetPos();
-            dimuon.proj_dump_neg = track_neg.getDumpPos();
-
-            //Retrieve the results
-            double z_vertex_opt = getVertexZ0();
-            if(optimize)
+
+            DimuonPair pair;
+            pair.trackID_pos = idx_pos[i];
+            pair.trackID_neg = idx_neg[j];
+
+            double dca;
+            pair.z_fast = findDimuonVertexFast(track_pos, track_neg, &dca);
+
+            ++nPairsAll;
+            if(preScreen && !passPreScreening(track_pos, track_neg, dca))
             {
-                //if(z_vertex_opt < -80. && getKFChisq() < 10.) z_vertex_opt = 4.094*(dimuon.p_pos_single + dimuon.p_neg_single).M() - 152.7;
-                if(dimuon.proj_target_pos.Perp() < dimuon.proj_dump_pos.Perp() && dimuon.proj_target_neg.Perp() < dimuon.proj_dump_neg.Perp())
-                {
-                    int nTry = 0;
-                    double z_curr = 9999.;
-                    while(fabs(z_curr - z_vertex_opt) > 0.5 && nTry < 100)
-                    {
-                        z_curr = z_vertex_opt;
-                        ++nTry;
-
-                        track_pos.setZVertex(z_vertex_opt);
-                        track_neg.setZVertex(z_vertex_opt);
-
-                        double m = (track_pos.getMomentumVertex() + track_neg.getMomentumVertex()).M();
-                        z_vertex_opt = -189.6 + 17.71*m - 1.159*m*m;
-
-                        //std::cout << nTry << "  " << z_curr << "  " << z_vertex_opt << "  " << (track_pos.getMomentumVertex() + track_neg.getMomentumVertex()).M() << std::endl;
-                    }
-                }
+                ++nPairsScreened;
+                continue;
             }
 
-            track_pos.setZVertex(z_vertex_opt);
-            track_neg.setZVertex(z_vertex_opt);
-            dimuon.p_pos = track_pos.getMomentumVertex();
-            dimuon.p_neg = track_neg.getMomentumVertex();
-            dimuon.chisq_kf = track_pos.getChisqVertex() + track_neg.getChisqVertex();
+            pairs.push_back(pair);
+        }
+    }
 
-            //If we are running in the like-sign mode, reverse one sign of px
-            if(sign1 + sign2 != 0)
+    //Fit the surviving pairs, the helpers are only used when there is more than one
+    pairEvent = recEvent;
+    pairLikeSign = sign1 + sign2 != 0;
+    pairResults.assign(pairs.size(), SRecDimuon());
+    nextTask = 0;
+    if(helpers.empty() || pairs.size() < 2)
+    {
+        runTasks(this);
+    }
+    else
+    {
+        for(unsigned int i = 0; i < helpers.size(); ++i)
+        {
+            helpers[i]->fitter->optimize = optimize;
+            helpers[i]->fitter->setControlParameter(_max_iteration, _tolerance);
+            helpers[i]->commands.push(0);
+        }
+        runTasks(this);
+
+        //The event is only touched again after all helpers are done
+        int done;
+        for(unsigned int i = 0; i < helpers.size(); ++i) helpersDone->pop(done);
+    }
+
+    //Fill the final data in the order of the combinations
+    for(unsigned int i = 0; i < pairResults.size(); ++i) recEvent->insertDimuon(pairResults[i]);
+
+    if(recEvent->getNDimuons() > 0) return VFEXIT_SUCCESS;
+    return VFEXIT_FAIL_ITERATION;
+}
+
+bool VertexFit::passPreScreening(SRecTrack& track_pos, SRecTrack& track_neg, double dca)
+{
+    //The trajectories have to meet somewhere, a negative dca means no closest approach was found and is kept
+    if(dca > VTX_PRESCREEN_DCA) return false;
+
+    //Heuristic: tracks which fit badly to their own vertex rarely make a good dimuon vertex. The single muon
+    //vertex z comes from extrapolateToIP and not from a chi square minimization, so the sum is not a lower bound
+    //of the dimuon vertex chi square and good pairs can be lost, see the README on measuring the loss
+    if(track_pos.getChisqVertex() + track_neg.getChisqVertex() > VTX_PRESCREEN_CHISQ) return false;
+
+    return true;
+}
+
+int VertexFit::fitDimuon(SRecTrack& track_pos, SRecTrack& track_neg, double z_fast, bool likeSign, SRecDimuon& dimuon)
+{
+    dimuon.p_pos_single = track_pos.getMomentumVertex();
+    dimuon.p_neg_single = track_neg.getMomentumVertex();
+    dimuon.vtx_pos = track_pos.getVertex();
+    dimuon.vtx_neg = track_neg.getVertex();
+    dimuon.chisq_single = track_pos.getChisqVertex() + track_neg.getChisqVertex();
+
+    //Start prepare the vertex fit
+    init();
+    addTrack(0, track_pos);
+    addTrack(1, track_neg);
+    addHypothesis(0.5*(dimuon.vtx_pos[2] + dimuon.vtx_neg[2]), 50.);
+    addHypothesis(z_fast, 50.);
+    choice_eval = processOnePair();
+
+    //Fill the dimuon info which are not related to track refitting first
+    dimuon.chisq_vx = getVXChisq();
+    dimuon.vtx.SetXYZ(_vtxpar_curr._r[0][0], _vtxpar_curr._r[1][0], _vtxpar_curr._r[2][0]);
+
+    dimuon.proj_target_pos = track_pos.getTargetPos();
+    dimuon.proj_dump_pos = track_pos.getDumpPos();
+    dimuon.proj_target_neg = track_neg.getTargetPos();
+    dimuon.proj_dump_neg = track_neg.getDumpPos();
+
+    //Retrieve the results
+    double z_vertex_opt = getVertexZ0();
+    if(optimize)
+    {
+        //if(z_vertex_opt < -80. && getKFChisq() < 10.) z_vertex_opt = 4.094*(dimuon.p_pos_single + dimuon.p_neg_single).M() - 152.7;
+        if(dimuon.proj_target_pos.Perp() < dimuon.proj_dump_pos.Perp() && dimuon.proj_target_neg.Perp() < dimuon.proj_dump_neg.Perp())
+        {
+            int nTry = 0;
+            double z_curr = 9999.;
+            while(fabs(z_curr - z_vertex_opt) > 0.5 && nTry < 100)
             {
-                if(dimuon.p_pos.Px() < 0)
-                {
-                    dimuon.p_pos.SetPx(-dimuon.p_pos.Px());
-                    dimuon.p_pos_single.SetPx(-dimuon.p_pos_single.Px());
-                }
-                if(dimuon.p_neg.Px() > 0)
-                {
-                    dimuon.p_neg.SetPx(-dimuon.p_neg.Px());
-                    dimuon.p_neg_single.SetPx(-dimuon.p_neg_single.Px());
-                }
-
-                if(dimuon.p_pos.Py()*dimuon.p_neg.Py() > 0)
-                {
-                    dimuon.p_pos.SetPy(-dimuon.p_pos.Py());
-                    dimuon.p_pos_single.SetPy(-dimuon.p_pos_single.Py());
-                }
+                z_curr = z_vertex_opt;
+                ++nTry;
+
+                TLorentzVector mom_pos, mom_neg;
+                track_pos.getVertexAtZ(z_vertex_opt, _kmfit, mom_pos);
+                track_neg.getVertexAtZ(z_vertex_opt, _kmfit, mom_neg);
+
+                double m = (mom_pos + mom_neg).M();
+                z_vertex_opt = -189.6 + 17.71*m - 1.159*m*m;
             }
-            dimuon.calcVariables();
+        }
+    }
 
-            //Test three fixed hypothesis
-            dimuon.chisq_dump = track_pos.getChisqDump() + track_neg.getChisqDump();
-            dimuon.chisq_target = track_pos.getChisqTarget() + track_neg.getChisqTarget();
-            dimuon.chisq_upstream = track_pos.getChisqUpstream() + track_neg.getChisqUpstream();
+    dimuon.chisq_kf = track_pos.getVertexAtZ(z_vertex_opt, _kmfit, dimuon.p_pos) + track_neg.getVertexAtZ(z_vertex_opt, _kmfit, dimuon.p_neg);
 
-            //Fill the final data
-            recEvent->insertDimuon(dimuon);
+    //If we are running in the like-sign mode, reverse one sign of px
+    if(likeSign)
+    {
+        if(dimuon.p_pos.Px() < 0)
+        {
+            dimuon.p_pos.SetPx(-dimuon.p_pos.Px());
+            dimuon.p_pos_single.SetPx(-dimuon.p_pos_single.Px());
+        }
+        if(dimuon.p_neg.Px() > 0)
+        {
+            dimuon.p_neg.SetPx(-dimuon.p_neg.Px());
+            dimuon.p_neg_single.SetPx(-dimuon.p_neg_single.Px());
+        }
 
-            //Fill the evaluation data
-            p_idx_eval = dimuon.trackID_pos;
-            m_idx_eval = dimuon.trackID_neg;
-            fillEvaluation();
+        if(dimuon.p_pos.Py()*dimuon.p_neg.Py() > 0)
+        {
+            dimuon.p_pos.SetPy(-dimuon.p_pos.Py());
+            dimuon.p_pos_single.SetPy(-dimuon.p_pos_single.Py());
         }
     }
+    dimuon.calcVariables();
 
-    if(recEvent->getNDimuons() > 0) return VFEXIT_SUCCESS;
-    return VFEXIT_FAIL_ITERATION;
+    //Test three fixed hypothesis
+    dimuon.chisq_dump = track_pos.getChisqDump() + track_neg.getChisqDump();
+    dimuon.chisq_target = track_pos.getChisqTarget() + track_neg.getChisqTarget();
+    dimuon.chisq_upstream = track_pos.getChisqUpstream() + track_neg.getChisqUpstream();
+
+    //Fill the evaluation data, only booked when the pairs are fitted in the calling thread
+    p_idx_eval = dimuon.trackID_pos;
+    m_idx_eval = dimuon.trackID_neg;
+    fillEvaluation();
+
+    return choice_eval;
+}
+
+void VertexFit::enableParallel(int nThreads)
+{
+    //The evaluation tree is filled pair by pair, so it stays serial
+    if(!helpers.empty() || nThreads < 2 || evalTree != NULL) return;
+
+    TThread::Initialize();
+    helpersDone = new ThreadQueue<int>(nThreads);
+
+    //This fitter is used by the calling thread, so only nThreads - 1 helpers are needed
+    for(int i = 0; i < nThreads - 1; ++i)
+    {
+        VertexHelper* helper = new VertexHelper;
+        helper->parent = this;
+        helper->fitter = new VertexFit();
+        helper->thread = new TThread(Form("vertexHelper%d", i), runHelper, helper);
+        helper->thread->Run();
+
+        helpers.push_back(helper);
+    }
+}
+
+void VertexFit::runTasks(VertexFit* fitter)
+{
+    while(true)
+    {
+        taskMutex.Lock();
+        unsigned int index = nextTask++;
+        taskMutex.UnLock();
+        if(index >= pairs.size()) break;
+
+        SRecDimuon& dimuon = pairResults[index];
+        dimuon.trackID_pos = pairs[index].trackID_pos;
+        dimuon.trackID_neg = pairs[index].trackID_neg;
+        fitter->fitDimuon(pairEvent->getTrack(dimuon.trackID_pos), pairEvent->getTrack(dimuon.trackID_neg), pairs[index].z_fast, pairLikeSign, dimuon);
+    }
 }
 
-double VertexFit::findDimuonVertexFast(SRecTrack& track1, SRecTrack& track2)
+void* VertexFit::runHelper(void* arg)
 {
-    //Swim both tracks all the way down, and store the numbers
-    TVector3 pos1[NSLICES_FMAG + NSTEPS_TARGET + 1];
-    TVector3 pos2[NSLICES_FMAG + NSTEPS_TARGET + 1];
-    TVector3 mom1[NSLICES_FMAG + NSTEPS_TARGET + 1];
-    TVector3 mom2[NSLICES_FMAG + NSTEPS_TARGET + 1];
-    track1.swimToVertex(pos1, mom1);
-    track2.swimToVertex(pos2, mom2);
+    VertexHelper* helper = (VertexHelper*)arg;
+
+    int task;
+    while(helper->commands.pop(task))
+    {
+        helper->parent->runTasks(helper->fitter);
+        helper->parent->helpersDone->push(task);
+    }
+
+    return NULL;
+}
+
+double VertexFit::findDimuonVertexFast(SRecTrack& track1, SRecTrack& track2, double* dca)
+{
+    //Both tracks were swum in setRecEvent, the trajectories are only read here so that the tracks can be shared
+    const double* traj1 = track1.getSwimStep(0);
+    const double* traj2 = track2.getSwimStep(0);
 
     int iStep_min = -1;
     double dist_min = 1E6;
@@ -229,16 +349,22 @@ double VertexFit::findDimuonVertexFast(SRecTrack& track1, SRecTrack& track2)
     int charge2 = track2.getCharge();
     for(int iStep = 0; iStep < NSLICES_FMAG + NSTEPS_TARGET + 1; ++iStep)
     {
-        double dist = (pos1[iStep] - pos2[iStep]).Perp();
-        if(dist < dist_min && charge1*mom1[iStep].Px() > 0 && charge2*mom2[iStep].Px() > 0)
+        const double* step1 = &traj1[6*iStep];
+        const double* step2 = &traj2[6*iStep];
+
+        double dx = step1[0] - step2[0];
+        double dy = step1[1] - step2[1];
+        double dist = sqrt(dx*dx + dy*dy);
+        if(dist < dist_min && charge1*step1[3] > 0 && charge2*step2[3] > 0)
         {
             iStep_min = iStep;
             dist_min = dist;
         }
     }
 
+    if(dca != NULL) *dca = iStep_min == -1 ? -1. : dist_min;
     if(iStep_min == -1) return Z_DUMP;
-    return pos1[iStep_min].Z();
+    return traj1[6*iStep_min+2];
 }
 
 void VertexFit::init()
@@ -408,25 +534,22 @@ void VertexFit::updateVertex()
     double pz = sqrt(p*p - px*px - py*py);
 
     ///Set the projector matrix from track state vector to the coordinate
-    TMatrixD H(2, 3);
-    H.Zero();
-
+    KMatrix<2, 3> H;
     H[0][0] = 1.;
     H[1][1] = 1.;
     H[0][2] = -px/pz;
     H[1][2] = -py/pz;
 
-    TMatrixD vertex_dummy(3, 1);
-    vertex_dummy.Zero();
+    KMatrix<3, 1> vertex_dummy;
     vertex_dummy[2][0] = _vtxpar_curr._r[2][0];
 
-    TMatrixD mxy = _node_vertex.getFiltered()._state_kf.GetSub(3, 4, 0, 0);
-    TMatrixD Vxy = _node_vertex.getFiltered()._covar_kf.GetSub(3, 4, 3, 4);
-    TMatrixD S = SMatrix::invertMatrix(Vxy + SMatrix::getABCt(H, _vtxpar_curr._cov, H));
-    TMatrixD K = SMatrix::getABtC(_vtxpar_curr._cov, H, S);
-    TMatrixD zeta = mxy - H*(_vtxpar_curr._r - vertex_dummy);
-    TMatrixD _r_filtered = _vtxpar_curr._r + K*zeta;
-    TMatrixD _cov_filtered = _vtxpar_curr._cov - K*H*(_vtxpar_curr._cov);
+    KMatrix<2, 1> mxy = _node_vertex.getFiltered()._state_kf.getSub<2, 1>(3, 0);
+    KMatrix<2, 2> Vxy = _node_vertex.getFiltered()._covar_kf.getSub<2, 2>(3, 3);
+    KMatrix<2, 2> S = SMatrix::invertMatrix(Vxy + SMatrix::getSimilarity(H, _vtxpar_curr._cov));
+    KMatrix<3, 2> K = SMatrix::getABtC(_vtxpar_curr._cov, H, S);
+    KMatrix<2, 1> zeta = mxy - H*(_vtxpar_curr._r - vertex_dummy);
+    KMatrix<3, 1> _r_filtered = _vtxpar_curr._r + K*zeta;
+    KMatrix<3, 3> _cov_filtered = _vtxpar_curr._cov - K*H*(_vtxpar_curr._cov);
 
     _chisq_vertex += SMatrix::getAtBC(zeta, S, zeta)[0][0];
 
@@ -22,23 +22,42 @@ Created: 2-8-2012
 
 #include <TFile.h>
 #include <TTree.h>
-#include <TMatrixD.h>
+#include <TMutex.h>
 
 #include "KalmanUtil.h"
 #include "KalmanFilter.h"
 #include "KalmanTrack.h"
 #include "SRecEvent.h"
 #include "FastTracklet.h"
+#include "ThreadQueue.h"
 #include "TrackExtrapolator/TrackExtrapolator.hh"
 
+class TThread;
+class VertexFit;
+
+///Helper of the parallel pair fits, a vertex fitter with its own Kalman filter running in its own thread
+struct VertexHelper
+{
+    VertexFit* parent;
+    VertexFit* fitter;
+    TThread* thread;
+
+    ThreadQueue<int> commands;
+};
+
+///One combination of the event passing the pre-screening, the tracks are referred to by their index in the SRecEvent
+struct DimuonPair
+{
+    int trackID_pos;
+    int trackID_neg;
+    double z_fast;
+};
+
 class VtxPar
 {
 public:
     VtxPar()
     {
-        _r.ResizeTo(3, 1);
-        _cov.ResizeTo(3, 3);
-
         _r.Zero();
         _cov.Zero();
     }
@@ -49,16 +68,20 @@ public:
         SMatrix::printMatrix(_cov, "Vertex covariance:");
     }
 
-    TMatrixD _r;
-    TMatrixD _cov;
+    KMatrix<3, 1> _r;
+    KMatrix<3, 3> _cov;
 };
 
 class VertexFit
 {
 public:
-    VertexFit();
+    ///The vertex finder uses the external Kalman filter if provided, otherwise it owns a private one
+    VertexFit(KalmanFilter* kmfit = NULL);
     ~VertexFit();
 
+    ///Access to the Kalman filter used for the single track vertex
+    KalmanFilter* getKalmanFilter() { return _kmfit; }
+
     ///Enable the optimization of final dimuon vertex z position
     void enableOptimization() { optimize = true; }
 
@@ -72,6 +95,20 @@ public:
     ///Set the SRecEvent, main external call the use vertex fit
     int setRecEvent(SRecEvent* recEvent, int sign1 = 1, int sign2 = -1);
 
+    ///Fit the pairs of an event with nThreads threads including the calling one, not available in evaluation mode
+    void enableParallel(int nThreads);
+
+    ///Enable/disable the pre-screening of the pairs with the VTX_PRESCREEN_* limits, disabled by default
+    void enablePreScreening(bool opt) { preScreen = opt; }
+    bool passPreScreening(SRecTrack& track_pos, SRecTrack& track_neg, double dca);
+
+    ///Number of pairs considered and of pairs rejected by the pre-screening since the construction
+    int getNPairsAll() { return nPairsAll; }
+    int getNPairsScreened() { return nPairsScreened; }
+
+    ///Full vertex fit of one pair starting from the fast vertex z_fast, the tracks are only read
+    int fitDimuon(SRecTrack& track_pos, SRecTrack& track_neg, double z_fast, bool likeSign, SRecDimuon& dimuon);
+
     ///Initialize and reset
     void init();
     void addHypothesis(double z, double sigz = 50.) { z_start.push_back(z); sig_z_start.push_back(sigz); }
@@ -87,7 +124,7 @@ public:
 
     ///Find the primary vertex
     int findVertex();
-    double findDimuonVertexFast(SRecTrack& track1, SRecTrack& track2);
+    double findDimuonVertexFast(SRecTrack& track1, SRecTrack& track2, double* dca = NULL);
     double findSingleMuonVertex(SRecTrack& _track);
     double findSingleMuonVertex(Node& _node_start);
     double findSingleMuonVertex(TrkPar& _trkpar_start);
@@ -120,6 +157,7 @@ private:
 
     ///pointer to external Kalman filter
     KalmanFilter* _kmfit;
+    bool _own_kmfit;
 
     ///chi squares
     double _chisq_vertex;
@@ -145,6 +183,26 @@ private:
     ///Flag to enable/disable optimization of final position
     bool optimize;
 
+    ///Pairs of the current event to be fitted, and the fitted dimuons in the same order
+    bool preScreen;
+    int nPairsAll;
+    int nPairsScreened;
+    SRecEvent* pairEvent;
+    bool pairLikeSign;
+    std::vector<DimuonPair> pairs;
+    std::vector<SRecDimuon> pairResults;
+
+    ///Parallel pair fits
+    //Take pairs until none is left, called by every thread with its own fitter
+    void runTasks(VertexFit* fitter);
+
+    static void* runHelper(void* arg);
+
+    std::vector<VertexHelper*> helpers;
+    ThreadQueue<int>* helpersDone;
+    unsigned int nextTask;
+    TMutex taskMutex;
+
     ///Evaluation file and tree
     TFile* evalFile;
     TTree* evalTree;
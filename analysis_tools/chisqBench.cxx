@@ -0,0 +1,230 @@
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include <TROOT.h>
+#include <TFile.h>
+#include <TTree.h>
+#include <TRandom.h>
+#include <TClonesArray.h>
+#include <TStopwatch.h>
+
+#include "GeomSvc.h"
+#include "FastTracklet.h"
+#include "KalmanFastTracking.h"
+#include "MODE_SWITCH.h"
+
+using namespace std;
+
+/*
+Benchmark of the chi square evaluation used by the tracklet fit: Tracklet::Eval against
+the packed TrackletChisqKernel, on the tracklets recorded by kFastTracking. Each tracklet
+is evaluated at nEval parameter sets smeared around its fitted parameters, like the
+minimizer does, and the kernel is re-packed once per tracklet as in the fit.
+
+The tracklets are used as read back, without an explicit unpackHits(). A leave-one-out
+refit as in SMillepede::addTrack checks first that a hit disabled in the unpacked hit array
+stays out of the fit.
+
+The analytic linearized fit (kFastTracking -a) is then checked against the Minuit fit:
+both are started from the same smeared parameters of each tracklet, and the chi square
+and parameter differences are reported with the number of fall-backs to Minuit.
+
+Usage: ./chisqBench kFastTracking_output [nEval] [nEvents]
+*/
+
+int main(int argc, char *argv[])
+{
+    if(argc < 2)
+    {
+        cout << "Usage: " << argv[0] << " kFastTracking_output [nEval] [nEvents]" << endl;
+        return 0;
+    }
+    int nEval = argc > 2 ? atoi(argv[2]) : 100;
+
+    GeomSvc* p_geomSvc = GeomSvc::instance();
+    p_geomSvc->init(GEOMETRY_VERSION);
+
+    TClonesArray* tracklets = new TClonesArray("Tracklet");
+    TFile* dataFile = new TFile(argv[1], "READ");
+    TTree* dataTree = (TTree*)dataFile->Get("save");
+    dataTree->SetBranchAddress("tracklets", &tracklets);
+
+    int nEvents = dataTree->GetEntries();
+    if(argc > 3 && atoi(argv[3]) < nEvents) nEvents = atoi(argv[3]);
+
+    //Collect the recorded tracklets and the parameter sets to evaluate
+    std::vector<Tracklet> samples;
+    for(int i = 0; i < nEvents; ++i)
+    {
+        dataTree->GetEntry(i);
+        for(int j = 0; j < tracklets->GetEntries(); ++j)
+        {
+            samples.push_back(*((Tracklet*)tracklets->At(j)));
+        }
+    }
+    if(samples.empty())
+    {
+        cout << "No tracklets found in " << argv[1] << endl;
+        return 0;
+    }
+
+    //Leave-one-out refit of the read-back tracklets: disable the first real hit and fit, the hit has to stay
+    //disabled and out of the packed kernel, i.e. the persistent list must not be unpacked again
+    KalmanFastTracking* fastfinder = new KalmanFastTracking(false);
+
+    int nLeaveOneOut = 0, nLeaveOneOutFailed = 0;
+    for(unsigned int i = 0; i < samples.size(); ++i)
+    {
+        Tracklet tracklet = samples[i];
+        tracklet.syncHits();
+
+        int nRealHits = 0;
+        TrackletHitArray::iterator disabled = tracklet.hitArray.end();
+        for(TrackletHitArray::iterator iter = tracklet.hitArray.begin(); iter != tracklet.hitArray.end(); ++iter)
+        {
+            if(iter->hit.index < 0) continue;
+
+            ++nRealHits;
+            if(disabled == tracklet.hitArray.end() && iter->hit.index > 0) disabled = iter;
+        }
+        if(disabled == tracklet.hitArray.end()) continue;
+
+        disabled->hit.index = -disabled->hit.index;
+        fastfinder->fitTracklet(tracklet);
+
+        TrackletChisqKernel kernel_loo;
+        kernel_loo.pack(tracklet);
+
+        ++nLeaveOneOut;
+        if(disabled->hit.index >= 0 || kernel_loo.getNHits() != nRealHits - 1) ++nLeaveOneOutFailed;
+    }
+    cout << "Leave-one-out refit: " << nLeaveOneOutFailed << " of " << nLeaveOneOut << " read-back tracklets still fit the disabled hit" << endl;
+
+    std::vector<double> pars(5*nEval*samples.size());
+    for(unsigned int i = 0; i < samples.size(); ++i)
+    {
+        for(int j = 0; j < nEval; ++j)
+        {
+            double* par = &pars[5*(i*nEval + j)];
+            par[0] = samples[i].tx + gRandom->Gaus(0., 1E-3);
+            par[1] = samples[i].ty + gRandom->Gaus(0., 1E-3);
+            par[2] = samples[i].x0 + gRandom->Gaus(0., 0.1);
+            par[3] = samples[i].y0 + gRandom->Gaus(0., 0.1);
+            par[4] = samples[i].invP*(1. + gRandom->Gaus(0., 1E-2));
+        }
+    }
+
+    std::vector<double> chisq_ref(nEval*samples.size()), chisq_kernel(nEval*samples.size());
+
+    TStopwatch watch;
+    watch.Start();
+    for(unsigned int i = 0; i < samples.size(); ++i)
+    {
+        Tracklet tracklet = samples[i];
+        for(int j = 0; j < nEval; ++j) chisq_ref[i*nEval + j] = tracklet.Eval(&pars[5*(i*nEval + j)]);
+    }
+    watch.Stop();
+    double time_ref = watch.CpuTime();
+
+    TrackletChisqKernel kernel;
+    watch.Start();
+    for(unsigned int i = 0; i < samples.size(); ++i)
+    {
+        kernel.pack(samples[i]);
+        for(int j = 0; j < nEval; ++j) chisq_kernel[i*nEval + j] = kernel.Eval(&pars[5*(i*nEval + j)]);
+    }
+    watch.Stop();
+    double time_kernel = watch.CpuTime();
+
+    //Residuals are compared once per tracklet at the fitted parameters
+    double maxDiff = 0., maxResDiff = 0.;
+    for(unsigned int i = 0; i < chisq_ref.size(); ++i)
+    {
+        if(fabs(chisq_ref[i] - chisq_kernel[i]) > maxDiff) maxDiff = fabs(chisq_ref[i] - chisq_kernel[i]);
+    }
+    for(unsigned int i = 0; i < samples.size(); ++i)
+    {
+        Tracklet tracklet = samples[i];
+        double par[5] = {tracklet.tx, tracklet.ty, tracklet.x0, tracklet.y0, tracklet.invP};
+        tracklet.Eval(par);
+
+        double residual[24];
+        for(int j = 0; j < 24; ++j) residual[j] = tracklet.residual[j];
+        kernel.pack(tracklet);
+        kernel.calcChisq(par, residual);
+
+        for(int j = 0; j < 24; ++j)
+        {
+            if(fabs(residual[j] - tracklet.residual[j]) > maxResDiff) maxResDiff = fabs(residual[j] - tracklet.residual[j]);
+        }
+    }
+
+    double nTotal = double(chisq_ref.size());
+    cout << samples.size() << " tracklets from " << nEvents << " events, " << nEval << " evaluations each" << endl;
+    cout << "Tracklet::Eval:      " << nTotal/time_ref << " evaluations/s" << endl;
+    cout << "TrackletChisqKernel: " << nTotal/time_kernel << " evaluations/s, speed-up " << time_ref/time_kernel << endl;
+    cout << "Max |chisq_ref - chisq_kernel| = " << maxDiff << ", max |residual_ref - residual_kernel| = " << maxResDiff << endl;
+
+    //Analytic fit vs. Minuit fit from the same starting point, the parameter differences are in units of the Minuit errors
+
+    int nFallback = 0, nWorse = 0;
+    double maxChisqDiff = 0.;
+    double maxParDiff[5] = {0., 0., 0., 0., 0.};
+    TStopwatch watch_minuit, watch_analytic;
+    watch_minuit.Reset();
+    watch_analytic.Reset();
+    for(unsigned int i = 0; i < samples.size(); ++i)
+    {
+        Tracklet tracklet_start = samples[i];
+        const double* par = &pars[5*i*nEval];
+        tracklet_start.tx = par[0];
+        tracklet_start.ty = par[1];
+        tracklet_start.x0 = par[2];
+        tracklet_start.y0 = par[3];
+        if(KMAG_ON == 1 && tracklet_start.stationID == 6) tracklet_start.invP = par[4];
+
+        Tracklet tracklet_minuit = tracklet_start;
+        watch_minuit.Start(kFALSE);
+        fastfinder->fitTracklet(tracklet_minuit);
+        watch_minuit.Stop();
+
+        Tracklet tracklet_analytic = tracklet_start;
+        watch_analytic.Start(kFALSE);
+        int status = fastfinder->fitTrackletAnalytic(tracklet_analytic);
+        watch_analytic.Stop();
+
+        if(status != 0)
+        {
+            ++nFallback;
+            continue;
+        }
+
+        double chisqDiff = tracklet_analytic.chisq - tracklet_minuit.chisq;
+        if(fabs(chisqDiff) > maxChisqDiff) maxChisqDiff = fabs(chisqDiff);
+        if(chisqDiff > 0.01 + 0.01*tracklet_minuit.chisq) ++nWorse;
+
+        double parDiff[5];
+        parDiff[0] = (tracklet_analytic.tx - tracklet_minuit.tx)/tracklet_minuit.err_tx;
+        parDiff[1] = (tracklet_analytic.ty - tracklet_minuit.ty)/tracklet_minuit.err_ty;
+        parDiff[2] = (tracklet_analytic.x0 - tracklet_minuit.x0)/tracklet_minuit.err_x0;
+        parDiff[3] = (tracklet_analytic.y0 - tracklet_minuit.y0)/tracklet_minuit.err_y0;
+        parDiff[4] = KMAG_ON == 1 && tracklet_start.stationID == 6 ? (tracklet_analytic.invP - tracklet_minuit.invP)/tracklet_minuit.err_invP : 0.;
+        for(int j = 0; j < 5; ++j)
+        {
+            if(fabs(parDiff[j]) > maxParDiff[j]) maxParDiff[j] = fabs(parDiff[j]);
+        }
+    }
+
+    int nAnalytic = samples.size() - nFallback;
+    cout << "Analytic vs. Minuit fit: " << nFallback << " of " << samples.size() << " tracklets fall back to Minuit, ";
+    cout << nWorse << " of " << nAnalytic << " have a chisq more than 1% above the Minuit one" << endl;
+    cout << "Max |chisq_analytic - chisq_minuit| = " << maxChisqDiff << ", max |par_analytic - par_minuit|/err_minuit:";
+    cout << " tx " << maxParDiff[0] << ", ty " << maxParDiff[1] << ", x0 " << maxParDiff[2] << ", y0 " << maxParDiff[3] << ", invP " << maxParDiff[4] << endl;
+    cout << "Minuit fit: " << samples.size()/watch_minuit.CpuTime() << " fits/s, analytic fit: " << samples.size()/watch_analytic.CpuTime() << " fits/s" << endl;
+
+    delete fastfinder;
+    dataFile->Close();
+    return 1;
+}
@@ -0,0 +1,467 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <list>
+#include <set>
+
+#include <TROOT.h>
+#include <TFile.h>
+#include <TTree.h>
+#include <TRandom.h>
+#include <TString.h>
+#include <TStopwatch.h>
+#include <TSystem.h>
+
+#include "GeomSvc.h"
+#include "SRawEvent.h"
+#include "SRecEvent.h"
+#include "FastTracklet.h"
+#include "KalmanFastTracking.h"
+#include "EventReducer.h"
+#include "VertexFit.h"
+#include "MODE_SWITCH.h"
+
+using namespace std;
+
+#ifdef MC_MODE
+typedef SRawMCEvent RawEvent;
+#else
+typedef SRawEvent RawEvent;
+#endif
+
+/*
+Synthetic event generator and occupancy scan of the event reduction and track finding,
+for benchmarking without the production data.
+
+Muons come from the target with the straight line + pT kick model used by the tracking:
+a kick of PT_KICK_FMAG at Z_FMAG_BEND and PT_KICK_KMAG at Z_KMAG_BEND, a multiple scattering
+of MUID_THE_P0/p in the absorber. The hits are placed on the GeomSvc geometry, with the drift
+time from the R-T curves of calibration.txt when loaded. Noise hits are added with a given
+fraction of fired elements per plane, and clusters of adjacent noise hits in the chambers.
+
+Usage:
+  ./eventGenerator generate output nEvents [options]
+  ./eventGenerator bench nEvents [options] [-o reducerOptions] [-v] [occupancy1 occupancy2 ...]
+  ./eventGenerator dumpGeometry
+
+Options: -n noise occupancy per plane (0.01), -c cluster probability per chamber plane (0.05),
+         -d fraction of dimuon events, the rest has one muon (0.5), -e chamber efficiency (0.95),
+         -s random seed (0 for a random one)
+
+'bench' generates the events in memory for each occupancy (default 0, 0.005, 0.01, 0.02, 0.04),
+runs EventReducer ("aocsh" by default) and KalmanFastTracking in-process on them, and reports
+events/s, the time per stage and the efficiency of finding the generated muons, excluding the
+initialization. '-v' also runs VertexFit on the events with two tracks. The fast tracking only
+needs GeomSvc, and eventGenerator has it read the plane geometry from KTRACKER_ROOT/GEOMETRY_VERSION.txt
+when it exists: './eventGenerator dumpGeometry' writes it once from MySQL. The other executables
+always read the geometry from MySQL. The bench with '-v' is not
+offline, VertexFit and the Kalman filter still need the Geant4 geometry from MySQL.
+*/
+
+struct GenConfig
+{
+    double occupancy;
+    double clusterProb;
+    double dimuonFraction;
+    double efficiency;
+};
+
+///Generated muon in the tracking parameterization, and the index of its chamber hits
+struct GenMuon
+{
+    int charge;
+    double invP;
+    double tx, ty, x0, y0;      //downstream of KMAG
+    double tx_st1, x0_st1;      //between FMAG and KMAG
+    std::set<int> hitIndex;
+};
+
+GeomSvc* p_geomSvc = NULL;
+
+///TDC time for a drift distance, the R-T curve is decreasing between tmin and tmax
+double getTDCTime(int detectorID, double driftDistance)
+{
+    const Plane& plane = p_geomSvc->getPlane(detectorID);
+
+    double t_lo = plane.tmin;
+    double t_hi = plane.tmax;
+    for(int i = 0; i < 30; ++i)
+    {
+        double t_mid = 0.5*(t_lo + t_hi);
+        if(p_geomSvc->getDriftDistance(detectorID, t_mid) > driftDistance)
+        {
+            t_lo = t_mid;
+        }
+        else
+        {
+            t_hi = t_mid;
+        }
+    }
+
+    return 0.5*(t_lo + t_hi);
+}
+
+///Make the hit, with the drift distance consistent with the R-T curve if there is one
+Hit makeHit(int index, int detectorID, int elementID, double driftDistance)
+{
+    Hit h;
+    h.index = index;
+    h.detectorID = detectorID;
+    h.elementID = elementID;
+    h.pos = p_geomSvc->getMeasurement(detectorID, elementID);
+    h.tdcTime = 0.;
+    h.driftDistance = 0.;
+    h.flag = 0;
+    h.setInTime();
+
+    if(detectorID <= nChamberPlanes)
+    {
+        if(p_geomSvc->isCalibrationLoaded() && p_geomSvc->getRTCurve(detectorID) != NULL)
+        {
+            h.tdcTime = getTDCTime(detectorID, driftDistance);
+            h.driftDistance = p_geomSvc->getDriftDistance(detectorID, h.tdcTime);
+        }
+        else
+        {
+            h.driftDistance = driftDistance;
+        }
+    }
+
+    return h;
+}
+
+///One muon from the target, regenerated until it is inside all the chamber stations
+void generateMuon(int charge, GenMuon& muon)
+{
+    int detectorIDs[4] = {3, 10, 16, 22};      //D1X, D2X, D3pX, D3mX
+    for(int nTry = 0; nTry < 1000; ++nTry)
+    {
+        double p = gRandom->Uniform(25., 100.);
+        double x_vtx = gRandom->Gaus(0., BEAM_SPOT_X);
+        double y_vtx = gRandom->Gaus(0., BEAM_SPOT_Y);
+        double z_vtx = Z_TARGET + gRandom->Uniform(-25., 25.);
+        double tx_vtx = gRandom->Gaus(0., 0.03);
+        double ty_vtx = gRandom->Gaus(0., 0.03);
+
+        //Same sign convention as Tracklet::getXZInfoInSt1 and Tracklet::getCharge
+        muon.charge = charge;
+        muon.invP = 1./(p - ELOSS_KFMAG);
+        muon.tx_st1 = tx_vtx - PT_KICK_FMAG*charge/(p - 0.5*ELOSS_KFMAG);
+        muon.x0_st1 = x_vtx + tx_vtx*(Z_FMAG_BEND - z_vtx) - muon.tx_st1*Z_FMAG_BEND;
+        muon.tx = muon.tx_st1 - PT_KICK_KMAG*charge*muon.invP;
+        muon.x0 = muon.x0_st1 + muon.tx_st1*Z_KMAG_BEND - muon.tx*Z_KMAG_BEND;
+        muon.ty = ty_vtx;
+        muon.y0 = y_vtx - ty_vtx*z_vtx;
+
+        if(fabs(muon.tx) > TX_MAX || fabs(muon.ty) > TY_MAX || fabs(muon.x0) > X0_MAX || fabs(muon.y0) > Y0_MAX) continue;
+
+        bool inAcceptance = true;
+        for(int i = 0; i < 4 && inAcceptance; ++i)
+        {
+            double z = p_geomSvc->getPlanePosition(detectorIDs[i]);
+            double x = i == 0 ? muon.x0_st1 + muon.tx_st1*z : muon.x0 + muon.tx*z;
+            inAcceptance = p_geomSvc->isInPlane(detectorIDs[i], x, muon.y0 + muon.ty*z);
+        }
+        if(inAcceptance) return;
+    }
+}
+
+///Hits of one muon on all the planes it crosses
+void addMuonHits(RawEvent* rawEvent, GenMuon& muon, const GenConfig& config, int& index)
+{
+    double dtx_absorber = gRandom->Gaus(0., MUID_THE_P0*muon.invP);
+    double dty_absorber = gRandom->Gaus(0., MUID_THE_P0*muon.invP);
+    for(int detectorID = 1; detectorID <= nChamberPlanes+nHodoPlanes+nPropPlanes; ++detectorID)
+    {
+        double z = p_geomSvc->getPlanePosition(detectorID);
+        bool st1 = z < Z_KMAG_BEND;
+        double tx = st1 ? muon.tx_st1 : muon.tx;
+        double x0 = st1 ? muon.x0_st1 : muon.x0;
+        double ty = muon.ty;
+        double y0 = muon.y0;
+        if(z > Z_ABSORBER)
+        {
+            x0 -= dtx_absorber*Z_ABSORBER;
+            tx += dtx_absorber;
+            y0 -= dty_absorber*Z_ABSORBER;
+            ty += dty_absorber;
+        }
+
+        if(!p_geomSvc->isInPlane(detectorID, x0 + tx*z, y0 + ty*z)) continue;
+        if(detectorID <= nChamberPlanes && gRandom->Rndm() > config.efficiency) continue;
+
+        double w = p_geomSvc->getInterception(detectorID, tx, ty, x0, y0);
+        int elementID = p_geomSvc->getExpElementID(detectorID, w);
+        if(elementID < 1 || elementID > p_geomSvc->getPlaneNElements(detectorID)) continue;
+
+        double driftDistance = fabs(w - p_geomSvc->getMeasurement(detectorID, elementID)) + gRandom->Gaus(0., RESOLUTION_DC);
+        if(driftDistance < 0.) driftDistance = 0.;
+
+        if(detectorID <= nChamberPlanes) muon.hitIndex.insert(index);
+        rawEvent->insertHit(makeHit(index++, detectorID, elementID, driftDistance));
+    }
+}
+
+///Random noise on all planes, and clusters of adjacent noise hits in the chambers
+void addNoiseHits(RawEvent* rawEvent, const GenConfig& config, int& index)
+{
+    for(int detectorID = 1; detectorID <= nChamberPlanes+nHodoPlanes+nPropPlanes; ++detectorID)
+    {
+        int nElements = p_geomSvc->getPlaneNElements(detectorID);
+        if(nElements <= 0) continue;
+
+        double halfCell = 0.5*p_geomSvc->getCellWidth(detectorID);
+        int nNoise = gRandom->Poisson(config.occupancy*nElements);
+        for(int i = 0; i < nNoise; ++i)
+        {
+            rawEvent->insertHit(makeHit(index++, detectorID, 1 + gRandom->Integer(nElements), gRandom->Uniform(0., halfCell)));
+        }
+
+        if(detectorID <= nChamberPlanes && gRandom->Rndm() < config.clusterProb)
+        {
+            int size = 3 + gRandom->Integer(6);
+            int first = 1 + gRandom->Integer(nElements);
+            for(int elementID = first; elementID < first + size && elementID <= nElements; ++elementID)
+            {
+                rawEvent->insertHit(makeHit(index++, detectorID, elementID, gRandom->Uniform(0., halfCell)));
+            }
+        }
+    }
+}
+
+void generateEvent(RawEvent* rawEvent, int eventID, const GenConfig& config, std::vector<GenMuon>& muons)
+{
+    rawEvent->clear();
+    rawEvent->setEventInfo(0, 0, eventID);
+    rawEvent->setTargetPos(1);
+    rawEvent->setTriggerBits(SRawEvent::MATRIX1);
+
+    muons.clear();
+    bool dimuon = gRandom->Rndm() < config.dimuonFraction;
+    int nMuons = dimuon ? 2 : 1;
+    int index = 1;     //0 would lose the sign in the signed hit index of the tracks
+    for(int i = 0; i < nMuons; ++i)
+    {
+        GenMuon muon;
+        generateMuon(dimuon ? 1 - 2*i : (gRandom->Rndm() > 0.5 ? 1 : -1), muon);
+        addMuonHits(rawEvent, muon, config, index);
+        muons.push_back(muon);
+    }
+
+    addNoiseHits(rawEvent, config, index);
+    rawEvent->reIndex(true);
+}
+
+int generate(const char* filename, int nEvents, const GenConfig& config)
+{
+    RawEvent* rawEvent = new RawEvent();
+    TFile* saveFile = new TFile(filename, "recreate");
+    TTree* saveTree = new TTree("save", "save");
+    saveTree->Branch("rawEvent", &rawEvent, 256000, 99);
+
+    std::vector<GenMuon> muons;
+    for(int i = 0; i < nEvents; ++i)
+    {
+        generateEvent(rawEvent, i, config, muons);
+        saveTree->Fill();
+
+        cout << "\r Generating event " << i << ", " << (i + 1)*100/nEvents << "% finished .. " << flush;
+    }
+    cout << endl;
+
+    saveFile->cd();
+    saveTree->Write();
+    saveFile->Close();
+
+    cout << nEvents << " events with occupancy " << config.occupancy << " written to " << filename << endl;
+    return 1;
+}
+
+///A generated muon is found if at least 75% of the real hits of a final tracklet are its hits
+bool isFound(const GenMuon& muon, std::list<Tracklet>& tracklets)
+{
+    for(std::list<Tracklet>::iterator iter = tracklets.begin(); iter != tracklets.end(); ++iter)
+    {
+        int nMatched = 0;
+        for(TrackletHitArray::const_iterator hit = iter->hitArray.begin(); hit != iter->hitArray.end(); ++hit)
+        {
+            if(hit->hit.index >= 0 && muon.hitIndex.find(hit->hit.index) != muon.hitIndex.end()) ++nMatched;
+        }
+        if(nMatched >= 0.75*iter->getNHits()) return true;
+    }
+
+    return false;
+}
+
+int bench(int nEvents, GenConfig config, TString opt, bool runVertex, std::vector<double> occupancies)
+{
+    EventReducer* eventReducer = new EventReducer(opt);
+    KalmanFastTracking* fastfinder = new KalmanFastTracking(false);
+    VertexFit* vtxfit = NULL;
+    if(runVertex)
+    {
+        vtxfit = new VertexFit();
+        vtxfit->enableOptimization();
+    }
+
+    RawEvent* rawEvent = new RawEvent();
+    SRecEvent* recEvent = new SRecEvent();
+    std::vector<GenMuon> muons;
+
+    cout << "occupancy  hits/event  events/s  efficiency  fakes/event";
+    for(int i = 0; i < nTrackingStages; ++i) cout << "  " << TrackingStats::getStageName(i) << "(ms)";
+    if(runVertex) cout << "  vertex(ms)";
+    cout << endl;
+
+    for(unsigned int i = 0; i < occupancies.size(); ++i)
+    {
+        config.occupancy = occupancies[i];
+
+        double nHits = 0.;
+        int nMuons = 0, nFound = 0, nFakes = 0;
+        double time_total = 0., time_vertex = 0.;
+        double time_stage[nTrackingStages];
+        for(int j = 0; j < nTrackingStages; ++j) time_stage[j] = 0.;
+
+        TStopwatch watch;
+        for(int j = 0; j < nEvents; ++j)
+        {
+            generateEvent(rawEvent, j, config, muons);
+            nHits += rawEvent->getNHitsAll();
+
+            watch.Start();
+            eventReducer->reduceEvent(rawEvent);
+            fastfinder->setRawEvent(rawEvent);
+            watch.Stop();
+            time_total += watch.RealTime();
+
+            const TrackingStats& stats = fastfinder->getStats();
+            for(int k = 0; k < nTrackingStages; ++k) time_stage[k] += stats.time[k];
+
+            std::list<Tracklet>& tracklets = fastfinder->getFinalTracklets();
+            for(unsigned int k = 0; k < muons.size(); ++k)
+            {
+                ++nMuons;
+                if(isFound(muons[k], tracklets)) ++nFound;
+            }
+            if(int(tracklets.size()) > int(muons.size())) nFakes += tracklets.size() - muons.size();
+
+            if(runVertex && tracklets.size() >= 2)
+            {
+                recEvent->clear();
+                recEvent->setRawEvent(rawEvent);
+                for(std::list<Tracklet>::iterator iter = tracklets.begin(); iter != tracklets.end(); ++iter)
+                {
+                    recEvent->insertTrack(iter->getSRecTrack());
+                }
+                recEvent->reIndex();
+
+                watch.Start();
+                vtxfit->setRecEvent(recEvent);
+                watch.Stop();
+                time_vertex += watch.RealTime();
+            }
+        }
+
+        printf("%9.4f  %10.1f  %8.1f  %10.3f  %11.3f", config.occupancy, nHits/nEvents, nEvents/time_total, double(nFound)/nMuons, double(nFakes)/nEvents);
+        for(int j = 0; j < nTrackingStages; ++j) printf("  %*.3f", int(strlen(TrackingStats::getStageName(j))) + 4, time_stage[j]/nEvents*1000.);
+        if(runVertex) printf("  %10.3f", time_vertex/nEvents*1000.);
+        printf("\n");
+    }
+
+    delete fastfinder;
+    delete eventReducer;
+    if(vtxfit != NULL) delete vtxfit;
+
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    GenConfig config;
+    config.occupancy = 0.01;
+    config.clusterProb = 0.05;
+    config.dimuonFraction = 0.5;
+    config.efficiency = 0.95;
+
+    TString opt = "aocsh";
+    bool runVertex = false;
+    int seed = 0;
+    std::vector<char*> args;
+    for(int i = 1; i < argc; ++i)
+    {
+        TString arg = argv[i];
+        if(arg == "-n" && i + 1 < argc)
+        {
+            config.occupancy = atof(argv[++i]);
+        }
+        else if(arg == "-c" && i + 1 < argc)
+        {
+            config.clusterProb = atof(argv[++i]);
+        }
+        else if(arg == "-d" && i + 1 < argc)
+        {
+            config.dimuonFraction = atof(argv[++i]);
+        }
+        else if(arg == "-e" && i + 1 < argc)
+        {
+            config.efficiency = atof(argv[++i]);
+        }
+        else if(arg == "-s" && i + 1 < argc)
+        {
+            seed = atoi(argv[++i]);
+        }
+        else if(arg == "-o" && i + 1 < argc)
+        {
+            opt = argv[++i];
+        }
+        else if(arg == "-v")
+        {
+            runVertex = true;
+        }
+        else
+        {
+            args.push_back(argv[i]);
+        }
+    }
+
+    TString filename = Form("%s/%s.txt", KTRACKER_ROOT, GEOMETRY_VERSION);
+    if(args.size() >= 1 && TString(args[0]) == "dumpGeometry")
+    {
+        if(!GeomSvc::dumpPlanesTable(GEOMETRY_VERSION, filename.Data())) return 0;
+
+        cout << "Planes table of " << GEOMETRY_VERSION << " written to " << filename << endl;
+        return 1;
+    }
+
+    //Run offline on the ascii dump of the Planes table once it has been written, MySQL otherwise
+    gRandom->SetSeed(seed);
+    if(!gSystem->AccessPathName(filename.Data())) GeomSvc::setPlanesFile(filename.Data());
+    p_geomSvc = GeomSvc::instance();
+    p_geomSvc->init(GEOMETRY_VERSION);
+
+    if(args.size() >= 3 && TString(args[0]) == "generate")
+    {
+        return generate(args[1], atoi(args[2]), config);
+    }
+    else if(args.size() >= 2 && TString(args[0]) == "bench")
+    {
+        std::vector<double> occupancies;
+        for(unsigned int i = 2; i < args.size(); ++i) occupancies.push_back(atof(args[i]));
+        if(occupancies.empty())
+        {
+            double defaults[5] = {0., 0.005, 0.01, 0.02, 0.04};
+            occupancies.assign(defaults, defaults + 5);
+        }
+
+        return bench(atoi(args[1]), config, opt, runVertex, occupancies);
+    }
+
+    cout << "Usage: " << argv[0] << " generate output nEvents [-n occupancy] [-c clusterProb] [-d dimuonFraction] [-e efficiency] [-s seed]" << endl;
+    cout << "       " << argv[0] << " bench nEvents [-n/-c/-d/-e/-s as above] [-o reducerOptions] [-v] [occupancy1 occupancy2 ...]" << endl;
+    cout << "       " << argv[0] << " dumpGeometry" << endl;
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <unistd.h>
+
+#include <TROOT.h>
+#include <TRandom.h>
+#include <TString.h>
+#include <TStopwatch.h>
+
+#include "TrackExtrapolator/TabulatedField3D.hh"
+#include "TrackExtrapolator/Settings.hh"
+#include "MODE_SWITCH.h"
+
+using namespace std;
+
+/*
+Convert the FMAG/KMAG field maps to the binary cache memory mapped by TabulatedField3D,
+and benchmark the start-up and the field lookup of the ascii and the binary maps.
+
+Usage:
+  ./fieldMap convert [-m]
+  ./fieldMap bench [nPoints]
+
+The cache is written next to the ascii maps in $KTRACKER_ROOT/TrackExtrapolator, '-m'
+reads the maps from MySQL instead of the ascii files. A cache made from MySQL carries no
+ascii map stamp, it is replaced from the ascii maps when they are present.
+*/
+
+int convert(bool fromMySQL)
+{
+    Settings settings;
+    settings.asciiFieldMap = !fromMySQL;
+    settings.useFieldMapCache = false;
+
+    G4String names[2] = {settings.fMagName, settings.kMagName};
+    for(int i = 0; i < 2; ++i)
+    {
+        TabulatedField3D fieldMap(fieldMapZOffset[i], fieldMapGrid[i][0], fieldMapGrid[i][1], fieldMapGrid[i][2], i == 0, &settings);
+
+        G4String output = TabulatedField3D::binaryMapName(names[i]);
+        if(!fieldMap.writeBinaryMap(output)) return 0;
+        cout << "Binary field map written to " << output << endl;
+    }
+
+    return 1;
+}
+
+int bench(int nPoints)
+{
+    Settings settings;
+    bool fmag[2] = {true, false};
+    const char* magNames[2] = {"FMAG", "KMAG"};
+
+    //Random points inside the field regions, in Geant4 units, shared by both maps
+    std::vector<double> points(3*nPoints);
+    for(int i = 0; i < nPoints; ++i)
+    {
+        bool inFMAG = i % 2 == 0;
+        points[3*i] = gRandom->Uniform(-100., 100.)*cm;
+        points[3*i+1] = gRandom->Uniform(-100., 100.)*cm;
+        points[3*i+2] = (inFMAG ? gRandom->Uniform(0., FMAG_LENGTH) : gRandom->Uniform(900., 1200.))*cm;
+    }
+
+    std::vector<double> field_ascii(3*nPoints), field_binary(3*nPoints);
+    for(int mode = 0; mode < 2; ++mode)
+    {
+        settings.useFieldMapCache = mode == 1;
+        std::vector<double>& result = mode == 0 ? field_ascii : field_binary;
+        cout << (mode == 0 ? "ascii" : "binary") << " field map: " << endl;
+
+        TStopwatch watch;
+        TabulatedField3D* fieldMaps[2];
+        for(int i = 0; i < 2; ++i)
+        {
+            watch.Start();
+            fieldMaps[i] = new TabulatedField3D(fieldMapZOffset[i], fieldMapGrid[i][0], fieldMapGrid[i][1], fieldMapGrid[i][2], fmag[i], &settings);
+            watch.Stop();
+            cout << "  " << magNames[i] << " start-up: " << watch.RealTime() << " s" << endl;
+        }
+
+        watch.Start();
+        for(int i = 0; i < nPoints; ++i) fieldMaps[i % 2]->GetFieldValue(&points[3*i], &result[3*i]);
+        watch.Stop();
+        cout << "  lookup: " << watch.CpuTime()/nPoints*1.E9 << " ns/point" << endl;
+
+        for(int i = 0; i < 2; ++i) delete fieldMaps[i];
+    }
+
+    double maxDiff = 0.;
+    for(int i = 0; i < 3*nPoints; ++i)
+    {
+        if(fabs(field_ascii[i] - field_binary[i]) > maxDiff) maxDiff = fabs(field_ascii[i] - field_binary[i]);
+    }
+    cout << "Max |B_ascii - B_binary| = " << maxDiff/tesla << " T" << endl;
+
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    //The map names in Settings are relative to the TrackExtrapolator directory, as in Field.cc
+    if(chdir(Form("%s/TrackExtrapolator", KTRACKER_ROOT)) != 0)
+    {
+        cout << "Failed to find directory for magnetic field maps" << endl;
+        return 0;
+    }
+
+    if(argc >= 2 && TString(argv[1]) == "convert")
+    {
+        return convert(argc > 2 && TString(argv[2]) == "-m");
+    }
+    else if(argc >= 2 && TString(argv[1]) == "bench")
+    {
+        return bench(argc > 2 ? atoi(argv[2]) : 1000000);
+    }
+
+    cout << "Usage: " << argv[0] << " convert [-m]" << endl;
+    cout << "       " << argv[0] << " bench [nPoints]" << endl;
+    return 0;
+}
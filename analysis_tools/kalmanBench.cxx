@@ -0,0 +1,170 @@
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include <TROOT.h>
+#include <TRandom.h>
+#include <TMatrixD.h>
+#include <TStopwatch.h>
+
+#include "KalmanMatrix.h"
+#include "KalmanUtil.h"
+
+using namespace std;
+
+/*
+Micro-benchmark of the Kalman filter kernels: the predict/filter/smooth steps of one
+1-D measurement node done with the heap-allocated TMatrixD (as the filter used to be)
+and with the fixed-size KMatrix used now. Randomly generated covariances/propagators
+are used so that it does not need the geometry service.
+
+Usage: ./kalmanBench [nNodes] [nRepeat]
+*/
+
+struct BenchNode
+{
+    KMatrix<5, 5> cov;
+    KMatrix<5, 5> prop;
+    KMatrix<5, 1> state;
+    KMatrix<1, 5> proj;
+    KMatrix<1, 1> meas;
+    KMatrix<1, 1> meas_cov;
+};
+
+///Generate a random positive-definite 5x5 covariance as A*At + diagonal
+KMatrix<5, 5> randomCovariance()
+{
+    KMatrix<5, 5> a;
+    for(int i = 0; i < 5; ++i)
+    {
+        for(int j = 0; j < 5; ++j) a[i][j] = gRandom->Gaus();
+    }
+
+    KMatrix<5, 5> cov = a*a.transpose();
+    for(int i = 0; i < 5; ++i) cov[i][i] += 1.;
+    return cov;
+}
+
+///Old TMatrixD version: prediction, information-form filter and RTS smoothing
+double runTMatrixD(const std::vector<BenchNode>& nodes, int nRepeat)
+{
+    double sum = 0.;
+    for(int n = 0; n < nRepeat; ++n)
+    {
+        for(unsigned int i = 0; i < nodes.size(); ++i)
+        {
+            TMatrixD C = nodes[i].cov.toTMatrixD();
+            TMatrixD F = nodes[i].prop.toTMatrixD();
+            TMatrixD p = nodes[i].state.toTMatrixD();
+            TMatrixD H = nodes[i].proj.toTMatrixD();
+            TMatrixD m = nodes[i].meas.toTMatrixD();
+            TMatrixD V = nodes[i].meas_cov.toTMatrixD();
+
+            //Predict
+            TMatrixD p_pred = F*p;
+            TMatrixD C_pred = F*C*TMatrixD(TMatrixD::kTransposed, F);
+
+            //Filter
+            TMatrixD Ht(TMatrixD::kTransposed, H);
+            TMatrixD Vinv = TMatrixD(TMatrixD::kInverted, V);
+            TMatrixD Cinv = TMatrixD(TMatrixD::kInverted, C_pred);
+            TMatrixD C_f = TMatrixD(TMatrixD::kInverted, Cinv + Ht*Vinv*H);
+            TMatrixD p_f = C_f*(Cinv*p_pred + Ht*Vinv*m);
+
+            TMatrixD r = m - H*p_f;
+            TMatrixD dp = p_f - p_pred;
+            double chi2 = (TMatrixD(TMatrixD::kTransposed, r)*Vinv*r)[0][0] + (TMatrixD(TMatrixD::kTransposed, dp)*Cinv*dp)[0][0];
+
+            //Smooth
+            TMatrixD A = C*TMatrixD(TMatrixD::kTransposed, F)*TMatrixD(TMatrixD::kInverted, C_pred);
+            TMatrixD C_s = C + A*(C_f - C_pred)*TMatrixD(TMatrixD::kTransposed, A);
+
+            sum += chi2 + C_s[0][0] + p_f[0][0];
+        }
+    }
+
+    return sum;
+}
+
+///New KMatrix version: gain-form filter with symmetric kernels
+double runKMatrix(const std::vector<BenchNode>& nodes, int nRepeat)
+{
+    double sum = 0.;
+    for(int n = 0; n < nRepeat; ++n)
+    {
+        for(unsigned int i = 0; i < nodes.size(); ++i)
+        {
+            const BenchNode& node = nodes[i];
+
+            //Predict
+            KMatrix<5, 1> p_pred = node.prop*node.state;
+            KMatrix<5, 5> C_pred = SMatrix::getSimilarity(node.prop, node.cov);
+
+            //Filter
+            KMatrix<5, 1> cht = C_pred*node.proj.transpose();
+            KMatrix<1, 1> S = node.meas_cov + node.proj*cht;
+            KMatrix<1, 1> Sinv;
+            SMatrix::invertMatrix(S, Sinv);
+
+            KMatrix<1, 1> r = node.meas - node.proj*p_pred;
+            KMatrix<5, 1> K = cht*Sinv;
+            KMatrix<5, 1> p_f = p_pred + K*r;
+            KMatrix<5, 5> C_f = C_pred;
+            SMatrix::subtractSymProduct(C_f, K, cht);
+            double chi2 = SMatrix::getSimilarity(r.transpose(), Sinv)[0][0];
+
+            //Smooth
+            KMatrix<5, 5> C_pred_inv;
+            SMatrix::invertSymMatrix(C_pred, C_pred_inv);
+            KMatrix<5, 5> A = node.cov*node.prop.transpose()*C_pred_inv;
+            KMatrix<5, 5> C_s = node.cov + SMatrix::getSimilarity(A, C_f - C_pred);
+
+            sum += chi2 + C_s[0][0] + p_f[0][0];
+        }
+    }
+
+    return sum;
+}
+
+int main(int argc, char *argv[])
+{
+    int nNodes = argc > 1 ? atoi(argv[1]) : 1000;
+    int nRepeat = argc > 2 ? atoi(argv[2]) : 100;
+
+    //Prepare the random nodes
+    gRandom->SetSeed(4357);
+    std::vector<BenchNode> nodes(nNodes);
+    for(int i = 0; i < nNodes; ++i)
+    {
+        nodes[i].cov = randomCovariance();
+        for(int j = 0; j < 5; ++j)
+        {
+            for(int k = 0; k < 5; ++k) nodes[i].prop[j][k] = (j == k ? 1. : 0.) + 0.1*gRandom->Gaus();
+            nodes[i].state[j][0] = gRandom->Gaus();
+            nodes[i].proj[0][j] = gRandom->Gaus();
+        }
+        nodes[i].meas[0][0] = gRandom->Gaus();
+        nodes[i].meas_cov[0][0] = 0.01 + gRandom->Rndm();
+    }
+
+    TStopwatch watch;
+    watch.Start();
+    double sum_old = runTMatrixD(nodes, nRepeat);
+    watch.Stop();
+    double time_old = watch.CpuTime();
+
+    watch.Start();
+    double sum_new = runKMatrix(nodes, nRepeat);
+    watch.Stop();
+    double time_new = watch.CpuTime();
+
+    double nTotal = double(nNodes)*nRepeat;
+    cout << "Benchmarked " << nNodes << " nodes x " << nRepeat << " times, predict + filter + smooth per node: " << endl;
+    cout << "  TMatrixD: " << time_old/nTotal*1.E9 << " ns/node" << endl;
+    cout << "  KMatrix:  " << time_new/nTotal*1.E9 << " ns/node" << endl;
+    cout << "  speed-up: " << time_old/time_new << endl;
+    cout << "  relative difference of the results: " << fabs(sum_old - sum_new)/fabs(sum_old) << endl;
+
+    return 1;
+}
@@ -0,0 +1,284 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+#include <TROOT.h>
+#include <TRandom.h>
+#include <TString.h>
+#include <TStopwatch.h>
+
+#include "GeomSvc.h"
+#include "KalmanMatrix.h"
+#include "PropagatorLUT.h"
+#include "TrackExtrapolator/TrackExtrapolator.hh"
+#include "MODE_SWITCH.h"
+
+using namespace std;
+
+/*
+Build and validate the propagator table used by KalmanFilter::predict between the drift
+chamber planes.
+
+Usage:
+  ./propLUT build output_table [-r] [nQP nTX nTY nX nY]
+  ./propLUT validate input_table [-r] [nSamples]
+
+'-r' uses the Runge-Kutta-Nystrom propagator instead of Geant4e as the full extrapolation.
+An even number of q/p nodes is recommended so that q/p = 0 is not a grid node.
+*/
+
+int build(const char* filename, bool useRK, int nBins[5])
+{
+    GeomSvc* p_geomSvc = GeomSvc::instance();
+    p_geomSvc->init(GEOMETRY_VERSION);
+
+    TrackExtrapolator extrapolator;
+    extrapolator.init(GEOMETRY_VERSION);
+    extrapolator.setRKPropagation(useRK);
+
+    //Chamber planes sorted in z, planes at the same z are merged
+    std::vector<double> z_planes;
+    for(int i = 1; i <= nChamberPlanes; ++i) z_planes.push_back(p_geomSvc->getPlanePosition(i));
+    std::sort(z_planes.begin(), z_planes.end());
+
+    std::vector<double> z_unique(1, z_planes.front());
+    for(unsigned int i = 1; i < z_planes.size(); ++i)
+    {
+        if(z_planes[i] - z_unique.back() > 1E-3) z_unique.push_back(z_planes[i]);
+    }
+
+    //Links between the adjacent planes, in both directions
+    std::vector<PropLUTLink> links;
+    for(unsigned int i = 0; i + 1 < z_unique.size(); ++i)
+    {
+        PropLUTLink link;
+        link.z_from = z_unique[i];
+        link.z_to = z_unique[i+1];
+        links.push_back(link);
+
+        std::swap(link.z_from, link.z_to);
+        links.push_back(link);
+    }
+
+    //Grid definition, covers the fast tracking cuts with some margin
+    PropLUTHeader header;
+    memset(&header, 0, sizeof(PropLUTHeader));
+    strncpy(header.magic, "KPROPLUT", 8);
+    header.version = PROPLUT_VERSION;
+    header.nLinks = links.size();
+
+    double range[5] = {1.25*INVP_MAX, 2.*TX_MAX, 2.*TY_MAX, 200., 200.};
+    for(int i = 0; i < 5; ++i)
+    {
+        header.nBins[i] = nBins[i];
+        header.min[i] = -range[i];
+        header.max[i] = range[i];
+    }
+
+    int nNodes = PropagatorLUT::getNNodes(header);
+    if(nNodes <= 0)
+    {
+        cout << "Each dimension needs at least 2 nodes." << endl;
+        return 0;
+    }
+
+    FILE* fp = fopen(filename, "wb");
+    if(fp == NULL)
+    {
+        cout << "Cannot open " << filename << " for writing." << endl;
+        return 0;
+    }
+
+    fwrite(&header, sizeof(PropLUTHeader), 1, fp);
+    fwrite(&links[0], sizeof(PropLUTLink), links.size(), fp);
+
+    //Covariance is irrelevant here, only the state and the propagator are tabulated
+    KMatrix<5, 5> cov_i, cov_f, prop;
+    cov_i.UnitMatrix();
+
+    std::vector<float> buffer(nNodes*PROPLUT_NODE_SIZE);
+    int nFailed = 0;
+    for(unsigned int i = 0; i < links.size(); ++i)
+    {
+        for(int j = 0; j < nNodes; ++j)
+        {
+            double node[5];
+            PropagatorLUT::getNodeState(header, j, node);
+
+            KMatrix<5, 1> state_i, state_f;
+            for(int k = 0; k < 5; ++k) state_i[k][0] = node[k];
+
+            float* entry = &buffer[j*PROPLUT_NODE_SIZE];
+            extrapolator.setInitialStateWithCov(links[i].z_from, state_i, cov_i);
+            if(fabs(node[0]) > 1E-4 && extrapolator.extrapolateTo(links[i].z_to))
+            {
+                extrapolator.getFinalStateWithCov(state_f, cov_f);
+                extrapolator.getPropagator(prop);
+
+                for(int k = 0; k < 5; ++k)
+                {
+                    entry[k] = state_f[k][0];
+                    for(int l = 0; l < 5; ++l) entry[5 + 5*k + l] = prop[k][l];
+                }
+            }
+            else
+            {
+                //NaN marks the node as unusable, the run time falls back to the extrapolator
+                for(int k = 0; k < PROPLUT_NODE_SIZE; ++k) entry[k] = std::numeric_limits<float>::quiet_NaN();
+                ++nFailed;
+            }
+        }
+
+        fwrite(&buffer[0], sizeof(float), buffer.size(), fp);
+        cout << "\r Link " << i << " from " << links[i].z_from << " to " << links[i].z_to << " done, ";
+        cout << (i + 1)*100/links.size() << "% finished .. " << flush;
+    }
+    cout << endl;
+    fclose(fp);
+
+    cout << "Table with " << links.size() << " links x " << nNodes << " nodes written to " << filename << ", ";
+    cout << nFailed << " nodes failed in extrapolation." << endl;
+
+    return 1;
+}
+
+int validate(const char* filename, bool useRK, int nSamples)
+{
+    GeomSvc* p_geomSvc = GeomSvc::instance();
+    p_geomSvc->init(GEOMETRY_VERSION);
+
+    PropagatorLUT propLUT;
+    PropagatorLUT* p_propLUT = &propLUT;
+    if(!p_propLUT->init(filename)) return 0;
+    p_propLUT->print();
+
+    TrackExtrapolator extrapolator;
+    extrapolator.init(GEOMETRY_VERSION);
+    extrapolator.setRKPropagation(useRK);
+
+    //Random states within the fast tracking cuts, random pair of planes with a small offset in z
+    int nPlanes = p_propLUT->getNPlanes();
+    std::vector<double> z_in(nSamples), z_out(nSamples);
+    std::vector<KMatrix<5, 1> > state_i(nSamples), state_lut(nSamples), state_full(nSamples);
+    std::vector<KMatrix<5, 5> > prop_lut(nSamples), prop_full(nSamples);
+    for(int i = 0; i < nSamples; ++i)
+    {
+        int from = gRandom->Integer(nPlanes);
+        int to = (from + 1 + gRandom->Integer(nPlanes - 1)) % nPlanes;
+
+        z_in[i] = p_propLUT->getPlaneZ(from) + gRandom->Uniform(-0.5, 0.5);
+        z_out[i] = p_propLUT->getPlaneZ(to) + gRandom->Uniform(-0.5, 0.5);
+
+        state_i[i][0][0] = (gRandom->Rndm() > 0.5 ? 1. : -1.)*gRandom->Uniform(INVP_MIN, INVP_MAX);
+        state_i[i][1][0] = gRandom->Uniform(-TX_MAX, TX_MAX);
+        state_i[i][2][0] = gRandom->Uniform(-TY_MAX, TY_MAX);
+        state_i[i][3][0] = gRandom->Uniform(-X0_MAX, X0_MAX);
+        state_i[i][4][0] = gRandom->Uniform(-X0_MAX, X0_MAX);
+    }
+
+    //Time the two separately, one call is far below the timer resolution
+    std::vector<bool> covered(nSamples), ok(nSamples);
+    TStopwatch watch;
+    watch.Start();
+    for(int i = 0; i < nSamples; ++i) covered[i] = p_propLUT->propagate(z_in[i], state_i[i], z_out[i], state_lut[i], prop_lut[i]);
+    watch.Stop();
+    double time_lut = watch.CpuTime();
+
+    KMatrix<5, 5> cov_i, cov_f;
+    cov_i.UnitMatrix();
+    watch.Start();
+    for(int i = 0; i < nSamples; ++i)
+    {
+        extrapolator.setInitialStateWithCov(z_in[i], state_i[i], cov_i);
+        ok[i] = extrapolator.extrapolateTo(z_out[i]);
+        if(!ok[i]) continue;
+
+        extrapolator.getFinalStateWithCov(state_full[i], cov_f);
+        extrapolator.getPropagator(prop_full[i]);
+    }
+    watch.Stop();
+    double time_full = watch.CpuTime();
+
+    //Residuals of the covered samples
+    const char* parNames[5] = {"q/p", "tx", "ty", "x", "y"};
+    double sum[5], sum2[5], maxDiff[5];
+    for(int i = 0; i < 5; ++i) sum[i] = sum2[i] = maxDiff[i] = 0.;
+    double maxPropDiff = 0.;
+    int nCovered = 0, nFailed = 0;
+    for(int i = 0; i < nSamples; ++i)
+    {
+        if(!covered[i]) continue;
+        if(!ok[i])
+        {
+            ++nFailed;
+            continue;
+        }
+
+        ++nCovered;
+        for(int j = 0; j < 5; ++j)
+        {
+            double diff = state_lut[i][j][0] - state_full[i][j][0];
+            sum[j] += diff;
+            sum2[j] += diff*diff;
+            if(fabs(diff) > maxDiff[j]) maxDiff[j] = fabs(diff);
+
+            for(int k = 0; k < 5; ++k)
+            {
+                double propDiff = fabs(prop_lut[i][j][k] - prop_full[i][j][k])/(fabs(prop_full[i][j][k]) + 1.);
+                if(propDiff > maxPropDiff) maxPropDiff = propDiff;
+            }
+        }
+    }
+
+    cout << nCovered << " of " << nSamples << " samples covered by the table, " << nFailed << " failed in full extrapolation." << endl;
+    if(nCovered == 0) return 1;
+
+    cout << "Time per propagation: table " << time_lut/nSamples*1.E6 << " us, full extrapolation " << time_full/nSamples*1.E6 << " us" << endl;
+    for(int i = 0; i < 5; ++i)
+    {
+        double mean = sum[i]/nCovered;
+        cout << "  " << parNames[i] << ": residual (table - full) mean = " << mean << ", RMS = " << sqrt(fabs(sum2[i]/nCovered - mean*mean));
+        cout << ", max = " << maxDiff[i] << endl;
+    }
+    cout << "  propagator: max |table - full|/(|full| + 1) = " << maxPropDiff << endl;
+
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    bool useRK = false;
+    std::vector<char*> args;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(TString(argv[i]) == "-r")
+        {
+            useRK = true;
+        }
+        else
+        {
+            args.push_back(argv[i]);
+        }
+    }
+
+    if(args.size() >= 2 && TString(args[0]) == "build")
+    {
+        int nBins[5] = {10, 7, 5, 5, 5};
+        for(unsigned int i = 2; i < args.size() && i < 7; ++i) nBins[i-2] = atoi(args[i]);
+        return build(args[1], useRK, nBins);
+    }
+    else if(args.size() >= 2 && TString(args[0]) == "validate")
+    {
+        int nSamples = args.size() > 2 ? atoi(args[2]) : 10000;
+        return validate(args[1], useRK, nSamples);
+    }
+
+    cout << "Usage: " << argv[0] << " build output_table [-r] [nQP nTX nTY nX nY]" << endl;
+    cout << "       " << argv[0] << " validate input_table [-r] [nSamples]" << endl;
+    return 0;
+}
@@ -0,0 +1,169 @@
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+
+#include <TROOT.h>
+#include <TFile.h>
+#include <TTree.h>
+#include <TMatrixD.h>
+#include <TStopwatch.h>
+
+#include "GeomSvc.h"
+#include "SRecEvent.h"
+#include "KalmanMatrix.h"
+#include "TrackExtrapolator/TrackExtrapolator.hh"
+#include "MODE_SWITCH.h"
+
+using namespace std;
+
+/*
+Validation of the Runge-Kutta-Nystrom propagator against Geant4e. The most downstream
+state of each reconstructed track is propagated to station 1, to the downstream face of
+FMAG and to the target with both extrapolators, the differences are printed in units of
+the Geant4e error and saved in a tree together with the timing.
+
+Usage: ./propValidation reconstructed_data output [nEvents]
+*/
+
+int main(int argc, char *argv[])
+{
+    if(argc < 3)
+    {
+        cout << "Usage: " << argv[0] << " reconstructed_data output [nEvents]" << endl;
+        return 0;
+    }
+
+    GeomSvc* p_geomSvc = GeomSvc::instance();
+    p_geomSvc->init(GEOMETRY_VERSION);
+
+    TrackExtrapolator g4eExt;
+    g4eExt.init(GEOMETRY_VERSION);
+
+    TrackExtrapolator rkExt;
+    rkExt.init(GEOMETRY_VERSION);
+    rkExt.setRKPropagation(true);
+
+    SRecEvent* recEvent = new SRecEvent();
+    TFile* dataFile = new TFile(argv[1], "READ");
+    TTree* dataTree = (TTree*)dataFile->Get("save");
+    dataTree->SetBranchAddress("recEvent", &recEvent);
+
+    int target;
+    double z_i, z_f;
+    double state_g4e[5], state_rk[5], err_g4e[5], err_rk[5], pull[5];
+    double time_g4e, time_rk;
+
+    TFile* saveFile = new TFile(argv[2], "recreate");
+    TTree* saveTree = new TTree("save", "save");
+    saveTree->Branch("target", &target, "target/I");
+    saveTree->Branch("z_i", &z_i, "z_i/D");
+    saveTree->Branch("z_f", &z_f, "z_f/D");
+    saveTree->Branch("state_g4e", state_g4e, "state_g4e[5]/D");
+    saveTree->Branch("state_rk", state_rk, "state_rk[5]/D");
+    saveTree->Branch("err_g4e", err_g4e, "err_g4e[5]/D");
+    saveTree->Branch("err_rk", err_rk, "err_rk[5]/D");
+    saveTree->Branch("pull", pull, "pull[5]/D");
+    saveTree->Branch("time_g4e", &time_g4e, "time_g4e/D");
+    saveTree->Branch("time_rk", &time_rk, "time_rk/D");
+
+    //Summary per target: sum and sum of squares of the differences in units of the Geant4e error
+    const int nTargets = 3;
+    const char* targetNames[nTargets] = {"station 1", "FMAG face", "target"};
+    double z_target[nTargets] = {0., FMAG_LENGTH, Z_TARGET};
+    double sum[nTargets][5], sum2[nTargets][5], sum_ratio[nTargets][5];
+    double totalTime_g4e[nTargets], totalTime_rk[nTargets];
+    int nProp[nTargets];
+    for(int i = 0; i < nTargets; ++i)
+    {
+        for(int j = 0; j < 5; ++j) sum[i][j] = sum2[i][j] = sum_ratio[i][j] = 0.;
+        totalTime_g4e[i] = totalTime_rk[i] = 0.;
+        nProp[i] = 0;
+    }
+
+    int nEvtMax = argc > 3 ? atoi(argv[3]) : dataTree->GetEntries();
+    if(nEvtMax > dataTree->GetEntries()) nEvtMax = dataTree->GetEntries();
+    for(int i = 0; i < nEvtMax; ++i)
+    {
+        dataTree->GetEntry(i);
+        for(int j = 0; j < recEvent->getNTracks(); ++j)
+        {
+            SRecTrack& track = recEvent->getTrack(j);
+            int nStates = track.getNHits();
+            if(nStates < 2) continue;
+
+            z_i = track.getZ(nStates-1);
+            KMatrix<5, 1> state_i(track.getStateVector(nStates-1));
+            KMatrix<5, 5> cov_i(track.getCovariance(nStates-1));
+
+            z_target[0] = track.getZ(0);
+            for(target = 0; target < nTargets; ++target)
+            {
+                z_f = z_target[target];
+                KMatrix<5, 1> state_f_g4e, state_f_rk;
+                KMatrix<5, 5> cov_f_g4e, cov_f_rk;
+
+                TStopwatch watch;
+                watch.Start();
+                g4eExt.setInitialStateWithCov(z_i, state_i, cov_i);
+                bool ok_g4e = g4eExt.extrapolateTo(z_f);
+                if(ok_g4e) g4eExt.getFinalStateWithCov(state_f_g4e, cov_f_g4e);
+                watch.Stop();
+                time_g4e = watch.CpuTime();
+
+                watch.Start();
+                rkExt.setInitialStateWithCov(z_i, state_i, cov_i);
+                bool ok_rk = rkExt.extrapolateTo(z_f);
+                if(ok_rk) rkExt.getFinalStateWithCov(state_f_rk, cov_f_rk);
+                watch.Stop();
+                time_rk = watch.CpuTime();
+
+                if(!(ok_g4e && ok_rk)) continue;
+
+                for(int k = 0; k < 5; ++k)
+                {
+                    state_g4e[k] = state_f_g4e[k][0];
+                    state_rk[k] = state_f_rk[k][0];
+                    err_g4e[k] = sqrt(fabs(cov_f_g4e[k][k]));
+                    err_rk[k] = sqrt(fabs(cov_f_rk[k][k]));
+                    pull[k] = (state_rk[k] - state_g4e[k])/err_g4e[k];
+
+                    sum[target][k] += pull[k];
+                    sum2[target][k] += pull[k]*pull[k];
+                    sum_ratio[target][k] += err_rk[k]/err_g4e[k];
+                }
+                totalTime_g4e[target] += time_g4e;
+                totalTime_rk[target] += time_rk;
+                ++nProp[target];
+
+                saveTree->Fill();
+            }
+        }
+
+        cout << "\r Processing event " << i << ", " << (i + 1)*100/nEvtMax << "% finished .. " << flush;
+    }
+    cout << endl;
+
+    //Print the summary
+    const char* parNames[5] = {"q/p", "tx", "ty", "x", "y"};
+    for(int i = 0; i < nTargets; ++i)
+    {
+        if(nProp[i] == 0) continue;
+
+        cout << "Propagation to " << targetNames[i] << " with " << nProp[i] << " tracks: " << endl;
+        cout << "  Geant4e: " << totalTime_g4e[i]/nProp[i]*1000. << " ms/track, RKN: " << totalTime_rk[i]/nProp[i]*1000. << " ms/track" << endl;
+        for(int j = 0; j < 5; ++j)
+        {
+            double mean = sum[i][j]/nProp[i];
+            double rms = sqrt(fabs(sum2[i][j]/nProp[i] - mean*mean));
+            cout << "  " << parNames[j] << ": (RKN - Geant4e)/error_Geant4e mean = " << mean << ", RMS = " << rms;
+            cout << ", error_RKN/error_Geant4e = " << sum_ratio[i][j]/nProp[i] << endl;
+        }
+    }
+
+    saveFile->cd();
+    saveTree->Write();
+    saveFile->Close();
+
+    return 1;
+}
@@ -52,6 +52,7 @@ int main(int argc, char **argv)
     cout << "Totally " << nEvents << " events in this run" << endl;
 
     if(argc > 5) nEvents = atoi(argv[5]);
+    p_mysqlSvc->enablePrefetch(nEvents < 1000 ? nEvents : 1000);
     for(int i = 0; i < nEvents; ++i)
     {
         if(!p_mysqlSvc->getNextEvent(rawEvent)) continue;
@@ -61,6 +62,7 @@ int main(int argc, char **argv)
         if(i % 1000 == 0) saveTree->AutoSave("SaveSelf");
     }
     cout << endl;
+    p_mysqlSvc->closePrefetch();
     cout << "sqlDataReader ends successfully." << endl;
 
     saveFile->cd();
@@ -14,6 +14,7 @@
 #include <TSQLRow.h>
 #include <TLorentzVector.h>
 #include <TClonesArray.h>
+#include <TStopwatch.h>
 
 #include "SRecEvent.h"
 #include "GeomSvc.h"
@@ -33,6 +34,10 @@ int main(int argc, char **argv)
     p_mysqlSvc->setWorkingSchema(argv[3]);
     if(!p_mysqlSvc->initWriter()) exit(EXIT_FAILURE);
 
+    ///Optional 6th argument: number of events per batch upload, 0 for one INSERT per row
+    int batchSize = argc > 6 ? atoi(argv[6]) : 200;
+    if(batchSize > 0) p_mysqlSvc->enableBatchWriter(batchSize);
+
     ///Retrieve data from file
     TClonesArray* tracklets = new TClonesArray("Tracklet");
     SRecEvent* recEvent1 = new SRecEvent();
@@ -52,6 +57,8 @@ int main(int argc, char **argv)
 
     int idx_vtx = 0;
     dataTree2->GetEntry(idx_vtx);
+    TStopwatch watch;
+    watch.Start();
     int nEvents = dataTree1->GetEntries();
     for(int i = 0; i < nEvents; ++i)
     {
@@ -74,6 +81,9 @@ int main(int argc, char **argv)
         }
     }
     cout << endl;
+    p_mysqlSvc->closeWriter();
+    watch.Stop();
+    cout << nEvents << " events uploaded in " << watch.RealTime() << " s, " << nEvents/watch.RealTime() << " events/s." << endl;
     cout << "sqlResWriter ends successfully." << endl;
 
     delete p_mysqlSvc;
@@ -0,0 +1,108 @@
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include <TROOT.h>
+#include <TFile.h>
+#include <TTree.h>
+#include <TStopwatch.h>
+
+#include "SRecEvent.h"
+#include "MODE_SWITCH.h"
+
+using namespace std;
+
+/*
+Benchmark of the FMAG swim of the reconstructed tracks: one track at a time against the batched
+structure-of-arrays swim SRecTrack::swimTrajectories, on the tracks recorded by kFastTracking or
+kVertex. The tracks are processed in blocks of nBlock tracks, so that the trajectory tables of
+a block stay in memory, and the two swims are checked to give identical trajectories.
+
+Usage: ./swimBench reconstructed_file [nBlock] [nEvents]
+*/
+
+int main(int argc, char *argv[])
+{
+    if(argc < 2)
+    {
+        cout << "Usage: " << argv[0] << " reconstructed_file [nBlock] [nEvents]" << endl;
+        return 0;
+    }
+    unsigned int nBlock = argc > 2 ? atoi(argv[2]) : 1000;
+    if(nBlock < 1) nBlock = 1;
+
+    SRecEvent* recEvent = new SRecEvent();
+    TFile* dataFile = new TFile(argv[1], "READ");
+    TTree* dataTree = (TTree*)dataFile->Get("save");
+    dataTree->SetBranchAddress("recEvent", &recEvent);
+
+    int nEvents = dataTree->GetEntries();
+    if(argc > 3 && atoi(argv[3]) < nEvents) nEvents = atoi(argv[3]);
+
+    double time_single = 0.;
+    double time_batch = 0.;
+    double maxDiff = 0.;
+    int nTracks = 0;
+
+    std::vector<SRecTrack> tracks_single, tracks_batch;
+    std::vector<SRecTrack*> ptrs;
+    TStopwatch watch;
+    for(int i = 0; i < nEvents; ++i)
+    {
+        dataTree->GetEntry(i);
+        for(int j = 0; j < recEvent->getNTracks(); ++j)
+        {
+            tracks_single.push_back(recEvent->getTrack(j));
+            tracks_batch.push_back(recEvent->getTrack(j));
+        }
+        recEvent->clear();
+
+        if(tracks_single.size() < nBlock && i != nEvents - 1) continue;
+        if(tracks_single.empty()) continue;
+
+        watch.Start();
+        for(unsigned int j = 0; j < tracks_single.size(); ++j) tracks_single[j].updateTrajectory();
+        watch.Stop();
+        time_single += watch.CpuTime();
+
+        ptrs.clear();
+        for(unsigned int j = 0; j < tracks_batch.size(); ++j) ptrs.push_back(&tracks_batch[j]);
+
+        watch.Start();
+        SRecTrack::swimTrajectories(&ptrs[0], ptrs.size());
+        watch.Stop();
+        time_batch += watch.CpuTime();
+
+        for(unsigned int j = 0; j < tracks_single.size(); ++j)
+        {
+            for(int k = 0; k < tracks_single[j].getNSwimSteps(); ++k)
+            {
+                const Double_t* step_single = tracks_single[j].getSwimStep(k);
+                const Double_t* step_batch = tracks_batch[j].getSwimStep(k);
+                for(int l = 0; l < 6; ++l)
+                {
+                    if(fabs(step_single[l] - step_batch[l]) > maxDiff) maxDiff = fabs(step_single[l] - step_batch[l]);
+                }
+            }
+        }
+
+        nTracks += tracks_single.size();
+        tracks_single.clear();
+        tracks_batch.clear();
+    }
+
+    if(nTracks == 0)
+    {
+        cout << "No tracks found in " << argv[1] << endl;
+        return 0;
+    }
+
+    cout << nTracks << " tracks from " << nEvents << " events, swum in blocks of " << nBlock << " tracks" << endl;
+    cout << "One track at a time: " << nTracks/time_single << " tracks/s" << endl;
+    cout << "Batched:             " << nTracks/time_batch << " tracks/s, speed-up " << time_single/time_batch << endl;
+    cout << "Max |single - batched| over all trajectory steps = " << maxDiff << endl;
+
+    dataFile->Close();
+    return 1;
+}
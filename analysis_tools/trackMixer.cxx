@@ -86,7 +86,7 @@ int main(int argc, char *argv[])
         if(nTracks != 1) continue;
 
         SRecTrack track = recEvent->getTrack(0);
-        track.setZVertex(track.getZVertex());
+        track.setZVertex(track.getZVertex(), vtxfit->getKalmanFilter());
         if(!track.isValid()) continue;
 
         int index = rawEvent->getTargetPos() - 1;
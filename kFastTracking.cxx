@@ -2,6 +2,8 @@
 #include <cmath>
 #include <algorithm>
 #include <string>
+#include <vector>
+#include <list>
 #include <time.h>
 
 #include <TROOT.h>
@@ -11,7 +13,11 @@
 #include <TMatrixD.h>
 #include <TLorentzVector.h>
 #include <TClonesArray.h>
+#include <TH1D.h>
 #include <TString.h>
+#include <TThread.h>
+#include <TMutex.h>
+#include <TStopwatch.h>
 
 #include "GeomSvc.h"
 #include "SRawEvent.h"
@@ -20,27 +26,197 @@
 #include "KalmanFastTracking.h"
 #include "KalmanFitter.h"
 #include "VertexFit.h"
+#include "PropagatorLUT.h"
 #include "EventReducer.h"
+#include "ThreadQueue.h"
 #include "MODE_SWITCH.h"
 
 using namespace std;
 
+#ifdef MC_MODE
+typedef SRawMCEvent RawEvent;
+#else
+typedef SRawEvent RawEvent;
+#endif
+
+///Everything one event needs to go from the reader through a worker to the writer
+struct TrackingJob
+{
+    long index;
+    RawEvent* rawEvent;
+    SRecEvent* recEvent;
+    std::list<Tracklet> tracklets;
+    TrackingStats stats;
+    double time;
+};
+
+///Each worker owns its own event reducer/track finder (and thus minimizers and Kalman filter)
+struct TrackingWorker
+{
+    EventReducer* eventReducer;
+    KalmanFastTracking* fastfinder;
+    bool wallClock;
+
+    ThreadQueue<TrackingJob*>* input;
+    OrderedQueue<TrackingJob*>* output;
+};
+
+///Reader stage, the input tree is only touched by this thread and the writer, under ioMutex
+struct TrackingReader
+{
+    TTree* dataTree;
+    RawEvent* rawEvent;
+    long offset;
+    long nEvtMax;
+
+    ThreadQueue<TrackingJob*>* input;
+};
+
+TMutex ioMutex;
+
+void processEvent(TrackingWorker* worker, TrackingJob* job)
+{
+    TStopwatch watch;
+    clock_t time_single = clock();
+
+    worker->eventReducer->reduceEvent(job->rawEvent);
+    job->recEvent->setRecStatus(worker->fastfinder->setRawEvent(job->rawEvent));
+    job->stats = worker->fastfinder->getStats();
+
+    std::list<Tracklet>& rec_tracklets = worker->fastfinder->getFinalTracklets();
+    if(!rec_tracklets.empty())
+    {
+        job->recEvent->setRawEvent(job->rawEvent);
+        for(std::list<Tracklet>::iterator iter = rec_tracklets.begin(); iter != rec_tracklets.end(); ++iter)
+        {
+            iter->calcChisq();
+            job->tracklets.push_back(*iter);
+
+#ifndef _ENABLE_KF
+            SRecTrack recTrack = iter->getSRecTrack();
+            job->recEvent->insertTrack(recTrack);
+#endif
+        }
+
+#ifdef _ENABLE_KF
+        std::list<SRecTrack>& rec_tracks = worker->fastfinder->getSRecTracks();
+        for(std::list<SRecTrack>::iterator iter = rec_tracks.begin(); iter != rec_tracks.end(); ++iter)
+        {
+            job->recEvent->insertTrack(*iter);
+        }
+#endif
+        job->recEvent->reIndex();
+    }
+
+    //clock() counts the CPU time of all threads, so the wall time is used when running in parallel
+    job->time = worker->wallClock ? watch.RealTime() : double(clock() - time_single)/CLOCKS_PER_SEC;
+}
+
+void* runWorker(void* arg)
+{
+    TrackingWorker* worker = (TrackingWorker*)arg;
+
+    TrackingJob* job;
+    while(worker->input->pop(job))
+    {
+        processEvent(worker, job);
+        worker->output->push(job->index, job);
+    }
+
+    return NULL;
+}
+
+void* runReader(void* arg)
+{
+    TrackingReader* reader = (TrackingReader*)arg;
+    for(long i = reader->offset; i < reader->nEvtMax; ++i)
+    {
+        TrackingJob* job = new TrackingJob;
+        job->index = i;
+        job->recEvent = new SRecEvent();
+
+        ioMutex.Lock();
+        reader->dataTree->GetEntry(i);
+        job->rawEvent = new RawEvent(*(reader->rawEvent));
+        ioMutex.UnLock();
+
+        reader->input->push(job);
+    }
+    reader->input->close();
+
+    return NULL;
+}
+
 int main(int argc, char *argv[])
 {
-    //Initialize geometry service
+    //Parse the command line: kFastTracking [-j nThreads] [-p nThreads] [-a] [-r] [-l table] [-f] input output [offset] [nEvents]
+    int nThreads = 1;
+    int nEventThreads = 1;
+    bool analyticFit = false;
+    bool rkPropagation = false;
+    TString lutFile = "";
+    bool linearizationReuse = true;
+    std::vector<char*> args;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(TString(argv[i]) == "-j" && i + 1 < argc)
+        {
+            nThreads = atoi(argv[++i]);
+        }
+        else if(TString(argv[i]) == "-p" && i + 1 < argc)
+        {
+            nEventThreads = atoi(argv[++i]);
+        }
+        else if(TString(argv[i]) == "-a")
+        {
+            analyticFit = true;
+        }
+        else if(TString(argv[i]) == "-r")
+        {
+            rkPropagation = true;
+        }
+        else if(TString(argv[i]) == "-l" && i + 1 < argc)
+        {
+            lutFile = argv[++i];
+        }
+        else if(TString(argv[i]) == "-f")
+        {
+            linearizationReuse = false;
+        }
+        else
+        {
+            args.push_back(argv[i]);
+        }
+    }
+    if(args.size() < 2 || nThreads < 1 || nEventThreads < 1)
+    {
+        cout << "Usage: " << argv[0] << " [-j nThreads] [-p nThreads] [-a] [-r] [-l table] [-f] input output [offset] [nEvents]" << endl;
+        cout << "  -p: threads per event for the back partial/global track loops of busy events" << endl;
+        cout << "  -a: use the analytic least square tracklet fit instead of Minuit" << endl;
+        cout << "  -r: use the Runge-Kutta-Nystrom propagator instead of Geant4e in the Kalman filter" << endl;
+        cout << "  -l: use the propagator table built by propLUT between the chamber planes in the Kalman filter" << endl;
+        cout << "  -f: propagate every node in every Kalman iteration instead of reusing the previous propagator" << endl;
+        return 0;
+    }
+
+    //Initialize geometry service, it is read-only after this point and shared by all workers
     LogInfo("Initializing geometry service ... ");
     GeomSvc* geometrySvc = GeomSvc::instance();
     geometrySvc->init(GEOMETRY_VERSION);
 
+    //The propagator table is mapped once and shared read-only by all workers
+    PropagatorLUT* propLUT = NULL;
+    if(lutFile != "")
+    {
+        propLUT = new PropagatorLUT();
+        if(!propLUT->init(lutFile.Data())) LogInfo("Failed to load the propagator table, the full extrapolation will be used");
+    }
+
     //Retrieve the raw event
     LogInfo("Retrieving the event stored in ROOT file ... ");
-#ifdef MC_MODE
-    SRawMCEvent* rawEvent = new SRawMCEvent();
-#else
-    SRawEvent* rawEvent = new SRawEvent();
-#endif
+    RawEvent* rawEvent = new RawEvent();
 
-    TFile *dataFile = new TFile(argv[1], "READ");
+    TFile *dataFile = new TFile(args[0], "READ");
     TTree *dataTree = (TTree *)dataFile->Get("save");
 
     dataTree->SetBranchAddress("rawEvent", &rawEvent);
@@ -53,9 +229,12 @@ int main(int argc, char *argv[])
     double time;
     SRecEvent* recEvent = new SRecEvent();
 
-    TFile* saveFile = new TFile(argv[2], "recreate");
+    TFile* saveFile = new TFile(args[1], "recreate");
 #ifdef ATTACH_RAW
+    //The attached raw event is the reduced copy coming out of the workers, not the one being read
+    RawEvent* rawEventOut = new RawEvent();
     TTree* saveTree = dataTree->CloneTree(0);
+    saveTree->SetBranchAddress("rawEvent", &rawEventOut);
 #else
     TTree* saveTree = new TTree("save", "save");
 #endif
@@ -66,89 +245,161 @@ int main(int argc, char *argv[])
     saveTree->Branch("tracklets", &tracklets, 256000, 99);
     tracklets->BypassStreamer();
 
-    //Initialize track finder
-    LogInfo("Initializing the track finder and kalman filter ... ");
-#ifdef _ENABLE_KF
-    KalmanFilter* filter = new KalmanFilter();
-    KalmanFastTracking* fastfinder = new KalmanFastTracking();
-#else
-    KalmanFastTracking* fastfinder = new KalmanFastTracking(false);
-#endif
+    //Per-event timing and counters of the tracking stages, and their sums over the job
+    TrackingStats stats;
+    saveTree->Branch("stageTime", stats.time, Form("stageTime[%d]/D", nTrackingStages));
+    saveTree->Branch("stageCandidates", stats.nCandidates, Form("stageCandidates[%d]/I", nTrackingStages));
+    saveTree->Branch("stageFits", stats.nFits, Form("stageFits[%d]/I", nTrackingStages));
+    saveTree->Branch("stageEvals", stats.nEvals, Form("stageEvals[%d]/I", nTrackingStages));
+
+    const char* summaryNames[4] = {"stageTime", "stageCandidates", "stageFits", "stageEvals"};
+    const char* summaryTitles[4] = {"Wall time (s)", "Candidates", "fitTracklet calls", "Minimizer evaluations"};
+    TH1D* summary[4];
+    for(int i = 0; i < 4; ++i)
+    {
+        summary[i] = new TH1D(Form("h_%s", summaryNames[i]), Form("%s per stage, summed over all events", summaryTitles[i]), nTrackingStages, -0.5, nTrackingStages - 0.5);
+        for(int j = 0; j < nTrackingStages; ++j) summary[i]->GetXaxis()->SetBinLabel(j + 1, TrackingStats::getStageName(j));
+    }
+
+    //Initialize the track finders and event reducers, one set per thread
+    LogInfo("Initializing the track finder and kalman filter with " << nThreads << " thread(s) ... ");
+    if(nThreads > 1) TThread::Initialize();
 
-    //Initialize the event reducer
     TString opt = "aocsh";
 #ifdef TRIGGER_TRIMING
     opt = opt + "t";
 #endif
-    EventReducer* eventReducer = new EventReducer(opt);
 
-    int offset = argc > 3 ? atoi(argv[3]) : 0;
-    int nEvtMax = argc > 4 ? atoi(argv[4]) + offset : dataTree->GetEntries();
+    long offset = args.size() > 2 ? atoi(args[2]) : 0;
+    long nEvtMax = args.size() > 3 ? atoi(args[3]) + offset : dataTree->GetEntries();
     if(nEvtMax > dataTree->GetEntries()) nEvtMax = dataTree->GetEntries();
     LogInfo("Running from event " << offset << " through to event " << nEvtMax);
-    for(int i = offset; i < nEvtMax; i++)
-    {
-        dataTree->GetEntry(i);
-        cout << "\r Processing event " << i << " with eventID = " << rawEvent->getEventID() << ", ";
-        cout << (i - offset + 1)*100/(nEvtMax - offset) << "% finished .. ";
 
-        clock_t time_single = clock();
+    ThreadQueue<TrackingJob*> input(4*nThreads);
+    OrderedQueue<TrackingJob*> output(offset);
 
-        eventReducer->reduceEvent(rawEvent);
-        recEvent->setRecStatus(fastfinder->setRawEvent(rawEvent));
+    std::vector<TrackingWorker> workers(nThreads);
+    for(int i = 0; i < nThreads; ++i)
+    {
+        workers[i].eventReducer = new EventReducer(opt);
+#ifdef _ENABLE_KF
+        workers[i].fastfinder = new KalmanFastTracking();
+#else
+        workers[i].fastfinder = new KalmanFastTracking(false);
+#endif
+        workers[i].fastfinder->enableAnalyticFit(analyticFit);
+        workers[i].fastfinder->enableParallel(nEventThreads);
+        workers[i].fastfinder->enableRKPropagation(rkPropagation);
+        workers[i].fastfinder->setPropagatorLUT(propLUT);
+        workers[i].fastfinder->enableLinearizationReuse(linearizationReuse);
+        workers[i].wallClock = nThreads > 1 || nEventThreads > 1;
+        workers[i].input = &input;
+        workers[i].output = &output;
+    }
 
-        //Fill the TClonesArray
-        arr_tracklets.Clear();
-        std::list<Tracklet>& rec_tracklets = fastfinder->getFinalTracklets();
-        if(rec_tracklets.empty()) continue;
+    TrackingReader reader;
+    reader.dataTree = dataTree;
+    reader.rawEvent = rawEvent;
+    reader.offset = offset;
+    reader.nEvtMax = nEvtMax;
+    reader.input = &input;
 
-        nTracklets = 0;
-        recEvent->setRawEvent(rawEvent);
-        for(std::list<Tracklet>::iterator iter = rec_tracklets.begin(); iter != rec_tracklets.end(); ++iter)
+    //Start the reader and workers, the main thread acts as the writer
+    std::vector<TThread*> threads;
+    if(nThreads > 1)
+    {
+        threads.push_back(new TThread("reader", runReader, (void*)&reader));
+        for(int i = 0; i < nThreads; ++i) threads.push_back(new TThread(Form("worker_%d", i), runWorker, (void*)&workers[i]));
+        for(unsigned int i = 0; i < threads.size(); ++i) threads[i]->Run();
+    }
+
+    for(long i = offset; i < nEvtMax; ++i)
+    {
+        TrackingJob* job;
+        if(nThreads > 1)
         {
-            iter->calcChisq();
-            //iter->print();
-            new(arr_tracklets[nTracklets]) Tracklet(*iter);
-            ++nTracklets;
+            job = output.pop();
+        }
+        else
+        {
+            job = new TrackingJob;
+            job->index = i;
+            job->recEvent = new SRecEvent();
 
-#ifndef _ENABLE_KF
-            SRecTrack recTrack = iter->getSRecTrack();
-            recEvent->insertTrack(recTrack);
-#endif
+            dataTree->GetEntry(i);
+            job->rawEvent = new RawEvent(*rawEvent);
+            processEvent(&workers[0], job);
         }
 
-#ifdef _ENABLE_KF
-        std::list<SRecTrack>& rec_tracks = fastfinder->getSRecTracks();
-        for(std::list<SRecTrack>::iterator iter = rec_tracks.begin(); iter != rec_tracks.end(); ++iter)
+        cout << "\r Processing event " << i << " with eventID = " << job->rawEvent->getEventID() << ", ";
+        cout << (i - offset + 1)*100/(nEvtMax - offset) << "% finished .. ";
+        cout << "it takes " << job->time << " seconds for this event." << flush;
+
+        //All events go into the summary, including those not saved
+        for(int j = 0; j < nTrackingStages; ++j)
         {
-            //iter->print();
-            recEvent->insertTrack(*iter);
+            summary[0]->Fill(j, job->stats.time[j]);
+            summary[1]->Fill(j, job->stats.nCandidates[j]);
+            summary[2]->Fill(j, job->stats.nFits[j]);
+            summary[3]->Fill(j, job->stats.nEvals[j]);
         }
-#endif
 
-        time_single = clock() - time_single;
-        time = double(time_single)/CLOCKS_PER_SEC;
-        cout << "it takes " << time << " seconds for this event." << flush;
+        //Fill the TClonesArray and the output tree, events without tracklets are not saved
+        if(!job->tracklets.empty())
+        {
+            arr_tracklets.Clear();
+            nTracklets = 0;
+            for(std::list<Tracklet>::iterator iter = job->tracklets.begin(); iter != job->tracklets.end(); ++iter)
+            {
+                new(arr_tracklets[nTracklets]) Tracklet(*iter);
+                ++nTracklets;
+            }
+
+            *recEvent = *(job->recEvent);
+            time = job->time;
+            stats = job->stats;
+#ifdef ATTACH_RAW
+            *rawEventOut = *(job->rawEvent);
+#endif
 
-        recEvent->reIndex();
-        saveTree->Fill();
-        if(saveTree->GetEntries() % 1000 == 0) saveTree->AutoSave("SaveSelf");
+            ioMutex.Lock();
+            saveTree->Fill();
+            if(saveTree->GetEntries() % 1000 == 0) saveTree->AutoSave("SaveSelf");
+            ioMutex.UnLock();
+        }
 
-        recEvent->clear();
-        rawEvent->clear();
+        delete job->rawEvent;
+        delete job->recEvent;
+        delete job;
     }
     cout << endl;
+
+    for(unsigned int i = 0; i < threads.size(); ++i)
+    {
+        threads[i]->Join();
+        delete threads[i];
+    }
     cout << "kFastTracking ends successfully." << endl;
 
+    cout << "Stage summary over " << nEvtMax - offset << " events: " << endl;
+    for(int i = 0; i < nTrackingStages; ++i)
+    {
+        cout << "  " << TrackingStats::getStageName(i) << ": " << summary[0]->GetBinContent(i + 1) << " s, ";
+        cout << summary[1]->GetBinContent(i + 1) << " candidates, " << summary[2]->GetBinContent(i + 1) << " fits, ";
+        cout << summary[3]->GetBinContent(i + 1) << " evaluations" << endl;
+    }
+
     saveFile->cd();
     saveTree->Write();
+    for(int i = 0; i < 4; ++i) summary[i]->Write();
     saveFile->Close();
 
-    delete fastfinder;
-    delete eventReducer;
-#ifdef _ENABLE_KF
-    filter->close();
-#endif
+    for(int i = 0; i < nThreads; ++i)
+    {
+        delete workers[i].fastfinder;
+        delete workers[i].eventReducer;
+    }
+    if(propLUT != NULL) delete propLUT;
 
     return 1;
 }
@@ -42,6 +42,9 @@ int main(int argc, char *argv[])
     p_mysqlSvc->setWorkingSchema(argv[1]);
     if(!(p_mysqlSvc->initReader() && p_mysqlSvc->initWriter())) exit(EXIT_FAILURE);
 
+    //Upload the results in batches from a background thread, so the tracking never waits for the database
+    p_mysqlSvc->enableBatchWriter();
+
     //Data output definition
     int nTracklets;
     SRawEvent* rawEvent = new SRawEvent();
@@ -82,8 +85,14 @@ int main(int argc, char *argv[])
     //Start tracking
     int nEvents = p_mysqlSvc->getNEvents();
     cout << "There are " << nEvents << " events in " << argv[1] << endl;
+
+    //Load the events in blocks from a background thread instead of 4-6 queries per event
+    p_mysqlSvc->enablePrefetch();
     for(int i = 0; i < nEvents; ++i)
     {
+        //Upload the buffered results on time also when the events give no tracks
+        p_mysqlSvc->pollWriter();
+
         //Read data
         if(!p_mysqlSvc->getNextEvent(rawEvent)) continue;
         ++nEvents_loaded;
@@ -138,6 +147,8 @@ int main(int argc, char *argv[])
         recEvent->clear();
     }
     cout << endl;
+    p_mysqlSvc->closePrefetch();
+    p_mysqlSvc->closeWriter();
     cout << "kOnlineTracking ended successfully." << endl;
     cout << "In total " << nEvents_loaded << " events loaded from " << argv[1] << ": " << nEvents_tracked << " events have at least one track, ";
     cout << nEvents_dimuon << " events have at least one dimuon pair, ";
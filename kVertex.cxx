@@ -2,6 +2,7 @@
 #include <cmath>
 #include <algorithm>
 #include <string>
+#include <vector>
 #include <time.h>
 
 #include <TROOT.h>
@@ -12,6 +13,9 @@
 #include <TLorentzVector.h>
 #include <TClonesArray.h>
 #include <TMath.h>
+#include <TString.h>
+#include <TThread.h>
+#include <TMutex.h>
 
 #include "GeomSvc.h"
 #include "SRawEvent.h"
@@ -21,12 +25,115 @@
 #include "KalmanFitter.h"
 #include "VertexFit.h"
 #include "SRecEvent.h"
+#include "ThreadQueue.h"
 
 using namespace std;
 
+///One event going from the reader through a worker to the writer
+struct VertexJob
+{
+    long index;
+    SRecEvent* recEvent;
+};
+
+///Each worker owns its own vertex fitter (and thus Kalman filter and track extrapolator)
+struct VertexWorker
+{
+    VertexFit* vtxfit;
+
+    ThreadQueue<VertexJob*>* input;
+    OrderedQueue<VertexJob*>* output;
+};
+
+///Reader stage, the input tree is only touched by this thread and the writer, under ioMutex
+struct VertexReader
+{
+    TTree* dataTree;
+    SRecEvent* recEvent;
+    long offset;
+    long nEvtMax;
+
+    ThreadQueue<VertexJob*>* input;
+};
+
+TMutex ioMutex;
+
+void* runWorker(void* arg)
+{
+    VertexWorker* worker = (VertexWorker*)arg;
+
+    VertexJob* job;
+    while(worker->input->pop(job))
+    {
+        job->recEvent->setRecStatus(worker->vtxfit->setRecEvent(job->recEvent));
+        worker->output->push(job->index, job);
+    }
+
+    return NULL;
+}
+
+void* runReader(void* arg)
+{
+    VertexReader* reader = (VertexReader*)arg;
+    for(long i = reader->offset; i < reader->nEvtMax; ++i)
+    {
+        VertexJob* job = new VertexJob;
+        job->index = i;
+
+        ioMutex.Lock();
+        reader->dataTree->GetEntry(i);
+        job->recEvent = new SRecEvent(*(reader->recEvent));
+        ioMutex.UnLock();
+
+        reader->input->push(job);
+    }
+    reader->input->close();
+
+    return NULL;
+}
+
 int main(int argc, char *argv[])
 {
-    //Initialize geometry service
+    //Parse the command line: kVertex [-j nThreads] [-p nThreads] [-c] [-s nSave] input output [offset] [nEvents]
+    int nThreads = 1;
+    int nPairThreads = 1;
+    bool preScreen = false;
+    int nAutoSave = 1000;
+    std::vector<char*> args;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(TString(argv[i]) == "-j" && i + 1 < argc)
+        {
+            nThreads = atoi(argv[++i]);
+        }
+        else if(TString(argv[i]) == "-p" && i + 1 < argc)
+        {
+            nPairThreads = atoi(argv[++i]);
+        }
+        else if(TString(argv[i]) == "-c")
+        {
+            preScreen = true;
+        }
+        else if(TString(argv[i]) == "-s" && i + 1 < argc)
+        {
+            nAutoSave = atoi(argv[++i]);
+        }
+        else
+        {
+            args.push_back(argv[i]);
+        }
+    }
+    if(args.size() < 2 || nThreads < 1 || nPairThreads < 1)
+    {
+        cout << "Usage: " << argv[0] << " [-j nThreads] [-p nThreads] [-c] [-s nSave] input output [offset] [nEvents]" << endl;
+        cout << "  -j: number of events vertexed in parallel, the output is still in the input order" << endl;
+        cout << "  -p: threads per event for the dimuon pair vertex fits" << endl;
+        cout << "  -c: pre-screen the pairs with the VTX_PRESCREEN_* limits before the vertex fit, loses some good dimuons" << endl;
+        cout << "  -s: auto-save the output tree every nSave saved events, 0 to only write it at the end" << endl;
+        return 0;
+    }
+
+    //Initialize geometry service, it is read-only after this point and shared by all workers
     LogInfo("Initializing geometry service ... ");
     GeomSvc* geometrySvc = GeomSvc::instance();
     geometrySvc->init(GEOMETRY_VERSION);
@@ -35,50 +142,120 @@ int main(int argc, char *argv[])
     LogInfo("Retrieving the event stored in ROOT file ... ");
     SRecEvent* recEvent = new SRecEvent();
 
-    TFile* dataFile = new TFile(argv[1], "READ");
+    TFile* dataFile = new TFile(args[0], "READ");
     TTree* dataTree = (TTree*)dataFile->Get("save");
 
     dataTree->SetBranchAddress("recEvent", &recEvent);
 
-    TFile* saveFile = new TFile(argv[2], "recreate");
+    TFile* saveFile = new TFile(args[1], "recreate");
 #ifdef ATTACH_RAW
+    //The cloned tree shares the branch buffers with the input tree, the writer re-reads the entry before filling
+    SRecEvent* recEventOut = recEvent;
     TTree* saveTree = dataTree->CloneTree(0);
 #else
+    //The output has its own event so that the reader can go on while the writer fills
+    SRecEvent* recEventOut = new SRecEvent();
     TTree* saveTree = new TTree("save", "save");
 
-    saveTree->Branch("recEvent", &recEvent, 256000, 99);
+    saveTree->Branch("recEvent", &recEventOut, 256000, 99);
 #endif
 
-    //Initialize track finder
-    LogInfo("Initializing the track finder and kalman filter ... ");
-    VertexFit* vtxfit = new VertexFit();
-    vtxfit->enableOptimization();
+    //Initialize the vertex fitters, one per thread
+    LogInfo("Initializing the vertex fitter and kalman filter with " << nThreads << " thread(s) ... ");
+    if(nThreads > 1) TThread::Initialize();
 
-    int offset = argc > 3 ? atoi(argv[3]) : 0;
-    int nEvtMax = argc > 4 ? atoi(argv[4]) + offset : dataTree->GetEntries();
+    long offset = args.size() > 2 ? atoi(args[2]) : 0;
+    long nEvtMax = args.size() > 3 ? atoi(args[3]) + offset : dataTree->GetEntries();
     if(nEvtMax > dataTree->GetEntries()) nEvtMax = dataTree->GetEntries();
     LogInfo("Running from event " << offset << " through to event " << nEvtMax);
-    for(int i = offset; i < nEvtMax; i++)
+
+    ThreadQueue<VertexJob*> input(4*nThreads);
+    OrderedQueue<VertexJob*> output(offset);
+
+    std::vector<VertexWorker> workers(nThreads);
+    for(int i = 0; i < nThreads; ++i)
     {
-        dataTree->GetEntry(i);
-        cout << "\r Processing event " << i << " with eventID = " << recEvent->getEventID() << ", ";
-        cout << (i + 1)*100/nEvtMax << "% finished .. " << flush;
+        workers[i].vtxfit = new VertexFit();
+        workers[i].vtxfit->enableOptimization();
+        workers[i].vtxfit->enablePreScreening(preScreen);
+        workers[i].vtxfit->enableParallel(nPairThreads);
+        workers[i].input = &input;
+        workers[i].output = &output;
+    }
 
-        recEvent->setRecStatus(vtxfit->setRecEvent(recEvent));
+    VertexReader reader;
+    reader.dataTree = dataTree;
+    reader.recEvent = recEvent;
+    reader.offset = offset;
+    reader.nEvtMax = nEvtMax;
+    reader.input = &input;
 
-        if(recEvent->getNDimuons() > 0) saveTree->Fill();
-        if(saveTree->GetEntries() % 1000 == 0) saveTree->AutoSave("SaveSelf");
+    //Start the reader and workers, the main thread acts as the writer
+    std::vector<TThread*> threads;
+    if(nThreads > 1)
+    {
+        threads.push_back(new TThread("reader", runReader, (void*)&reader));
+        for(int i = 0; i < nThreads; ++i) threads.push_back(new TThread(Form("worker_%d", i), runWorker, (void*)&workers[i]));
+        for(unsigned int i = 0; i < threads.size(); ++i) threads[i]->Run();
+    }
 
-        recEvent->clear();
+    for(long i = offset; i < nEvtMax; ++i)
+    {
+        VertexJob* job;
+        if(nThreads > 1)
+        {
+            job = output.pop();
+        }
+        else
+        {
+            job = new VertexJob;
+            job->index = i;
+
+            dataTree->GetEntry(i);
+            job->recEvent = new SRecEvent(*recEvent);
+            job->recEvent->setRecStatus(workers[0].vtxfit->setRecEvent(job->recEvent));
+        }
+
+        cout << "\r Processing event " << i << " with eventID = " << job->recEvent->getEventID() << ", ";
+        cout << (i - offset + 1)*100/(nEvtMax - offset) << "% finished .. " << flush;
+
+        //Events without dimuons are not saved
+        if(job->recEvent->getNDimuons() > 0)
+        {
+            ioMutex.Lock();
+#ifdef ATTACH_RAW
+            if(nThreads > 1) dataTree->GetEntry(job->index);
+#endif
+            *recEventOut = *(job->recEvent);
+            saveTree->Fill();
+            if(nAutoSave > 0 && saveTree->GetEntries() % nAutoSave == 0) saveTree->AutoSave("SaveSelf");
+            ioMutex.UnLock();
+        }
+
+        delete job->recEvent;
+        delete job;
     }
     cout << endl;
+
+    for(unsigned int i = 0; i < threads.size(); ++i)
+    {
+        threads[i]->Join();
+        delete threads[i];
+    }
     cout << "kVertex ends successfully." << endl;
 
     saveFile->cd();
     saveTree->Write();
     saveFile->Close();
 
-    delete vtxfit;
+    int nPairsAll = 0, nPairsScreened = 0;
+    for(int i = 0; i < nThreads; ++i)
+    {
+        nPairsAll += workers[i].vtxfit->getNPairsAll();
+        nPairsScreened += workers[i].vtxfit->getNPairsScreened();
+        delete workers[i].vtxfit;
+    }
+    if(preScreen) cout << "Pre-screening rejected " << nPairsScreened << " of " << nPairsAll << " pairs." << endl;
 
     return 1;
 }